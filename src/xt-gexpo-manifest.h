@@ -0,0 +1,99 @@
+/*
+    Griffeye XML export X-Tension for X-Ways Forensics
+    Copyright (C) 2019 R. Yushaev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Layout of the export manifest, shared by the X-Tension and the tools.
+//
+// "Export Manifest.dat" holds a header followed by fixed-width records,
+// one per exported file, so it can be memory-mapped and indexed directly.
+// Strings live in "Export Manifest.str": NUL-terminated UTF-16LE strings
+// after a header, referenced by their byte offset. Offset 0 is no string.
+// Both files are only ever appended to; strings are written before the
+// record that references them. A trailing partial record is ignored by
+// readers and cut off before the next run appends to the file.
+
+#ifndef XT_GEXPO_MANIFEST_H
+#define XT_GEXPO_MANIFEST_H
+
+#include <stdint.h>
+
+// "GXDM" and "GXST", little endian
+#define MANIFEST_MAGIC         0x4d445847
+#define MANIFEST_STRINGS_MAGIC 0x54535847
+#define MANIFEST_VERSION       2
+
+// Values of XtManifestRecord.type
+#define MANIFEST_TYPE_PICTURE 1
+#define MANIFEST_TYPE_VIDEO   2
+
+// Bits of XtManifestRecord.flags
+#define MANIFEST_FLAG_HASHED 0x0001
+// Known benign file, indexed but not exported
+#define MANIFEST_FLAG_KNOWN  0x0002
+// Video details have been probed, see duration to codec
+#define MANIFEST_FLAG_VIDEO  0x0004
+
+// Values of XtManifestRecord.integrity, 0 if not checked or intact
+#define MANIFEST_INTEGRITY_TRUNCATED 1
+#define MANIFEST_INTEGRITY_CORRUPT   2
+
+// Length of XtManifestRecord.codec, including the terminator
+#define MANIFEST_CODEC_LEN 32
+
+struct XtManifestHeader {
+    uint32_t magic;
+    uint32_t version;
+    // Newer versions may append fields. Readers accept any version from
+    // MANIFEST_VERSION on and step by record_size, but the X-Tension only
+    // appends to a manifest of its own version and record size.
+    uint32_t record_size;
+    uint32_t reserved;
+};
+
+struct XtManifestRecord {
+    // FNV-1a hash of the evidence item name
+    uint64_t volume_hash;
+    int64_t xwf_id;
+    int64_t filesize;
+    // Unix time, 0 if unknown
+    int64_t created;
+    int64_t accessed;
+    int64_t written;
+    // String table offsets: evidence item name, <fullpath> value and
+    // output file path relative to the "Griffeye Export" folder
+    uint64_t evidence;
+    uint64_t fullpath;
+    uint64_t output;
+    uint32_t export_id;
+    uint16_t type;
+    uint16_t deleted;
+    uint16_t category;
+    uint16_t flags;
+    uint16_t integrity;
+    uint16_t reserved;
+    uint8_t md5[16];
+    // Bytes of unreadable regions that were zero-filled
+    int64_t unreadable;
+    // Video details in seconds, pixels and Unix time, 0 if unknown
+    double duration;
+    uint32_t width;
+    uint32_t height;
+    int64_t video_created;
+    char codec[MANIFEST_CODEC_LEN];
+};
+
+#endif
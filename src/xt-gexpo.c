@@ -23,7 +23,11 @@
 #define STRICT_TYPED_ITEMIDS
 
 #include <Shlobj.h>
+#include <psapi.h>
 #include <strsafe.h>
+#include <bcrypt.h>
+
+#include "xt-gexpo-manifest.h"
 
 #define EXPORT_DIR  L"Griffeye Export"
 #define EXISTING_SUBDIR L"Existing"
@@ -31,29 +35,246 @@
 #define IMG_SUBDIR  L"Pictures"
 #define VID_SUBDIR  L"Movies"
 #define CASE_REPORT L"Case Report.xml"
-#define IMG_REPORT  L"C4P Index.xml"
-#define VID_REPORT  L"C4M Index.xml"
+#define CASE_REPORT_TMP L"Case Report.xml.tmp"
+#define IMG_REPORT  L"C4P Index"
+#define VID_REPORT  L"C4M Index"
+#define XML_EXT     L".xml"
+#define MANIFEST    L"Export Manifest.dat"
+#define MANIFEST_STR L"Export Manifest.str"
+#define TRACE_JSON  L"Trace.json"
+#define TRACE_TEXT  L"Trace Summary.txt"
+#define KNOWN_LIST  L"Known Files.txt"
+#define EXIF_LIST   L"Exif.txt"
+#define PREVIEW_SUBDIR L"Previews"
+#define STATUS_JSON L"Status.json"
+#define STATUS_TMP  L"Status.json.tmp"
+#define QOS_CONTROL L"Control.ini"
+#define HASH_CACHE  L".gxh"
+
+// Spilled worklists, see XtSpill. Blocks are a multiple of the
+// allocation granularity.
+#define SPILL_BLOCK  1048576
+#define SPILL_PREFIX L"gxw"
+// Spilled metadata records end before fullpath
+#define FILE_RECORD_LEN offsetof(struct XtFile, fullpath)
+
+#define OPTIONS     L"..\\xt-gexpo.ini"
 #define MIN_VER     1760
 #define MIN_VER_S   L"17.6"
 
 #define REP_TABLE_SUCCESS L"[XT][gexpo] exported"
 #define REP_TABLE_FAILED  L"[XT][gexpo] could not read file"
+#define REP_TABLE_KNOWN   L"[XT][gexpo] known benign"
+#define REP_TABLE_SIZE    L"[XT][gexpo] inaccurate size"
+#define REP_TABLE_TRUNCATED L"[XT][gexpo] truncated"
+#define REP_TABLE_CORRUPT L"[XT][gexpo] corrupt"
+#define REP_TABLE_PARTIAL L"[XT][gexpo] partially recovered"
 
 #define NAME_BUF_LEN 256
 #define BIG_BUF_LEN  2048
+// Size of the write buffer of each index file
+#define INDEX_BUF_LEN 65536
+// Closing tag of an index part, see IndexSeal
+#define INDEX_END     L"</ReportIndex>"
+// Manifest records buffered before the index parts are sealed early
+#define MANIFEST_BUF_RECORDS 4096
+
+// Minimum milliseconds between two XWF_SetProgressPercentage calls
+#define PROGRESS_INTERVAL 250
+
+// Window of the header parsers and maximum number of reads per item
+#define PROBE_BUF_LEN   4096
+#define PROBE_MAX_READS 8
 
 #define TYPE_OTHER   0
 #define TYPE_PICTURE 1
 #define TYPE_VIDEO   2
 
-//1 * 1024 * 1024 * 1024 = 1.073.741.824 = 1GB --> size of data that is used to read and write large files
+//1 * 1024 * 1024 * 1024 = 1.073.741.824 = 1GB --> maximum size of data that is used to read and write large files
 #define FILE_CHUNK 1073741824
+//64 * 1024 * 1024 = 64MB, default chunk size, see ChunkSizeMB
+#define DEFAULT_CHUNK 67108864
+//maximum number of chunks read ahead of the writer, see ReadAhead
+#define MAX_READ_AHEAD 16
+#define PIPELINE_SLOTS (MAX_READ_AHEAD + 1)
+//64 * 1024 = 64KB, allocation unit of sparse files on NTFS, see WriteSparse
+#define SPARSE_BLOCK 65536
 //2 * 1024 * 1024 * 1024 = 2.147.483.648 = 2GB, this variable is used to determine what is considered a "large" file
 #define FILE_2GB 2147483648
 
 #define REPORT_TYPE_EXISTING 0
 #define REPORT_TYPE_DELETED 1
 
+// Results of ExportItem
+#define EXPORT_DONE         0
+#define EXPORT_EMPTY        1
+#define EXPORT_INACCESSIBLE 2
+#define EXPORT_ABORT        3
+#define EXPORT_KNOWN        4
+#define EXPORT_DEFERRED     5
+
+// Actions for known benign files, see BenignAction
+#define BENIGN_SKIP  0
+#define BENIGN_LIST  1
+#define BENIGN_INDEX 2
+
+// Reasons for skipping an item before any data is read, see FilterItem
+#define FILTER_PASS   0
+#define FILTER_SIZE   1
+#define FILTER_TIME   2
+#define FILTER_STATUS 3
+#define FILTER_PATH   4
+
+#define FILTER_ANY      0
+#define FILTER_EXISTING 1
+#define FILTER_DELETED  2
+
+// Glob tokens, see GlobCompile
+#define GLOB_LITERAL    0
+#define GLOB_ANY        1
+#define GLOB_STAR       2
+#define GLOB_GLOBSTAR   3
+#define GLOB_MAX_TOKENS 63
+#define GLOB_MAX_COUNT  32
+
+// Priority classes of the export order, see ScheduleInit
+#define SCHEDULE_TYPE     1
+#define SCHEDULE_STATUS   2
+#define SCHEDULE_PATH     3
+#define SCHEDULE_SIZE     4
+#define SCHEDULE_OFFSET   5
+#define SCHEDULE_MAX_KEYS 5
+#define SCHEDULE_SIZE_BITS 48
+
+// Feedback control of the read-ahead pipeline, see TuneWindow
+#define TUNE_MIN_CHUNK  1048576
+#define TUNE_WINDOW_MS  1000
+#define TUNE_GAIN       0.05
+#define TUNE_MAX_EVENTS 4096
+// Probed moves, in the order they are tried
+#define TUNE_CHUNK_UP   0
+#define TUNE_DEPTH_UP   1
+#define TUNE_CHUNK_DOWN 2
+#define TUNE_DEPTH_DOWN 3
+#define TUNE_MOVES      4
+
+// Rate limits, see QosTake
+#define QOS_BURST_SEC 1
+#define QOS_SLICE_MS  100
+
+// Free space check, see PreflightVolume
+#define PREFLIGHT_OFF    0
+#define PREFLIGHT_WARN   1
+#define PREFLIGHT_REFUSE 2
+// Bytes read per sampled file, written by the write sample in chunks
+#define PREFLIGHT_READ_LEN   4194304
+#define PREFLIGHT_WRITE_LEN  16777216
+#define PREFLIGHT_CHUNK      1048576
+// Estimated index and report size per exported file
+#define PREFLIGHT_XML_BYTES  2048
+#define PREFLIGHT_TMP L"Preflight.tmp"
+
+// Coalesced reads, see CoalesceData
+#define COALESCE_TAIL 512
+// Smaller NTFS files may be resident in their FILE record
+#define NTFS_RESIDENT_MAX 1024
+
+// Integrity check results, see CheckFeed
+#define CHECK_NONE      0
+#define CHECK_OK        1
+#define CHECK_TRUNCATED 2
+#define CHECK_CORRUPT   3
+// Checked formats
+#define CHECK_JPEG 1
+#define CHECK_PNG  2
+#define CHECK_GIF  3
+#define CHECK_BMFF 4
+#define CHECK_AVI  5
+// Parser states
+#define CS_DETECT      0
+#define CS_JPEG_SOI    1
+#define CS_JPEG_MARKER 2
+#define CS_JPEG_LENGTH 3
+#define CS_JPEG_SCAN   4
+#define CS_PNG_SIG     5
+#define CS_PNG_CHUNK   6
+#define CS_PNG_CRC     7
+#define CS_GIF_HEADER  8
+#define CS_GIF_BLOCK   9
+#define CS_GIF_IMAGE   10
+#define CS_GIF_BYTE    11
+#define CS_GIF_SUB     12
+#define CS_BMFF_BOX    13
+#define CS_BMFF_LARGE  14
+#define CS_AVI_RIFF    15
+#define CS_AVI_CHUNK   16
+#define CS_AVI_LIST    17
+// Nesting of checked boxes and lists
+#define CHECK_DEPTH 8
+
+// Exif fields, see ExifParse. Thumbnails are stored in APP1 segments,
+// which are limited to 64 KB.
+#define EXIF_STR_LEN     64
+#define EXIF_THUMB_MAX   65536
+#define EXIF_MAX_ENTRIES 1024
+
+// Video details, see VideoProbe. Header boxes and lists can be spread over
+// the file, so the probe may read a few more windows than image parsers.
+#define VIDEO_CODEC_LEN   MANIFEST_CODEC_LEN
+#define VIDEO_PROBE_READS 32
+
+// Matroska element IDs, with their length markers
+#define EBML_SEGMENT        0x18538067
+#define EBML_INFO           0x1549a966
+#define EBML_TIMECODE_SCALE 0x2ad7b1
+#define EBML_DURATION       0x4489
+#define EBML_DATE           0x4461
+#define EBML_TRACKS         0x1654ae6b
+#define EBML_TRACK_ENTRY    0xae
+#define EBML_TRACK_TYPE     0x83
+#define EBML_CODEC_ID       0x86
+#define EBML_VIDEO          0xe0
+#define EBML_PIXEL_WIDTH    0xb0
+#define EBML_PIXEL_HEIGHT   0xba
+#define EBML_CLUSTER        0x1f43b675
+
+// "GXHS", little endian
+#define HASH_SET_MAGIC   0x53485847
+#define HASH_SET_VERSION 1
+#define HASH_REC_LEN     17
+#define BLOOM_HASHES     6
+
+// "GXCS", little endian. The index of the content store is a hash table of
+// fixed capacity, see StoreOpen.
+#define STORE_MAGIC     0x53435847
+#define STORE_VERSION   1
+#define STORE_INDEX     L"Store Index.dat"
+#define STORE_TMP       L".gxs"
+#define STORE_MAX_FILES 1048576
+#define STORE_LOCK_HIGH 0x7fffffff
+//1024 * 1024 = 1MB, pieces in which stored copies are compared, see StoreMatches
+#define STORE_COMPARE   1048576
+
+// Instrumented phases, see trace_names
+#define TRACE_CLASSIFY 0
+#define TRACE_METADATA 1
+#define TRACE_OPEN     2
+#define TRACE_READ     3
+#define TRACE_CREATE   4
+#define TRACE_WRITE    5
+#define TRACE_XML      6
+#define TRACE_RTABLE   7
+#define TRACE_ITEM     8
+#define TRACE_COLLECT  9
+#define TRACE_EXPORT   10
+#define TRACE_PROBE    11
+#define TRACE_THROTTLE 12
+#define TRACE_PHASES   13
+
+// Latency histogram buckets, powers of two in microseconds
+#define TRACE_BUCKETS  32
+#define TRACE_SLOWEST  20
+
 #define EXPORT __declspec (dllexport)
 
 struct XtFile {
@@ -64,9 +285,58 @@ struct XtFile {
     INT64 filesize;
     INT16 deleted;
 
+    // Category from a hash set, written into <category>
+    INT16 category;
+    BOOL hashed;
+    BYTE md5[16];
+    // Linked to a copy in the content store, see StoreFile
+    BOOL stored;
+
+    // Result of the integrity check, and whether less than filesize
+    // bytes could be read
+    INT16 integrity;
+    BOOL short_read;
+
+    // Bytes of unreadable regions that were zero-filled, see ReadBisect
+    INT64 unreadable;
+
+    // Volume offset of the first data byte, -1 if unknown, see GetItemDataOffset
+    INT64 data_ofs;
+    // Data is stored in one piece from data_ofs on, e.g. carved files
+    BOOL contiguous;
+
     WCHAR fullpath[BIG_BUF_LEN];
 };
 
+// Buffered C4All index file, optionally split into several parts.
+// Every part is a complete ReportIndex document.
+struct XtIndex {
+    HANDLE file;
+    LPCWSTR name;
+
+    // Current part and first part written by this run
+    UINT32 part;
+    UINT32 first_part;
+
+    // Records and bytes in the current part
+    UINT32 records;
+    INT64 bytes;
+
+    // Buffer and handle are only held while the index is among the
+    // recently used ones, see IndexAcquire
+    DWORD used;
+    BYTE *buf;
+
+    // Report directory, and whether the current part still lacks its
+    // final closing tag. A sealed part ends with a provisional closing
+    // tag that is overwritten by the next record, see IndexSeal.
+    LPCWSTR dir;
+    BOOL active;
+    BOOL sealed;
+    struct XtIndex *lru_prev;
+    struct XtIndex *lru_next;
+};
+
 // Decoupled report data
 // In case of a merged report, all XtVolumes will point to the same XtReport,
 // increasing its ref_count. In case of separate reports per evidence item,
@@ -78,11 +348,40 @@ struct XtReport {
     UINT32 movie_count;
     UINT32 empty_count;
     UINT32 size_mismatch_count;
+    UINT32 truncated_count;
+    UINT32 corrupt_count;
+    UINT32 partial_count;
+    UINT32 deferred_count;
     UINT32 inaccessible_count;
 
+    // Incremented concurrently by XT_ProcessItem
+    volatile LONG delta_skipped_count;
+    volatile LONG shard_skipped_count;
+    volatile LONG too_small_count;
+    volatile LONG filtered_count[FILTER_PATH + 1];
+
+    // Records listed in the case report by the last checkpoint
+    UINT32 committed_images;
+    UINT32 committed_movies;
+
+    UINT32 known_count;
+    UINT32 categorized_count;
+    UINT32 coalesced_count;
+    UINT32 exif_count;
+    UINT32 video_count;
+    UINT32 stored_count;
+    HANDLE known_list;
+    HANDLE exif_list;
+
+    // Export IDs already taken by previous runs (delta export)
+    UINT32 image_base;
+    UINT32 movie_base;
+
+    // Report files are only created before the first export, see ReportOpen
+    BOOL opened;
     HANDLE xml_case_report;
-    HANDLE xml_image_index;
-    HANDLE xml_movie_index;
+    struct XtIndex image_index;
+    struct XtIndex movie_index;
 
     WCHAR export_path[MAX_PATH];
 };
@@ -93,16 +392,56 @@ struct XtFileId {
     int type;
 };
 
+// Fixed-size records in a temporary file, mapped one block at a time.
+// Only the mapped block is resident, the rest is paged to the file
+// instead of the page file.
+struct XtSpill {
+    HANDLE file;
+    HANDLE mapping;
+    DWORD record_size;
+    DWORD block_records;
+
+    SRWLOCK lock;
+    BYTE *view;
+    INT64 block;
+};
+
+// Enumerated items of a volume, their metadata and the export order. Kept
+// in memory, or for volumes with more than [Worklist] SpillItems items in
+// spill files, see WorklistOpen. Spill files are rewritten in export
+// order instead of having an order of their own, see ScheduleOrderExternal.
+struct XtWorklist {
+    BOOL spilled;
+    BOOL ordered;
+
+    struct XtFileId *ids;
+    struct XtFile *files;
+    struct XtWorkItem *order;
+
+    struct XtSpill id_spill;
+    struct XtSpill file_spill;
+};
+
 struct XtVolume {
     struct XtVolume *next;
+    struct XtVolume *hash_next;
     struct XtReport *report_existing;
     struct XtReport *report_deleted;
 
-    struct XtFileId *file_ids;
-    struct XtFile *files;
+    struct XtWorklist worklist;
+
+    // Amount of enumerated file IDs, incremented concurrently
+    // by XT_ProcessItem
+    volatile LONG64 file_count;
+
+    // Hash of the top-level evidence item name, see HashName
+    UINT64 name_hash;
 
-    // Amount of enumerated file IDs
-    INT64 file_count;
+    // String table offset of the name, 0 until the first manifest record
+    UINT64 manifest_name;
+
+    // Volume handle of the current XT_Prepare call
+    HANDLE hVolume;
 
     // Top-level evidence item name
     // Used to group volumes (partitions) together
@@ -113,13 +452,597 @@ struct XtVolume {
     WCHAR name_ex[NAME_BUF_LEN];
 };
 
+// Optional settings, read from xt-gexpo.ini next to xt-gexpo.conf
+struct XtOptions {
+    // Continue an existing export and skip files exported by a previous run
+    BOOL delta;
+
+    // Start a new index part after this many records or bytes, 0 = never
+    UINT32 index_max_records;
+    INT64 index_max_bytes;
+
+    // Files are read and written in chunks of this size. Files larger than
+    // one chunk are written by a separate thread while up to read_ahead
+    // further chunks are being read.
+    DWORD chunk_size;
+    UINT32 read_ahead;
+
+    // Read runs of physically adjacent files up to coalesce_max_file bytes
+    // with a single read of up to coalesce_buf bytes
+    BOOL coalesce;
+    INT64 coalesce_max_file;
+    DWORD coalesce_buf;
+
+    // Skip blocks of zeros in exported files instead of writing them
+    BOOL sparse;
+
+    // Pictures below these dimensions are not exported, 0 = no limit
+    UINT32 min_width;
+    UINT32 min_height;
+    UINT64 min_pixels;
+
+    // Maximum index files kept open at the same time
+    UINT32 max_open_indexes;
+
+    // Milliseconds between two index checkpoints, 0 = only between volumes
+    DWORD checkpoint_interval;
+
+    // Export only the files of shard shard_index (1-based) out of
+    // shard_count, see ShardOwns. 0 = no sharding.
+    UINT32 shard_index;
+    UINT32 shard_count;
+
+    // Volumes with more items are enumerated into spill files in
+    // spill_dir, 0 = never. Spilled worklists are sorted in runs of up to
+    // sort_memory bytes.
+    DWORD spill_items;
+    DWORD sort_memory;
+    WCHAR spill_dir[MAX_PATH];
+
+    // Check the structure of exported pictures and videos, see CheckFeed
+    BOOL check;
+
+    // Items with a read slower than slow_read ms are exported after all
+    // others, 0 = never. Failed reads are split down to salvage_block bytes.
+    DWORD slow_read;
+    BOOL salvage;
+    DWORD salvage_block;
+
+    // List Exif fields of exported pictures and save their thumbnails
+    BOOL exif;
+    BOOL thumbnails;
+
+    // Record duration, resolution and codec of exported videos
+    BOOL video;
+
+    // Calculate MD5 hashes of all exported files
+    BOOL hash;
+    int benign_action;
+};
+
+// Glob compiled to a bit-parallel NFA. Bit k of the state is set while
+// the first k tokens have matched, so a pattern matches if bit count is
+// set after the last character. '*' and '**' keep their state on every
+// character they accept and may also be skipped entirely.
+struct XtGlob {
+    UINT32 count;
+    // Transitions to the next token and self loops of star tokens,
+    // for lower case ASCII and for any other character
+    UINT64 step[128];
+    UINT64 self[128];
+    UINT64 step_other;
+    UINT64 self_other;
+    // Tokens after a star, reachable without consuming a character
+    UINT64 skip;
+    // Non-ASCII literals are compared one by one
+    WCHAR literal[GLOB_MAX_TOKENS];
+    UINT64 literal_other;
+};
+
+// Metadata criteria, evaluated in XT_ProcessItem before any data is read
+struct XtFilter {
+    BOOL enabled;
+
+    INT64 min_size;
+    INT64 max_size;
+
+    // Unix time windows, after <= t < before, 0 = no limit
+    INT64 created_after;
+    INT64 created_before;
+    INT64 modified_after;
+    INT64 modified_before;
+    INT64 accessed_after;
+    INT64 accessed_before;
+
+    int status;
+
+    struct XtGlob *include;
+    UINT32 include_count;
+    struct XtGlob *exclude;
+    UINT32 exclude_count;
+};
+
+// Export order of XT_Finalize. Keys are compared in the configured order,
+// items of equal priority keep their enumeration order.
+struct XtSchedule {
+    int keys[SCHEDULE_MAX_KEYS];
+    int key_count;
+    // Data offsets are only looked up if needed
+    BOOL offsets;
+
+    struct XtGlob *paths;
+    UINT32 path_count;
+};
+
+// Position of an item in the export worklist
+struct XtWorkItem {
+    UINT64 key;
+    INT64 index;
+};
+
+// Work item of a spilled worklist together with its records, so that
+// they are sorted along, see ScheduleOrderExternal
+struct XtSortRecord {
+    struct XtWorkItem item;
+    struct XtFileId id;
+    BYTE file[FILE_RECORD_LEN];
+};
+
+// Input of one sorted run, see ScheduleOrderExternal
+struct XtMergeRun {
+    struct XtSortRecord *buf;
+    DWORD count;
+    DWORD next;
+    // Next item to read and end of the run, in items
+    INT64 pos;
+    INT64 end;
+};
+
+// Directory path of an item, relative to the volume root
+struct XtDirEntry {
+    struct XtDirEntry *next;
+    LONG dir_id;
+    WCHAR path[];
+};
+
+// Directory paths by item ID, shared by all XT_ProcessItem threads and
+// by GetXwfFileInfo. Emptied by XT_Prepare, as item IDs are per volume.
+struct XtDirCache {
+    SRWLOCK lock;
+    struct XtDirEntry **buckets;
+    UINT32 mask;
+};
+
+// Sorted array of 17 byte records (MD5 hash, category), memory-mapped
+// from a cache file which is built from a text hash list on first use.
+// The optional Bloom filter answers most negative lookups without
+// touching the mapped records.
+struct XtHashSet {
+    HANDLE file;
+    HANDLE mapping;
+    const BYTE *view;
+
+    const BYTE *records;
+    UINT64 count;
+
+    UINT64 *bloom;
+    UINT64 bloom_mask;
+};
+
+// Header of a hash set cache file
+struct XtHashSetHeader {
+    UINT32 magic;
+    UINT32 version;
+    UINT64 count;
+};
+
+// Header of the content store index, followed by capacity entries
+struct XtStoreHeader {
+    UINT32 magic;
+    UINT32 version;
+    UINT64 capacity;
+    UINT64 count;
+};
+
+// Content in the store, a filesize of 0 marks an empty slot, so empty
+// files are never stored
+struct XtStoreEntry {
+    BYTE md5[16];
+    INT64 filesize;
+};
+
+// Content-addressed store of exported files shared by cases. Stored
+// copies are hardlinks named by MD5 hash, the mapped index tells which
+// contents are present. Several X-Ways instances may use the same store,
+// every access to the index holds a lock on its file.
+struct XtStore {
+    WCHAR dir[MAX_PATH];
+    HANDLE file;
+    HANDLE mapping;
+    struct XtStoreHeader *header;
+    struct XtStoreEntry *entries;
+};
+
+// Random access to the first bytes of an item for the header parsers.
+// Either reads small windows of an item on demand or only provides the
+// data of an existing buffer, if hItem is NULL.
+struct XtProbe {
+    HANDLE hItem;
+    INT64 size;
+
+    // Item offset and length of the available data
+    INT64 offset;
+    DWORD len;
+    const BYTE *data;
+
+    UINT32 reads;
+    BYTE buf[PROBE_BUF_LEN];
+};
+
+// Byte order and position of a TIFF header, IFD offsets are relative to it
+struct XtTiff {
+    struct XtProbe *p;
+    INT64 base;
+    BOOL le;
+};
+
+// Exif fields of the picture being exported
+struct XtExif {
+    BOOL valid;
+    BOOL gps;
+    double latitude;
+    double longitude;
+    WCHAR make[EXIF_STR_LEN];
+    WCHAR model[EXIF_STR_LEN];
+    WCHAR taken[20];
+
+    // Copy of the embedded JPEG thumbnail, thumb_len = 0 if there is none
+    BYTE *thumb;
+    DWORD thumb_len;
+    DWORD thumb_cap;
+};
+
+// Streaming structure check of exported data. Headers are collected in
+// hdr, everything else is skipped without copying.
+struct XtCheck {
+    int format;
+    int state;
+    int result;
+    // End marker reached, the rest is not checked
+    BOOL done;
+    // JPEG frame header, PNG IHDR, GIF image, BMFF moov or meta, AVI movi
+    BOOL seen;
+    BOOL last;
+
+    // Bytes fed and bytes parsed
+    INT64 bytes;
+    INT64 offset;
+    INT64 skip;
+    DWORD need;
+    DWORD have;
+    BYTE hdr[16];
+
+    BYTE marker;
+    BOOL ff;
+    BOOL crc_on;
+    UINT32 crc;
+    INT64 list_end;
+
+    // Ends of the enclosing boxes or lists
+    INT64 ends[CHECK_DEPTH];
+    int depth;
+};
+
+// One buffer of the read-ahead pipeline
+struct XtChunk {
+    BYTE *data;
+    DWORD capacity;
+    DWORD size;
+    HANDLE file;
+    INT64 xwf_id;
+};
+
+// Single reader, single writer ring of chunks. The X-Ways thread fills
+// chunks with XWF_Read, the writer thread writes them in order.
+// The ring uses depth of the PIPELINE_SLOTS slots, chunk buffers are
+// allocated on first use.
+struct XtPipeline {
+    HANDLE thread;
+    HANDLE free_slots;
+    HANDLE full_slots;
+
+    struct XtChunk *slots;
+    UINT32 depth;
+    UINT32 head;
+    UINT32 tail;
+    // Bytes read per chunk
+    DWORD chunk;
+
+    volatile LONG failed;
+
+    // Write latency, only measured for the tuner
+    volatile LONG64 write_ticks;
+    volatile LONG writes;
+};
+
+// Volume data of physically adjacent files, read at once
+struct XtRun {
+    BYTE *buf;
+    // Volume offsets of the data in buf
+    INT64 start;
+    INT64 end;
+    // Last worklist position covered by this run
+    INT64 last;
+};
+
+// Details of the video being exported, 0 if unknown
+struct XtVideo {
+    BOOL valid;
+    double duration;
+    UINT32 width;
+    UINT32 height;
+    // Unix time
+    INT64 created;
+    char codec[VIDEO_CODEC_LEN];
+};
+
+// State of the export engine during XT_Finalize
+struct XtExport {
+    HANDLE hVolume;
+    struct XtPipeline pipeline;
+
+    // Reused for files that fit into a single chunk
+    BYTE *buf;
+    DWORD buf_size;
+
+    // Volume geometry, 0 if unknown
+    DWORD sector_size;
+    DWORD cluster_size;
+    struct XtRun run;
+
+    // Parsed from the first chunk of the current file, depending on type
+    int type;
+    struct XtExif exif;
+    struct XtVideo video;
+
+    // The first block of a chunk of the current item was slower than
+    // options.slow_read, and whether the item may still be deferred
+    BOOL slow;
+    BOOL defer;
+    // Worklist indexes of items deferred by slow reads, which are
+    // exported once the worklist is done
+    INT64 *deferred;
+    INT64 deferred_count;
+    INT64 deferred_cap;
+};
+
+// Open addressing hash table of previously exported files.
+// A filesize of 0 marks an empty slot, empty files are never exported.
+struct XtDeltaEntry {
+    UINT64 volume_hash;
+    INT64 xwf_id;
+    INT64 filesize;
+    INT64 deleted;
+};
+
+// Highest export IDs per evidence item and deletion status, in an open
+// addressing hash table keyed by volume_hash
+struct XtDeltaBase {
+    UINT64 volume_hash;
+    UINT32 image_count[2];
+    UINT32 movie_count[2];
+    BOOL used;
+};
+
+struct XtDelta {
+    struct XtDeltaEntry *table;
+    UINT64 mask;
+    INT64 count;
+
+    struct XtDeltaBase *bases;
+    UINT64 base_mask;
+    UINT64 base_count;
+};
+
+// A single timed span, stored in the order of completion
+struct XtTraceEvent {
+    INT64 start;
+    INT64 duration;
+    INT64 xwf_id;
+    INT64 bytes;
+    UINT32 thread_id;
+    UINT32 phase;
+};
+
+// Optional instrumentation, see TRACE_BEGIN and TRACE_END
+struct XtTrace {
+    BOOL enabled;
+
+    struct XtTraceEvent *events;
+    volatile LONG64 count;
+    INT64 capacity;
+
+    // Performance counter ticks per second and at XT_Init
+    INT64 frequency;
+    INT64 origin;
+
+    // Histograms are kept for all spans, even if the event buffer is full
+    volatile LONG64 histogram[TRACE_PHASES][TRACE_BUCKETS];
+    volatile LONG64 total[TRACE_PHASES];
+};
+
+struct XtTuneEvent {
+    INT64 time;
+    DWORD chunk;
+    UINT32 depth;
+    double rate;
+    double read_ms;
+    double write_ms;
+    const char *action;
+};
+
+// Hill climbing on chunk size and ring depth of the read-ahead pipeline.
+// Each window of TUNE_WINDOW_MS either measures the current settings or
+// probes a single move: accepted moves are repeated, others are reverted
+// and the next move is tried after another measurement. Chunk size moves
+// are multiplicative, depth moves additive, chunk * depth stays within
+// the memory budget.
+struct XtTuner {
+    BOOL enabled;
+    INT64 budget;
+
+    DWORD chunk;
+    UINT32 depth;
+    int move;
+    BOOL probing;
+    double baseline;
+    UINT32 windows;
+
+    // Current window, in performance counter ticks
+    INT64 frequency;
+    INT64 window_start;
+    INT64 bytes;
+    INT64 read_ticks;
+    UINT32 reads;
+    INT64 write_ticks_base;
+    LONG writes_base;
+
+    // Decisions, written to the trace, the last one also to Status.json
+    struct XtTuneEvent *events;
+    UINT32 event_count;
+    const char *action;
+};
+
+// Token bucket, tokens are bytes or files. A bucket may go into debt by
+// a single request, see QosTake.
+struct XtBucket {
+    // Tokens per second, 0 = unlimited
+    double rate;
+    double tokens;
+    INT64 last;
+};
+
+// Rate limits and I/O priority of the export, re-read from the options
+// while exporting. Only used by the main thread (XT_Finalize).
+struct XtQos {
+    struct XtBucket read;
+    struct XtBucket write;
+    struct XtBucket files;
+    BOOL low_priority;
+    // Background mode of the main thread, see QosBackground
+    BOOL background;
+
+    // Control.ini in the export root, overrides xt-gexpo.ini
+    WCHAR control_path[MAX_PATH];
+    DWORD reload;
+    ULONGLONG last_reload;
+    INT64 frequency;
+    // Time spent waiting for tokens, in performance counter ticks
+    INT64 throttled;
+};
+
+// Live progress, periodically written to Status.json in the export root.
+// Only used by the main thread (XT_Init, XT_Prepare, XT_Finalize, XT_Done).
+struct XtStatus {
+    BOOL enabled;
+    DWORD interval;
+
+    WCHAR path[MAX_PATH];
+    WCHAR tmp_path[MAX_PATH];
+
+    const char *phase;
+    INT64 files_done;
+    INT64 files_total;
+    INT64 bytes_done;
+    INT64 bytes_total;
+
+    // Start of the current phase and the previous sample, for rates
+    ULONGLONG phase_start;
+    ULONGLONG last_write;
+    ULONGLONG last_progress;
+    INT64 last_files;
+    INT64 last_bytes;
+};
+
+// Dry run and free space check before each volume is exported
+struct XtPreflight {
+    BOOL dry_run;
+    int free_space;
+    INT64 reserve;
+    UINT32 samples;
+    BOOL refused;
+
+    // Samples of all volumes so far, in performance counter ticks
+    INT64 frequency;
+    INT64 open_ticks;
+    INT64 opened;
+    INT64 read_ticks;
+    INT64 read_bytes;
+    // Bytes per second, 0 if not measured
+    double write_rate;
+
+    // Totals of a dry run
+    INT64 files;
+    INT64 bytes;
+    INT64 needed;
+    double seconds;
+};
+
+// Volumes by name hash, see SetCurrentVolume
+struct XtVolumeTable {
+    struct XtVolume **buckets;
+    UINT32 mask;
+    UINT32 count;
+};
+
+// Open index files, most recently used first
+struct XtIndexLru {
+    struct XtIndex *head;
+    struct XtIndex *tail;
+    UINT32 count;
+};
+
+// Only changed by XT_Prepare, never while XT_ProcessItem may be running
 struct XtVolume *first_volume = NULL;
+struct XtVolume *last_volume = NULL;
 struct XtVolume *current_volume = NULL;
+struct XtVolumeTable volume_table = {0};
+struct XtIndexLru index_lru = {0};
+
+struct XtOptions options = {0};
+struct XtDelta delta = {0};
+struct XtTrace trace = {0};
+struct XtTuner tuner = {0};
+struct XtQos qos = {0};
+struct XtStatus status = {0};
+struct XtPreflight preflight = {0};
+struct XtFilter filter = {0};
+struct XtSchedule schedule = {0};
+struct XtDirCache dir_cache = {SRWLOCK_INIT};
+struct XtHashSet benign_set = {0};
+struct XtHashSet categorized_set = {0};
+struct XtStore store = {0};
+BCRYPT_ALG_HANDLE md5_alg = NULL;
+
+const char *trace_names[TRACE_PHASES] = {
+        "classify", "metadata", "open", "read", "create",
+        "write", "xml", "report table", "item", "collect metadata", "export",
+        "probe", "throttle"
+};
+HANDLE manifest_file = NULL;
+HANDLE manifest_strings = NULL;
+UINT64 manifest_strings_size = 0;
+// Records not written yet, see ManifestFlush
+struct XtManifestRecord *manifest_buf = NULL;
+DWORD manifest_count = 0;
+DWORD manifest_capacity = 0;
+ULONGLONG last_checkpoint = 0;
 
 WCHAR case_name[NAME_BUF_LEN] = {0};
 WCHAR export_dir[MAX_PATH] = {0};
 WCHAR export_dir_existing[MAX_PATH] = {0};
 WCHAR export_dir_deleted[MAX_PATH] = {0};
+WCHAR options_path[MAX_PATH] = {0};
 
 DWORD config_bytes_transferred = 0;
 
@@ -149,11 +1072,28 @@ HANDLE hXwfWnd = NULL;
 #define XT_PREPARE_CALLPI     0x01
 #define XT_PREPARE_CALLPILATE 0x02
 
+#define XWF_ITEM_INFO_FLAGS    3
 #define XWF_ITEM_INFO_DELETION 4
 #define XWF_ITEM_INFO_CREATIONTIME     32
 #define XWF_ITEM_INFO_MODIFICATIONTIME 33
 #define XWF_ITEM_INFO_LASTACCESSTIME   34
 
+// Item flags
+#define XWF_FLAG_VIRTUAL          0x00000008
+#define XWF_FLAG_NTFS             0x00000800
+#define XWF_FLAG_UNKNOWN          0x00008000
+#define XWF_FLAG_PARTIALLY_KNOWN  0x00010000
+#define XWF_FLAG_SHADOW_COPY      0x00800000
+#define XWF_FLAG_KNOWN_ORIGINAL   0x01000000
+#define XWF_FLAG_EMBEDDED         0x80000000
+#define XWF_FLAG_EXTERNAL         0x100000000
+#define XWF_FLAG_ALTERNATIVE      0x200000000
+// Items whose data is not stored as is at their start sector
+#define XWF_FLAGS_NOT_ON_VOLUME   (XWF_FLAG_VIRTUAL | XWF_FLAG_UNKNOWN \
+                                   | XWF_FLAG_PARTIALLY_KNOWN | XWF_FLAG_SHADOW_COPY \
+                                   | XWF_FLAG_KNOWN_ORIGINAL | XWF_FLAG_EMBEDDED \
+                                   | XWF_FLAG_EXTERNAL | XWF_FLAG_ALTERNATIVE)
+
 #define XWF_CASEPROP_TITLE 1
 #define XWF_CASEPROP_DIR   6
 
@@ -171,6 +1111,8 @@ typedef INT64  (XTAPI *fp_XWF_GetItemInformation)(LONG, LONG, LPBOOL);
 
 typedef LPWSTR (XTAPI *fp_XWF_GetItemName)(LONG);
 
+typedef VOID   (XTAPI *fp_XWF_GetItemOfs)(LONG, PINT64, PINT64);
+
 typedef LONG   (XTAPI *fp_XWF_GetItemParent)(LONG);
 
 typedef INT64  (XTAPI *fp_XWF_GetItemSize)(LONG);
@@ -179,6 +1121,8 @@ typedef LONG   (XTAPI *fp_XWF_GetItemType)(LONG, LPWSTR, DWORD);
 
 typedef HANDLE (XTAPI *fp_XWF_GetNextEvObj)(HANDLE, LPVOID);
 
+typedef VOID   (XTAPI *fp_XWF_GetVolumeInformation)(HANDLE, LPLONG, LPDWORD, LPDWORD, PINT64, PINT64);
+
 typedef VOID   (XTAPI *fp_XWF_GetVolumeName)(HANDLE, LPWSTR, DWORD);
 
 typedef VOID   (XTAPI *fp_XWF_HideProgress)();
@@ -204,10 +1148,12 @@ fp_XWF_GetFirstEvObj XWF_GetFirstEvObj = NULL;
 fp_XWF_GetItemCount XWF_GetItemCount = NULL;
 fp_XWF_GetItemInformation XWF_GetItemInformation = NULL;
 fp_XWF_GetItemName XWF_GetItemName = NULL;
+fp_XWF_GetItemOfs XWF_GetItemOfs = NULL;
 fp_XWF_GetItemParent XWF_GetItemParent = NULL;
 fp_XWF_GetItemSize XWF_GetItemSize = NULL;
 fp_XWF_GetItemType XWF_GetItemType = NULL;
 fp_XWF_GetNextEvObj XWF_GetNextEvObj = NULL;
+fp_XWF_GetVolumeInformation XWF_GetVolumeInformation = NULL;
 fp_XWF_GetVolumeName XWF_GetVolumeName = NULL;
 fp_XWF_HideProgress XWF_HideProgress = NULL;
 fp_XWF_OpenItem XWF_OpenItem = NULL;
@@ -231,10 +1177,12 @@ GetXwfFunctions() {
     LOAD_FUNCTION (XWF_GetItemCount);
     LOAD_FUNCTION (XWF_GetItemInformation);
     LOAD_FUNCTION (XWF_GetItemName);
+    LOAD_FUNCTION (XWF_GetItemOfs);
     LOAD_FUNCTION (XWF_GetItemParent);
     LOAD_FUNCTION (XWF_GetItemSize);
     LOAD_FUNCTION (XWF_GetItemType);
     LOAD_FUNCTION (XWF_GetNextEvObj);
+    LOAD_FUNCTION (XWF_GetVolumeInformation);
     LOAD_FUNCTION (XWF_GetVolumeName);
     LOAD_FUNCTION (XWF_HideProgress);
     LOAD_FUNCTION (XWF_OpenItem);
@@ -248,6 +1196,8 @@ GetXwfFunctions() {
 
 // Returns 1 if all function pointers have been initialized
 // Returns 0 if at least one function pointer is NULL
+// XWF_GetItemOfs and XWF_GetVolumeInformation are optional, without them
+// files are never read as part of a coalesced run.
 DWORD
 CheckXwfFunctions() {
     return (XWF_AddToReportTable
@@ -273,6 +1223,466 @@ CheckXwfFunctions() {
            ) ? 1 : 0;
 }
 
+// Reads optional settings from xt-gexpo.ini in the parent directory of the
+// case directory. Missing files or keys keep the default values.
+VOID
+LoadOptions(LPCWSTR case_dir) {
+    PWSTR ini_path = NULL;
+    PathAllocCombine(case_dir, OPTIONS, 0, &ini_path);
+    StringCchCopyW(options_path, MAX_PATH, ini_path);
+    LocalFree(ini_path);
+
+    options.delta = GetPrivateProfileIntW(L"Export", L"Delta", 0, options_path);
+    options.index_max_records = GetPrivateProfileIntW(L"Index", L"MaxRecords", 0, options_path);
+    options.index_max_bytes = (INT64) GetPrivateProfileIntW(L"Index", L"MaxSizeMB", 0, options_path) * 1024 * 1024;
+    options.max_open_indexes = GetPrivateProfileIntW(L"Index", L"MaxOpenFiles", 256, options_path);
+    if (2 > options.max_open_indexes) {
+        options.max_open_indexes = 2;
+    }
+    options.checkpoint_interval = GetPrivateProfileIntW(L"Index", L"CheckpointSec", 30, options_path) * 1000;
+
+    UINT chunk_mb = GetPrivateProfileIntW(L"Export", L"ChunkSizeMB", DEFAULT_CHUNK / 1024 / 1024, options_path);
+    options.chunk_size = chunk_mb < 1 ? DEFAULT_CHUNK
+                                      : chunk_mb > FILE_CHUNK / 1024 / 1024 ? FILE_CHUNK
+                                                                            : chunk_mb * 1024 * 1024;
+    options.read_ahead = GetPrivateProfileIntW(L"Export", L"ReadAhead", 1, options_path);
+    if (MAX_READ_AHEAD < options.read_ahead) {
+        options.read_ahead = MAX_READ_AHEAD;
+    }
+
+    options.coalesce = GetPrivateProfileIntW(L"Export", L"Coalesce", 0, options_path)
+                       && XWF_GetItemOfs && XWF_GetVolumeInformation;
+    options.coalesce_max_file = (INT64) GetPrivateProfileIntW(L"Export", L"CoalesceMaxFileKB", 1024, options_path) * 1024;
+    options.sparse = GetPrivateProfileIntW(L"Export", L"Sparse", 0, options_path);
+    UINT coalesce_mb = GetPrivateProfileIntW(L"Export", L"CoalesceBufferMB", 8, options_path);
+    options.coalesce_buf = coalesce_mb < 1 ? 1024 * 1024
+                                           : coalesce_mb > 256 ? 256 * 1024 * 1024
+                                                               : coalesce_mb * 1024 * 1024;
+    if (options.coalesce_max_file > options.coalesce_buf / 2) {
+        options.coalesce_max_file = options.coalesce_buf / 2;
+    }
+
+    options.min_width = GetPrivateProfileIntW(L"Filter", L"MinWidth", 0, options_path);
+    options.min_height = GetPrivateProfileIntW(L"Filter", L"MinHeight", 0, options_path);
+    options.min_pixels = GetPrivateProfileIntW(L"Filter", L"MinPixels", 0, options_path);
+
+    options.shard_index = GetPrivateProfileIntW(L"Shard", L"Index", 0, options_path);
+    options.shard_count = GetPrivateProfileIntW(L"Shard", L"Count", 0, options_path);
+
+    options.spill_items = GetPrivateProfileIntW(L"Worklist", L"SpillItems", 0, options_path);
+    UINT sort_mb = GetPrivateProfileIntW(L"Worklist", L"SortMemoryMB", 64, options_path);
+    options.sort_memory = (sort_mb < 1 ? 1 : sort_mb > 1024 ? 1024 : sort_mb) * 1024 * 1024;
+    GetPrivateProfileStringW(L"Worklist", L"TempDir", L"", options.spill_dir, MAX_PATH, options_path);
+
+    options.check = GetPrivateProfileIntW(L"Integrity", L"Check", 0, options_path);
+
+    options.slow_read = GetPrivateProfileIntW(L"Salvage", L"SlowReadMs", 0, options_path);
+    options.salvage = GetPrivateProfileIntW(L"Salvage", L"Bisect", 0, options_path);
+    UINT block_kb = GetPrivateProfileIntW(L"Salvage", L"MinBlockKB", 4, options_path);
+    options.salvage_block = (block_kb < 1 ? 1 : block_kb > 1024 ? 1024 : block_kb) * 1024;
+
+    options.thumbnails = GetPrivateProfileIntW(L"Exif", L"Thumbnails", 0, options_path);
+    options.exif = options.thumbnails || GetPrivateProfileIntW(L"Exif", L"Extract", 0, options_path);
+
+    options.video = GetPrivateProfileIntW(L"Video", L"Probe", 0, options_path);
+}
+
+// Both macros cost a single branch if tracing is disabled
+#define TRACE_BEGIN() (trace.enabled ? TraceNow() : 0)
+#define TRACE_END(phase, start, xwf_id, bytes) \
+    do { if (trace.enabled) TraceRecord((phase), (start), (xwf_id), (bytes)); } while (0)
+
+INT64
+TraceNow() {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+VOID
+TraceInit() {
+    trace.enabled = GetPrivateProfileIntW(L"Trace", L"Enabled", 0, options_path);
+    if (!trace.enabled) {
+        return;
+    }
+    trace.capacity = GetPrivateProfileIntW(L"Trace", L"MaxEvents", 1000000, options_path);
+    trace.events = malloc(sizeof(struct XtTraceEvent) * trace.capacity);
+    if (NULL == trace.events) {
+        trace.capacity = 0;
+    }
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    trace.frequency = frequency.QuadPart;
+    trace.origin = TraceNow();
+}
+
+// Thread-safe, events are dropped once the buffer is full
+VOID
+TraceRecord(UINT32 phase, INT64 start, INT64 xwf_id, INT64 bytes) {
+    INT64 duration = TraceNow() - start;
+    INT64 us = duration * 1000000 / trace.frequency;
+    int bucket = 0;
+    while (us && TRACE_BUCKETS - 1 > bucket) {
+        us >>= 1;
+        bucket++;
+    }
+    InterlockedIncrement64(&trace.histogram[phase][bucket]);
+    InterlockedExchangeAdd64(&trace.total[phase], duration);
+
+    INT64 i = InterlockedIncrement64(&trace.count) - 1;
+    if (i < trace.capacity) {
+        struct XtTraceEvent *ev = &trace.events[i];
+        ev->start = start;
+        ev->duration = duration;
+        ev->xwf_id = xwf_id;
+        ev->bytes = bytes;
+        ev->thread_id = GetCurrentThreadId();
+        ev->phase = phase;
+    }
+}
+
+// Small buffered writer for the trace output files
+struct XtTextFile {
+    HANDLE file;
+    DWORD used;
+    char buf[65536];
+};
+
+VOID
+TextPrintf(struct XtTextFile *out, const char *format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    StringCchVPrintfA(line, 512, format, args);
+    va_end(args);
+
+    size_t len = strlen(line);
+    if (sizeof(out->buf) < out->used + len) {
+        WriteFile(out->file, out->buf, out->used, NULL, NULL);
+        out->used = 0;
+    }
+    memcpy(out->buf + out->used, line, len);
+    out->used += (DWORD) len;
+}
+
+VOID
+TextClose(struct XtTextFile *out) {
+    WriteFile(out->file, out->buf, out->used, NULL, NULL);
+    CloseHandle(out->file);
+}
+
+double
+TraceMs(INT64 ticks) {
+    return ticks * 1000.0 / trace.frequency;
+}
+
+// Writes all spans as Chrome trace (also readable by Perfetto) and a
+// summary with latency histograms and the slowest items into dir.
+VOID
+TraceFinish(LPCWSTR dir) {
+    if (!trace.enabled) {
+        return;
+    }
+    INT64 count = trace.count < trace.capacity ? trace.count : trace.capacity;
+    PWSTR path = NULL;
+    struct XtTextFile *out = malloc(sizeof(struct XtTextFile));
+    if (NULL == out) {
+        return;
+    }
+
+    PathAllocCombine(dir, TRACE_JSON, 0, &path);
+    out->file = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    out->used = 0;
+    LocalFree(path);
+    if (INVALID_HANDLE_VALUE != out->file) {
+        TextPrintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        for (INT64 i = 0; i < count; i++) {
+            struct XtTraceEvent *ev = &trace.events[i];
+            TextPrintf(out, "%s{\"name\":\"%s\",\"cat\":\"gexpo\",\"ph\":\"X\","
+                            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,"
+                            "\"args\":{\"item\":%lld,\"bytes\":%lld}}\n",
+                       i ? "," : "",
+                       trace_names[ev->phase],
+                       TraceMs(ev->start - trace.origin) * 1000.0,
+                       TraceMs(ev->duration) * 1000.0,
+                       ev->thread_id, ev->xwf_id, ev->bytes);
+        }
+        for (UINT32 i = 0; i < tuner.event_count; i++) {
+            struct XtTuneEvent *ev = &tuner.events[i];
+            TextPrintf(out, "%s{\"name\":\"tuning\",\"cat\":\"gexpo\",\"ph\":\"C\","
+                            "\"ts\":%.3f,\"pid\":1,\"args\":{\"chunk MB\":%.1f,"
+                            "\"depth\":%u,\"MB/s\":%.1f}}\n",
+                       count || i ? "," : "",
+                       TraceMs(ev->time - trace.origin) * 1000.0,
+                       ev->chunk / (1024.0 * 1024), ev->depth, ev->rate / (1024 * 1024));
+        }
+        TextPrintf(out, "]}\n");
+        TextClose(out);
+    }
+
+    PathAllocCombine(dir, TRACE_TEXT, 0, &path);
+    out->file = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    out->used = 0;
+    LocalFree(path);
+    if (INVALID_HANDLE_VALUE != out->file) {
+        if (trace.count > trace.capacity) {
+            TextPrintf(out, "Event buffer full, %lld of %lld spans are missing in "
+                            "the trace. Histograms are complete.\r\n\r\n",
+                       trace.count - trace.capacity, trace.count);
+        }
+        for (int p = 0; p < TRACE_PHASES; p++) {
+            INT64 n = 0;
+            for (int b = 0; b < TRACE_BUCKETS; b++) {
+                n += trace.histogram[p][b];
+            }
+            if (0 == n) {
+                continue;
+            }
+            TextPrintf(out, "%s: %lld spans, %.1f ms total, %.3f ms average\r\n",
+                       trace_names[p], n, TraceMs(trace.total[p]), TraceMs(trace.total[p]) / n);
+            for (int b = 0; b < TRACE_BUCKETS; b++) {
+                if (trace.histogram[p][b]) {
+                    TextPrintf(out, "  < %10llu us: %lld\r\n",
+                               1ULL << b, trace.histogram[p][b]);
+                }
+            }
+            TextPrintf(out, "\r\n");
+        }
+
+        // Simple insertion into a small sorted list is enough here
+        struct XtTraceEvent *slowest[TRACE_SLOWEST] = {0};
+        for (INT64 i = 0; i < count; i++) {
+            struct XtTraceEvent *ev = &trace.events[i];
+            if (TRACE_ITEM != ev->phase
+                || (slowest[TRACE_SLOWEST - 1] && slowest[TRACE_SLOWEST - 1]->duration >= ev->duration)) {
+                continue;
+            }
+            int pos = TRACE_SLOWEST - 1;
+            while (0 < pos && (NULL == slowest[pos - 1] || slowest[pos - 1]->duration < ev->duration)) {
+                slowest[pos] = slowest[pos - 1];
+                pos--;
+            }
+            slowest[pos] = ev;
+        }
+        TextPrintf(out, "Slowest items:\r\n");
+        for (int i = 0; i < TRACE_SLOWEST && slowest[i]; i++) {
+            TextPrintf(out, "  item %lld: %.1f ms, %lld bytes\r\n",
+                       slowest[i]->xwf_id, TraceMs(slowest[i]->duration), slowest[i]->bytes);
+        }
+
+        if (tuner.event_count) {
+            TextPrintf(out, "\r\nTuning decisions:\r\n");
+        }
+        for (UINT32 i = 0; i < tuner.event_count; i++) {
+            struct XtTuneEvent *ev = &tuner.events[i];
+            TextPrintf(out, "  %10.1f ms: %-7s %.1f MB/s, read %.1f ms, write %.1f ms"
+                            " -> %.1f MB chunks, depth %u\r\n",
+                       TraceMs(ev->time - trace.origin), ev->action, ev->rate / (1024 * 1024),
+                       ev->read_ms, ev->write_ms, ev->chunk / (1024.0 * 1024), ev->depth);
+        }
+        TextClose(out);
+    }
+    free(out);
+}
+
+// Releases the trace buffers, also when no trace file was written
+VOID
+TraceFree() {
+    free(trace.events);
+    trace.events = NULL;
+    free(tuner.events);
+    tuner.events = NULL;
+    tuner.event_count = 0;
+    trace.enabled = 0;
+}
+
+// Sets up the status file in dir, the export root
+VOID
+StatusInit(LPCWSTR dir) {
+    status.enabled = GetPrivateProfileIntW(L"Status", L"Enabled", 1, options_path);
+    status.interval = GetPrivateProfileIntW(L"Status", L"IntervalMs", 2000, options_path);
+    PathCchCombine(status.path, MAX_PATH, dir, STATUS_JSON);
+    PathCchCombine(status.tmp_path, MAX_PATH, dir, STATUS_TMP);
+}
+
+// Appends a JSON string, escaping quotes, backslashes and control characters
+VOID
+StatusAppendString(char *buf, size_t len, LPCWSTR str) {
+    char utf8[NAME_BUF_LEN * 3];
+    char escaped[NAME_BUF_LEN * 6 + 3];
+    size_t pos = 0;
+
+    if (0 == WideCharToMultiByte(CP_UTF8, 0, str, -1, utf8, sizeof(utf8), NULL, NULL)) {
+        utf8[0] = '\0';
+    }
+    escaped[pos++] = '"';
+    for (char *c = utf8; *c && pos < sizeof(escaped) - 8; c++) {
+        if ('"' == *c || '\\' == *c) {
+            escaped[pos++] = '\\';
+            escaped[pos++] = *c;
+        } else if (0x20 > (BYTE) *c) {
+            StringCchPrintfA(escaped + pos, 7, "\\u%04x", (BYTE) *c);
+            pos += 6;
+        } else {
+            escaped[pos++] = *c;
+        }
+    }
+    escaped[pos++] = '"';
+    escaped[pos] = '\0';
+    StringCchCatA(buf, len, escaped);
+}
+
+// Rewrites Status.json. The file is written under a temporary name and
+// then renamed, so readers never see a partially written status.
+VOID
+StatusWrite(ULONGLONG now) {
+    char buf[4096] = {0};
+    char line[1024];
+    UINT64 inaccessible = 0, empty = 0, mismatch = 0, known = 0, skipped = 0, too_small = 0;
+    UINT64 truncated = 0, corrupt = 0, partial = 0;
+    UINT64 images = 0, movies = 0;
+
+    for (struct XtVolume *vol = first_volume; vol; vol = vol->next) {
+        struct XtReport *reports[] = {vol->report_existing, vol->report_deleted};
+        for (int i = 0; i < 2; i++) {
+            if (NULL == reports[i]) {
+                continue;
+            }
+            images += reports[i]->image_count - reports[i]->image_base;
+            movies += reports[i]->movie_count - reports[i]->movie_base;
+            inaccessible += reports[i]->inaccessible_count;
+            empty += reports[i]->empty_count;
+            mismatch += reports[i]->size_mismatch_count;
+            known += reports[i]->known_count;
+            skipped += reports[i]->delta_skipped_count;
+            too_small += reports[i]->too_small_count;
+            truncated += reports[i]->truncated_count;
+            corrupt += reports[i]->corrupt_count;
+            partial += reports[i]->partial_count;
+        }
+    }
+
+    double elapsed = (now - status.phase_start) / 1000.0;
+    double sample = (now - status.last_write) / 1000.0;
+    double mb = 1024.0 * 1024.0;
+    double avg_mbs = 0 < elapsed ? status.bytes_done / mb / elapsed : 0;
+    double avg_fps = 0 < elapsed ? status.files_done / elapsed : 0;
+    double cur_mbs = 0 < sample ? (status.bytes_done - status.last_bytes) / mb / sample : 0;
+    double cur_fps = 0 < sample ? (status.files_done - status.last_files) / sample : 0;
+    // Estimate by size, like the progress bar
+    INT64 eta = -1;
+    if (0 < status.bytes_done && 0 < elapsed) {
+        eta = (INT64) ((status.bytes_total - status.bytes_done) / (status.bytes_done / elapsed));
+    }
+
+    PROCESS_MEMORY_COUNTERS mem = {0};
+    mem.cb = sizeof(mem);
+    GetProcessMemoryInfo(GetCurrentProcess(), &mem, sizeof(mem));
+
+    StringCchCopyA(buf, 4096, "{\n  \"evidence\": ");
+    StatusAppendString(buf, 4096, current_volume ? current_volume->name_ex : L"");
+    StringCchPrintfA(line, 1024,
+                     ",\n  \"phase\": \"%s\",\n"
+                     "  \"files_done\": %lld,\n  \"files_total\": %lld,\n"
+                     "  \"bytes_done\": %lld,\n  \"bytes_total\": %lld,\n"
+                     "  \"mb_per_sec\": %.2f,\n  \"avg_mb_per_sec\": %.2f,\n"
+                     "  \"files_per_sec\": %.2f,\n  \"avg_files_per_sec\": %.2f,\n"
+                     "  \"eta_sec\": %lld,\n  \"elapsed_sec\": %.1f,\n",
+                     status.phase, status.files_done, status.files_total,
+                     status.bytes_done, status.bytes_total,
+                     cur_mbs, avg_mbs, cur_fps, avg_fps, eta, elapsed);
+    StringCchCatA(buf, 4096, line);
+    StringCchPrintfA(line, 1024,
+                     "  \"exported_images\": %llu,\n  \"exported_movies\": %llu,\n"
+                     "  \"inaccessible\": %llu,\n  \"empty\": %llu,\n"
+                     "  \"size_mismatch\": %llu,\n  \"known_benign\": %llu,\n"
+                     "  \"delta_skipped\": %llu,\n  \"too_small\": %llu,\n"
+                     "  \"truncated\": %llu,\n  \"corrupt\": %llu,\n"
+                     "  \"partial\": %llu,\n"
+                     "  \"memory_bytes\": %llu,\n  \"peak_memory_bytes\": %llu,\n",
+                     images, movies, inaccessible, empty, mismatch, known, skipped, too_small,
+                     truncated, corrupt, partial,
+                     (UINT64) mem.PagefileUsage, (UINT64) mem.PeakPagefileUsage);
+    StringCchCatA(buf, 4096, line);
+    // Current settings of the adaptive export, see XtTuner
+    StringCchPrintfA(line, 1024,
+                     "  \"adaptive_chunk_mb\": %.1f,\n  \"adaptive_read_ahead\": %u,\n"
+                     "  \"adaptive_action\": \"%s\",\n",
+                     tuner.enabled ? tuner.chunk / mb : 0, tuner.enabled ? tuner.depth - 1 : 0,
+                     !tuner.enabled ? "off" : tuner.action ? tuner.action : "start");
+    StringCchCatA(buf, 4096, line);
+    // Current limits, 0 = unlimited
+    StringCchPrintfA(line, 1024,
+                     "  \"qos_read_mb_per_sec\": %.0f,\n  \"qos_write_mb_per_sec\": %.0f,\n"
+                     "  \"qos_files_per_sec\": %.0f,\n  \"qos_low_priority\": %s,\n"
+                     "  \"throttled_sec\": %.1f\n}\n",
+                     qos.read.rate / mb, qos.write.rate / mb, qos.files.rate,
+                     qos.low_priority ? "true" : "false",
+                     qos.frequency ? (double) qos.throttled / qos.frequency : 0);
+    StringCchCatA(buf, 4096, line);
+
+    HANDLE file = CreateFileW(status.tmp_path, GENERIC_WRITE, 0, NULL,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == file) {
+        return;
+    }
+    BOOL written = WriteFile(file, buf, (DWORD) strlen(buf), NULL, NULL);
+    CloseHandle(file);
+    if (written) {
+        MoveFileExW(status.tmp_path, status.path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    }
+
+    status.last_write = now;
+    status.last_files = status.files_done;
+    status.last_bytes = status.bytes_done;
+}
+
+// Starts a new phase with its own totals and writes the status right away
+VOID
+StatusPhase(const char *phase, INT64 files_total, INT64 bytes_total) {
+    ULONGLONG now = GetTickCount64();
+    status.phase = phase;
+    status.files_done = 0;
+    status.files_total = files_total;
+    status.bytes_done = 0;
+    status.bytes_total = bytes_total;
+    status.phase_start = now;
+    status.last_write = now;
+    status.last_progress = now;
+    status.last_files = 0;
+    status.last_bytes = 0;
+    if (status.enabled) {
+        StatusWrite(now);
+    }
+}
+
+// Called once per file. Updates the progress bar at most every
+// PROGRESS_INTERVAL and the status file at most every IntervalMs.
+VOID
+StatusProgress(INT64 files_done, INT64 bytes_done) {
+    ULONGLONG now = GetTickCount64();
+    status.files_done = files_done;
+    status.bytes_done = bytes_done;
+    if (now - status.last_progress >= PROGRESS_INTERVAL || files_done == status.files_total) {
+        INT64 total = status.bytes_total ? status.bytes_total : status.files_total;
+        INT64 done = status.bytes_total ? bytes_done : files_done;
+        XWF_SetProgressPercentage(total ? (DWORD) (done * 100 / total) : 100);
+        status.last_progress = now;
+    }
+    if (status.enabled && now - status.last_write >= status.interval) {
+        StatusWrite(now);
+    }
+}
+
+// Marks the export as aborted, keeping the counters of the current phase
+VOID
+StatusAbort() {
+    status.phase = "aborted";
+    if (status.enabled) {
+        StatusWrite(GetTickCount64());
+    }
+}
+
 // Expands provided path on dialog initialization
 BFFCALLBACK
 MyCallback(HWND hwnd, UINT uMsg, LPARAM lParam, LPARAM lpData) {
@@ -294,8 +1704,20 @@ CreateExportDirStructure(LPWSTR dir) {
     PWSTR deleted_subdir = NULL;
     PathAllocCombine(dir, EXPORT_DIR, 0, &new_dir);
     if (!CreateDirectoryW(new_dir, NULL)) {
-        LocalFree(new_dir);
-        return 0;
+        // A delta export continues an existing export folder, but only
+        // if a previous run left its manifest there.
+        DWORD error = GetLastError();
+        PWSTR manifest = NULL;
+        PathAllocCombine(new_dir, MANIFEST, 0, &manifest);
+        BOOL resume = options.delta
+                      && ERROR_ALREADY_EXISTS == error
+                      && INVALID_FILE_ATTRIBUTES != GetFileAttributesW(manifest);
+        LocalFree(manifest);
+        if (!resume) {
+            LocalFree(new_dir);
+            SetLastError(error);
+            return 0;
+        }
     }
 
     PathAllocCombine(new_dir, EXISTING_SUBDIR, 0, &existing_subdir);
@@ -375,7 +1797,9 @@ BrowseForExportDir(LPWSTR dir) {
         StringCchCopyW(dir, MAX_PATH, case_export_dir);
         LocalFree(case_export_dir);
 
-        if (!CreateDirectoryW(dir, NULL) || !CreateExportDirStructure(dir)) {
+        BOOL dir_created = CreateDirectoryW(dir, NULL)
+                           || (options.delta && ERROR_ALREADY_EXISTS == GetLastError());
+        if (!dir_created || !CreateExportDirStructure(dir)) {
             if (ERROR_ALREADY_EXISTS == GetLastError()) {
                 XWF_OutputMessage(L"ERROR: The selected directory already contains a Griffeye"
                                   " export folder. Plese select another directory.", 0);
@@ -427,33 +1851,6 @@ BrowseForExportDir(LPWSTR dir) {
     return 1;
 }
 
-// Returns 1 if the XtVolume was found.
-// Returns 0 if a new XtVolume was created.
-BOOL
-SetCurrentVolume(LPWSTR name) {
-    struct XtVolume *previous = first_volume;
-    struct XtVolume *current = previous;
-
-    while (current) {
-        if (0 == wcscmp(name, current->name)) {
-            current_volume = current;
-            return 1;
-        }
-        previous = current;
-        current = current->next;
-    }
-
-    // We need to create a new (maybe first) volume
-    current_volume = calloc(1, sizeof(struct XtVolume));
-    if (previous) {
-        previous->next = current_volume;
-    } else {
-        first_volume = current_volume;
-    }
-
-    return 0;
-}
-
 HANDLE
 MyCreateFile(LPCWSTR lpFileName) {
     return CreateFileW(lpFileName,
@@ -465,14 +1862,420 @@ MyCreateFile(LPCWSTR lpFileName) {
                        NULL);
 }
 
-// A simpler implementation of PathCchAppendEx without extensive checks.
-// The WinAPI is too smart for our use case and can cut off path parts,
-// e.g. when the file name of an embedded file extracted by X-Ways contains
-// an absolute path including a drive letter.
-VOID
-MyPathAppend(PWSTR pszPath, size_t cchPath, PCWSTR pszMore) {
-    if (NULL == pszPath || NULL == pszMore) {
-        return;
+// FNV-1a hash of an evidence item name, used to identify evidence items
+// across runs in the export manifest
+UINT64
+HashName(LPCWSTR name) {
+    UINT64 hash = 14695981039346656037ULL;
+    while (*name) {
+        hash ^= *name++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Returns 1 if the file belongs to the configured shard
+// Returns 0 if another instance exports it
+// The shard only depends on evidence item name and item ID, so all
+// instances working on the same case agree without coordination.
+BOOL
+ShardOwns(UINT64 name_hash, LONG xwf_id) {
+    // splitmix64 finalizer, consecutive IDs spread evenly across shards
+    UINT64 x = name_hash ^ ((UINT64) xwf_id * 0x9E3779B97F4A7C15ULL);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x % options.shard_count == options.shard_index - 1;
+}
+
+// Doubles the bucket count of the volume table
+VOID
+VolumeTableGrow() {
+    UINT32 buckets = volume_table.buckets ? 2 * (volume_table.mask + 1) : 256;
+    struct XtVolume **grown = calloc(buckets, sizeof(struct XtVolume *));
+    if (NULL == grown) {
+        return;
+    }
+    for (struct XtVolume *vol = first_volume; vol; vol = vol->next) {
+        UINT32 slot = (UINT32) vol->name_hash & (buckets - 1);
+        vol->hash_next = grown[slot];
+        grown[slot] = vol;
+    }
+    free(volume_table.buckets);
+    volume_table.buckets = grown;
+    volume_table.mask = buckets - 1;
+}
+
+// Returns 1 if the XtVolume was found.
+// Returns 0 if a new XtVolume was created.
+BOOL
+SetCurrentVolume(LPWSTR name) {
+    UINT64 hash = HashName(name);
+    if (volume_table.buckets) {
+        struct XtVolume *vol = volume_table.buckets[(UINT32) hash & volume_table.mask];
+        for (; vol; vol = vol->hash_next) {
+            if (vol->name_hash == hash && 0 == wcscmp(name, vol->name)) {
+                current_volume = vol;
+                return 1;
+            }
+        }
+    }
+
+    // We need to create a new (maybe first) volume
+    current_volume = calloc(1, sizeof(struct XtVolume));
+    StringCchCopyW(current_volume->name, NAME_BUF_LEN, name);
+    current_volume->name_hash = hash;
+    if (last_volume) {
+        last_volume->next = current_volume;
+    } else {
+        first_volume = current_volume;
+    }
+    last_volume = current_volume;
+
+    if (NULL == volume_table.buckets || volume_table.count >= volume_table.mask + 1) {
+        // Rehashes all volumes, including the new one
+        VolumeTableGrow();
+    } else {
+        UINT32 slot = (UINT32) hash & volume_table.mask;
+        current_volume->hash_next = volume_table.buckets[slot];
+        volume_table.buckets[slot] = current_volume;
+    }
+    volume_table.count++;
+
+    return 0;
+}
+
+UINT64
+DeltaSlot(UINT64 volume_hash, INT64 xwf_id) {
+    UINT64 h = volume_hash ^ ((UINT64) xwf_id * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 29;
+    return h * 0xbf58476d1ce4e5b9ULL;
+}
+
+// Returns the entry of a file that has been exported by a previous run
+// Returns NULL if the file is unknown
+struct XtDeltaEntry *
+DeltaLookup(UINT64 volume_hash, INT64 xwf_id) {
+    if (NULL == delta.table) {
+        return NULL;
+    }
+    UINT64 i = DeltaSlot(volume_hash, xwf_id) & delta.mask;
+    while (delta.table[i].filesize) {
+        if (delta.table[i].xwf_id == xwf_id
+            && delta.table[i].volume_hash == volume_hash) {
+            return &delta.table[i];
+        }
+        i = (i + 1) & delta.mask;
+    }
+    return NULL;
+}
+
+// Returns the slot of an evidence item in a table of export IDs, or the
+// empty slot where it belongs
+struct XtDeltaBase *
+DeltaBaseSlot(struct XtDeltaBase *bases, UINT64 mask, UINT64 volume_hash) {
+    UINT64 i = DeltaSlot(volume_hash, 0) & mask;
+    while (bases[i].used && bases[i].volume_hash != volume_hash) {
+        i = (i + 1) & mask;
+    }
+    return &bases[i];
+}
+
+// Returns the export IDs of an evidence item, adding it if it is new
+// Returns NULL if out of memory
+struct XtDeltaBase *
+DeltaBase(UINT64 volume_hash) {
+    struct XtDeltaBase *base = delta.bases ? DeltaBaseSlot(delta.bases, delta.base_mask, volume_hash) : NULL;
+    if (base && base->used) {
+        return base;
+    }
+    // At most half of the slots are used
+    if (NULL == delta.bases || 2 * (delta.base_count + 1) > delta.base_mask + 1) {
+        UINT64 capacity = delta.bases ? 2 * (delta.base_mask + 1) : 64;
+        struct XtDeltaBase *bases = calloc(capacity, sizeof(struct XtDeltaBase));
+        if (NULL == bases) {
+            return NULL;
+        }
+        for (UINT64 b = 0; delta.bases && b <= delta.base_mask; b++) {
+            if (delta.bases[b].used) {
+                *DeltaBaseSlot(bases, capacity - 1, delta.bases[b].volume_hash) = delta.bases[b];
+            }
+        }
+        free(delta.bases);
+        delta.bases = bases;
+        delta.base_mask = capacity - 1;
+        base = DeltaBaseSlot(delta.bases, delta.base_mask, volume_hash);
+    }
+    base->volume_hash = volume_hash;
+    base->used = 1;
+    delta.base_count++;
+    return base;
+}
+
+VOID
+DeltaInsert(const struct XtManifestRecord *rec) {
+    UINT64 i = DeltaSlot(rec->volume_hash, rec->xwf_id) & delta.mask;
+    while (delta.table[i].filesize) {
+        if (delta.table[i].xwf_id == rec->xwf_id
+            && delta.table[i].volume_hash == rec->volume_hash) {
+            break;
+        }
+        i = (i + 1) & delta.mask;
+    }
+    if (0 == delta.table[i].filesize) {
+        delta.count++;
+    }
+    delta.table[i].volume_hash = rec->volume_hash;
+    delta.table[i].xwf_id = rec->xwf_id;
+    delta.table[i].filesize = rec->filesize;
+    delta.table[i].deleted = rec->deleted ? 1 : 0;
+
+    // Remember the highest export IDs per evidence item
+    struct XtDeltaBase *base = DeltaBase(rec->volume_hash);
+    if (NULL == base) {
+        return;
+    }
+    UINT32 *count = TYPE_PICTURE == rec->type ? base->image_count : base->movie_count;
+    if (count[rec->deleted ? 1 : 0] < rec->export_id) {
+        count[rec->deleted ? 1 : 0] = rec->export_id;
+    }
+}
+
+// Loads the manifest of previous runs into the delta lookup table.
+// Returns 1 if the manifest was loaded or does not exist yet
+// Returns 0 if the manifest could not be read
+BOOL
+DeltaLoadManifest(LPCWSTR path) {
+    HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (INVALID_HANDLE_VALUE == file) {
+        return ERROR_FILE_NOT_FOUND == GetLastError();
+    }
+
+    LARGE_INTEGER size = {0};
+    HANDLE mapping = NULL;
+    const BYTE *view = NULL;
+    if (GetFileSizeEx(file, &size) && sizeof(struct XtManifestHeader) <= size.QuadPart) {
+        mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    }
+    const struct XtManifestHeader *header = (const struct XtManifestHeader *) view;
+    if (NULL == view
+        || MANIFEST_MAGIC != header->magic
+        || MANIFEST_VERSION != header->version
+        || sizeof(struct XtManifestRecord) != header->record_size) {
+        if (view) UnmapViewOfFile(view);
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return 0;
+    }
+
+    // A trailing partial record is left behind by an interrupted run, it is
+    // ignored here and cut off by ManifestOpenFile
+    INT64 record_count = (size.QuadPart - sizeof(struct XtManifestHeader)) / header->record_size;
+    UINT64 capacity = 1024;
+    while (capacity < record_count * 2) {
+        capacity *= 2;
+    }
+    delta.table = calloc(capacity, sizeof(struct XtDeltaEntry));
+    delta.mask = capacity - 1;
+    delta.count = 0;
+
+    const BYTE *rec = view + sizeof(struct XtManifestHeader);
+    for (INT64 r = 0; delta.table && r < record_count; r++) {
+        DeltaInsert((const struct XtManifestRecord *) rec);
+        rec += header->record_size;
+    }
+    BOOL rv = NULL != delta.table;
+
+    UnmapViewOfFile(view);
+    CloseHandle(mapping);
+    CloseHandle(file);
+
+    return rv;
+}
+
+// Sets the export counters of a new report to the highest export IDs
+// of previous runs, so that numbering continues where they stopped.
+VOID
+DeltaInitReport(struct XtReport *report, UINT64 volume_hash, int report_type) {
+    struct XtDeltaBase *base = delta.bases ? DeltaBaseSlot(delta.bases, delta.base_mask, volume_hash) : NULL;
+    if (base && base->used) {
+        report->image_base = base->image_count[report_type];
+        report->movie_base = base->movie_count[report_type];
+    }
+    report->image_count = report->image_base;
+    report->movie_count = report->movie_base;
+}
+
+// Opens a manifest file for appending and writes its header if it is new.
+// A partial record left behind by an interrupted run is cut off, so that
+// appended records stay aligned. record_size is 0 for the string table.
+// Returns the handle if successful
+// Returns NULL if not
+HANDLE
+ManifestOpenFile(LPCWSTR dir, LPCWSTR name, LPCVOID header, DWORD header_size, DWORD record_size) {
+    PWSTR path = NULL;
+    PathAllocCombine(dir, name, 0, &path);
+    HANDLE file = CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                              OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    LocalFree(path);
+    if (INVALID_HANDLE_VALUE == file) {
+        return NULL;
+    }
+    BOOL existed = ERROR_ALREADY_EXISTS == GetLastError();
+    LARGE_INTEGER size = {0};
+    BOOL rv = !existed || GetFileSizeEx(file, &size);
+    if (rv && header_size > size.QuadPart) {
+        // New, or interrupted before the header was complete
+        rv = SetEndOfFile(file) && WriteFile(file, header, header_size, NULL, NULL);
+    } else if (rv) {
+        if (record_size) {
+            size.QuadPart -= (size.QuadPart - header_size) % record_size;
+        }
+        rv = SetFilePointerEx(file, size, NULL, FILE_BEGIN) && SetEndOfFile(file);
+    }
+    if (!rv) {
+        CloseHandle(file);
+        return NULL;
+    }
+    return file;
+}
+
+// Opens the export manifest for appending, loading it first in delta mode.
+// Returns 1 if successful
+// Returns 0 if not
+BOOL
+ManifestOpen(LPCWSTR dir) {
+    PWSTR path = NULL;
+    PathAllocCombine(dir, MANIFEST, 0, &path);
+    if (options.delta && !DeltaLoadManifest(path)) {
+        LocalFree(path);
+        XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension could not r"
+                          "ead the export manifest of the previous run. Abor"
+                          "ting.", 0);
+        return 0;
+    }
+    LocalFree(path);
+
+    struct XtManifestHeader header = {MANIFEST_MAGIC, MANIFEST_VERSION, sizeof(struct XtManifestRecord), 0};
+    UINT32 strings_header[2] = {MANIFEST_STRINGS_MAGIC, MANIFEST_VERSION};
+    manifest_file = ManifestOpenFile(dir, MANIFEST, &header, sizeof(header), sizeof(struct XtManifestRecord));
+    manifest_strings = ManifestOpenFile(dir, MANIFEST_STR, strings_header, sizeof(strings_header), 0);
+    LARGE_INTEGER size = {0};
+    if (NULL == manifest_file
+        || NULL == manifest_strings
+        || !GetFileSizeEx(manifest_strings, &size)) {
+        return 0;
+    }
+    manifest_strings_size = size.QuadPart;
+
+    return 1;
+}
+
+// Appends a string to the string table of the manifest
+// Returns its offset if successful
+// Returns 0 if not
+UINT64
+ManifestAppendString(LPCWSTR str) {
+    DWORD len = (DWORD) (sizeof(WCHAR) * (wcslen(str) + 1));
+    if (!WriteFile(manifest_strings, str, len, NULL, NULL)) {
+        return 0;
+    }
+    UINT64 offset = manifest_strings_size;
+    manifest_strings_size += len;
+    return offset;
+}
+
+// Writes out the buffered records. Only called once the index parts hold
+// all records, so that the manifest never lists files the indexes lack.
+// Returns 1 if successful
+// Returns 0 if not
+BOOL
+ManifestFlush() {
+    BOOL rv = 0 == manifest_count
+              || WriteFile(manifest_file, manifest_buf, manifest_count * sizeof(struct XtManifestRecord), NULL, NULL);
+    manifest_count = 0;
+    return rv;
+}
+
+// Buffers a record until the next checkpoint, see ManifestFlush.
+// video is NULL if the file is no video or has not been probed
+VOID
+ManifestAppend(INT64 xwf_id, struct XtFile *xf, int type, LPCWSTR filepath, BOOL known,
+               struct XtVideo *video) {
+    struct XtManifestRecord rec = {0};
+
+    // Output paths are stored relative to the export root
+    size_t root_len = wcslen(export_dir);
+    if (0 == _wcsnicmp(filepath, export_dir, root_len) && L'\\' == filepath[root_len]) {
+        filepath += root_len + 1;
+    }
+    if (0 == current_volume->manifest_name) {
+        current_volume->manifest_name = ManifestAppendString(current_volume->name);
+    }
+    rec.evidence = current_volume->manifest_name;
+    rec.fullpath = ManifestAppendString(xf->fullpath);
+    rec.output = ManifestAppendString(filepath);
+
+    rec.volume_hash = current_volume->name_hash;
+    rec.xwf_id = xwf_id;
+    rec.filesize = xf->filesize;
+    rec.created = xf->created;
+    rec.accessed = xf->accessed;
+    rec.written = xf->written;
+    rec.export_id = (UINT32) xf->export_id;
+    rec.type = (UINT16) type;
+    rec.deleted = xf->deleted ? 1 : 0;
+    rec.category = (UINT16) xf->category;
+    if (xf->hashed) {
+        rec.flags |= MANIFEST_FLAG_HASHED;
+        memcpy(rec.md5, xf->md5, 16);
+    }
+    if (known) {
+        rec.flags |= MANIFEST_FLAG_KNOWN;
+    }
+    rec.integrity = CHECK_TRUNCATED == xf->integrity ? MANIFEST_INTEGRITY_TRUNCATED
+                  : CHECK_CORRUPT == xf->integrity ? MANIFEST_INTEGRITY_CORRUPT : 0;
+    rec.unreadable = xf->unreadable;
+    if (video) {
+        rec.flags |= MANIFEST_FLAG_VIDEO;
+        rec.duration = video->duration;
+        rec.width = video->width;
+        rec.height = video->height;
+        rec.video_created = video->created;
+        memcpy(rec.codec, video->codec, MANIFEST_CODEC_LEN);
+    }
+
+    if (manifest_count == manifest_capacity) {
+        DWORD capacity = manifest_capacity ? 2 * manifest_capacity : 256;
+        struct XtManifestRecord *grown = realloc(manifest_buf, capacity * sizeof(rec));
+        if (NULL == grown) {
+            // Better ahead of the indexes than lost
+            WriteFile(manifest_file, &rec, sizeof(rec), NULL, NULL);
+            return;
+        }
+        manifest_buf = grown;
+        manifest_capacity = capacity;
+    }
+    manifest_buf[manifest_count++] = rec;
+}
+
+VOID
+DeltaFree() {
+    free(delta.table);
+    free(delta.bases);
+    ZeroMemory(&delta, sizeof(delta));
+}
+
+// A simpler implementation of PathCchAppendEx without extensive checks.
+// The WinAPI is too smart for our use case and can cut off path parts,
+// e.g. when the file name of an embedded file extracted by X-Ways contains
+// an absolute path including a drive letter.
+VOID
+MyPathAppend(PWSTR pszPath, size_t cchPath, PCWSTR pszMore) {
+    if (NULL == pszPath || NULL == pszMore) {
+        return;
     }
 
     size_t l_path = wcslen(pszPath);
@@ -525,302 +2328,4987 @@ XmlSanitizeString(PWSTR str) {
     }
 }
 
-BOOL
-GetXwfFileInfo(LONG nItemID, struct XtFile *file) {
-    // Converts WinAPI FILETIME to unix epoch time
-#define GET_ITEM_TIME(x) (XWF_GetItemInformation (nItemID, (x), NULL) \
-                              / 10000000 - 11644473600LL)
-
-    file->created = GET_ITEM_TIME (XWF_ITEM_INFO_CREATIONTIME);
-    file->accessed = GET_ITEM_TIME (XWF_ITEM_INFO_LASTACCESSTIME);
-    file->written = GET_ITEM_TIME (XWF_ITEM_INFO_MODIFICATIONTIME);
-    if (0 > file->created) file->created = 0;
-    if (0 > file->accessed) file->accessed = 0;
-    if (0 > file->written) file->written = 0;
+#define BE16(p) ((UINT32) (p)[0] << 8 | (p)[1])
+#define BE32(p) ((UINT32) (p)[0] << 24 | (UINT32) (p)[1] << 16 | (UINT32) (p)[2] << 8 | (p)[3])
+#define LE16(p) ((UINT32) (p)[1] << 8 | (p)[0])
+#define LE24(p) ((UINT32) (p)[2] << 16 | (UINT32) (p)[1] << 8 | (p)[0])
+#define LE32(p) ((UINT32) (p)[3] << 24 | (UINT32) (p)[2] << 16 | (UINT32) (p)[1] << 8 | (p)[0])
 
-    file->deleted = XWF_GetItemInformation(nItemID, XWF_ITEM_INFO_DELETION, NULL);
+VOID
+ProbeInitItem(struct XtProbe *p, HANDLE hItem, INT64 size) {
+    p->hItem = hItem;
+    p->size = size;
+    p->offset = 0;
+    p->len = 0;
+    p->data = p->buf;
+    p->reads = PROBE_MAX_READS;
+}
 
-    // Selects correct report depending on file deletion status
-    struct XtReport *report = file->deleted == 0 ? current_volume->report_existing : current_volume->report_deleted;
+VOID
+ProbeInitBuffer(struct XtProbe *p, const BYTE *data, DWORD len, INT64 size) {
+    p->hItem = NULL;
+    p->size = size;
+    p->offset = 0;
+    p->len = len;
+    p->data = data;
+    p->reads = 0;
+}
 
-    file->filesize = XWF_GetItemSize(nItemID);
-    if (1 > file->filesize) {
-        // Should never happen for valid files, ignore
-        report->empty_count++;
-        return 0;
+// Returns a pointer to len bytes at offset of the item
+// Returns NULL if these bytes are not available
+const BYTE *
+ProbeAt(struct XtProbe *p, INT64 offset, DWORD len) {
+    if (0 > offset || offset + len > p->size) {
+        return NULL;
     }
-
-    WCHAR filepath[BIG_BUF_LEN] = {0};
-    WCHAR filename[BIG_BUF_LEN] = {0};
-
-    // Recursively concatenate full file path
-    StringCchCopyW(filepath, BIG_BUF_LEN, XWF_GetItemName(nItemID));
-    LONG parent = XWF_GetItemParent(nItemID);
-    LONG grandparent = parent;
-
-    // Last valid parent item always is called "(Root directory)"
-    // We need to check parent and grandparent to discard this
-    if (-1 != parent) {
-        grandparent = XWF_GetItemParent(parent);
+    if (offset >= p->offset && offset + len <= p->offset + p->len) {
+        return p->data + (offset - p->offset);
+    }
+    if (NULL == p->hItem || 0 == p->reads || PROBE_BUF_LEN < len) {
+        return NULL;
     }
-    while (-1 != grandparent) {
-        StringCchCopyW(filename, BIG_BUF_LEN, XWF_GetItemName(parent));
-        MyPathAppend(filename, BIG_BUF_LEN, filepath);
-        StringCchCopyW(filepath, BIG_BUF_LEN, filename);
+    p->reads--;
+    p->offset = offset;
+    p->len = XWF_Read(p->hItem, offset, p->buf, PROBE_BUF_LEN);
+    p->data = p->buf;
+    if (p->len < len) {
+        return NULL;
+    }
+    return p->buf;
+}
 
-        parent = XWF_GetItemParent(parent);
-        if (-1 == parent) {
-            break;
+BOOL
+JpegDimensions(struct XtProbe *p, UINT32 *width, UINT32 *height) {
+    INT64 pos = 2;
+    const BYTE *b;
+
+    while (NULL != (b = ProbeAt(p, pos, 4)) && 0xff == b[0]) {
+        BYTE marker = b[1];
+        if (0xff == marker) {
+            // Fill byte
+            pos++;
+            continue;
+        }
+        if (0x01 == marker || (0xd0 <= marker && 0xd7 >= marker)) {
+            pos += 2;
+            continue;
+        }
+        // Start of frame, except DHT, JPG and DAC which share the range
+        if (0xc0 <= marker && 0xcf >= marker
+            && 0xc4 != marker && 0xc8 != marker && 0xcc != marker) {
+            const BYTE *sof = ProbeAt(p, pos + 5, 4);
+            if (NULL == sof) {
+                return 0;
+            }
+            *height = BE16(sof);
+            *width = BE16(sof + 2);
+            return 1;
         }
-        grandparent = XWF_GetItemParent(parent);
+        // Start of scan, no frame header so far
+        if (0xda == marker || 0xd9 == marker) {
+            return 0;
+        }
+        pos += 2 + BE16(b + 2);
     }
-    StringCchCopyW(file->fullpath, BIG_BUF_LEN, current_volume->name_ex);
-    MyPathAppend(file->fullpath, BIG_BUF_LEN, filepath);
-
-    XmlSanitizeString(file->fullpath);
-
-    return 1;
+    return 0;
 }
 
+// Finds the next ISO base media box of the given type in [*start, end).
+// On success, *start is the box offset, *box_end the end of the box
+// and *header the size of the box header.
 BOOL
-XmlWriteString(HANDLE file, LPCWSTR str) {
-    return WriteFile(file, str, sizeof(WCHAR) * wcslen(str), NULL, NULL);
+BmffFindBox(struct XtProbe *p, INT64 *start, INT64 end, const char *type,
+            INT64 *box_end, DWORD *header) {
+    INT64 pos = *start;
+
+    while (pos + 8 <= end) {
+        const BYTE *b = ProbeAt(p, pos, 16 <= end - pos ? 16 : 8);
+        if (NULL == b) {
+            return 0;
+        }
+        INT64 size = BE32(b);
+        DWORD header_size = 8;
+        if (1 == size && 16 <= end - pos) {
+            size = (INT64) BE32(b + 8) << 32 | BE32(b + 12);
+            header_size = 16;
+        } else if (0 == size) {
+            size = end - pos;
+        }
+        if (size < header_size || pos + size > end) {
+            return 0;
+        }
+        if (0 == memcmp(b + 4, type, 4)) {
+            *start = pos;
+            *box_end = pos + size;
+            *header = header_size;
+            return 1;
+        }
+        pos += size;
+    }
+    return 0;
 }
 
+// HEIF/AVIF: the largest image spatial extent is the primary image, smaller
+// ones belong to thumbnails or grid tiles
 BOOL
-XmlWriteBomHeader(HANDLE file) {
-    char bom[2] = {0xff, 0xfe};
-    LPCWSTR header = L"<?xml version=\"1.0\" encoding=\"utf-16\"?>\r\n";
+HeifDimensions(struct XtProbe *p, UINT32 *width, UINT32 *height) {
+    INT64 pos = 0;
+    INT64 end = 0;
+    DWORD header = 0;
 
-    return (WriteFile(file, bom, 2, NULL, NULL)
-            && XmlWriteString(file, header));
+    // meta, iprp and ipco are nested, meta is a full box
+    if (!BmffFindBox(p, &pos, p->size, "meta", &end, &header)) {
+        return 0;
+    }
+    pos += header + 4;
+    if (!BmffFindBox(p, &pos, end, "iprp", &end, &header)) {
+        return 0;
+    }
+    pos += header;
+    if (!BmffFindBox(p, &pos, end, "ipco", &end, &header)) {
+        return 0;
+    }
+    pos += header;
+
+    *width = 0;
+    *height = 0;
+    INT64 box_end = 0;
+    while (BmffFindBox(p, &pos, end, "ispe", &box_end, &header)) {
+        const BYTE *b = ProbeAt(p, pos + header + 4, 8);
+        if (b && (UINT64) BE32(b) * BE32(b + 4) > (UINT64) *width * *height) {
+            *width = BE32(b);
+            *height = BE32(b + 4);
+        }
+        pos = box_end;
+    }
+    return 0 != *width;
 }
 
+// Parses the dimensions of JPEG, PNG, GIF, BMP, WebP and HEIF pictures
+// without allocating memory.
+// Returns 1 if the dimensions are known
+// Returns 0 if the format is unknown or the header is damaged
 BOOL
-XmlWriteReport(HANDLE file) {
-    WCHAR ver[18] = {0};
-    WCHAR date[64] = {0};
-    WCHAR time[64] = {0};
-
-    StringCchPrintfW(ver, 18, L"%d.%d",
-                     xwf_version / 100,
-                     xwf_version % 100 / 10);
-    GetDateFormatEx(LOCALE_NAME_USER_DEFAULT,
-                    0, NULL,
-                    L"dd'-'MMM'-'yyyy",
-                    date, 64, NULL);
-    GetTimeFormatEx(LOCALE_NAME_USER_DEFAULT,
-                    TIME_FORCE24HOURFORMAT, NULL,
-                    L"HH'-'mm'-'ss",
-                    time, 64);
+ImageDimensions(struct XtProbe *p, UINT32 *width, UINT32 *height) {
+    const BYTE *b = ProbeAt(p, 0, 32);
+    if (NULL == b) {
+        return 0;
+    }
 
-    return (XmlWriteBomHeader(file)
-            && XmlWriteString(file, L"<CaseReport>\r\n  <CaseNumber><![CDATA[")
-            && XmlWriteString(file, case_name)
-            && XmlWriteString(file, L"]]></CaseNumber>\r\n  <Date><![CDATA[")
-            && XmlWriteString(file, date)
-            && XmlWriteString(file, L"]]></Date>\r\n  <Time><![CDATA[")
-            && XmlWriteString(file, time)
-            && XmlWriteString(file, L"]]></Time>\r\n  <Comment><![CDATA[Created"
-                                    " by Griffeye XML export X-Tension: https:"
-                                    "//github.com/Naufragous/xt-gexpo/ ]]></Co"
-                                    "mment>\r\n  <DLLversion><![CDATA[V1.0]]><"
-                                    "/DLLversion>\r\n  <XwaysVersion><![CDATA[")
-            && XmlWriteString(file, ver)
-            && XmlWriteString(file, L"]]></XwaysVersion>\r\n</CaseReport>"));
+    if (0xff == b[0] && 0xd8 == b[1]) {
+        return JpegDimensions(p, width, height);
+    }
+    if (0 == memcmp(b, "\x89PNG\r\n\x1a\n", 8) && 0 == memcmp(b + 12, "IHDR", 4)) {
+        *width = BE32(b + 16);
+        *height = BE32(b + 20);
+        return 1;
+    }
+    if (0 == memcmp(b, "GIF87a", 6) || 0 == memcmp(b, "GIF89a", 6)) {
+        *width = LE16(b + 6);
+        *height = LE16(b + 8);
+        return 1;
+    }
+    if ('B' == b[0] && 'M' == b[1]) {
+        if (12 == LE32(b + 14)) {
+            // OS/2 BITMAPCOREHEADER
+            *width = LE16(b + 18);
+            *height = LE16(b + 20);
+        } else {
+            // Negative height marks a top-down bitmap
+            INT32 h = (INT32) LE32(b + 22);
+            *width = LE32(b + 18);
+            *height = 0 > h ? -h : h;
+        }
+        return 1;
+    }
+    if (0 == memcmp(b, "RIFF", 4) && 0 == memcmp(b + 8, "WEBP", 4)) {
+        if (0 == memcmp(b + 12, "VP8 ", 4) && 0x9d == b[23] && 0x01 == b[24] && 0x2a == b[25]) {
+            *width = LE16(b + 26) & 0x3fff;
+            *height = LE16(b + 28) & 0x3fff;
+            return 1;
+        }
+        if (0 == memcmp(b + 12, "VP8L", 4) && 0x2f == b[20]) {
+            *width = 1 + (((b[22] & 0x3f) << 8) | b[21]);
+            *height = 1 + (((b[24] & 0x0f) << 10) | (b[23] << 2) | ((b[22] & 0xc0) >> 6));
+            return 1;
+        }
+        if (0 == memcmp(b + 12, "VP8X", 4)) {
+            *width = 1 + LE24(b + 24);
+            *height = 1 + LE24(b + 27);
+            return 1;
+        }
+        return 0;
+    }
+    if (0 == memcmp(b + 4, "ftyp", 4)) {
+        return HeifDimensions(p, width, height);
+    }
+    return 0;
 }
 
+// Finds the TIFF header of the Exif APP1 segment of a JPEG
 BOOL
-XmlWriteIndex(HANDLE file) {
-    LPCWSTR s = L"<ReportIndex version=\"1.0\" source=\"Naufragous\" dll=\"Gr"
-                "iffeye XML export X-Tension\">\r\n";
+ExifFindJpeg(struct XtProbe *p, INT64 *tiff) {
+    INT64 pos = 2;
+    const BYTE *b;
+
+    while (NULL != (b = ProbeAt(p, pos, 4)) && 0xff == b[0]) {
+        BYTE marker = b[1];
+        if (0xff == marker) {
+            pos++;
+            continue;
+        }
+        if (0xda == marker || 0xd9 == marker) {
+            return 0;
+        }
+        if (0xe1 == marker) {
+            const BYTE *id = ProbeAt(p, pos + 4, 6);
+            if (id && 0 == memcmp(id, "Exif\0\0", 6)) {
+                *tiff = pos + 10;
+                return 1;
+            }
+        }
+        pos += 2 + BE16(b + 2);
+    }
+    return 0;
+}
 
-    return (XmlWriteBomHeader(file)
-            && XmlWriteString(file, s));
+// Reads an unsigned big endian value of 0, 2, 4 or 8 bytes
+UINT64
+BmffValue(const BYTE *b, DWORD size) {
+    switch (size) {
+        case 2: return BE16(b);
+        case 4: return BE32(b);
+        case 8: return (UINT64) BE32(b) << 32 | BE32(b + 4);
+    }
+    return 0;
 }
 
-// Appends a complete file entry to specified index file
+// Finds the Exif item of a HEIF file through meta, iinf and iloc. Only
+// items stored at a file offset are supported.
 BOOL
-XmlWriteXtFile(HANDLE file, struct XtFile *xf,
-               LPCWSTR tag1, LPCWSTR tag2, LPCWSTR subdir) {
-    WCHAR id[32] = {0};
-    WCHAR ctime[32] = {0};
-    WCHAR atime[32] = {0};
-    WCHAR wtime[32] = {0};
-    WCHAR size[32] = {0};
+ExifFindHeif(struct XtProbe *p, INT64 *tiff) {
+    INT64 meta = 0;
+    INT64 meta_end = 0;
+    DWORD header = 0;
+    if (!BmffFindBox(p, &meta, p->size, "meta", &meta_end, &header)) {
+        return 0;
+    }
+    meta += header + 4;
+
+    // Item ID of type Exif, from infe version 2 or 3
+    INT64 pos = meta;
+    INT64 end = 0;
+    const BYTE *b;
+    if (!BmffFindBox(p, &pos, meta_end, "iinf", &end, &header)
+        || NULL == (b = ProbeAt(p, pos + header, 1))) {
+        return 0;
+    }
+    pos += header + (b[0] ? 8 : 6);
+    UINT32 exif_id = 0;
+    INT64 infe_end = 0;
+    while (0 == exif_id && BmffFindBox(p, &pos, end, "infe", &infe_end, &header)) {
+        b = ProbeAt(p, pos + header, 14);
+        if (b && 2 == b[0] && 0 == memcmp(b + 8, "Exif", 4)) {
+            exif_id = BE16(b + 4);
+        } else if (b && 3 == b[0] && 0 == memcmp(b + 10, "Exif", 4)) {
+            exif_id = BE32(b + 4);
+        }
+        pos = infe_end;
+    }
+    if (0 == exif_id) {
+        return 0;
+    }
 
-    StringCchPrintfW(id, 32, L"%lld", xf->export_id);
-    StringCchPrintfW(ctime, 32, L"%lld", xf->created);
-    StringCchPrintfW(atime, 32, L"%lld", xf->accessed);
-    StringCchPrintfW(wtime, 32, L"%lld", xf->written);
-    StringCchPrintfW(size, 32, L"%lld", xf->filesize);
+    pos = meta;
+    if (!BmffFindBox(p, &pos, meta_end, "iloc", &end, &header)
+        || NULL == (b = ProbeAt(p, pos + header, 8))) {
+        return 0;
+    }
+    int version = b[0];
+    DWORD offset_size = b[4] >> 4;
+    DWORD length_size = b[4] & 15;
+    DWORD base_size = b[5] >> 4;
+    DWORD index_size = version ? b[5] & 15 : 0;
+    DWORD id_size = 2 > version ? 2 : 4;
+    UINT32 count = (UINT32) BmffValue(b + 6, id_size);
+    pos += header + 6 + id_size;
+    for (UINT32 i = 0; i < count && pos < end; i++) {
+        b = ProbeAt(p, pos, id_size);
+        if (NULL == b) {
+            return 0;
+        }
+        UINT64 id = BmffValue(b, id_size);
+        pos += id_size;
+        UINT32 method = 0;
+        if (version) {
+            b = ProbeAt(p, pos, 2);
+            method = b ? BE16(b) & 15 : 1;
+            pos += 2;
+        }
+        b = ProbeAt(p, pos + 2, base_size + 2);
+        if (NULL == b) {
+            return 0;
+        }
+        UINT64 base = BmffValue(b, base_size);
+        UINT32 extents = BE16(b + base_size);
+        pos += 2 + base_size + 2;
+        DWORD extent_size = index_size + offset_size + length_size;
+        if (id == exif_id) {
+            b = ProbeAt(p, pos + index_size, offset_size);
+            if (0 != method || 0 == extents || NULL == b) {
+                return 0;
+            }
+            // The item starts with the offset of the TIFF header
+            INT64 item = (INT64) (base + BmffValue(b, offset_size));
+            const BYTE *skip = ProbeAt(p, item, 4);
+            if (0 > item || NULL == skip) {
+                return 0;
+            }
+            *tiff = item + 4 + BE32(skip);
+            return 1;
+        }
+        pos += (INT64) extents * extent_size;
+    }
+    return 0;
+}
+
+// Reads an unsigned value of 2 or 4 bytes, 0 if out of bounds
+UINT32
+TiffValue(struct XtTiff *t, INT64 offset, DWORD size) {
+    const BYTE *b = ProbeAt(t->p, t->base + offset, size);
+    if (NULL == b) {
+        return 0;
+    }
+    if (2 == size) {
+        return t->le ? LE16(b) : BE16(b);
+    }
+    return t->le ? LE32(b) : BE32(b);
+}
+
+// Finds tag in the IFD at ifd. *value is the offset of its value, which
+// is stored in the entry itself if it fits into 4 bytes.
+// Returns 1 if the tag has been found
+// Returns 0 if not
+BOOL
+TiffEntry(struct XtTiff *t, UINT32 ifd, UINT16 tag, UINT32 *type, UINT32 *count, UINT32 *value) {
+    static const DWORD type_size[] = {0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8};
+    UINT32 entries = 0 == ifd ? 0 : TiffValue(t, ifd, 2);
+    for (UINT32 i = 0; i < entries && i < EXIF_MAX_ENTRIES; i++) {
+        UINT32 entry = ifd + 2 + i * 12;
+        if (tag != TiffValue(t, entry, 2)) {
+            continue;
+        }
+        *type = TiffValue(t, entry + 2, 2);
+        *count = TiffValue(t, entry + 4, 4);
+        if (1 > *type || 12 < *type) {
+            return 0;
+        }
+        UINT64 size = (UINT64) type_size[*type] * *count;
+        *value = 4 >= size ? entry + 8 : TiffValue(t, entry + 8, 4);
+        return 1;
+    }
+    return 0;
+}
+
+// Copies an ASCII tag, control characters become spaces
+VOID
+TiffString(struct XtTiff *t, UINT32 ifd, UINT16 tag, PWSTR out, size_t len) {
+    UINT32 type, count, value;
+    out[0] = L'\0';
+    if (!TiffEntry(t, ifd, tag, &type, &count, &value) || 2 != type) {
+        return;
+    }
+    size_t n = count < len ? count : len - 1;
+    const BYTE *b = ProbeAt(t->p, t->base + value, (DWORD) n);
+    if (NULL == b) {
+        return;
+    }
+    size_t i = 0;
+    for (; i < n && b[i]; i++) {
+        out[i] = 0x20 > b[i] || 0x7f == b[i] ? L' ' : b[i];
+    }
+    while (0 < i && L' ' == out[i - 1]) {
+        i--;
+    }
+    out[i] = L'\0';
+}
+
+// Degrees of a GPS coordinate, negative for S and W
+// Returns 0 if the coordinate is missing or invalid
+BOOL
+TiffCoordinate(struct XtTiff *t, UINT32 ifd, UINT16 ref_tag, UINT16 tag, double *degrees) {
+    UINT32 type, count, value;
+    WCHAR ref[2];
+    TiffString(t, ifd, ref_tag, ref, 2);
+    if (!TiffEntry(t, ifd, tag, &type, &count, &value) || 5 != type || 3 > count) {
+        return 0;
+    }
+    double part[3];
+    for (int i = 0; i < 3; i++) {
+        UINT32 den = TiffValue(t, value + i * 8 + 4, 4);
+        if (0 == den) {
+            return 0;
+        }
+        part[i] = (double) TiffValue(t, value + i * 8, 4) / den;
+    }
+    *degrees = part[0] + part[1] / 60 + part[2] / 3600;
+    if (L'S' == ref[0] || L'W' == ref[0]) {
+        *degrees = -*degrees;
+    }
+    return 1;
+}
+
+// Parses camera, capture time, GPS position and the embedded thumbnail of
+// JPEG and HEIF pictures from the first chunk of their data, which is
+// already in memory. Nothing is read from the item.
+VOID
+ExifParse(struct XtExif *exif, const BYTE *data, DWORD len, INT64 size) {
+    exif->valid = 0;
+    exif->gps = 0;
+    exif->thumb_len = 0;
+    if (!options.exif) {
+        return;
+    }
+
+    struct XtProbe p;
+    ProbeInitBuffer(&p, data, len, size);
+    const BYTE *b = ProbeAt(&p, 0, 12);
+    struct XtTiff t = {&p, 0, 0};
+    BOOL found = 0;
+    if (b && 0xff == b[0] && 0xd8 == b[1]) {
+        found = ExifFindJpeg(&p, &t.base);
+    } else if (b && 0 == memcmp(b + 4, "ftyp", 4)) {
+        found = ExifFindHeif(&p, &t.base);
+    }
+    if (!found || NULL == (b = ProbeAt(&p, t.base, 8))) {
+        return;
+    }
+    if (0 == memcmp(b, "II*\0", 4)) {
+        t.le = 1;
+    } else if (0 != memcmp(b, "MM\0*", 4)) {
+        return;
+    }
+
+    UINT32 ifd0 = TiffValue(&t, 4, 4);
+    UINT32 type, count, value;
+    TiffString(&t, ifd0, 0x010f, exif->make, EXIF_STR_LEN);
+    TiffString(&t, ifd0, 0x0110, exif->model, EXIF_STR_LEN);
+
+    // DateTimeOriginal, or the modification time of the picture
+    exif->taken[0] = L'\0';
+    if (TiffEntry(&t, ifd0, 0x8769, &type, &count, &value)) {
+        TiffString(&t, TiffValue(&t, value, 4), 0x9003, exif->taken, 20);
+    }
+    if (L'\0' == exif->taken[0]) {
+        TiffString(&t, ifd0, 0x0132, exif->taken, 20);
+    }
+    if (L':' == exif->taken[4] && L':' == exif->taken[7]) {
+        exif->taken[4] = L'-';
+        exif->taken[7] = L'-';
+    }
+
+    if (TiffEntry(&t, ifd0, 0x8825, &type, &count, &value)) {
+        UINT32 gps = TiffValue(&t, value, 4);
+        exif->gps = TiffCoordinate(&t, gps, 1, 2, &exif->latitude)
+                    && TiffCoordinate(&t, gps, 3, 4, &exif->longitude);
+    }
+
+    // JPEGInterchangeFormat in IFD1, which follows IFD0
+    UINT32 entries = 0 == ifd0 ? 0 : TiffValue(&t, ifd0, 2);
+    UINT32 ifd1 = entries ? TiffValue(&t, ifd0 + 2 + entries * 12, 4) : 0;
+    UINT32 thumb = 0;
+    UINT32 thumb_len = 0;
+    if (options.thumbnails
+        && TiffEntry(&t, ifd1, 0x0201, &type, &count, &value)
+        && 0 != (thumb = TiffValue(&t, value, 4))
+        && TiffEntry(&t, ifd1, 0x0202, &type, &count, &value)
+        && 0 != (thumb_len = TiffValue(&t, value, 4))
+        && EXIF_THUMB_MAX >= thumb_len
+        && NULL != (b = ProbeAt(&p, t.base + thumb, thumb_len))
+        && 0xff == b[0] && 0xd8 == b[1]) {
+        if (exif->thumb_cap < thumb_len) {
+            free(exif->thumb);
+            exif->thumb = malloc(EXIF_THUMB_MAX);
+            exif->thumb_cap = exif->thumb ? EXIF_THUMB_MAX : 0;
+        }
+        if (exif->thumb) {
+            memcpy(exif->thumb, b, thumb_len);
+            exif->thumb_len = thumb_len;
+        }
+    }
+
+    exif->valid = L'\0' != exif->make[0] || L'\0' != exif->model[0]
+                  || L'\0' != exif->taken[0] || exif->gps || exif->thumb_len;
+}
+
+// Copies a codec identifier, keeping only characters that are safe in an
+// XML attribute
+VOID
+VideoCodec(struct XtVideo *v, const BYTE *b, DWORD len) {
+    DWORD n = 0;
+    for (DWORD i = 0; i < len && n + 1 < VIDEO_CODEC_LEN && b[i]; i++) {
+        BOOL safe = ('0' <= b[i] && '9' >= b[i]) || ('A' <= b[i] && 'Z' >= b[i])
+                    || ('a' <= b[i] && 'z' >= b[i]) || strchr("_./ ", b[i]);
+        v->codec[n++] = safe ? b[i] : '_';
+    }
+    while (0 < n && ' ' == v->codec[n - 1]) {
+        n--;
+    }
+    v->codec[n] = '\0';
+}
+
+// Moves pos into the box type in [*pos, *end), and end to the end of it
+BOOL
+BmffEnter(struct XtProbe *p, INT64 *pos, INT64 *end, const char *type) {
+    INT64 box_end = 0;
+    DWORD header = 0;
+    if (!BmffFindBox(p, pos, *end, type, &box_end, &header)) {
+        return 0;
+    }
+    *pos += header;
+    *end = box_end;
+    return 1;
+}
+
+// MP4 and QuickTime: movie header, then the sample description of the
+// first video track. The moov box may be anywhere in the file.
+BOOL
+VideoBmff(struct XtProbe *p, struct XtVideo *v) {
+    INT64 moov = 0;
+    INT64 moov_end = p->size;
+    if (!BmffEnter(p, &moov, &moov_end, "moov")) {
+        return 0;
+    }
+
+    INT64 pos = moov;
+    INT64 end = moov_end;
+    const BYTE *b;
+    if (BmffEnter(p, &pos, &end, "mvhd") && NULL != (b = ProbeAt(p, pos, 32))) {
+        UINT64 created = 1 == b[0] ? (UINT64) BE32(b + 4) << 32 | BE32(b + 8) : BE32(b + 4);
+        UINT32 timescale = 1 == b[0] ? BE32(b + 20) : BE32(b + 12);
+        UINT64 duration = 1 == b[0] ? (UINT64) BE32(b + 24) << 32 | BE32(b + 28) : BE32(b + 16);
+        if (timescale && (1 == b[0] ? MAXUINT64 : MAXUINT32) != duration) {
+            v->duration = (double) duration / timescale;
+        }
+        // Seconds since 1904
+        if (created > 2082844800) {
+            v->created = (INT64) (created - 2082844800);
+        }
+    }
+
+    INT64 trak = moov;
+    INT64 trak_end = 0;
+    DWORD header = 0;
+    while (BmffFindBox(p, &trak, moov_end, "trak", &trak_end, &header)) {
+        INT64 mdia = trak + header;
+        INT64 mdia_end = trak_end;
+        INT64 hdlr = 0;
+        INT64 hdlr_end = 0;
+        if (BmffEnter(p, &mdia, &mdia_end, "mdia")) {
+            hdlr = mdia;
+            hdlr_end = mdia_end;
+        }
+        // Handler type after version, flags and pre_defined
+        if (hdlr && BmffEnter(p, &hdlr, &hdlr_end, "hdlr")
+            && NULL != (b = ProbeAt(p, hdlr + 8, 4)) && 0 == memcmp(b, "vide", 4)) {
+            pos = mdia;
+            end = mdia_end;
+            // First sample entry after version, flags and entry count
+            if (BmffEnter(p, &pos, &end, "minf") && BmffEnter(p, &pos, &end, "stbl")
+                && BmffEnter(p, &pos, &end, "stsd") && NULL != (b = ProbeAt(p, pos + 8, 36))) {
+                VideoCodec(v, b + 4, 4);
+                v->width = BE16(b + 32);
+                v->height = BE16(b + 34);
+            }
+            break;
+        }
+        trak = trak_end;
+    }
+    return 1;
+}
+
+// Finds the chunk id, or the list of type list, in [*pos, end). On success,
+// *pos is the chunk offset and *chunk_end the end of its data.
+BOOL
+RiffFindChunk(struct XtProbe *p, INT64 *pos, INT64 end, const char *id, const char *list,
+              INT64 *chunk_end) {
+    while (*pos + 8 <= end) {
+        const BYTE *b = ProbeAt(p, *pos, 8);
+        if (NULL == b) {
+            return 0;
+        }
+        INT64 size = LE32(b + 4);
+        if (0 == memcmp(b, id, 4)) {
+            const BYTE *type = list ? ProbeAt(p, *pos + 8, 4) : NULL;
+            if (NULL == list || (type && 0 == memcmp(type, list, 4))) {
+                *chunk_end = *pos + 8 + size > end ? end : *pos + 8 + size;
+                return 1;
+            }
+        }
+        // Chunks are padded to an even size
+        *pos += 8 + size + (size & 1);
+    }
+    return 0;
+}
+
+// AVI: main header, then the stream header and format of the first video
+// stream
+BOOL
+VideoAvi(struct XtProbe *p, struct XtVideo *v) {
+    const BYTE *b = ProbeAt(p, 4, 4);
+    INT64 riff_end = b && 8 + (INT64) LE32(b) < p->size ? 8 + LE32(b) : p->size;
+    INT64 hdrl = 12;
+    INT64 hdrl_end = 0;
+    if (!RiffFindChunk(p, &hdrl, riff_end, "LIST", "hdrl", &hdrl_end)) {
+        return 0;
+    }
+
+    INT64 pos = hdrl + 12;
+    INT64 end = 0;
+    if (RiffFindChunk(p, &pos, hdrl_end, "avih", NULL, &end) && NULL != (b = ProbeAt(p, pos + 8, 40))) {
+        v->duration = (double) LE32(b) * LE32(b + 16) / 1000000;
+        v->width = LE32(b + 32);
+        v->height = LE32(b + 36);
+    }
+
+    INT64 strl = hdrl + 12;
+    INT64 strl_end = 0;
+    while (RiffFindChunk(p, &strl, hdrl_end, "LIST", "strl", &strl_end)) {
+        pos = strl + 12;
+        b = RiffFindChunk(p, &pos, strl_end, "strh", NULL, &end) ? ProbeAt(p, pos + 8, 8) : NULL;
+        if (b && 0 == memcmp(b, "vids", 4)) {
+            // The compression of the bitmap header is more reliable than
+            // the stream handler
+            VideoCodec(v, b + 4, 4);
+            pos = strl + 12;
+            if (RiffFindChunk(p, &pos, strl_end, "strf", NULL, &end)
+                && NULL != (b = ProbeAt(p, pos + 8 + 16, 4)) && LE32(b)) {
+                VideoCodec(v, b, 4);
+            }
+            break;
+        }
+        strl = strl_end + (strl_end & 1);
+    }
+    return 1;
+}
+
+// Reads an EBML element ID (with its length marker) or size at pos
+// Returns the length of the number, 0 if it is invalid
+DWORD
+EbmlNumber(struct XtProbe *p, INT64 pos, BOOL id, UINT64 *value) {
+    const BYTE *b = ProbeAt(p, pos, 1);
+    if (NULL == b || 0 == b[0]) {
+        return 0;
+    }
+    DWORD len = 1;
+    while (!(b[0] & 0x80 >> (len - 1))) {
+        len++;
+    }
+    if ((id && 4 < len) || NULL == (b = ProbeAt(p, pos, len))) {
+        return 0;
+    }
+    UINT64 mask = id ? 0xff : 0xff >> len;
+    *value = b[0] & mask;
+    BOOL unknown = *value == mask;
+    for (DWORD i = 1; i < len; i++) {
+        *value = *value << 8 | b[i];
+        unknown = unknown && 0xff == b[i];
+    }
+    // Sizes with all bits set are unknown
+    if (!id && unknown) {
+        *value = MAXUINT64;
+    }
+    return len;
+}
+
+// Reads the element at *pos in [*pos, end) and advances *pos past it
+BOOL
+EbmlNext(struct XtProbe *p, INT64 *pos, INT64 end, UINT32 *id, INT64 *data, INT64 *data_end) {
+    UINT64 value = 0;
+    UINT64 size = 0;
+    DWORD id_len = EbmlNumber(p, *pos, 1, &value);
+    DWORD size_len = id_len ? EbmlNumber(p, *pos + id_len, 0, &size) : 0;
+    if (0 == size_len || *pos >= end) {
+        return 0;
+    }
+    *id = (UINT32) value;
+    *data = *pos + id_len + size_len;
+    *data_end = MAXUINT64 == size || (UINT64) (end - *data) < size ? end : *data + (INT64) size;
+    *pos = *data_end;
+    return 1;
+}
+
+// Unsigned integer or float element of up to 8 bytes
+UINT64
+EbmlUint(struct XtProbe *p, INT64 data, INT64 data_end) {
+    DWORD len = 8 < data_end - data ? 8 : (DWORD) (data_end - data);
+    const BYTE *b = ProbeAt(p, data, len);
+    UINT64 value = 0;
+    for (DWORD i = 0; b && i < len; i++) {
+        value = value << 8 | b[i];
+    }
+    return value;
+}
+
+double
+EbmlFloat(struct XtProbe *p, INT64 data, INT64 data_end) {
+    UINT64 bits = EbmlUint(p, data, data_end);
+    if (4 == data_end - data) {
+        float f;
+        UINT32 bits32 = (UINT32) bits;
+        memcpy(&f, &bits32, 4);
+        return f;
+    }
+    double d;
+    memcpy(&d, &bits, 8);
+    return 8 == data_end - data ? d : 0;
+}
+
+// Matroska and WebM: segment info, then the first video track. Both
+// precede the first cluster.
+BOOL
+VideoMkv(struct XtProbe *p, struct XtVideo *v) {
+    INT64 pos = 0;
+    UINT32 id = 0;
+    INT64 data = 0;
+    INT64 data_end = 0;
+    // EBML header, then the segment
+    if (!EbmlNext(p, &pos, p->size, &id, &data, &data_end)
+        || !EbmlNext(p, &pos, p->size, &id, &data, &data_end) || EBML_SEGMENT != id) {
+        return 0;
+    }
+
+    INT64 segment = data;
+    INT64 segment_end = data_end;
+    UINT64 scale = 1000000;
+    double duration = 0;
+    BOOL info = 0;
+    BOOL tracks = 0;
+    while (!(info && tracks) && EbmlNext(p, &segment, segment_end, &id, &data, &data_end)
+           && EBML_CLUSTER != id) {
+        INT64 child = data;
+        INT64 end = data_end;
+        if (EBML_INFO == id) {
+            info = 1;
+            while (EbmlNext(p, &child, end, &id, &data, &data_end)) {
+                if (EBML_TIMECODE_SCALE == id) {
+                    scale = EbmlUint(p, data, data_end);
+                } else if (EBML_DURATION == id) {
+                    duration = EbmlFloat(p, data, data_end);
+                } else if (EBML_DATE == id) {
+                    // Nanoseconds since 2001
+                    v->created = (INT64) EbmlUint(p, data, data_end) / 1000000000 + 978307200;
+                }
+            }
+        } else if (EBML_TRACKS == id) {
+            tracks = 1;
+            while (EbmlNext(p, &child, end, &id, &data, &data_end) && !v->width) {
+                if (EBML_TRACK_ENTRY != id) {
+                    continue;
+                }
+                INT64 field = data;
+                INT64 entry_end = data_end;
+                BOOL video = 0;
+                while (EbmlNext(p, &field, entry_end, &id, &data, &data_end)) {
+                    if (EBML_TRACK_TYPE == id) {
+                        video = 1 == EbmlUint(p, data, data_end);
+                    } else if (EBML_CODEC_ID == id) {
+                        const BYTE *b = ProbeAt(p, data, (DWORD) (data_end - data < VIDEO_CODEC_LEN
+                                                                  ? data_end - data : VIDEO_CODEC_LEN));
+                        if (b) {
+                            VideoCodec(v, b, (DWORD) (data_end - data));
+                        }
+                    } else if (EBML_VIDEO == id) {
+                        INT64 dim = data;
+                        INT64 video_end = data_end;
+                        while (EbmlNext(p, &dim, video_end, &id, &data, &data_end)) {
+                            if (EBML_PIXEL_WIDTH == id) {
+                                v->width = (UINT32) EbmlUint(p, data, data_end);
+                            } else if (EBML_PIXEL_HEIGHT == id) {
+                                v->height = (UINT32) EbmlUint(p, data, data_end);
+                            }
+                        }
+                    }
+                }
+                if (!video) {
+                    v->codec[0] = '\0';
+                    v->width = 0;
+                    v->height = 0;
+                }
+            }
+        }
+    }
+    v->duration = duration * scale / 1000000000;
+    return info || tracks;
+}
+
+// Duration, resolution, codec and creation time of MP4/MOV, AVI and
+// Matroska/WebM videos. Uses the first chunk of the export and reads the
+// few header regions outside of it, e.g. a moov box at the end.
+VOID
+VideoProbe(struct XtVideo *v, HANDLE hItem, const BYTE *data, DWORD len, INT64 size) {
+    ZeroMemory(v, sizeof(struct XtVideo));
+    if (!options.video) {
+        return;
+    }
+    struct XtProbe p;
+    if (hItem) {
+        ProbeInitItem(&p, hItem, size);
+        p.data = data;
+        p.len = len;
+        p.reads = VIDEO_PROBE_READS;
+    } else {
+        ProbeInitBuffer(&p, data, len, size);
+    }
+
+    const BYTE *b = ProbeAt(&p, 0, 12);
+    if (NULL == b) {
+        return;
+    }
+    if (0 == memcmp(b + 4, "ftyp", 4) || 0 == memcmp(b + 4, "moov", 4)
+        || 0 == memcmp(b + 4, "mdat", 4) || 0 == memcmp(b + 4, "wide", 4)
+        || 0 == memcmp(b + 4, "free", 4) || 0 == memcmp(b + 4, "skip", 4)) {
+        v->valid = VideoBmff(&p, v);
+    } else if (0 == memcmp(b, "RIFF", 4) && 0 == memcmp(b + 8, "AVI ", 4)) {
+        v->valid = VideoAvi(&p, v);
+    } else if (0 == memcmp(b, "\x1a\x45\xdf\xa3", 4)) {
+        v->valid = VideoMkv(&p, v);
+    }
+}
+
+// Parses the first chunk of the current file depending on its type. hItem
+// is NULL if the file has already been read completely.
+VOID
+ExportProbe(struct XtExport *ex, HANDLE hItem, const BYTE *data, DWORD len, INT64 size) {
+    ex->exif.valid = 0;
+    ex->video.valid = 0;
+    if (TYPE_PICTURE == ex->type) {
+        ExifParse(&ex->exif, data, len, size);
+    } else if (TYPE_VIDEO == ex->type) {
+        VideoProbe(&ex->video, hItem, data, len, size);
+    }
+}
+
+// Returns 1 if the picture is known to be smaller than configured
+// Returns 0 if the picture is large enough or its dimensions are unknown
+BOOL
+IsImageTooSmall(HANDLE hVolume, LONG nItemID) {
+    INT64 size = XWF_GetItemSize(nItemID);
+    if (1 > size) {
+        return 0;
+    }
+    HANDLE hItem = XWF_OpenItem(hVolume, nItemID, 1);
+    if (0 == hItem) {
+        return 0;
+    }
+
+    struct XtProbe probe;
+    UINT32 width = 0;
+    UINT32 height = 0;
+    INT64 t_probe = TRACE_BEGIN();
+    ProbeInitItem(&probe, hItem, size);
+    BOOL known = ImageDimensions(&probe, &width, &height);
+    XWF_Close(hItem);
+    TRACE_END(TRACE_PROBE, t_probe, nItemID, 0);
+
+    return known && (width < options.min_width
+                     || height < options.min_height
+                     || (UINT64) width * height < options.min_pixels);
+}
+
+UINT32 crc_table[256];
+
+// PNG chunk CRC, crc starts at 0xffffffff
+UINT32
+Crc32(UINT32 crc, const BYTE *data, DWORD len) {
+    if (0 == crc_table[1]) {
+        for (UINT32 n = 0; n < 256; n++) {
+            UINT32 c = n;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xedb88320 ^ c >> 1 : c >> 1;
+            }
+            crc_table[n] = c;
+        }
+    }
+    for (DWORD i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ crc >> 8;
+    }
+    return crc;
+}
+
+VOID
+CheckBegin(struct XtCheck *c) {
+    ZeroMemory(c, sizeof(struct XtCheck));
+    c->result = options.check ? CHECK_OK : CHECK_NONE;
+    c->state = CS_DETECT;
+    c->need = 12;
+}
+
+VOID
+CheckNeed(struct XtCheck *c, int state, DWORD need) {
+    c->state = state;
+    c->need = need;
+    c->have = 0;
+}
+
+// Type codes of boxes, chunks and lists are printable ASCII
+BOOL
+CheckFourCC(const BYTE *b) {
+    for (int i = 0; i < 4; i++) {
+        if (0x20 > b[i] || 0x7e < b[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Leaves all boxes or lists that end at pos
+VOID
+CheckPop(struct XtCheck *c, INT64 pos) {
+    while (c->depth && pos >= c->ends[c->depth - 1]) {
+        c->depth--;
+    }
+}
+
+// Scans entropy-coded JPEG data for the next marker, stuffed bytes and
+// restart markers belong to the scan
+// Returns the number of bytes consumed
+DWORD
+CheckJpegScan(struct XtCheck *c, const BYTE *data, DWORD len) {
+    DWORD i = 0;
+    while (i < len) {
+        if (!c->ff) {
+            const BYTE *p = memchr(data + i, 0xff, len - i);
+            if (NULL == p) {
+                return len;
+            }
+            i = (DWORD) (p - data) + 1;
+            c->ff = 1;
+            continue;
+        }
+        BYTE b = data[i];
+        if (0xff == b) {
+            i++;
+            continue;
+        }
+        c->ff = 0;
+        if (0x00 == b || (0xd0 <= b && 0xd7 >= b)) {
+            i++;
+            continue;
+        }
+        // The marker byte is collected as header
+        CheckNeed(c, CS_JPEG_MARKER, 2);
+        c->hdr[0] = 0xff;
+        c->have = 1;
+        return i;
+    }
+    return len;
+}
+
+VOID CheckParse(struct XtCheck *c, const BYTE *data, DWORD len);
+
+VOID
+CheckDetect(struct XtCheck *c) {
+    const BYTE *b = c->hdr;
+    if (0xff == b[0] && 0xd8 == b[1] && 0xff == b[2]) {
+        c->format = CHECK_JPEG;
+        CheckNeed(c, CS_JPEG_SOI, 2);
+    } else if (0 == memcmp(b, "\x89PNG\r\n\x1a\n", 8)) {
+        c->format = CHECK_PNG;
+        CheckNeed(c, CS_PNG_SIG, 8);
+    } else if (0 == memcmp(b, "GIF87a", 6) || 0 == memcmp(b, "GIF89a", 6)) {
+        c->format = CHECK_GIF;
+        CheckNeed(c, CS_GIF_HEADER, 13);
+    } else if (0 == memcmp(b + 4, "ftyp", 4) || 0 == memcmp(b + 4, "moov", 4)
+               || 0 == memcmp(b + 4, "mdat", 4) || 0 == memcmp(b + 4, "wide", 4)
+               || 0 == memcmp(b + 4, "free", 4) || 0 == memcmp(b + 4, "skip", 4)) {
+        c->format = CHECK_BMFF;
+        CheckNeed(c, CS_BMFF_BOX, 8);
+    } else if (0 == memcmp(b, "RIFF", 4) && 0 == memcmp(b + 8, "AVI ", 4)) {
+        c->format = CHECK_AVI;
+        CheckNeed(c, CS_AVI_RIFF, 12);
+    } else {
+        c->result = CHECK_NONE;
+        return;
+    }
+    // Parse the detected bytes again
+    BYTE head[12];
+    memcpy(head, b, 12);
+    c->offset -= 12;
+    CheckParse(c, head, 12);
+}
+
+VOID
+CheckJpeg(struct XtCheck *c) {
+    const BYTE *b = c->hdr;
+    switch (c->state) {
+        case CS_JPEG_SOI:
+            CheckNeed(c, CS_JPEG_MARKER, 2);
+            break;
+        case CS_JPEG_MARKER:
+            if (0xff != b[0]) {
+                c->result = CHECK_CORRUPT;
+            } else if (0xff == b[1]) {
+                // Fill byte
+                c->have = 1;
+            } else if (0xd9 == b[1]) {
+                c->done = 1;
+                c->result = c->seen ? CHECK_OK : CHECK_CORRUPT;
+            } else if (0x01 == b[1] || (0xd0 <= b[1] && 0xd7 >= b[1])) {
+                CheckNeed(c, CS_JPEG_MARKER, 2);
+            } else if (0xd8 == b[1] || 0x00 == b[1]) {
+                c->result = CHECK_CORRUPT;
+            } else {
+                c->marker = b[1];
+                CheckNeed(c, CS_JPEG_LENGTH, 2);
+            }
+            break;
+        case CS_JPEG_LENGTH:
+            if (2 > BE16(b)) {
+                c->result = CHECK_CORRUPT;
+                break;
+            }
+            c->skip = BE16(b) - 2;
+            // Start of frame, except DHT, JPG and DAC which share the range
+            if (0xc0 <= c->marker && 0xcf >= c->marker
+                && 0xc4 != c->marker && 0xc8 != c->marker && 0xcc != c->marker) {
+                c->seen = 1;
+            }
+            if (0xda != c->marker) {
+                CheckNeed(c, CS_JPEG_MARKER, 2);
+            } else if (c->seen) {
+                CheckNeed(c, CS_JPEG_SCAN, 0);
+                c->ff = 0;
+            } else {
+                c->result = CHECK_CORRUPT;
+            }
+            break;
+    }
+}
+
+VOID
+CheckPng(struct XtCheck *c) {
+    const BYTE *b = c->hdr;
+    switch (c->state) {
+        case CS_PNG_SIG:
+            CheckNeed(c, CS_PNG_CHUNK, 8);
+            break;
+        case CS_PNG_CHUNK:
+            if (0x7fffffff < BE32(b) || !CheckFourCC(b + 4)
+                || (!c->seen && 0 != memcmp(b + 4, "IHDR", 4))) {
+                c->result = CHECK_CORRUPT;
+                break;
+            }
+            c->seen = 1;
+            c->last = 0 == memcmp(b + 4, "IEND", 4);
+            c->crc = Crc32(0xffffffff, b + 4, 4);
+            c->crc_on = 1;
+            c->skip = BE32(b);
+            CheckNeed(c, CS_PNG_CRC, 4);
+            break;
+        case CS_PNG_CRC:
+            c->crc_on = 0;
+            if ((c->crc ^ 0xffffffff) != BE32(b)) {
+                c->result = CHECK_CORRUPT;
+            } else if (c->last) {
+                c->done = 1;
+            } else {
+                CheckNeed(c, CS_PNG_CHUNK, 8);
+            }
+            break;
+    }
+}
+
+VOID
+CheckGif(struct XtCheck *c) {
+    const BYTE *b = c->hdr;
+    switch (c->state) {
+        case CS_GIF_HEADER:
+            // Global color table
+            if (b[10] & 0x80) {
+                c->skip = 3 << ((b[10] & 7) + 1);
+            }
+            CheckNeed(c, CS_GIF_BLOCK, 1);
+            break;
+        case CS_GIF_BLOCK:
+            if (0x21 == b[0]) {
+                // Extension label, then sub-blocks
+                CheckNeed(c, CS_GIF_BYTE, 1);
+            } else if (0x2c == b[0]) {
+                CheckNeed(c, CS_GIF_IMAGE, 9);
+            } else if (0x3b == b[0]) {
+                c->done = 1;
+                c->result = c->seen ? CHECK_OK : CHECK_CORRUPT;
+            } else {
+                c->result = CHECK_CORRUPT;
+            }
+            break;
+        case CS_GIF_IMAGE:
+            c->seen = 1;
+            // Local color table, then LZW code size and sub-blocks
+            if (b[8] & 0x80) {
+                c->skip = 3 << ((b[8] & 7) + 1);
+            }
+            CheckNeed(c, CS_GIF_BYTE, 1);
+            break;
+        case CS_GIF_BYTE:
+            CheckNeed(c, CS_GIF_SUB, 1);
+            break;
+        case CS_GIF_SUB:
+            c->skip = b[0];
+            CheckNeed(c, 0 == b[0] ? CS_GIF_BLOCK : CS_GIF_SUB, 1);
+            break;
+    }
+}
+
+// Boxes have to fit into their parent, only the top level may exceed the
+// data that has been read
+VOID
+CheckBox(struct XtCheck *c, INT64 start, INT64 size, DWORD header, const BYTE *type) {
+    INT64 end = start + size;
+    if (size < header || !CheckFourCC(type)
+        || (c->depth && end > c->ends[c->depth - 1])) {
+        c->result = CHECK_CORRUPT;
+        return;
+    }
+    if (0 == memcmp(type, "moov", 4) || 0 == memcmp(type, "meta", 4)) {
+        c->seen = 1;
+    }
+    CheckNeed(c, CS_BMFF_BOX, 8);
+    static const char *containers[] = {"moov", "trak", "mdia", "minf", "stbl", "edts",
+                                       "dinf", "mvex", "moof", "traf", "mfra"};
+    for (int i = 0; i < sizeof(containers) / sizeof(containers[0]); i++) {
+        if (0 == memcmp(type, containers[i], 4) && CHECK_DEPTH > c->depth) {
+            c->ends[c->depth++] = end;
+            return;
+        }
+    }
+    c->skip = size - header;
+}
+
+VOID
+CheckBmff(struct XtCheck *c) {
+    const BYTE *b = c->hdr;
+    switch (c->state) {
+        case CS_BMFF_BOX: {
+            INT64 start = c->offset - 8;
+            CheckPop(c, start);
+            INT64 size = BE32(b);
+            if (1 == size) {
+                memcpy(c->hdr + 8, b + 4, 4);
+                CheckNeed(c, CS_BMFF_LARGE, 8);
+                break;
+            }
+            if (0 == size) {
+                // Up to the end of the parent or of the file
+                if (0 == c->depth) {
+                    c->done = 1;
+                    break;
+                }
+                size = c->ends[c->depth - 1] - start;
+            }
+            CheckBox(c, start, size, 8, b + 4);
+            break;
+        }
+        case CS_BMFF_LARGE: {
+            // The type has been kept after the size
+            BYTE type[4];
+            memcpy(type, b + 8, 4);
+            INT64 size = (INT64) BE32(b) << 32 | BE32(b + 4);
+            CheckBox(c, c->offset - 16, 0 > size ? 0 : size, 16, type);
+            break;
+        }
+    }
+}
+
+VOID
+CheckAvi(struct XtCheck *c) {
+    const BYTE *b = c->hdr;
+    switch (c->state) {
+        case CS_AVI_RIFF:
+            c->ends[c->depth++] = 8 + (INT64) LE32(b + 4);
+            CheckNeed(c, CS_AVI_CHUNK, 8);
+            break;
+        case CS_AVI_CHUNK: {
+            INT64 start = c->offset - 8;
+            CheckPop(c, start);
+            // OpenDML extensions and trailing data are not checked
+            if (0 == c->depth) {
+                c->done = 1;
+                break;
+            }
+            INT64 parent = c->ends[c->depth - 1];
+            INT64 size = LE32(b + 4);
+            INT64 end = start + 8 + size;
+            if (!CheckFourCC(b) || end > parent) {
+                c->result = CHECK_CORRUPT;
+                break;
+            }
+            // Chunks are padded to an even size, some writers omit the
+            // padding of the last one
+            if ((size & 1) && end < parent) {
+                end++;
+            }
+            if (0 == memcmp(b, "LIST", 4)) {
+                if (4 > size) {
+                    c->result = CHECK_CORRUPT;
+                    break;
+                }
+                c->list_end = end;
+                CheckNeed(c, CS_AVI_LIST, 4);
+                break;
+            }
+            c->skip = end - c->offset;
+            CheckNeed(c, CS_AVI_CHUNK, 8);
+            break;
+        }
+        case CS_AVI_LIST:
+            // Every frame is a chunk of movi, which is only bounds checked
+            if (0 == memcmp(b, "movi", 4)) {
+                c->seen = 1;
+                c->skip = c->list_end - c->offset;
+            } else if (CHECK_DEPTH > c->depth) {
+                c->ends[c->depth++] = c->list_end;
+            } else {
+                c->skip = c->list_end - c->offset;
+            }
+            CheckNeed(c, CS_AVI_CHUNK, 8);
+            break;
+    }
+}
+
+VOID
+CheckParse(struct XtCheck *c, const BYTE *data, DWORD len) {
+    while (len && CHECK_OK == c->result && !c->done) {
+        DWORD n;
+        if (c->skip) {
+            n = c->skip < len ? (DWORD) c->skip : len;
+            if (c->crc_on) {
+                c->crc = Crc32(c->crc, data, n);
+            }
+            c->skip -= n;
+        } else if (CS_JPEG_SCAN == c->state) {
+            n = CheckJpegScan(c, data, len);
+        } else {
+            n = c->need - c->have < len ? c->need - c->have : len;
+            memcpy(c->hdr + c->have, data, n);
+            c->have += n;
+        }
+        data += n;
+        len -= n;
+        c->offset += n;
+        if (0 == c->skip && CS_JPEG_SCAN != c->state && c->need == c->have) {
+            c->have = 0;
+            switch (c->format) {
+                case CHECK_JPEG: CheckJpeg(c); break;
+                case CHECK_PNG: CheckPng(c); break;
+                case CHECK_GIF: CheckGif(c); break;
+                case CHECK_BMFF: CheckBmff(c); break;
+                case CHECK_AVI: CheckAvi(c); break;
+                default: CheckDetect(c);
+            }
+        }
+    }
+}
+
+// Checks the structure of JPEG, PNG, GIF, MP4/MOV and AVI data as it is
+// exported, chunk by chunk in file order
+VOID
+CheckFeed(struct XtCheck *c, const BYTE *data, DWORD len) {
+    c->bytes += len;
+    CheckParse(c, data, len);
+}
+
+// Stores the result in xf. Formats with an end marker are truncated
+// without it, containers if a box or list exceeds the data.
+VOID
+CheckEnd(struct XtCheck *c, struct XtFile *xf) {
+    xf->short_read = c->bytes < xf->filesize;
+    if (CHECK_OK == c->result && CS_DETECT == c->state) {
+        // Too short to tell the format
+        c->result = CHECK_NONE;
+    }
+    if (CHECK_OK == c->result && !c->done) {
+        BOOL marker = CHECK_JPEG == c->format || CHECK_PNG == c->format || CHECK_GIF == c->format;
+        CheckPop(c, c->offset);
+        if (marker || c->depth || c->skip || c->have) {
+            c->result = CHECK_TRUNCATED;
+        }
+    }
+    if (CHECK_OK == c->result && !c->seen) {
+        c->result = CHECK_CORRUPT;
+    }
+    xf->integrity = (INT16) c->result;
+}
+
+// Converts a WinAPI FILETIME of an item to unix epoch time, 0 if unknown
+INT64
+GetItemTime(LONG nItemID, LONG info_type) {
+    INT64 t = XWF_GetItemInformation(nItemID, info_type, NULL) / 10000000 - 11644473600LL;
+    return 0 > t ? 0 : t;
+}
+
+VOID
+DirCacheFree() {
+    if (dir_cache.buckets) {
+        for (UINT32 i = 0; i <= dir_cache.mask; i++) {
+            struct XtDirEntry *entry = dir_cache.buckets[i];
+            while (entry) {
+                struct XtDirEntry *next = entry->next;
+                free(entry);
+                entry = next;
+            }
+        }
+        free(dir_cache.buckets);
+    }
+    dir_cache.buckets = NULL;
+    dir_cache.mask = 0;
+}
+
+// Not thread-safe, only called by XT_Prepare and XT_Done
+VOID
+DirCacheReset(DWORD item_count) {
+    DirCacheFree();
+    UINT32 buckets = 1024;
+    while (buckets < item_count / 4 && buckets < (1U << 24)) {
+        buckets *= 2;
+    }
+    dir_cache.buckets = calloc(buckets, sizeof(struct XtDirEntry *));
+    dir_cache.mask = dir_cache.buckets ? buckets - 1 : 0;
+}
+
+// Writes the path of a directory relative to the volume root into out.
+// The root directory itself and its parent have an empty path.
+VOID
+DirCachePath(LONG dir_id, PWSTR out, size_t len) {
+    out[0] = L'\0';
+    if (-1 == dir_id) {
+        return;
+    }
+    LONG parent = XWF_GetItemParent(dir_id);
+    // Last valid parent item always is called "(Root directory)"
+    if (-1 == parent) {
+        return;
+    }
+
+    UINT32 slot = ((UINT32) dir_id * 0x9e3779b1) & dir_cache.mask;
+    if (dir_cache.buckets) {
+        AcquireSRWLockShared(&dir_cache.lock);
+        for (struct XtDirEntry *entry = dir_cache.buckets[slot]; entry; entry = entry->next) {
+            if (entry->dir_id == dir_id) {
+                StringCchCopyW(out, len, entry->path);
+                ReleaseSRWLockShared(&dir_cache.lock);
+                return;
+            }
+        }
+        ReleaseSRWLockShared(&dir_cache.lock);
+    }
+
+    DirCachePath(parent, out, len);
+    if (L'\0' == out[0]) {
+        StringCchCopyW(out, len, XWF_GetItemName(dir_id));
+    } else {
+        MyPathAppend(out, len, XWF_GetItemName(dir_id));
+    }
+
+    if (NULL == dir_cache.buckets) {
+        return;
+    }
+    size_t path_len = wcslen(out) + 1;
+    struct XtDirEntry *added = malloc(sizeof(struct XtDirEntry) + path_len * sizeof(WCHAR));
+    if (NULL == added) {
+        return;
+    }
+    added->dir_id = dir_id;
+    memcpy(added->path, out, path_len * sizeof(WCHAR));
+
+    // Another thread may have added the same directory in the meantime
+    AcquireSRWLockExclusive(&dir_cache.lock);
+    struct XtDirEntry *entry = dir_cache.buckets[slot];
+    while (entry && entry->dir_id != dir_id) {
+        entry = entry->next;
+    }
+    if (NULL == entry) {
+        added->next = dir_cache.buckets[slot];
+        dir_cache.buckets[slot] = added;
+        added = NULL;
+    }
+    ReleaseSRWLockExclusive(&dir_cache.lock);
+    free(added);
+}
+
+// CharLowerW converts a single character if the high-order word is zero,
+// independent of the C runtime locale
+WCHAR
+GlobFold(WCHAR c) {
+    return L'/' == c ? L'\\' : (WCHAR) (UINT_PTR) CharLowerW((LPWSTR) (UINT_PTR) c);
+}
+
+// Compiles a case-insensitive glob. '?' and '*' match any character but
+// a backslash, '**' also matches backslashes. Paths are matched in full,
+// starting with a backslash for the volume root.
+// Returns 1 if successful
+// Returns 0 if the pattern has too many tokens
+BOOL
+GlobCompile(LPCWSTR pattern, struct XtGlob *glob) {
+    BYTE tokens[GLOB_MAX_TOKENS];
+    UINT32 count = 0;
+
+    ZeroMemory(glob, sizeof(struct XtGlob));
+    for (LPCWSTR c = pattern; *c; c++) {
+        BYTE token = GLOB_LITERAL;
+        if (L'*' == *c) {
+            token = L'*' == c[1] ? GLOB_GLOBSTAR : GLOB_STAR;
+            while (L'*' == c[1]) {
+                c++;
+            }
+            // Adjacent stars collapse into one, '**' wins
+            if (count && GLOB_STAR <= tokens[count - 1]) {
+                if (GLOB_GLOBSTAR == token) {
+                    tokens[count - 1] = GLOB_GLOBSTAR;
+                }
+                continue;
+            }
+        } else if (L'?' == *c) {
+            token = GLOB_ANY;
+        }
+        if (GLOB_MAX_TOKENS == count) {
+            return 0;
+        }
+        tokens[count] = token;
+        glob->literal[count] = GlobFold(*c);
+        count++;
+    }
+
+    glob->count = count;
+    for (UINT32 k = 0; k < count; k++) {
+        UINT64 next = 1ULL << (k + 1);
+        switch (tokens[k]) {
+            case GLOB_LITERAL:
+                if (128 > glob->literal[k]) {
+                    glob->step[glob->literal[k]] |= next;
+                } else {
+                    glob->literal_other |= next;
+                }
+                break;
+            case GLOB_ANY:
+                for (int c = 0; c < 128; c++) {
+                    if (L'\\' != c) glob->step[c] |= next;
+                }
+                glob->step_other |= next;
+                break;
+            case GLOB_STAR:
+            case GLOB_GLOBSTAR:
+                for (int c = 0; c < 128; c++) {
+                    if (L'\\' != c || GLOB_GLOBSTAR == tokens[k]) glob->self[c] |= next;
+                }
+                glob->self_other |= next;
+                glob->skip |= next;
+                break;
+        }
+    }
+    return 1;
+}
+
+// Returns 1 if the whole path matches the glob
+// Returns 0 if not
+BOOL
+GlobMatch(const struct XtGlob *glob, LPCWSTR path) {
+    UINT64 state = 1;
+    state |= (state << 1) & glob->skip;
+    for (LPCWSTR p = path; *p && state; p++) {
+        WCHAR c = GlobFold(*p);
+        UINT64 step;
+        UINT64 self;
+        if (128 > c) {
+            step = glob->step[c];
+            self = glob->self[c];
+        } else {
+            step = glob->step_other;
+            self = glob->self_other;
+            for (UINT64 bits = glob->literal_other; bits; bits &= bits - 1) {
+                UINT32 k = 0;
+                while (0 == (bits >> (k + 1) & 1)) {
+                    k++;
+                }
+                if (glob->literal[k] == c) {
+                    step |= 1ULL << (k + 1);
+                }
+            }
+        }
+        state = ((state << 1) & step) | (state & self);
+        state |= (state << 1) & glob->skip;
+    }
+    return 0 != (state >> glob->count & 1);
+}
+
+// Compiles a list of globs separated by '|'
+// Returns 1 if successful or the list is empty
+// Returns 0 if a pattern is invalid
+BOOL
+GlobCompileList(LPCWSTR section, LPCWSTR key, struct XtGlob **globs, UINT32 *count) {
+    WCHAR list[BIG_BUF_LEN];
+    GetPrivateProfileStringW(section, key, L"", list, BIG_BUF_LEN, options_path);
+    *count = 0;
+    if (L'\0' == list[0]) {
+        return 1;
+    }
+    *globs = calloc(GLOB_MAX_COUNT, sizeof(struct XtGlob));
+    if (NULL == *globs) {
+        return 0;
+    }
+    PWSTR context = NULL;
+    for (PWSTR pattern = wcstok_s(list, L"|", &context); pattern; pattern = wcstok_s(NULL, L"|", &context)) {
+        if (GLOB_MAX_COUNT == *count || !GlobCompile(pattern, &(*globs)[*count])) {
+            return 0;
+        }
+        (*count)++;
+    }
+    return 1;
+}
+
+// Reads "YYYY-MM-DD" or "YYYY-MM-DD HH:MM[:SS]" (UTC) as unix time
+// Returns 1 if successful or the setting is empty
+// Returns 0 if the setting is invalid
+BOOL
+FilterLoadTime(LPCWSTR key, INT64 *t) {
+    WCHAR value[64];
+    SYSTEMTIME st = {0};
+    FILETIME ft;
+    int year, month, day, hour = 0, minute = 0, second = 0;
+
+    *t = 0;
+    if (0 == GetPrivateProfileStringW(L"Filter", key, L"", value, 64, options_path)) {
+        return 1;
+    }
+    if (3 > swscanf_s(value, L"%d-%d-%d %d:%d:%d", &year, &month, &day, &hour, &minute, &second)) {
+        return 0;
+    }
+    st.wYear = (WORD) year;
+    st.wMonth = (WORD) month;
+    st.wDay = (WORD) day;
+    st.wHour = (WORD) hour;
+    st.wMinute = (WORD) minute;
+    st.wSecond = (WORD) second;
+    if (!SystemTimeToFileTime(&st, &ft)) {
+        return 0;
+    }
+    *t = (((INT64) ft.dwHighDateTime << 32 | ft.dwLowDateTime) / 10000000 - 11644473600LL);
+    filter.enabled = 1;
+    return 1;
+}
+
+// Loads the [Filter] metadata criteria
+// Returns 1 if successful
+// Returns 0 if a setting is invalid
+BOOL
+FilterInit() {
+    WCHAR value[16];
+
+    filter.min_size = GetPrivateProfileIntW(L"Filter", L"MinSizeKB", 0, options_path) * 1024LL;
+    filter.max_size = GetPrivateProfileIntW(L"Filter", L"MaxSizeMB", 0, options_path) * 1024LL * 1024;
+    GetPrivateProfileStringW(L"Filter", L"Status", L"any", value, 16, options_path);
+    filter.status = 0 == lstrcmpiW(value, L"existing") ? FILTER_EXISTING
+                  : 0 == lstrcmpiW(value, L"deleted") ? FILTER_DELETED : FILTER_ANY;
+    filter.enabled = filter.min_size || filter.max_size || FILTER_ANY != filter.status;
+
+    BOOL rv = FilterLoadTime(L"CreatedAfter", &filter.created_after)
+              && FilterLoadTime(L"CreatedBefore", &filter.created_before)
+              && FilterLoadTime(L"ModifiedAfter", &filter.modified_after)
+              && FilterLoadTime(L"ModifiedBefore", &filter.modified_before)
+              && FilterLoadTime(L"AccessedAfter", &filter.accessed_after)
+              && FilterLoadTime(L"AccessedBefore", &filter.accessed_before)
+              && GlobCompileList(L"Filter", L"Include", &filter.include, &filter.include_count)
+              && GlobCompileList(L"Filter", L"Exclude", &filter.exclude, &filter.exclude_count);
+    if (filter.include_count || filter.exclude_count) {
+        filter.enabled = 1;
+    }
+    return rv;
+}
+
+VOID
+FilterFree() {
+    free(filter.include);
+    free(filter.exclude);
+    ZeroMemory(&filter, sizeof(struct XtFilter));
+}
+
+// Returns 1 if t lies within [after, before)
+// Returns 0 if not or if t is unknown while a window is set
+BOOL
+FilterTimeInWindow(INT64 t, INT64 after, INT64 before) {
+    if (0 == after && 0 == before) {
+        return 1;
+    }
+    return 0 != t && (0 == after || t >= after) && (0 == before || t < before);
+}
+
+#define FILTER_TIME_SET(a, b) (filter.a || filter.b)
+
+// Evaluates the metadata criteria, cheapest first
+// Returns FILTER_PASS if the item should be exported
+// Returns the FILTER_* reason otherwise
+int
+FilterItem(LONG nItemID, BOOL deleted) {
+    if ((FILTER_EXISTING == filter.status && deleted)
+        || (FILTER_DELETED == filter.status && !deleted)) {
+        return FILTER_STATUS;
+    }
+
+    if (filter.min_size || filter.max_size) {
+        INT64 size = XWF_GetItemSize(nItemID);
+        if (size < filter.min_size || (filter.max_size && size > filter.max_size)) {
+            return FILTER_SIZE;
+        }
+    }
+
+    if (FILTER_TIME_SET(created_after, created_before)
+        && !FilterTimeInWindow(GetItemTime(nItemID, XWF_ITEM_INFO_CREATIONTIME),
+                               filter.created_after, filter.created_before)) {
+        return FILTER_TIME;
+    }
+    if (FILTER_TIME_SET(modified_after, modified_before)
+        && !FilterTimeInWindow(GetItemTime(nItemID, XWF_ITEM_INFO_MODIFICATIONTIME),
+                               filter.modified_after, filter.modified_before)) {
+        return FILTER_TIME;
+    }
+    if (FILTER_TIME_SET(accessed_after, accessed_before)
+        && !FilterTimeInWindow(GetItemTime(nItemID, XWF_ITEM_INFO_LASTACCESSTIME),
+                               filter.accessed_after, filter.accessed_before)) {
+        return FILTER_TIME;
+    }
+
+    if (filter.include_count || filter.exclude_count) {
+        WCHAR path[BIG_BUF_LEN] = L"\\";
+        DirCachePath(XWF_GetItemParent(nItemID), path + 1, BIG_BUF_LEN - 1);
+        MyPathAppend(path, BIG_BUF_LEN, XWF_GetItemName(nItemID));
+
+        BOOL included = 0 == filter.include_count;
+        for (UINT32 i = 0; i < filter.include_count && !included; i++) {
+            included = GlobMatch(&filter.include[i], path);
+        }
+        for (UINT32 i = 0; i < filter.exclude_count && included; i++) {
+            included = !GlobMatch(&filter.exclude[i], path);
+        }
+        if (!included) {
+            return FILTER_PATH;
+        }
+    }
+
+    return FILTER_PASS;
+}
+
+// Loads the priority classes from a list like "type,size,path,status":
+//   type   pictures before videos
+//   status existing before deleted files
+//   path   files matching PriorityPaths before all others
+//   size   smaller before larger files
+//   offset files in the order of their data on the volume
+// Without an order, coalesced reads imply "offset".
+// Returns 1 if successful or no order is configured
+// Returns 0 if a setting is invalid
+BOOL
+ScheduleInit() {
+    WCHAR order[128];
+    GetPrivateProfileStringW(L"Schedule", L"Order", L"", order, 128, options_path);
+
+    // All keys have to fit into the 64 bits of XtWorkItem.key
+    int bits = 0;
+    PWSTR context = NULL;
+    for (PWSTR key = wcstok_s(order, L", ", &context); key; key = wcstok_s(NULL, L", ", &context)) {
+        int value = 0 == lstrcmpiW(key, L"type") ? SCHEDULE_TYPE
+                  : 0 == lstrcmpiW(key, L"status") ? SCHEDULE_STATUS
+                  : 0 == lstrcmpiW(key, L"path") ? SCHEDULE_PATH
+                  : 0 == lstrcmpiW(key, L"size") ? SCHEDULE_SIZE
+                  : 0 == lstrcmpiW(key, L"offset") ? SCHEDULE_OFFSET : 0;
+        if (0 == value || SCHEDULE_MAX_KEYS == schedule.key_count) {
+            return 0;
+        }
+        for (int k = 0; k < schedule.key_count; k++) {
+            if (schedule.keys[k] == value) {
+                return 0;
+            }
+        }
+        bits += SCHEDULE_SIZE == value || SCHEDULE_OFFSET == value ? SCHEDULE_SIZE_BITS : 1;
+        if (64 < bits) {
+            return 0;
+        }
+        schedule.keys[schedule.key_count++] = value;
+    }
+    if (0 == schedule.key_count && options.coalesce) {
+        schedule.keys[schedule.key_count++] = SCHEDULE_OFFSET;
+    }
+    for (int k = 0; k < schedule.key_count; k++) {
+        schedule.offsets |= SCHEDULE_OFFSET == schedule.keys[k];
+    }
+    return GlobCompileList(L"Schedule", L"PriorityPaths", &schedule.paths, &schedule.path_count);
+}
+
+VOID
+ScheduleFree() {
+    free(schedule.paths);
+    ZeroMemory(&schedule, sizeof(struct XtSchedule));
+}
+
+// Creates a temporary file in TempDir, or in the export directory, that
+// is deleted when its handle is closed
+HANDLE
+SpillCreateFile() {
+    WCHAR path[MAX_PATH];
+    LPCWSTR dir = L'\0' != options.spill_dir[0] ? options.spill_dir : export_dir;
+    if (0 == GetTempFileNameW(dir, SPILL_PREFIX, 0, path)) {
+        return INVALID_HANDLE_VALUE;
+    }
+    HANDLE file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (INVALID_HANDLE_VALUE == file) {
+        DeleteFileW(path);
+    }
+    return file;
+}
+
+// Creates a spill file for up to capacity records. Blocks that are never
+// written take no disk space.
+// Returns 1 if successful
+// Returns 0 if not
+BOOL
+SpillOpen(struct XtSpill *spill, DWORD record_size, INT64 capacity) {
+    ZeroMemory(spill, sizeof(struct XtSpill));
+    InitializeSRWLock(&spill->lock);
+    spill->record_size = record_size;
+    spill->block_records = SPILL_BLOCK / record_size;
+    spill->block = -1;
+    spill->file = SpillCreateFile();
+    if (INVALID_HANDLE_VALUE == spill->file) {
+        spill->file = NULL;
+        return 0;
+    }
+    DWORD bytes;
+    DeviceIoControl(spill->file, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes, NULL);
+    INT64 size = (capacity / spill->block_records + 1) * SPILL_BLOCK;
+    spill->mapping = CreateFileMappingW(spill->file, NULL, PAGE_READWRITE,
+                                        (DWORD) (size >> 32), (DWORD) size, NULL);
+    return NULL != spill->mapping;
+}
+
+VOID
+SpillClose(struct XtSpill *spill) {
+    if (spill->view) {
+        UnmapViewOfFile(spill->view);
+    }
+    if (spill->mapping) {
+        CloseHandle(spill->mapping);
+    }
+    if (spill->file) {
+        CloseHandle(spill->file);
+    }
+    ZeroMemory(spill, sizeof(struct XtSpill));
+}
+
+// Replaces the records of dst by those of src, which is left empty
+VOID
+SpillReplace(struct XtSpill *dst, struct XtSpill *src) {
+    SpillClose(dst);
+    *dst = *src;
+    InitializeSRWLock(&dst->lock);
+    ZeroMemory(src, sizeof(struct XtSpill));
+}
+
+// Maps the block of record i, the lock must be held
+// Returns NULL if the block could not be mapped
+BYTE *
+SpillRecord(struct XtSpill *spill, INT64 i) {
+    INT64 block = i / spill->block_records;
+    if (block != spill->block) {
+        if (spill->view) {
+            UnmapViewOfFile(spill->view);
+        }
+        INT64 offset = block * SPILL_BLOCK;
+        spill->view = MapViewOfFile(spill->mapping, FILE_MAP_WRITE,
+                                    (DWORD) (offset >> 32), (DWORD) offset, SPILL_BLOCK);
+        spill->block = spill->view ? block : -1;
+        if (NULL == spill->view) {
+            return NULL;
+        }
+    }
+    return spill->view + (i % spill->block_records) * spill->record_size;
+}
+
+// Thread-safe, records are copied since the view may change at any time
+VOID
+SpillGet(struct XtSpill *spill, INT64 i, LPVOID record) {
+    AcquireSRWLockExclusive(&spill->lock);
+    BYTE *p = SpillRecord(spill, i);
+    if (p) {
+        memcpy(record, p, spill->record_size);
+    } else {
+        ZeroMemory(record, spill->record_size);
+    }
+    ReleaseSRWLockExclusive(&spill->lock);
+}
+
+VOID
+SpillPut(struct XtSpill *spill, INT64 i, LPCVOID record) {
+    AcquireSRWLockExclusive(&spill->lock);
+    BYTE *p = SpillRecord(spill, i);
+    if (p) {
+        memcpy(p, record, spill->record_size);
+    }
+    ReleaseSRWLockExclusive(&spill->lock);
+}
+
+VOID
+WorklistFree(struct XtWorklist *wl) {
+    free(wl->ids);
+    free(wl->files);
+    free(wl->order);
+    SpillClose(&wl->id_spill);
+    SpillClose(&wl->file_spill);
+    ZeroMemory(wl, sizeof(struct XtWorklist));
+}
+
+// Prepares the worklist for up to item_count enumerated items. Volumes
+// with more than SpillItems items are spilled, or kept in memory if the
+// spill file cannot be created.
+// Returns 1 if successful
+// Returns 0 if out of memory
+BOOL
+WorklistOpen(struct XtWorklist *wl, DWORD item_count) {
+    WorklistFree(wl);
+    if (options.spill_items && item_count > options.spill_items) {
+        wl->spilled = SpillOpen(&wl->id_spill, sizeof(struct XtFileId), item_count);
+        if (wl->spilled) {
+            return 1;
+        }
+        SpillClose(&wl->id_spill);
+    }
+    wl->ids = malloc(sizeof(struct XtFileId) * item_count);
+    return NULL != wl->ids;
+}
+
+// Returns 1 if items can be added
+BOOL
+WorklistReady(struct XtWorklist *wl) {
+    return wl->spilled || NULL != wl->ids;
+}
+
+// Thread-safe, called by XT_ProcessItem
+VOID
+WorklistAddId(struct XtWorklist *wl, INT64 i, INT64 xwf_id, int type) {
+    struct XtFileId id = {xwf_id, type};
+    if (wl->spilled) {
+        SpillPut(&wl->id_spill, i, &id);
+    } else if (wl->ids) {
+        wl->ids[i] = id;
+    }
+}
+
+// Returns the ID of item i, stored in buf if the worklist is spilled
+struct XtFileId *
+WorklistId(struct XtWorklist *wl, INT64 i, struct XtFileId *buf) {
+    if (!wl->spilled) {
+        return &wl->ids[i];
+    }
+    SpillGet(&wl->id_spill, i, buf);
+    return buf;
+}
+
+// Allocates zeroed metadata for count items
+// Returns 1 if successful
+// Returns 0 if not
+BOOL
+WorklistAllocFiles(struct XtWorklist *wl, INT64 count) {
+    if (wl->spilled) {
+        return SpillOpen(&wl->file_spill, FILE_RECORD_LEN, count);
+    }
+    free(wl->files);
+    wl->files = calloc(count, sizeof(struct XtFile));
+    return NULL != wl->files;
+}
+
+// Returns the metadata of item i, stored in buf if the worklist is
+// spilled. Spilled records lack fullpath, see GetXwfFilePath.
+struct XtFile *
+WorklistFile(struct XtWorklist *wl, INT64 i, struct XtFile *buf) {
+    if (!wl->spilled) {
+        return &wl->files[i];
+    }
+    SpillGet(&wl->file_spill, i, buf);
+    buf->fullpath[0] = L'\0';
+    return buf;
+}
+
+// Stores changed metadata of item i, the array is changed in place
+VOID
+WorklistPutFile(struct XtWorklist *wl, INT64 i, struct XtFile *xf) {
+    if (wl->spilled) {
+        SpillPut(&wl->file_spill, i, xf);
+    }
+}
+
+// Returns the item at position n of the export order
+INT64
+WorklistIndex(struct XtWorklist *wl, INT64 n) {
+    return wl->ordered ? wl->order[n].index : n;
+}
+
+// Combines all priority classes of an item into one key, lower is earlier
+UINT64
+ScheduleKey(struct XtFileId *file_id, struct XtFile *xf) {
+    UINT64 key = 0;
+    for (int k = 0; k < schedule.key_count; k++) {
+        switch (schedule.keys[k]) {
+            case SCHEDULE_TYPE:
+                key = key << 1 | (TYPE_PICTURE != file_id->type);
+                break;
+            case SCHEDULE_STATUS:
+                key = key << 1 | (0 != xf->deleted);
+                break;
+            case SCHEDULE_PATH: {
+                // fullpath starts with the volume name, match the rest
+                LPCWSTR path = xf->fullpath + wcslen(current_volume->name_ex);
+                BOOL match = 0;
+                for (UINT32 i = 0; i < schedule.path_count && !match; i++) {
+                    match = GlobMatch(&schedule.paths[i], path);
+                }
+                key = key << 1 | !match;
+                break;
+            }
+            case SCHEDULE_SIZE: {
+                UINT64 size = 0 > xf->filesize ? 0 : xf->filesize;
+                UINT64 max = (1ULL << SCHEDULE_SIZE_BITS) - 1;
+                key = key << SCHEDULE_SIZE_BITS | (size > max ? max : size);
+                break;
+            }
+            case SCHEDULE_OFFSET: {
+                // Unknown offsets last
+                UINT64 max = (1ULL << SCHEDULE_SIZE_BITS) - 1;
+                UINT64 ofs = 0 > xf->data_ofs ? max : xf->data_ofs;
+                key = key << SCHEDULE_SIZE_BITS | (ofs > max ? max : ofs);
+                break;
+            }
+        }
+    }
+    return key;
+}
+
+int
+WorkItemCompare(const void *a, const void *b) {
+    const struct XtWorkItem *wa = a;
+    const struct XtWorkItem *wb = b;
+    if (wa->key != wb->key) {
+        return wa->key < wb->key ? -1 : 1;
+    }
+    return wa->index < wb->index ? -1 : wa->index > wb->index;
+}
+
+// Full path of an item for the <fullpath> tag
+VOID
+GetXwfFilePath(LONG nItemID, struct XtFile *file) {
+    // Directory paths are cached, siblings share a single lookup
+    WCHAR filepath[BIG_BUF_LEN] = {0};
+    DirCachePath(XWF_GetItemParent(nItemID), filepath, BIG_BUF_LEN);
+    StringCchCopyW(file->fullpath, BIG_BUF_LEN, current_volume->name_ex);
+    if (L'\0' != filepath[0]) {
+        MyPathAppend(file->fullpath, BIG_BUF_LEN, filepath);
+    }
+    MyPathAppend(file->fullpath, BIG_BUF_LEN, XWF_GetItemName(nItemID));
+
+    XmlSanitizeString(file->fullpath);
+}
+
+// Work item of position i with its priority key
+VOID
+ScheduleItem(struct XtWorklist *wl, INT64 i, BOOL paths, struct XtWorkItem *item) {
+    struct XtFileId id_buf;
+    struct XtFile file_buf;
+    struct XtFileId *id = WorklistId(wl, i, &id_buf);
+    struct XtFile *xf = WorklistFile(wl, i, &file_buf);
+    if (paths && L'\0' == xf->fullpath[0] && -1 != xf->export_id) {
+        GetXwfFilePath((LONG) id->xwf_id, xf);
+    }
+    item->key = -1 == xf->export_id ? 0 : ScheduleKey(id, xf);
+    item->index = i;
+}
+
+// Sort record of position i of a spilled worklist
+VOID
+ScheduleRecord(struct XtWorklist *wl, INT64 i, BOOL paths, struct XtSortRecord *record) {
+    struct XtFile file_buf;
+    WorklistId(wl, i, &record->id);
+    struct XtFile *xf = WorklistFile(wl, i, &file_buf);
+    if (paths && -1 != xf->export_id) {
+        GetXwfFilePath((LONG) record->id.xwf_id, xf);
+    }
+    record->item.key = -1 == xf->export_id ? 0 : ScheduleKey(&record->id, xf);
+    record->item.index = i;
+    memcpy(record->file, xf, FILE_RECORD_LEN);
+}
+
+// Stores a sorted record at position n of the new spill files
+VOID
+ScheduleEmit(struct XtSpill *ids, struct XtSpill *files, INT64 n, struct XtSortRecord *record) {
+    SpillPut(ids, n, &record->id);
+    SpillPut(files, n, record->file);
+}
+
+// Positional read of count records from a run file
+// Returns the number of records read
+DWORD
+ScheduleReadRun(HANDLE file, INT64 pos, struct XtSortRecord *buf, DWORD count) {
+    OVERLAPPED ov = {0};
+    INT64 offset = pos * sizeof(struct XtSortRecord);
+    ov.Offset = (DWORD) offset;
+    ov.OffsetHigh = (DWORD) (offset >> 32);
+    DWORD read = 0;
+    if (!ReadFile(file, buf, count * sizeof(struct XtSortRecord), &read, &ov)) {
+        return 0;
+    }
+    return read / sizeof(struct XtSortRecord);
+}
+
+// External merge sort of a spilled worklist. The records are sorted along
+// with their keys and written to new spill files in export order, which
+// then replace the old ones. Every spill file is read and written
+// sequentially, instead of fetching the records in a random order through
+// a single mapped block while exporting. Runs of up to SortMemoryMB are
+// sorted in memory and written to a temporary file, then all runs are
+// merged in one pass. There are few runs, so the smallest head is found
+// by a linear scan.
+// Returns 1 if successful
+// Returns 0 if not, the files are then exported in enumeration order
+BOOL
+ScheduleOrderExternal(struct XtWorklist *wl, INT64 fc, BOOL paths) {
+    INT64 run_len = options.sort_memory / sizeof(struct XtSortRecord);
+    if (run_len > fc) {
+        run_len = fc;
+    }
+    INT64 runs = (fc + run_len - 1) / run_len;
+    struct XtSortRecord *buf = malloc(sizeof(struct XtSortRecord) * run_len);
+    struct XtMergeRun *heads = calloc(runs, sizeof(struct XtMergeRun));
+    HANDLE file = 1 < runs ? SpillCreateFile() : NULL;
+    struct XtSpill ids = {0};
+    struct XtSpill files = {0};
+    BOOL rv = buf && heads && INVALID_HANDLE_VALUE != file
+              && SpillOpen(&ids, sizeof(struct XtFileId), fc)
+              && SpillOpen(&files, FILE_RECORD_LEN, fc);
+
+    // Sorted runs, a single run goes straight into the order
+    for (INT64 r = 0; rv && r < runs; r++) {
+        if (XWF_ShouldStop()) {
+            rv = 0;
+            break;
+        }
+        INT64 start = r * run_len;
+        INT64 n = fc - start < run_len ? fc - start : run_len;
+        for (INT64 i = 0; i < n; i++) {
+            ScheduleRecord(wl, start + i, paths, &buf[i]);
+        }
+        // The work item comes first, so records compare like work items
+        qsort(buf, n, sizeof(struct XtSortRecord), WorkItemCompare);
+        if (1 == runs) {
+            for (INT64 i = 0; i < n; i++) {
+                ScheduleEmit(&ids, &files, i, &buf[i]);
+            }
+        } else {
+            rv = WriteFile(file, buf, (DWORD) (n * sizeof(struct XtSortRecord)), NULL, NULL);
+        }
+        heads[r].pos = start;
+        heads[r].end = start + n;
+    }
+
+    // The sort buffer is shared by the input buffers of all runs
+    DWORD slice = (DWORD) (run_len / runs);
+    rv = rv && 0 < slice;
+    for (INT64 r = 0; rv && 1 < runs && r < runs; r++) {
+        heads[r].buf = buf + r * slice;
+    }
+    for (INT64 n = 0; rv && 1 < runs && n < fc; n++) {
+        INT64 best = -1;
+        for (INT64 r = 0; r < runs; r++) {
+            struct XtMergeRun *head = &heads[r];
+            if (head->next == head->count && head->pos < head->end) {
+                DWORD want = head->end - head->pos < slice ? (DWORD) (head->end - head->pos) : slice;
+                head->count = ScheduleReadRun(file, head->pos, head->buf, want);
+                head->next = 0;
+                head->pos += head->count;
+            }
+            if (head->next < head->count
+                && (-1 == best || 0 > WorkItemCompare(&head->buf[head->next],
+                                                      &heads[best].buf[heads[best].next]))) {
+                best = r;
+            }
+        }
+        if (-1 == best) {
+            rv = 0;
+            break;
+        }
+        ScheduleEmit(&ids, &files, n, &heads[best].buf[heads[best].next++]);
+    }
+
+    if (file && INVALID_HANDLE_VALUE != file) {
+        CloseHandle(file);
+    }
+    free(heads);
+    free(buf);
+    if (rv) {
+        SpillReplace(&wl->id_spill, &ids);
+        SpillReplace(&wl->file_spill, &files);
+    }
+    SpillClose(&ids);
+    SpillClose(&files);
+    return rv;
+}
+
+// Sorts the collected files into the export order of the worklist.
+// Keeps enumeration order if no order is configured or if there is not
+// enough memory.
+VOID
+ScheduleOrder(struct XtWorklist *wl, INT64 fc) {
+    if (0 == schedule.key_count) {
+        return;
+    }
+    BOOL paths = 0;
+    for (int k = 0; k < schedule.key_count; k++) {
+        paths |= SCHEDULE_PATH == schedule.keys[k];
+    }
+    if (wl->spilled) {
+        // Positions are the export order afterwards
+        ScheduleOrderExternal(wl, fc, paths);
+        return;
+    }
+    struct XtWorkItem *order = malloc(sizeof(struct XtWorkItem) * fc);
+    if (NULL == order) {
+        return;
+    }
+    for (INT64 i = 0; i < fc; i++) {
+        ScheduleItem(wl, i, paths, &order[i]);
+    }
+    qsort(order, fc, sizeof(struct XtWorkItem), WorkItemCompare);
+    wl->order = order;
+    wl->ordered = 1;
+}
+
+// Deletion status and size only, enough for a dry run
+BOOL
+GetXwfFileSize(LONG nItemID, struct XtFile *file) {
+    file->deleted = XWF_GetItemInformation(nItemID, XWF_ITEM_INFO_DELETION, NULL);
+
+    // Selects correct report depending on file deletion status
+    struct XtReport *report = file->deleted == 0 ? current_volume->report_existing : current_volume->report_deleted;
+
+    file->filesize = XWF_GetItemSize(nItemID);
+    if (1 > file->filesize) {
+        // Should never happen for valid files, ignore
+        report->empty_count++;
+        return 0;
+    }
+    return 1;
+}
+
+BOOL
+GetXwfFileInfo(LONG nItemID, struct XtFile *file) {
+    file->created = GetItemTime(nItemID, XWF_ITEM_INFO_CREATIONTIME);
+    file->accessed = GetItemTime(nItemID, XWF_ITEM_INFO_LASTACCESSTIME);
+    file->written = GetItemTime(nItemID, XWF_ITEM_INFO_MODIFICATIONTIME);
+
+    if (!GetXwfFileSize(nItemID, file)) {
+        return 0;
+    }
+    GetXwfFilePath(nItemID, file);
+    return 1;
+}
+
+// Looks up where the data of an item starts on the volume.
+// Carved items report their start as a negative definition offset, their
+// data is contiguous.
+// Returns -1 if unknown or if the data is not stored on the volume as is
+INT64
+GetItemDataOffset(LONG nItemID, INT64 filesize, DWORD sector_size, BOOL *contiguous) {
+    *contiguous = 0;
+    if (0 == sector_size) {
+        return -1;
+    }
+    INT64 flags = XWF_GetItemInformation(nItemID, XWF_ITEM_INFO_FLAGS, NULL);
+    if (flags & XWF_FLAGS_NOT_ON_VOLUME) {
+        return -1;
+    }
+    // Resident data shares its sector with the FILE record
+    if (flags & XWF_FLAG_NTFS && NTFS_RESIDENT_MAX > filesize) {
+        return -1;
+    }
+    INT64 def_ofs = 0;
+    INT64 start_sector = -1;
+    XWF_GetItemOfs(nItemID, &def_ofs, &start_sector);
+    if (0 > def_ofs) {
+        *contiguous = 1;
+        return -def_ofs;
+    }
+    return 0 < start_sector ? start_sector * sector_size : -1;
+}
+
+BOOL
+XmlWriteString(HANDLE file, LPCWSTR str) {
+    return WriteFile(file, str, sizeof(WCHAR) * wcslen(str), NULL, NULL);
+}
+
+BOOL
+XmlWriteBomHeader(HANDLE file) {
+    char bom[2] = {0xff, 0xfe};
+    LPCWSTR header = L"<?xml version=\"1.0\" encoding=\"utf-16\"?>\r\n";
+
+    return (WriteFile(file, bom, 2, NULL, NULL)
+            && XmlWriteString(file, header));
+}
+
+// Builds the path of an index part: "C4P Index.xml" for the first part,
+// "C4P Index 2.xml" and so on for any further part. If dir is NULL, only
+// the name is returned. The returned path must be released with LocalFree.
+PWSTR
+AllocIndexPath(LPCWSTR dir, LPCWSTR index_name, UINT32 part) {
+    WCHAR name[NAME_BUF_LEN] = {0};
+    PWSTR path = NULL;
+
+    if (1 < part) {
+        StringCchPrintfW(name, NAME_BUF_LEN, L"%ls %u" XML_EXT, index_name, part);
+    } else {
+        StringCchPrintfW(name, NAME_BUF_LEN, L"%ls" XML_EXT, index_name);
+    }
+    PathAllocCombine(dir, name, 0, &path);
+
+    return path;
+}
+
+// Returns the number of the first index part that does not exist yet.
+// This is always 1, unless a delta export adds to a previous run.
+UINT32
+FindFreeIndexPart(LPCWSTR dir, LPCWSTR index_name) {
+    UINT32 part = 1;
+    while (1) {
+        PWSTR path = AllocIndexPath(dir, index_name, part);
+        DWORD attributes = GetFileAttributesW(path);
+        LocalFree(path);
+        if (INVALID_FILE_ATTRIBUTES == attributes) {
+            return part;
+        }
+        part++;
+    }
+}
+
+// Returns the last index part that contains records, 0 if there is none
+UINT32
+LastIndexPart(struct XtIndex *index, UINT32 base, UINT32 count) {
+    return count > base ? index->part : index->first_part - 1;
+}
+
+BOOL
+XmlWriteIndexParts(HANDLE file, LPCWSTR tag, LPCWSTR index_name, UINT32 last_part) {
+    BOOL rv = 1;
+
+    for (UINT32 part = 1; rv && part <= last_part; part++) {
+        PWSTR name = AllocIndexPath(NULL, index_name, part);
+        rv = (NULL != name
+              && XmlWriteString(file, L"    <")
+              && XmlWriteString(file, tag)
+              && XmlWriteString(file, L"><![CDATA[")
+              && XmlWriteString(file, name)
+              && XmlWriteString(file, L"]]></")
+              && XmlWriteString(file, tag)
+              && XmlWriteString(file, L">\r\n"));
+        LocalFree(name);
+    }
+    return rv;
+}
+
+// Writes a case report. Unless complete is set, the report of a running
+// export only lists the records committed so far.
+BOOL
+XmlWriteReport(HANDLE file, struct XtReport *report, BOOL complete) {
+    WCHAR ver[18] = {0};
+    WCHAR date[64] = {0};
+    WCHAR time[64] = {0};
+
+    StringCchPrintfW(ver, 18, L"%d.%d",
+                     xwf_version / 100,
+                     xwf_version % 100 / 10);
+    GetDateFormatEx(LOCALE_NAME_USER_DEFAULT,
+                    0, NULL,
+                    L"dd'-'MMM'-'yyyy",
+                    date, 64, NULL);
+    GetTimeFormatEx(LOCALE_NAME_USER_DEFAULT,
+                    TIME_FORCE24HOURFORMAT, NULL,
+                    L"HH'-'mm'-'ss",
+                    time, 64);
+
+    BOOL rv = (XmlWriteBomHeader(file)
+               && XmlWriteString(file, L"<CaseReport>\r\n  <CaseNumber><![CDATA[")
+               && XmlWriteString(file, case_name)
+               && XmlWriteString(file, L"]]></CaseNumber>\r\n  <Date><![CDATA[")
+               && XmlWriteString(file, date)
+               && XmlWriteString(file, L"]]></Date>\r\n  <Time><![CDATA[")
+               && XmlWriteString(file, time)
+               && XmlWriteString(file, L"]]></Time>\r\n  <Comment><![CDATA[Created"
+                                       " by Griffeye XML export X-Tension: https:"
+                                       "//github.com/Naufragous/xt-gexpo/ ]]></Co"
+                                       "mment>\r\n  <DLLversion><![CDATA[V1.0]]><"
+                                       "/DLLversion>\r\n  <XwaysVersion><![CDATA[")
+               && XmlWriteString(file, ver)
+               && XmlWriteString(file, L"]]></XwaysVersion>\r\n"));
+
+    if (rv && report) {
+        rv = (XmlWriteString(file, L"  <IndexFiles>\r\n")
+              && XmlWriteIndexParts(file, L"ImageIndex", IMG_REPORT,
+                                    LastIndexPart(&report->image_index, report->image_base, report->image_count))
+              && XmlWriteIndexParts(file, L"MovieIndex", VID_REPORT,
+                                    LastIndexPart(&report->movie_index, report->movie_base, report->movie_count))
+              && XmlWriteString(file, L"  </IndexFiles>\r\n"));
+        // Record counter for tools that import while the export is running
+        WCHAR committed[128];
+        StringCchPrintfW(committed, 128, L"  <Committed images=\"%u\" movies=\"%u\" complete=\"%d\"/>\r\n",
+                         report->image_count, report->movie_count, complete ? 1 : 0);
+        rv = rv && XmlWriteString(file, committed);
+    }
+
+    return rv && XmlWriteString(file, L"</CaseReport>");
+}
+
+BOOL
+IndexFlush(struct XtIndex *index) {
+    BOOL rv = WriteFile(index->file, index->buf, index->used, NULL, NULL);
+    index->used = 0;
+    return rv;
+}
+
+BOOL
+IndexWrite(struct XtIndex *index, LPCVOID data, DWORD len) {
+    if (INDEX_BUF_LEN < index->used + len && !IndexFlush(index)) {
+        return 0;
+    }
+    if (INDEX_BUF_LEN < len) {
+        index->bytes += len;
+        return WriteFile(index->file, data, len, NULL, NULL);
+    }
+    memcpy(index->buf + index->used, data, len);
+    index->used += len;
+    index->bytes += len;
+    return 1;
+}
+
+BOOL
+IndexWriteString(struct XtIndex *index, LPCWSTR str) {
+    return IndexWrite(index, str, (DWORD) (sizeof(WCHAR) * wcslen(str)));
+}
+
+VOID
+IndexLruUnlink(struct XtIndex *index) {
+    if (index->lru_prev) {
+        index->lru_prev->lru_next = index->lru_next;
+    } else {
+        index_lru.head = index->lru_next;
+    }
+    if (index->lru_next) {
+        index->lru_next->lru_prev = index->lru_prev;
+    } else {
+        index_lru.tail = index->lru_prev;
+    }
+    index->lru_prev = NULL;
+    index->lru_next = NULL;
+}
+
+VOID
+IndexLruPush(struct XtIndex *index) {
+    index->lru_prev = NULL;
+    index->lru_next = index_lru.head;
+    if (index_lru.head) {
+        index_lru.head->lru_prev = index;
+    } else {
+        index_lru.tail = index;
+    }
+    index_lru.head = index;
+}
+
+// Returns 1 if all records written to the part are on disk and followed
+// by a closing tag. Parts whose seal failed are only sealed again by the
+// next successful IndexSeal.
+BOOL
+IndexSealed(const struct XtIndex *index) {
+    return !index->active || index->sealed;
+}
+
+// Flushes all complete records together with a provisional closing tag,
+// so the part is a valid document until the next record is appended.
+// Only called between records.
+// Returns 1 if successful
+// Returns 0 if not
+BOOL
+IndexSeal(struct XtIndex *index) {
+    if (IndexSealed(index) || NULL == index->file) {
+        return 1;
+    }
+    // Tag and records in a single write, the tag does not count towards
+    // the part size
+    BOOL rv = IndexWriteString(index, INDEX_END) && IndexFlush(index);
+    index->bytes -= sizeof(INDEX_END) - sizeof(WCHAR);
+    index->sealed = rv;
+    return rv;
+}
+
+// Seals the part, flushes the buffer and closes the handle. The part
+// stays active.
+BOOL
+IndexRelease(struct XtIndex *index) {
+    if (NULL == index->file) {
+        return 1;
+    }
+    BOOL rv = IndexSeal(index) && IndexFlush(index);
+    CloseHandle(index->file);
+    free(index->buf);
+    index->file = NULL;
+    index->buf = NULL;
+    IndexLruUnlink(index);
+    index_lru.count--;
+    return rv;
+}
+
+// Makes room for another open index file
+BOOL
+IndexLruReserve() {
+    BOOL rv = 1;
+    while (index_lru.tail && index_lru.count >= options.max_open_indexes) {
+        rv = IndexRelease(index_lru.tail) && rv;
+    }
+    return rv;
+}
+
+// Registers a freshly opened file handle of an index
+// Returns 1 if successful
+// Returns 0 if not
+BOOL
+IndexAttach(struct XtIndex *index, HANDLE file) {
+    if (INVALID_HANDLE_VALUE == file) {
+        return 0;
+    }
+    index->buf = malloc(INDEX_BUF_LEN);
+    if (NULL == index->buf) {
+        CloseHandle(file);
+        return 0;
+    }
+    index->file = file;
+    index->used = 0;
+    IndexLruPush(index);
+    index_lru.count++;
+    return 1;
+}
+
+// Positions the file before the provisional closing tag of a sealed part.
+// The tag stays in the file until the buffer is written out again.
+BOOL
+IndexUnseal(struct XtIndex *index) {
+    if (!index->sealed) {
+        return 1;
+    }
+    LARGE_INTEGER back;
+    back.QuadPart = -(LONGLONG) (sizeof(INDEX_END) - sizeof(WCHAR));
+    index->sealed = 0;
+    return SetFilePointerEx(index->file, back, NULL, FILE_END);
+}
+
+// Makes sure the current part is open and ready for the next record,
+// reopening it if it was closed to stay within MaxOpenFiles. Readers may
+// open the part at any time.
+// Returns 1 if successful
+// Returns 0 if not
+BOOL
+IndexAcquire(struct XtIndex *index) {
+    if (index->file) {
+        if (index_lru.head != index) {
+            IndexLruUnlink(index);
+            IndexLruPush(index);
+        }
+        return IndexUnseal(index);
+    }
+    if (!IndexLruReserve()) {
+        return 0;
+    }
+    PWSTR path = AllocIndexPath(index->dir, index->name, index->part);
+    HANDLE file = CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LocalFree(path);
+    // Appends at the end, or before the closing tag if the part was sealed
+    LARGE_INTEGER zero = {0};
+    return (IndexAttach(index, file)
+            && SetFilePointerEx(index->file, zero, NULL, FILE_END)
+            && IndexUnseal(index));
+}
+
+// Creates the current index part and writes its header
+// Returns 1 if successful
+// Returns 0 if not
+BOOL
+IndexOpenPart(struct XtIndex *index) {
+    char bom[2] = {0xff, 0xfe};
+    if (!IndexLruReserve()) {
+        return 0;
+    }
+    PWSTR path = AllocIndexPath(index->dir, index->name, index->part);
+    HANDLE file = CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                              CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    LocalFree(path);
+    if (!IndexAttach(index, file)) {
+        return 0;
+    }
+    index->active = 1;
+    index->sealed = 0;
+    index->records = 0;
+    index->bytes = 0;
+
+    return (IndexWrite(index, bom, 2)
+            && IndexWriteString(index, L"<?xml version=\"1.0\" encoding=\"utf-16\"?>\r\n")
+            && IndexWriteString(index, L"<ReportIndex version=\"1.0\" source=\"Na"
+                                       "ufragous\" dll=\"Griffeye XML export X-Te"
+                                       "nsion\">\r\n")
+            && IndexSeal(index));
+}
+
+// Completes the current index part and releases its file
+BOOL
+IndexClosePart(struct XtIndex *index) {
+    if (!index->active || !IndexAcquire(index)) {
+        return 0;
+    }
+    index->active = 0;
+    BOOL rv = IndexWriteString(index, INDEX_END);
+    return IndexRelease(index) && rv;
+}
+
+BOOL
+IndexOpen(struct XtIndex *index, LPCWSTR dir, LPCWSTR name) {
+    index->dir = dir;
+    index->name = name;
+    index->part = FindFreeIndexPart(dir, name);
+    index->first_part = index->part;
+    return IndexOpenPart(index);
+}
+
+// Writes out the buffered records before the buffer runs full, sealed
+// so that the part is a valid document between checkpoints as well. Only
+// records larger than half the buffer are still flushed in pieces.
+// Only called between records.
+BOOL
+IndexMakeRoom(struct XtIndex *index) {
+    if (INDEX_BUF_LEN / 2 > index->used) {
+        return 1;
+    }
+    return IndexSeal(index) && IndexUnseal(index);
+}
+
+// Starts a new part before the next record if the current part is full
+BOOL
+IndexRotate(struct XtIndex *index) {
+    if (0 == index->records
+        || ((0 == options.index_max_records || index->records < options.index_max_records)
+            && (0 == options.index_max_bytes || index->bytes < options.index_max_bytes))) {
+        return 1;
+    }
+    IndexClosePart(index);
+    index->part++;
+    return IndexOpenPart(index);
+}
+
+// Appends a complete file entry to specified index file
+// details are additional elements written into the entry as is, if not NULL
+BOOL
+XmlWriteXtFile(struct XtIndex *index, LPCWSTR dir, struct XtFile *xf,
+               LPCWSTR tag1, LPCWSTR tag2, LPCWSTR subdir, LPCWSTR details) {
+    WCHAR id[32] = {0};
+    WCHAR ctime[32] = {0};
+    WCHAR atime[32] = {0};
+    WCHAR wtime[32] = {0};
+    WCHAR size[32] = {0};
+    WCHAR category[8] = {0};
+    WCHAR unreadable[64] = {0};
+
+    StringCchPrintfW(id, 32, L"%lld", xf->export_id);
+    StringCchPrintfW(category, 8, L"%d", xf->category);
+    StringCchPrintfW(ctime, 32, L"%lld", xf->created);
+    StringCchPrintfW(atime, 32, L"%lld", xf->accessed);
+    StringCchPrintfW(wtime, 32, L"%lld", xf->written);
+    StringCchPrintfW(size, 32, L"%lld", xf->filesize);
+    if (xf->unreadable) {
+        StringCchPrintfW(unreadable, 64, L"  <unreadable>%lld</unreadable>\r\n", xf->unreadable);
+    }
+
+    if (!IndexRotate(index) || !IndexAcquire(index) || !IndexMakeRoom(index)) {
+        return 0;
+    }
+    index->records++;
+
+    return (IndexWriteString(index, L"<")
+            && IndexWriteString(index, tag1)
+            && IndexWriteString(index, L">\r\n  <path><![CDATA[")
+            && IndexWriteString(index, subdir)
+            && IndexWriteString(index, L"\\]]></path>\r\n  <")
+            && IndexWriteString(index, tag2)
+            && IndexWriteString(index, L">")
+            && IndexWriteString(index, id)
+            && IndexWriteString(index, L"</")
+            && IndexWriteString(index, tag2)
+            && IndexWriteString(index, L">\r\n  <id>")
+            && IndexWriteString(index, id)
+            && IndexWriteString(index, L"</id>\r\n  <category>")
+            && IndexWriteString(index, category)
+            && IndexWriteString(index, L"</category>\r\n  <fileoffset>0</fileof"
+                                       "fset>\r\n  <fullpath><![CDATA[")
+            && IndexWriteString(index, xf->fullpath)
+            && IndexWriteString(index, L"]]></fullpath>\r\n  <created>")
+            && IndexWriteString(index, ctime)
+            && IndexWriteString(index, L"</created>\r\n  <accessed>")
+            && IndexWriteString(index, atime)
+            && IndexWriteString(index, L"</accessed>\r\n  <written>")
+            && IndexWriteString(index, wtime)
+            && IndexWriteString(index, L"</written>\r\n  <fileSize>")
+            && IndexWriteString(index, size)
+            && IndexWriteString(index, L"</fileSize>\r\n")
+            && (CHECK_TRUNCATED > xf->integrity
+                || IndexWriteString(index, CHECK_TRUNCATED == xf->integrity
+                                           ? L"  <integrity>truncated</integrity>\r\n"
+                                           : L"  <integrity>corrupt</integrity>\r\n"))
+            && (0 == xf->unreadable || IndexWriteString(index, unreadable))
+            && (NULL == details || IndexWriteString(index, details))
+            && IndexWriteString(index, L"</")
+            && IndexWriteString(index, tag1)
+            && IndexWriteString(index, L">\r\n"));
+}
+
+// Creates templates for the three xml report files in dir and also
+// subdirectories for images and videos.
+// Returns 1 if all directories and files were created
+// Returns 0 otherwise
+BOOL
+XmlCreateReportFiles(struct XtReport *report) {
+    LPCWSTR dir = report->export_path;
+    PWSTR img_subdir = NULL;
+    PWSTR vid_subdir = NULL;
+    PWSTR case_report = NULL;
+
+    PathAllocCombine(dir, IMG_SUBDIR, 0, &img_subdir);
+    PathAllocCombine(dir, VID_SUBDIR, 0, &vid_subdir);
+    PathAllocCombine(dir, CASE_REPORT, 0, &case_report);
+
+    CreateDirectoryW(dir, NULL);
+    CreateDirectoryW(img_subdir, NULL);
+    CreateDirectoryW(vid_subdir, NULL);
+
+    report->xml_case_report = MyCreateFile(case_report);
+    if (INVALID_HANDLE_VALUE == report->xml_case_report
+        && options.delta
+        && ERROR_FILE_EXISTS == GetLastError()) {
+        // Keep the case report of the previous run until XmlFinishReport
+        report->xml_case_report = NULL;
+    }
+
+    LocalFree(img_subdir);
+    LocalFree(vid_subdir);
+    LocalFree(case_report);
+
+    if (INVALID_HANDLE_VALUE == report->xml_case_report
+        || !IndexOpen(&report->image_index, dir, IMG_REPORT)
+        || !IndexOpen(&report->movie_index, dir, VID_REPORT)) {
+        return 0;
+    }
+
+    // The template is completed by XmlUpdateReport, no need to keep it open
+    if (report->xml_case_report) {
+        XmlWriteReport(report->xml_case_report, NULL, 0);
+        CloseHandle(report->xml_case_report);
+        report->xml_case_report = NULL;
+    }
+
+    return 1;
+}
+
+// Creates the report files before the first export into the report
+// Returns 1 if successful or the files already exist
+// Returns 0 if not
+BOOL
+ReportOpen(struct XtReport *report) {
+    if (report->opened) {
+        return 1;
+    }
+    report->opened = 1;
+    return XmlCreateReportFiles(report);
+}
+
+BOOL
+XmlAppendImage(struct XtFile *xf, struct XtReport *report) {
+    return XmlWriteXtFile(&report->image_index, report->export_path, xf,
+                          L"Image", L"picture", IMG_SUBDIR, NULL);
+}
+
+// Video details are not part of the C4All schema, importers skip the
+// <video> element like the other unknown ones
+BOOL
+XmlAppendMovie(struct XtFile *xf, struct XtReport *report, struct XtVideo *video) {
+    WCHAR details[256] = {0};
+    if (video) {
+        StringCchPrintfW(details, 256, L"  <video duration=\"%.3f\" width=\"%u\" heig"
+                                       "ht=\"%u\" codec=\"%hs\" created=\"%lld\"/>\r\n",
+                         video->duration, video->width, video->height,
+                         video->codec, video->created);
+    }
+    return XmlWriteXtFile(&report->movie_index, report->export_path, xf,
+                          L"Movie", L"movie", VID_SUBDIR, video ? details : NULL);
+}
+
+// Lists a known benign file that has not been exported
+VOID
+KnownListAppend(struct XtReport *report, struct XtFile *xf) {
+    if (NULL == report->known_list) {
+        PWSTR path = NULL;
+        PathAllocCombine(report->export_path, KNOWN_LIST, 0, &path);
+        report->known_list = CreateFileW(path, FILE_APPEND_DATA, FILE_SHARE_READ, NULL,
+                                         OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        LocalFree(path);
+        if (INVALID_HANDLE_VALUE != report->known_list
+            && ERROR_ALREADY_EXISTS != GetLastError()) {
+            char bom[2] = {0xff, 0xfe};
+            WriteFile(report->known_list, bom, 2, NULL, NULL);
+        }
+    }
+    if (INVALID_HANDLE_VALUE == report->known_list) {
+        return;
+    }
+    WCHAR line[40];
+    for (int i = 0; i < 16; i++) {
+        StringCchPrintfW(line + 2 * i, 3, L"%02x", xf->md5[i]);
+    }
+    StringCchCatW(line, 40, L"\t");
+    XmlWriteString(report->known_list, line);
+    XmlWriteString(report->known_list, xf->fullpath);
+    XmlWriteString(report->known_list, L"\r\n");
+}
+
+// Appends a line with the Exif fields of an exported picture to the Exif
+// list of its report and saves its thumbnail under Previews\<id>.jpg
+VOID
+ExifListAppend(struct XtReport *report, struct XtFile *xf, struct XtExif *exif) {
+    if (NULL == report->exif_list) {
+        PWSTR path = NULL;
+        PathAllocCombine(report->export_path, EXIF_LIST, 0, &path);
+        report->exif_list = CreateFileW(path, FILE_APPEND_DATA, FILE_SHARE_READ, NULL,
+                                        OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        LocalFree(path);
+        if (INVALID_HANDLE_VALUE != report->exif_list
+            && ERROR_ALREADY_EXISTS != GetLastError()) {
+            char bom[2] = {0xff, 0xfe};
+            WriteFile(report->exif_list, bom, 2, NULL, NULL);
+            XmlWriteString(report->exif_list, L"id\tmake\tmodel\ttaken\tlatitude\tlongitude\tthumbnail\r\n");
+        }
+    }
+    if (INVALID_HANDLE_VALUE == report->exif_list) {
+        return;
+    }
+
+    WCHAR thumb[MAX_PATH] = {0};
+    if (exif->thumb_len) {
+        PWSTR dir = NULL;
+        PWSTR path = NULL;
+        WCHAR name[32];
+        StringCchPrintfW(name, 32, L"%lld.jpg", xf->export_id);
+        PathAllocCombine(report->export_path, PREVIEW_SUBDIR, 0, &dir);
+        PathAllocCombine(dir, name, 0, &path);
+        CreateDirectoryW(dir, NULL);
+        HANDLE file = CreateFileW(path, GENERIC_WRITE, 0, NULL,
+                                  CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (INVALID_HANDLE_VALUE != file) {
+            if (WriteFile(file, exif->thumb, exif->thumb_len, NULL, NULL)) {
+                StringCchPrintfW(thumb, MAX_PATH, L"%ls\\%ls", PREVIEW_SUBDIR, name);
+            }
+            CloseHandle(file);
+        }
+        LocalFree(dir);
+        LocalFree(path);
+    }
+
+    WCHAR line[512];
+    StringCchPrintfW(line, 512, L"%lld\t%ls\t%ls\t%ls\t", xf->export_id, exif->make, exif->model, exif->taken);
+    XmlWriteString(report->exif_list, line);
+    if (exif->gps) {
+        StringCchPrintfW(line, 512, L"%.6f\t%.6f\t", exif->latitude, exif->longitude);
+        XmlWriteString(report->exif_list, line);
+    } else {
+        XmlWriteString(report->exif_list, L"\t\t");
+    }
+    XmlWriteString(report->exif_list, thumb);
+    XmlWriteString(report->exif_list, L"\r\n");
+    report->exif_count++;
+}
+
+// Rewrites the case report, now referencing all index parts. The report
+// is written under a temporary name and then renamed, so readers never
+// see a partially written one.
+VOID
+XmlUpdateReport(struct XtReport *report, BOOL complete) {
+    PWSTR case_report = NULL;
+    PWSTR tmp = NULL;
+    PathAllocCombine(report->export_path, CASE_REPORT, 0, &case_report);
+    PathAllocCombine(report->export_path, CASE_REPORT_TMP, 0, &tmp);
+
+    report->xml_case_report = CreateFileW(tmp, GENERIC_WRITE, 0, NULL,
+                                          CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE != report->xml_case_report) {
+        BOOL written = XmlWriteReport(report->xml_case_report, report, complete);
+        CloseHandle(report->xml_case_report);
+        if (written && MoveFileExW(tmp, case_report, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+            // Otherwise the next checkpoint tries again
+            report->committed_images = report->image_count;
+            report->committed_movies = report->movie_count;
+        } else {
+            DeleteFileW(tmp);
+        }
+    }
+    report->xml_case_report = NULL;
+    LocalFree(case_report);
+    LocalFree(tmp);
+}
+
+// Seals all open index parts. Closed parts are sealed already, see
+// IndexRelease. Once all parts are sealed, the buffered manifest records
+// are written out.
+VOID
+IndexSealAll() {
+    BOOL sealed = 1;
+    for (struct XtIndex *index = index_lru.head; index; index = index->lru_next) {
+        IndexSeal(index);
+    }
+    for (struct XtVolume *vol = first_volume; vol; vol = vol->next) {
+        struct XtReport *reports[] = {vol->report_existing, vol->report_deleted};
+        for (int i = 0; i < 2; i++) {
+            if (reports[i] && reports[i]->opened) {
+                sealed = sealed && IndexSealed(&reports[i]->image_index) && IndexSealed(&reports[i]->movie_index);
+            }
+        }
+    }
+    if (sealed) {
+        ManifestFlush();
+    }
+}
+
+// Makes everything exported so far importable: seals all open index
+// parts and updates the case reports of all reports with new records.
+// A report whose parts could not be sealed keeps its case report until a
+// later checkpoint succeeds, so the case report never counts records that
+// are not on disk.
+VOID
+ReportCheckpoint() {
+    IndexSealAll();
+    for (struct XtVolume *vol = first_volume; vol; vol = vol->next) {
+        struct XtReport *reports[] = {vol->report_existing, vol->report_deleted};
+        for (int i = 0; i < 2; i++) {
+            // Merged reports are shared by all volumes, but only updated once
+            if (reports[i] && reports[i]->opened
+                && (reports[i]->committed_images != reports[i]->image_count
+                    || reports[i]->committed_movies != reports[i]->movie_count)
+                && IndexSealed(&reports[i]->image_index)
+                && IndexSealed(&reports[i]->movie_index)) {
+                XmlUpdateReport(reports[i], 0);
+            }
+        }
+    }
+    last_checkpoint = GetTickCount64();
+}
+
+// Called between two files, checkpoints every CheckpointSec. The index
+// parts are sealed early when the manifest buffer is full.
+VOID
+ReportCheckpointPoll() {
+    if (options.checkpoint_interval
+        && GetTickCount64() - last_checkpoint >= options.checkpoint_interval) {
+        ReportCheckpoint();
+    } else if (MANIFEST_BUF_RECORDS <= manifest_count) {
+        IndexSealAll();
+    }
+}
+
+// Returns 0 if the index parts of the report could not be closed
+BOOL
+XmlFinishReport(struct XtReport *report, BOOL report_type, PWSTR evidence_name) {
+    BOOL closed = 1;
+    if (report && 1 == report->ref_count--) {
+        // This is the last reference, close tags and release files.
+        // Reports without any export never had files.
+        if (report->opened) {
+            // Both parts are closed, even if the first one fails
+            closed = IndexClosePart(&report->image_index);
+            closed = IndexClosePart(&report->movie_index) && closed;
+            if (closed) {
+                XmlUpdateReport(report, 1);
+            }
+        }
+        if (report->known_list && INVALID_HANDLE_VALUE != report->known_list) {
+            CloseHandle(report->known_list);
+        }
+        if (report->exif_list && INVALID_HANDLE_VALUE != report->exif_list) {
+            CloseHandle(report->exif_list);
+        }
+
+        // One log entry per evidence item
+        WCHAR buf[512];
+        LPCWSTR info_text =
+                report_type == REPORT_TYPE_EXISTING ? L"[%ls]: Exported %d images and %d videos from existing files"
+                                                    : L"[%ls]: Exported %d images and %d videos from deleted files";
+        StringCchPrintfW(buf, 512,
+                         info_text,
+                         evidence_name,
+                         report->image_count - report->image_base,
+                         report->movie_count - report->movie_base);
+        XWF_OutputMessage(buf, 0);
+        if (report->delta_skipped_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] skipping %d files exported by a previous run",
+                             report->delta_skipped_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->shard_skipped_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] leaving %d files to other shards",
+                             report->shard_skipped_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->filtered_count[FILTER_STATUS]) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] excluding %d files by deletion status",
+                             report->filtered_count[FILTER_STATUS]);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->filtered_count[FILTER_SIZE]) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] excluding %d files outside the size range",
+                             report->filtered_count[FILTER_SIZE]);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->filtered_count[FILTER_TIME]) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] excluding %d files outside the time windows",
+                             report->filtered_count[FILTER_TIME]);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->filtered_count[FILTER_PATH]) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] excluding %d files by path pattern",
+                             report->filtered_count[FILTER_PATH]);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->coalesced_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] reading %d files in runs of adjacent clusters",
+                             report->coalesced_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->too_small_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] excluding %d pictures below the minimum dimensions",
+                             report->too_small_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->categorized_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] including %d files categorized by hash set",
+                             report->categorized_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->exif_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] listing Exif data of %d pictures in %ls",
+                             report->exif_count, EXIF_LIST);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->video_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] recording details of %d videos in the index",
+                             report->video_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->stored_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] linking %d files to copies in the content store",
+                             report->stored_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->known_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] excluding %d known benign files (see report table)",
+                             report->known_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->size_mismatch_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] including %d files with inaccurate si"
+                             "ze (see report table)",
+                             report->size_mismatch_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->truncated_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] including %d truncated files (see report table)",
+                             report->truncated_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->corrupt_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] including %d corrupt files (see report table)",
+                             report->corrupt_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->partial_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] including %d partially recovered files (see report table)",
+                             report->partial_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->deferred_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] exporting %d files with slow reads last",
+                             report->deferred_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->inaccessible_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] excluding %d inaccessible files (see "
+                             "report table)",
+                             report->inaccessible_count);
+            XWF_OutputMessage(buf, 0);
+        }
+        if (report->empty_count) {
+            StringCchPrintfW(buf, 512,
+                             L"[*] excluding %d empty files",
+                             report->empty_count);
+            XWF_OutputMessage(buf, 0);
+        }
+
+        if (!report->opened) {
+            return closed;
+        }
+
+        // Remove any empty export directories
+        LPWSTR dir = report->export_path;
+
+        PWSTR img_subdir = NULL;
+        PWSTR vid_subdir = NULL;
+        PWSTR case_report = NULL;
+        PWSTR image_index = NULL;
+        PWSTR movie_index = NULL;
+
+        PathAllocCombine(dir, IMG_SUBDIR, 0, &img_subdir);
+        PathAllocCombine(dir, VID_SUBDIR, 0, &vid_subdir);
+        PathAllocCombine(dir, CASE_REPORT, 0, &case_report);
+        image_index = AllocIndexPath(dir, IMG_REPORT, report->image_index.part);
+        movie_index = AllocIndexPath(dir, VID_REPORT, report->movie_index.part);
+
+        // Only this run's index parts are removed, directories of
+        // previous runs are not empty and will not be removed.
+        if (report->image_base == report->image_count) {
+            DeleteFileW(image_index);
+            RemoveDirectoryW(img_subdir);
+        }
+        if (report->movie_base == report->movie_count) {
+            DeleteFileW(movie_index);
+            RemoveDirectoryW(vid_subdir);
+        }
+        if (0 == report->image_count
+            && 0 == report->movie_count) {
+            DeleteFileW(case_report);
+            RemoveDirectoryW(dir);
+        }
+
+        LocalFree(img_subdir);
+        LocalFree(vid_subdir);
+        LocalFree(case_report);
+        LocalFree(image_index);
+        LocalFree(movie_index);
+    }
+    return closed;
+}
+
+int
+HexValue(char c) {
+    if ('0' <= c && '9' >= c) return c - '0';
+    if ('a' <= c && 'f' >= c) return c - 'a' + 10;
+    if ('A' <= c && 'F' >= c) return c - 'A' + 10;
+    return -1;
+}
+
+// Parses "<md5>[separator<category>]", returns 0 for any other line,
+// e.g. headers or SHA-1 hashes
+BOOL
+HashSetParseLine(const char *line, const char *end, BYTE *rec) {
+    while (line < end && (' ' == *line || '\t' == *line || '"' == *line)) {
+        line++;
+    }
+    if (end - line < 32) {
+        return 0;
+    }
+    for (int i = 0; i < 16; i++) {
+        int hi = HexValue(line[2 * i]);
+        int lo = HexValue(line[2 * i + 1]);
+        if (0 > hi || 0 > lo) {
+            return 0;
+        }
+        rec[i] = (BYTE) (hi << 4 | lo);
+    }
+    line += 32;
+    if (line < end && 0 <= HexValue(*line)) {
+        return 0;
+    }
+    while (line < end && ('0' > *line || '9' < *line)) {
+        line++;
+    }
+    int category = 0;
+    while (line < end && '0' <= *line && '9' >= *line) {
+        category = category * 10 + (*line++ - '0');
+    }
+    rec[16] = (BYTE) (255 < category ? 255 : category);
+    return 1;
+}
+
+int
+HashRecordCompare(const void *a, const void *b) {
+    return memcmp(a, b, 16);
+}
+
+// Converts a text hash list into a sorted cache file
+// Returns 1 if successful
+// Returns 0 if not
+BOOL
+HashSetBuildCache(LPCWSTR text_path, LPCWSTR cache_path) {
+    HANDLE text = CreateFileW(text_path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (INVALID_HANDLE_VALUE == text) {
+        return 0;
+    }
+
+    UINT64 count = 0;
+    UINT64 capacity = 1024 * 1024;
+    BYTE *records = malloc(capacity * HASH_REC_LEN);
+    const DWORD chunk = 16 * 1024 * 1024;
+    char *buf = malloc(chunk);
+    DWORD carry = 0;
+    DWORD bytes_read = 0;
+    BOOL rv = NULL != records && NULL != buf;
+
+    // Lines may span two reads, keep the incomplete tail
+    while (rv && ReadFile(text, buf + carry, chunk - carry, &bytes_read, NULL)) {
+        DWORD len = carry + bytes_read;
+        char *line = buf;
+        char *end = buf + len;
+        while (line < end) {
+            char *eol = memchr(line, '\n', end - line);
+            if (NULL == eol && 0 != bytes_read) {
+                break;
+            }
+            if (NULL == eol) {
+                eol = end;
+            }
+            if (count == capacity) {
+                BYTE *grown = realloc(records, capacity * 2 * HASH_REC_LEN);
+                if (NULL == grown) {
+                    rv = 0;
+                    break;
+                }
+                records = grown;
+                capacity *= 2;
+            }
+            if (HashSetParseLine(line, eol, records + count * HASH_REC_LEN)) {
+                count++;
+            }
+            line = eol + 1;
+        }
+        if (0 == bytes_read) {
+            break;
+        }
+        carry = line < end ? (DWORD) (end - line) : 0;
+        if (chunk == carry) {
+            // A single line of 16 MB is no hash list
+            rv = 0;
+        }
+        memmove(buf, line, carry);
+    }
+    CloseHandle(text);
+    free(buf);
+
+    if (rv) {
+        qsort(records, count, HASH_REC_LEN, HashRecordCompare);
+        // Remove duplicates, the first category wins
+        UINT64 unique = 0;
+        for (UINT64 i = 0; i < count; i++) {
+            if (0 == unique || memcmp(records + (unique - 1) * HASH_REC_LEN, records + i * HASH_REC_LEN, 16)) {
+                memmove(records + unique * HASH_REC_LEN, records + i * HASH_REC_LEN, HASH_REC_LEN);
+                unique++;
+            }
+        }
+        count = unique;
+
+        struct XtHashSetHeader header = {HASH_SET_MAGIC, HASH_SET_VERSION, count};
+        HANDLE cache = CreateFileW(cache_path, GENERIC_WRITE, 0, NULL,
+                                   CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        rv = INVALID_HANDLE_VALUE != cache && WriteFile(cache, &header, sizeof(header), NULL, NULL);
+        for (UINT64 done = 0; rv && done < count;) {
+            DWORD n = count - done > chunk / HASH_REC_LEN ? chunk / HASH_REC_LEN : (DWORD) (count - done);
+            rv = WriteFile(cache, records + done * HASH_REC_LEN, n * HASH_REC_LEN, NULL, NULL);
+            done += n;
+        }
+        if (INVALID_HANDLE_VALUE != cache) {
+            CloseHandle(cache);
+        }
+        if (!rv) {
+            DeleteFileW(cache_path);
+        }
+    }
+    free(records);
+
+    return rv;
+}
+
+VOID
+BloomPositions(const BYTE *md5, UINT64 *h1, UINT64 *h2) {
+    memcpy(h1, md5, 8);
+    memcpy(h2, md5 + 8, 8);
+    *h2 |= 1;
+}
+
+// Maps the cache of a text hash list, building or refreshing it if needed
+// Returns 1 if successful
+// Returns 0 if not
+BOOL
+HashSetLoad(struct XtHashSet *set, LPCWSTR text_path, UINT32 bloom_bits) {
+    WCHAR cache_path[MAX_PATH];
+    WIN32_FILE_ATTRIBUTE_DATA text_info;
+    WIN32_FILE_ATTRIBUTE_DATA cache_info;
+
+    StringCchPrintfW(cache_path, MAX_PATH, L"%ls" HASH_CACHE, text_path);
+    if (!GetFileAttributesExW(text_path, GetFileExInfoStandard, &text_info)) {
+        return 0;
+    }
+    if (!GetFileAttributesExW(cache_path, GetFileExInfoStandard, &cache_info)
+        || 0 < CompareFileTime(&text_info.ftLastWriteTime, &cache_info.ftLastWriteTime)) {
+        if (!HashSetBuildCache(text_path, cache_path)) {
+            return 0;
+        }
+    }
+
+    set->file = CreateFileW(cache_path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (INVALID_HANDLE_VALUE == set->file) {
+        set->file = NULL;
+        return 0;
+    }
+    set->mapping = CreateFileMappingW(set->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    set->view = set->mapping ? MapViewOfFile(set->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (NULL == set->view) {
+        return 0;
+    }
+    const struct XtHashSetHeader *header = (const struct XtHashSetHeader *) set->view;
+    LARGE_INTEGER size;
+    GetFileSizeEx(set->file, &size);
+    if (HASH_SET_MAGIC != header->magic
+        || HASH_SET_VERSION != header->version
+        || sizeof(struct XtHashSetHeader) + header->count * HASH_REC_LEN > (UINT64) size.QuadPart) {
+        return 0;
+    }
+    set->records = set->view + sizeof(struct XtHashSetHeader);
+    set->count = header->count;
+
+    if (bloom_bits && set->count) {
+        UINT64 bits = 64;
+        while (bits < set->count * bloom_bits) {
+            bits *= 2;
+        }
+        set->bloom = calloc(bits / 64, sizeof(UINT64));
+        set->bloom_mask = bits - 1;
+        for (UINT64 i = 0; set->bloom && i < set->count; i++) {
+            UINT64 h1, h2;
+            BloomPositions(set->records + i * HASH_REC_LEN, &h1, &h2);
+            for (int k = 0; k < BLOOM_HASHES; k++) {
+                UINT64 bit = (h1 + k * h2) & set->bloom_mask;
+                set->bloom[bit / 64] |= 1ULL << (bit % 64);
+            }
+        }
+    }
+
+    return 1;
+}
+
+// Returns the category of a hash, or -1 if the set does not contain it
+int
+HashSetLookup(struct XtHashSet *set, const BYTE *md5) {
+    if (0 == set->count) {
+        return -1;
+    }
+    if (set->bloom) {
+        UINT64 h1, h2;
+        BloomPositions(md5, &h1, &h2);
+        for (int k = 0; k < BLOOM_HASHES; k++) {
+            UINT64 bit = (h1 + k * h2) & set->bloom_mask;
+            if (0 == (set->bloom[bit / 64] & 1ULL << (bit % 64))) {
+                return -1;
+            }
+        }
+    }
+    UINT64 lo = 0;
+    UINT64 hi = set->count;
+    while (lo < hi) {
+        UINT64 mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(set->records + mid * HASH_REC_LEN, md5, 16);
+        if (0 == cmp) {
+            return set->records[mid * HASH_REC_LEN + 16];
+        }
+        if (0 > cmp) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+VOID
+HashSetFree(struct XtHashSet *set) {
+    if (set->view) UnmapViewOfFile(set->view);
+    if (set->mapping) CloseHandle(set->mapping);
+    if (set->file) CloseHandle(set->file);
+    free(set->bloom);
+    ZeroMemory(set, sizeof(struct XtHashSet));
+}
+
+// Loads the configured hash sets and prepares MD5 calculation
+// Returns 1 if successful or no hash set is configured
+// Returns 0 if a configured hash set could not be loaded
+// Loads the hash set configured under key, if any, and logs its size. A
+// list in which no line holds an MD5 hash, e.g. a SHA-1 list, would
+// silently disable the filter, so an empty set is an error.
+// Returns 1 if successful or no set is configured
+// Returns 0 if not
+BOOL
+HashSetConfigure(struct XtHashSet *set, LPCWSTR key, UINT32 bloom_bits) {
+    WCHAR path[MAX_PATH];
+    WCHAR buf[MAX_PATH + 64];
+    if (!GetPrivateProfileStringW(L"HashSets", key, L"", path, MAX_PATH, options_path)) {
+        return 1;
+    }
+    options.hash = 1;
+    if (!HashSetLoad(set, path, bloom_bits)) {
+        return 0;
+    }
+    if (0 == set->count) {
+        StringCchPrintfW(buf, MAX_PATH + 64, L"ERROR: Griffeye XML export X-Tension found no MD5 hashes in %ls", path);
+        XWF_OutputMessage(buf, 0);
+        return 0;
+    }
+    StringCchPrintfW(buf, MAX_PATH + 64, L"Hash set %ls: %llu hashes from %ls", key, set->count, path);
+    XWF_OutputMessage(buf, 0);
+    return 1;
+}
+
+BOOL
+HashSetsInit() {
+    WCHAR action[16];
+    UINT32 bloom_bits = GetPrivateProfileIntW(L"HashSets", L"BloomBitsPerEntry", 10, options_path);
+
+    GetPrivateProfileStringW(L"HashSets", L"BenignAction", L"skip", action, 16, options_path);
+    if (0 == lstrcmpiW(action, L"list")) {
+        options.benign_action = BENIGN_LIST;
+    } else if (0 == lstrcmpiW(action, L"index")) {
+        options.benign_action = BENIGN_INDEX;
+    } else {
+        options.benign_action = BENIGN_SKIP;
+    }
+
+    BOOL rv = HashSetConfigure(&benign_set, L"Benign", bloom_bits)
+              && HashSetConfigure(&categorized_set, L"Categorized", bloom_bits);
+    if (rv && options.hash) {
+        rv = BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&md5_alg, BCRYPT_MD5_ALGORITHM, NULL, 0));
+    }
+    if (!rv) {
+        options.hash = 0;
+    }
+    return rv;
+}
+
+VOID
+HashSetsFree() {
+    HashSetFree(&benign_set);
+    HashSetFree(&categorized_set);
+    if (md5_alg) {
+        BCryptCloseAlgorithmProvider(md5_alg, 0);
+        md5_alg = NULL;
+    }
+}
+
+// Exclusive lock of the content store, shared by all X-Ways instances. The
+// locked byte lies far beyond the index, so it never overlaps the mapping.
+VOID
+StoreLock() {
+    OVERLAPPED ov = {0};
+    ov.OffsetHigh = STORE_LOCK_HIGH;
+    LockFileEx(store.file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov);
+}
+
+VOID
+StoreUnlock() {
+    OVERLAPPED ov = {0};
+    ov.OffsetHigh = STORE_LOCK_HIGH;
+    UnlockFileEx(store.file, 0, 1, 0, &ov);
+}
+
+VOID
+StoreClose() {
+    if (store.header) UnmapViewOfFile(store.header);
+    if (store.mapping) CloseHandle(store.mapping);
+    if (store.file) CloseHandle(store.file);
+    ZeroMemory(&store, sizeof(struct XtStore));
+}
+
+// Opens the content store configured in [Store], creating it on first use
+// Returns 1 if successful or no store is configured
+// Returns 0 if the store could not be opened
+BOOL
+StoreOpen() {
+    StoreClose();
+    if (!GetPrivateProfileStringW(L"Store", L"Dir", L"", store.dir, MAX_PATH, options_path)) {
+        return 1;
+    }
+    UINT max_files = GetPrivateProfileIntW(L"Store", L"MaxFiles", STORE_MAX_FILES, options_path);
+    // Twice as many slots keep probe sequences short
+    UINT64 capacity = 1024;
+    while (capacity < (UINT64) max_files * 2) {
+        capacity *= 2;
+    }
+
+    PWSTR index_path = NULL;
+    CreateDirectoryW(store.dir, NULL);
+    PathAllocCombine(store.dir, STORE_INDEX, 0, &index_path);
+    store.file = CreateFileW(index_path, GENERIC_READ | GENERIC_WRITE,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                             OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    LocalFree(index_path);
+    if (INVALID_HANDLE_VALUE == store.file) {
+        store.file = NULL;
+        return 0;
+    }
+
+    // The first instance creates the index while the others wait
+    StoreLock();
+    LARGE_INTEGER size = {0};
+    BOOL rv = GetFileSizeEx(store.file, &size);
+    if (rv && 0 == size.QuadPart) {
+        struct XtStoreHeader header = {STORE_MAGIC, STORE_VERSION, capacity, 0};
+        DWORD bytes;
+        size.QuadPart = sizeof(struct XtStoreHeader) + capacity * sizeof(struct XtStoreEntry);
+        DeviceIoControl(store.file, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes, NULL);
+        rv = WriteFile(store.file, &header, sizeof(struct XtStoreHeader), &bytes, NULL)
+             && SetFilePointerEx(store.file, size, NULL, FILE_BEGIN)
+             && SetEndOfFile(store.file);
+    }
+    StoreUnlock();
+
+    store.mapping = rv ? CreateFileMappingW(store.file, NULL, PAGE_READWRITE, 0, 0, NULL) : NULL;
+    store.header = store.mapping ? MapViewOfFile(store.mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL;
+    if (NULL == store.header
+        || STORE_MAGIC != store.header->magic
+        || STORE_VERSION != store.header->version
+        || 0 == store.header->capacity
+        || store.header->capacity & (store.header->capacity - 1)
+        || sizeof(struct XtStoreHeader) + store.header->capacity * sizeof(struct XtStoreEntry)
+           > (UINT64) size.QuadPart) {
+        StoreClose();
+        return 0;
+    }
+    store.entries = (struct XtStoreEntry *) (store.header + 1);
+    options.hash = 1;
+    return 1;
+}
+
+// Returns the slot of a content, or the empty slot where it belongs
+// Returns NULL if the index is full
+// The store must be locked
+struct XtStoreEntry *
+StoreSlot(const BYTE *md5, INT64 filesize) {
+    UINT64 mask = store.header->capacity - 1;
+    UINT64 start;
+    memcpy(&start, md5, sizeof(UINT64));
+    for (UINT64 n = 0; n <= mask; n++) {
+        struct XtStoreEntry *entry = &store.entries[(start + n) & mask];
+        if (0 == entry->filesize
+            || (filesize == entry->filesize && 0 == memcmp(entry->md5, md5, 16))) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Path of the stored copy of a content, <dir>\<first byte>\<md5>
+VOID
+StoreBlobPath(const BYTE *md5, PWSTR path, BOOL create_dir) {
+    StringCchPrintfW(path, MAX_PATH, L"%ls\\%02x", store.dir, md5[0]);
+    if (create_dir) {
+        CreateDirectoryW(path, NULL);
+    }
+    StringCchCatW(path, MAX_PATH, L"\\");
+    for (int i = 0; i < 16; i++) {
+        WCHAR hex[3];
+        StringCchPrintfW(hex, 3, L"%02x", md5[i]);
+        StringCchCatW(path, MAX_PATH, hex);
+    }
+}
+
+// Returns 1 if the store has an entry for the content of xf
+BOOL
+StoreHas(struct XtFile *xf) {
+    StoreLock();
+    struct XtStoreEntry *entry = StoreSlot(xf->md5, xf->filesize);
+    BOOL rv = entry && entry->filesize;
+    StoreUnlock();
+    return rv;
+}
+
+// Compares a stored copy with the content of an export, which is either
+// size bytes at data or, if data is NULL, the file at filepath. Equal MD5
+// hashes alone do not prove equal contents.
+// Returns 1 if both have the same size and bytes
+// Returns 0 if they differ or one of them could not be read
+BOOL
+StoreMatches(LPCWSTR blob, LPCWSTR filepath, const BYTE *data, INT64 size) {
+    HANDLE stored = CreateFileW(blob, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    HANDLE exported = data ? NULL : CreateFileW(filepath, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    BYTE *buf = malloc(data ? STORE_COMPARE : 2 * STORE_COMPARE);
+    LARGE_INTEGER stored_size = {0};
+    BOOL rv = INVALID_HANDLE_VALUE != stored && INVALID_HANDLE_VALUE != exported && buf
+              && GetFileSizeEx(stored, &stored_size) && size == stored_size.QuadPart;
+    for (INT64 pos = 0; rv && pos < size; pos += STORE_COMPARE) {
+        DWORD len = size - pos < STORE_COMPARE ? (DWORD) (size - pos) : STORE_COMPARE;
+        DWORD stored_len = 0;
+        DWORD exported_len = len;
+        const BYTE *other = data ? data + pos : buf + STORE_COMPARE;
+        rv = ReadFile(stored, buf, len, &stored_len, NULL)
+             && (data || ReadFile(exported, buf + STORE_COMPARE, len, &exported_len, NULL))
+             && len == stored_len && len == exported_len
+             && 0 == memcmp(buf, other, len);
+    }
+    free(buf);
+    if (INVALID_HANDLE_VALUE != stored) {
+        CloseHandle(stored);
+    }
+    if (exported && INVALID_HANDLE_VALUE != exported) {
+        CloseHandle(exported);
+    }
+    return rv;
+}
+
+// Links filepath to the stored copy of the content of xf, if there is one.
+// data holds the whole content, which has not been written yet.
+// Returns 1 if the file has been linked and needs not be written
+// Returns 0 if not
+BOOL
+StoreLink(LPCWSTR filepath, struct XtFile *xf, const BYTE *data) {
+    if (NULL == store.header || !xf->hashed || 0 == xf->filesize) {
+        return 0;
+    }
+    WCHAR blob[MAX_PATH];
+    StoreBlobPath(xf->md5, blob, 0);
+    xf->stored = StoreHas(xf)
+                 && StoreMatches(blob, NULL, data, xf->filesize)
+                 && CreateHardLinkW(filepath, blob, NULL);
+    return xf->stored;
+}
+
+// Adds an exported file to the content store, or replaces it by a link to
+// the stored copy if its content is already there. The store only holds
+// links, so it costs no writes, but it must be on the export volume.
+VOID
+StoreFile(LPCWSTR filepath, struct XtFile *xf) {
+    if (NULL == store.header || !xf->hashed || xf->stored || 0 == xf->filesize) {
+        return;
+    }
+    WCHAR blob[MAX_PATH];
+    WCHAR tmp[MAX_PATH];
+    StoreBlobPath(xf->md5, blob, 1);
+    StringCchPrintfW(tmp, MAX_PATH, L"%ls" STORE_TMP, filepath);
+    StoreLock();
+    struct XtStoreEntry *entry = StoreSlot(xf->md5, xf->filesize);
+    BOOL present = entry && entry->filesize;
+    if (!present && entry && store.header->count * 4 < store.header->capacity * 3
+        && (CreateHardLinkW(blob, filepath, NULL) || ERROR_ALREADY_EXISTS == GetLastError())) {
+        memcpy(entry->md5, xf->md5, 16);
+        entry->filesize = xf->filesize;
+        store.header->count++;
+    }
+    StoreUnlock();
+    if (!present) {
+        return;
+    }
+
+    // Compared without the lock, stored copies are never changed
+    if (StoreMatches(blob, filepath, NULL, xf->filesize)) {
+        // The export is only replaced once the link exists
+        xf->stored = CreateHardLinkW(tmp, blob, NULL)
+                     && MoveFileExW(tmp, filepath, MOVEFILE_REPLACE_EXISTING);
+        if (!xf->stored) {
+            DeleteFileW(tmp);
+        }
+    } else {
+        // Restores a stored copy that has been deleted, a different
+        // content with the same hash is kept as exported
+        CreateHardLinkW(blob, filepath, NULL);
+    }
+}
+
+BCRYPT_HASH_HANDLE
+HashBegin() {
+    BCRYPT_HASH_HANDLE hash = NULL;
+    if (options.hash && !BCRYPT_SUCCESS(BCryptCreateHash(md5_alg, &hash, NULL, 0, NULL, 0, 0))) {
+        hash = NULL;
+    }
+    return hash;
+}
+
+VOID
+HashEnd(BCRYPT_HASH_HANDLE hash, struct XtFile *xf) {
+    xf->hashed = BCRYPT_SUCCESS(BCryptFinishHash(hash, xf->md5, 16, 0));
+    BCryptDestroyHash(hash);
+}
+
+// Sets the category of known categorized files
+// Returns 1 if the file is known to be benign
+// Returns 0 otherwise
+BOOL
+CheckKnownHash(struct XtFile *xf) {
+    if (!xf->hashed) {
+        return 0;
+    }
+    int category = HashSetLookup(&categorized_set, xf->md5);
+    if (0 <= category) {
+        xf->category = (INT16) category;
+        return 0;
+    }
+    return 0 <= HashSetLookup(&benign_set, xf->md5);
+}
+
+// Changes the rate of a bucket, keeping its debt
+VOID
+QosSetRate(struct XtBucket *bucket, double rate) {
+    if (0 == rate) {
+        bucket->tokens = 0;
+    } else if (0 == bucket->rate) {
+        // Newly limited, starts with a full burst
+        bucket->tokens = rate * QOS_BURST_SEC;
+        bucket->last = TraceNow();
+    }
+    bucket->rate = rate;
+}
+
+// Reads a [QoS] setting, from the control file if it has one
+UINT
+QosSetting(LPCWSTR key, INT fallback) {
+    UINT value = GetPrivateProfileIntW(L"QoS", key, fallback, options_path);
+    return GetPrivateProfileIntW(L"QoS", key, (INT) value, qos.control_path);
+}
+
+// Reads the [QoS] settings and logs any change
+VOID
+QosLoad() {
+    double mb = 1024.0 * 1024.0;
+    double read = QosSetting(L"ReadMBps", 0) * mb;
+    double write = QosSetting(L"WriteMBps", 0) * mb;
+    double files = QosSetting(L"FilesPerSec", 0);
+    BOOL low_priority = QosSetting(L"LowPriority", 0);
+    qos.reload = QosSetting(L"ReloadMs", 5000);
+
+    if (read != qos.read.rate || write != qos.write.rate
+        || files != qos.files.rate || low_priority != qos.low_priority) {
+        WCHAR buf[256];
+        StringCchPrintfW(buf, 256, L"QoS: read %.0f MB/s, write %.0f MB/s, %.0f files/s, low priority %ls (0 = unlimited)",
+                         read / mb, write / mb, files, low_priority ? L"on" : L"off");
+        XWF_OutputMessage(buf, 0);
+    }
+    QosSetRate(&qos.read, read);
+    QosSetRate(&qos.write, write);
+    QosSetRate(&qos.files, files);
+    qos.low_priority = low_priority;
+}
+
+// Reads the settings, dir is the export root with the control file
+VOID
+QosInit(LPCWSTR dir) {
+    // The DLL stays loaded between runs
+    ZeroMemory(&qos, sizeof(struct XtQos));
+    PathCchCombine(qos.control_path, MAX_PATH, dir, QOS_CONTROL);
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    qos.frequency = frequency.QuadPart;
+    QosLoad();
+}
+
+// Enters or leaves background mode on the calling thread, which lowers
+// the I/O priority of everything it reads and writes. X-Ways reads the
+// evidence on the thread that calls XWF_Read, so this is the only way to
+// lower the priority of the source reads.
+VOID
+QosBackground(BOOL *current, BOOL on) {
+    if (*current != on
+        && SetThreadPriority(GetCurrentThread(), on ? THREAD_MODE_BACKGROUND_BEGIN : THREAD_MODE_BACKGROUND_END)) {
+        *current = on;
+    }
+}
+
+// Asks the file system to treat writes to an exported file as low priority
+VOID
+QosHintFile(HANDLE file) {
+    if (qos.low_priority) {
+        FILE_IO_PRIORITY_HINT_INFO hint = {IoPriorityHintLow};
+        SetFileInformationByHandle(file, FileIoPriorityHintInfo, &hint, sizeof(hint));
+    }
+}
+
+// Re-reads the settings every ReloadMs, called between two files
+VOID
+QosPoll() {
+    ULONGLONG now = GetTickCount64();
+    if (0 == qos.reload || now - qos.last_reload < qos.reload) {
+        return;
+    }
+    qos.last_reload = now;
+    QosLoad();
+    QosBackground(&qos.background, qos.low_priority);
+}
+
+// Takes amount tokens and waits until the bucket is out of debt. Requests
+// larger than a burst still pass, followed by a longer wait, so chunk
+// sizes need not be aligned with the limits.
+VOID
+QosTake(struct XtBucket *bucket, double amount) {
+    if (0 == bucket->rate) {
+        return;
+    }
+    INT64 now = TraceNow();
+    bucket->tokens += (double) (now - bucket->last) * bucket->rate / qos.frequency;
+    if (bucket->tokens > bucket->rate * QOS_BURST_SEC) {
+        bucket->tokens = bucket->rate * QOS_BURST_SEC;
+    }
+    bucket->tokens -= amount;
+    bucket->last = now;
+    if (0 <= bucket->tokens) {
+        return;
+    }
+
+    INT64 t_throttle = TRACE_BEGIN();
+    DWORD wait = (DWORD) (-bucket->tokens * 1000 / bucket->rate);
+    while (wait && !XWF_ShouldStop()) {
+        DWORD step = wait < QOS_SLICE_MS ? wait : QOS_SLICE_MS;
+        Sleep(step);
+        wait -= step;
+    }
+    qos.throttled += TraceNow() - now;
+    TRACE_END(TRACE_THROTTLE, t_throttle, -1, (INT64) amount);
+}
+
+// Returns 1 if all len bytes at data are zero, len is a multiple of 256
+BOOL
+IsZeroBlock(const BYTE *data, DWORD len) {
+    const UINT64 *word = (const UINT64 *) data;
+    for (DWORD i = 0; i < len / 8; i += 32) {
+        // No branch in the inner loop, so that it is vectorized
+        UINT64 any = 0;
+        for (DWORD j = 0; j < 32; j++) {
+            any |= word[i + j];
+        }
+        if (any) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Writes len bytes at the file pointer like WriteFile, but skips blocks of
+// zeros that are aligned to SPARSE_BLOCK in the file. The file is made
+// sparse on the first skip, the skipped ranges then take no disk space and
+// read back as zeros. On file systems without sparse files they are filled
+// with zeros by the file system. The file must be closed with
+// CloseExportFile, as it may end with a skipped range.
+BOOL
+WriteSparse(HANDLE file, const BYTE *data, DWORD len) {
+    LARGE_INTEGER pos = {0};
+    LARGE_INTEGER zero = {0};
+    if (!options.sparse || SPARSE_BLOCK > len
+        || !SetFilePointerEx(file, zero, &pos, FILE_CURRENT)) {
+        return WriteFile(file, data, len, NULL, NULL);
+    }
+
+    // Start of the data not written yet, and the next aligned block
+    DWORD start = 0;
+    DWORD block = (DWORD) ((SPARSE_BLOCK - pos.QuadPart % SPARSE_BLOCK) % SPARSE_BLOCK);
+    BOOL marked = 0;
+    while (block + SPARSE_BLOCK <= len) {
+        if (!IsZeroBlock(data + block, SPARSE_BLOCK)) {
+            block += SPARSE_BLOCK;
+            continue;
+        }
+        DWORD end = block + SPARSE_BLOCK;
+        while (end + SPARSE_BLOCK <= len && IsZeroBlock(data + end, SPARSE_BLOCK)) {
+            end += SPARSE_BLOCK;
+        }
+        if (!marked) {
+            DWORD bytes;
+            DeviceIoControl(file, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes, NULL);
+            marked = 1;
+        }
+        LARGE_INTEGER skip;
+        skip.QuadPart = end - block;
+        if ((block > start && !WriteFile(file, data + start, block - start, NULL, NULL))
+            || !SetFilePointerEx(file, skip, NULL, FILE_CURRENT)) {
+            return 0;
+        }
+        start = end;
+        block = end;
+    }
+    return start == len || WriteFile(file, data + start, len - start, NULL, NULL);
+}
+
+// Closes an exported file. Sets the end of file first, which is not
+// written if WriteSparse skipped the last block.
+// Returns 1 if successful
+// Returns 0 if the file could not be extended to its full size
+BOOL
+CloseExportFile(HANDLE file) {
+    BOOL rv = !options.sparse || SetEndOfFile(file);
+    CloseHandle(file);
+    return rv;
+}
+
+// Writer thread of the read-ahead pipeline.
+// A chunk without a file handle stops the thread.
+DWORD WINAPI
+PipelineWriter(LPVOID param) {
+    struct XtPipeline *pl = param;
+    BOOL background = 0;
+
+    while (1) {
+        WaitForSingleObject(pl->full_slots, INFINITE);
+        struct XtChunk *c = &pl->slots[pl->tail];
+        if (NULL == c->file) {
+            return 0;
+        }
+        QosBackground(&background, qos.low_priority);
+        // After a failed write, only release the remaining chunks
+        if (!pl->failed) {
+            INT64 t_write = tuner.enabled || trace.enabled ? TraceNow() : 0;
+            if (!WriteSparse(c->file, c->data, c->size)) {
+                InterlockedExchange(&pl->failed, 1);
+            }
+            if (tuner.enabled) {
+                InterlockedExchangeAdd64(&pl->write_ticks, TraceNow() - t_write);
+                InterlockedIncrement(&pl->writes);
+            }
+            TRACE_END(TRACE_WRITE, t_write, c->xwf_id, c->size);
+        }
+        pl->tail = (pl->tail + 1) % pl->depth;
+        ReleaseSemaphore(pl->free_slots, 1, NULL);
+    }
+}
+
+// Stops the writer thread and releases all buffers
+VOID
+PipelineStop(struct XtPipeline *pl) {
+    if (pl->thread) {
+        WaitForSingleObject(pl->free_slots, INFINITE);
+        pl->slots[pl->head].file = NULL;
+        ReleaseSemaphore(pl->full_slots, 1, NULL);
+        WaitForSingleObject(pl->thread, INFINITE);
+        CloseHandle(pl->thread);
+    }
+    if (pl->free_slots) CloseHandle(pl->free_slots);
+    if (pl->full_slots) CloseHandle(pl->full_slots);
+    if (pl->slots) {
+        for (UINT32 i = 0; i < PIPELINE_SLOTS; i++) {
+            free(pl->slots[i].data);
+        }
+        free(pl->slots);
+    }
+    ZeroMemory(pl, sizeof(struct XtPipeline));
+}
+
+// Starts the writer thread on first use. Anything allocated is released
+// again if the pipeline cannot be started.
+// Returns 1 if the pipeline is running
+// Returns 0 if not
+BOOL
+PipelineStart(struct XtPipeline *pl) {
+    if (pl->thread) {
+        return 1;
+    }
+    pl->depth = tuner.enabled ? tuner.depth : options.read_ahead + 1;
+    pl->chunk = tuner.enabled ? tuner.chunk : options.chunk_size;
+    pl->head = 0;
+    pl->tail = 0;
+    pl->failed = 0;
+    pl->slots = calloc(PIPELINE_SLOTS, sizeof(struct XtChunk));
+    if (NULL == pl->slots
+        || NULL == (pl->free_slots = CreateSemaphoreW(NULL, pl->depth, PIPELINE_SLOTS, NULL))
+        || NULL == (pl->full_slots = CreateSemaphoreW(NULL, 0, PIPELINE_SLOTS, NULL))
+        || NULL == (pl->thread = CreateThread(NULL, 0, PipelineWriter, pl, 0, NULL))) {
+        PipelineStop(pl);
+        return 0;
+    }
+    tuner.window_start = 0;
+
+    return 1;
+}
+
+// Makes sure the buffer of a free slot holds at least size bytes.
+// Buffers only grow, smaller chunks reuse them.
+// Returns 1 if successful
+// Returns 0 if out of memory
+BOOL
+ChunkReserve(struct XtChunk *c, DWORD size) {
+    if (c->data && c->capacity >= size) {
+        return 1;
+    }
+    free(c->data);
+    c->data = malloc(size);
+    c->capacity = c->data ? size : 0;
+    return NULL != c->data;
+}
+
+// Waits until the writer thread has written all queued chunks
+VOID
+PipelineDrain(struct XtPipeline *pl) {
+    for (UINT32 i = 0; i < pl->depth; i++) {
+        WaitForSingleObject(pl->free_slots, INFINITE);
+    }
+    ReleaseSemaphore(pl->free_slots, pl->depth, NULL);
+}
+
+// Changes the ring depth of a drained pipeline. The writer thread is
+// waiting for a full slot and does not touch the ring until then.
+VOID
+PipelineResize(struct XtPipeline *pl, UINT32 depth) {
+    if (depth > pl->depth) {
+        ReleaseSemaphore(pl->free_slots, depth - pl->depth, NULL);
+    }
+    for (UINT32 i = depth; i < pl->depth; i++) {
+        WaitForSingleObject(pl->free_slots, INFINITE);
+    }
+    // Buffers of larger chunks are released as well, more slots of the
+    // current size have to fit into the memory budget
+    for (UINT32 i = 0; i < PIPELINE_SLOTS; i++) {
+        if (depth <= i || pl->slots[i].capacity > pl->chunk) {
+            free(pl->slots[i].data);
+            pl->slots[i].data = NULL;
+            pl->slots[i].capacity = 0;
+        }
+    }
+    pl->depth = depth;
+    pl->head = 0;
+    pl->tail = 0;
+}
+
+VOID
+TuneInit() {
+    free(tuner.events);
+    ZeroMemory(&tuner, sizeof(struct XtTuner));
+    tuner.enabled = GetPrivateProfileIntW(L"Export", L"Adaptive", 0, options_path) && options.read_ahead;
+    if (!tuner.enabled) {
+        return;
+    }
+    tuner.budget = (INT64) GetPrivateProfileIntW(L"Export", L"MemoryBudgetMB", 1024, options_path) * 1024 * 1024;
+    if (2 * TUNE_MIN_CHUNK > tuner.budget) {
+        tuner.budget = 2 * TUNE_MIN_CHUNK;
+    }
+    // Start with the configured settings, reduced to fit into the budget
+    tuner.chunk = options.chunk_size;
+    tuner.depth = options.read_ahead + 1;
+    while (tuner.chunk / 2 >= TUNE_MIN_CHUNK && (INT64) tuner.chunk * tuner.depth > tuner.budget) {
+        tuner.chunk /= 2;
+    }
+    while (2 < tuner.depth && (INT64) tuner.chunk * tuner.depth > tuner.budget) {
+        tuner.depth--;
+    }
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    tuner.frequency = frequency.QuadPart;
+    if (trace.enabled) {
+        tuner.events = malloc(sizeof(struct XtTuneEvent) * TUNE_MAX_EVENTS);
+    }
+}
+
+// Applies a move, or its opposite if revert is set
+// Returns 1 if the settings changed
+// Returns 0 if the move would leave the limits
+BOOL
+TuneApply(int move, BOOL revert) {
+    BOOL up = (TUNE_CHUNK_UP == move || TUNE_DEPTH_UP == move) != revert;
+    if (TUNE_CHUNK_UP == move || TUNE_CHUNK_DOWN == move) {
+        DWORD chunk = up ? tuner.chunk * 2 : tuner.chunk / 2;
+        if (TUNE_MIN_CHUNK > chunk || FILE_CHUNK < chunk
+            || (INT64) chunk * tuner.depth > tuner.budget) {
+            return 0;
+        }
+        tuner.chunk = chunk;
+    } else {
+        UINT32 depth = up ? tuner.depth + 1 : tuner.depth - 1;
+        if (2 > depth || PIPELINE_SLOTS < depth
+            || (INT64) tuner.chunk * depth > tuner.budget) {
+            return 0;
+        }
+        tuner.depth = depth;
+    }
+    return 1;
+}
+
+// Evaluates a finished window and decides on the next settings
+VOID
+TuneWindow(struct XtPipeline *pl, INT64 now) {
+    double seconds = (double) (now - tuner.window_start) / tuner.frequency;
+    double rate = tuner.bytes / seconds;
+    // Updated by the writer thread
+    LONG writes = InterlockedExchangeAdd(&pl->writes, 0) - tuner.writes_base;
+    INT64 write_ticks = InterlockedExchangeAdd64(&pl->write_ticks, 0) - tuner.write_ticks_base;
+    double read_ms = tuner.reads ? tuner.read_ticks * 1000.0 / tuner.frequency / tuner.reads : 0;
+    double write_ms = writes ? write_ticks * 1000.0 / tuner.frequency / writes : 0;
+
+    const char *action;
+    BOOL probe = 1;
+    if (tuner.probing && rate > tuner.baseline * (1 + TUNE_GAIN)) {
+        tuner.baseline = rate;
+        action = "accept";
+    } else if (tuner.probing) {
+        // Measure the previous settings again before the next probe
+        TuneApply(tuner.move, 1);
+        tuner.move = (tuner.move + 1) % TUNE_MOVES;
+        tuner.probing = 0;
+        probe = 0;
+        action = "revert";
+    } else {
+        tuner.baseline = rate;
+        action = "measure";
+    }
+    if (probe) {
+        // Continue in the same direction, or try the next possible move
+        tuner.probing = 0;
+        for (int k = 0; k < TUNE_MOVES && !tuner.probing; k++) {
+            tuner.probing = TuneApply(tuner.move, 0);
+            if (!tuner.probing) {
+                tuner.move = (tuner.move + 1) % TUNE_MOVES;
+            }
+        }
+    }
+    tuner.windows++;
+
+    if (tuner.events && TUNE_MAX_EVENTS > tuner.event_count) {
+        struct XtTuneEvent *ev = &tuner.events[tuner.event_count++];
+        ev->time = now;
+        ev->chunk = tuner.chunk;
+        ev->depth = tuner.depth;
+        ev->rate = rate;
+        ev->read_ms = read_ms;
+        ev->write_ms = write_ms;
+        ev->action = action;
+    }
+    tuner.action = action;
+    pl->chunk = tuner.chunk;
+}
+
+// Accounts a chunk read by the pipeline, read_ticks is the XWF_Read latency
+VOID
+TuneSample(struct XtPipeline *pl, DWORD size, INT64 read_ticks) {
+    INT64 now = TraceNow();
+    if (0 == tuner.window_start) {
+        tuner.window_start = now;
+        tuner.bytes = 0;
+        tuner.read_ticks = 0;
+        tuner.reads = 0;
+        tuner.write_ticks_base = InterlockedExchangeAdd64(&pl->write_ticks, 0);
+        tuner.writes_base = InterlockedExchangeAdd(&pl->writes, 0);
+        return;
+    }
+    tuner.bytes += size;
+    tuner.read_ticks += read_ticks;
+    tuner.reads++;
+    if (now - tuner.window_start >= tuner.frequency * TUNE_WINDOW_MS / 1000) {
+        TuneWindow(pl, now);
+        // Settings take effect from the next window on
+        tuner.window_start = 0;
+    }
+}
+
+// Reads up to size bytes of an item at offset, as reported by X-Ways
+// Returns the number of bytes actually read
+DWORD
+ReadAttempt(HANDLE hItem, INT64 xwf_id, INT64 offset, LPVOID buf, DWORD size) {
+    INT64 t_read = TRACE_BEGIN();
+    DWORD actual_size = XWF_Read(hItem, offset, buf, size);
+    TRACE_END(TRACE_READ, t_read, xwf_id, actual_size);
+    QosTake(&qos.read, actual_size);
+    return actual_size;
+}
+
+// Reads up to size bytes of an item at offset
+// Returns the number of bytes actually read
+DWORD
+ReadItem(HANDLE hItem, INT64 xwf_id, INT64 offset, LPVOID buf, DWORD size, INT64 filesize) {
+    DWORD actual_size = ReadAttempt(hItem, xwf_id, offset, buf, size);
+    //remove the following "if" as soon as XWF_Read return value is fixed
+    //only overwrite actual_size if file is considered to be large because XWF_Read is returning 0 in that case --> should be fixed in future releases of X-Ways according to S. Fleischmann
+    if ((actual_size == 0) && (filesize >= FILE_2GB)) {
+        actual_size = size;
+    }
+    return actual_size;
+}
+
+// Reads [offset, offset + size) in halves until the pieces are read
+// completely or are no larger than options.salvage_block. The unreadable
+// rest of each such piece is zero-filled.
+// Returns the number of bytes actually read
+DWORD
+ReadSplit(HANDLE hItem, INT64 xwf_id, INT64 offset, BYTE *buf, DWORD size) {
+    DWORD actual = ReadAttempt(hItem, xwf_id, offset, buf, size);
+    if (actual >= size) {
+        return size;
+    }
+    if (size <= options.salvage_block || XWF_ShouldStop()) {
+        ZeroMemory(buf + actual, size - actual);
+        return actual;
+    }
+    DWORD half = size / 2;
+    return ReadSplit(hItem, xwf_id, offset, buf, half)
+           + ReadSplit(hItem, xwf_id, offset + half, buf + half, size - half);
+}
+
+// Salvages a chunk that could not be read at all. A chunk whose first and
+// last blocks are both unreadable is taken as the end of the data, which
+// is what X-Ways returns for items with an inaccurate size.
+// Returns size if anything could be read, the unreadable bytes are then
+// zero-filled and added to xf->unreadable
+// Returns 0 if not
+DWORD
+ReadBisect(HANDLE hItem, INT64 xwf_id, struct XtFile *xf, INT64 offset, BYTE *buf, DWORD size) {
+    DWORD block = size < options.salvage_block ? size : options.salvage_block;
+    if (0 == ReadAttempt(hItem, xwf_id, offset, buf, block)
+        && 0 == ReadAttempt(hItem, xwf_id, offset + size - block, buf + size - block, block)) {
+        return 0;
+    }
+    DWORD actual = ReadSplit(hItem, xwf_id, offset, buf, size);
+    if (0 == actual) {
+        return 0;
+    }
+    xf->unreadable += size - actual;
+    return size;
+}
+
+// ReadItem with the watchdog and salvage of the export, see ReadBisect.
+// XWF_Read cannot be interrupted, so while the item may be deferred, the
+// first block of each chunk is read on its own. If that is slower than
+// options.slow_read, ex->slow is set and the caller defers the item before
+// the whole chunk is read. A slow read of a whole chunk is kept instead,
+// the item is then no longer deferred, so that no slow region is read twice.
+DWORD
+ReadChunk(struct XtExport *ex, HANDLE hItem, INT64 xwf_id, struct XtFile *xf,
+          INT64 offset, BYTE *buf, DWORD size) {
+    ULONGLONG start = options.slow_read ? GetTickCount64() : 0;
+    if (ex->defer) {
+        DWORD block = size < options.salvage_block ? size : options.salvage_block;
+        ReadAttempt(hItem, xwf_id, offset, buf, block);
+        if (GetTickCount64() - start >= options.slow_read) {
+            ex->slow = 1;
+            return 0;
+        }
+        start = GetTickCount64();
+    }
+    DWORD actual = ReadAttempt(hItem, xwf_id, offset, buf, size);
+    if (0 == actual && options.salvage) {
+        actual = ReadBisect(hItem, xwf_id, xf, offset, buf, size);
+    }
+    //remove the following "if" as soon as XWF_Read return value is fixed, see ReadItem
+    if (0 == actual && xf->filesize >= FILE_2GB) {
+        actual = size;
+    }
+    if (options.slow_read && GetTickCount64() - start >= options.slow_read) {
+        ex->defer = 0;
+    }
+    return actual;
+}
+
+// Makes room for another deferred item
+// Returns 1 if successful
+// Returns 0 if out of memory, the next item is then not deferred
+BOOL
+ExportDeferReserve(struct XtExport *ex) {
+    if (ex->deferred_count < ex->deferred_cap) {
+        return 1;
+    }
+    INT64 cap = ex->deferred_cap ? ex->deferred_cap * 2 : 64;
+    INT64 *deferred = realloc(ex->deferred, cap * sizeof(INT64));
+    if (NULL == deferred) {
+        return 0;
+    }
+    ex->deferred = deferred;
+    ex->deferred_cap = cap;
+    return 1;
+}
+
+// Creates an exported file, but only when we are actually going to export data
+HANDLE
+CreateExportFile(LPCWSTR filepath, INT64 xwf_id) {
+    QosTake(&qos.files, 1);
+    INT64 t_create = TRACE_BEGIN();
+    HANDLE file = MyCreateFile(filepath);
+    // Leftover of an interrupted delta run which never
+    // made it into the manifest, overwrite it
+    if (INVALID_HANDLE_VALUE == file
+        && options.delta
+        && ERROR_FILE_EXISTS == GetLastError()) {
+        file = CreateFileW(filepath, GENERIC_WRITE, 0, NULL,
+                           CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    }
+    TRACE_END(TRACE_CREATE, t_create, xwf_id, 0);
+    if (INVALID_HANDLE_VALUE == file) {
+        XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension cou"
+                          "ld not create a file in the export direc"
+                          "tory. Aborting.", 0);
+    } else {
+        QosHintFile(file);
+    }
+    return file;
+}
+
+VOID
+ExportMemoryError(struct XtFile *xf) {
+    XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension cou"
+                      "ld not allocate memory for file export. "
+                      "Aborting.", 0);
+    // print erroring file
+    XWF_OutputMessage(xf->fullpath, 0);
+}
+
+VOID
+ExportWriteError() {
+    XWF_OutputMessage(L"ERROR: Griffeye XML export X-Ten"
+                      "sion could not write to export d"
+                      "irectory. Aborting.", 0);
+}
+
+// Reads and writes chunk by chunk on the calling thread
+int
+ExportDirect(struct XtExport *ex, HANDLE hItem, INT64 xwf_id,
+             struct XtFile *xf, LPCWSTR filepath) {
+    // It is possible that we will get less bytes from XWF_Read
+    INT64 expected_size = xf->filesize;
+    INT64 offset = 0;
+    HANDLE file = NULL;
+    BCRYPT_HASH_HANDLE hash = HashBegin();
+    struct XtCheck check;
+    CheckBegin(&check);
+    int rv = EXPORT_DONE;
+
+    while (offset < expected_size) {
+        DWORD size = expected_size - offset > options.chunk_size
+                     ? options.chunk_size : (DWORD) (expected_size - offset);
+        if (ex->buf_size < size) {
+            free(ex->buf);
+            ex->buf = malloc(size);
+            ex->buf_size = ex->buf ? size : 0;
+            if (NULL == ex->buf) {
+                ExportMemoryError(xf);
+                rv = EXPORT_ABORT;
+                break;
+            }
+        }
+
+        // Actual size can be less (or even zero)
+        DWORD actual_size = ReadChunk(ex, hItem, xwf_id, xf, offset, ex->buf, size);
+        if (ex->slow && ex->defer) {
+            rv = EXPORT_DEFERRED;
+            break;
+        }
+        if (0 == actual_size) {
+            // Happens when X-Ways reports a filesize > 0 but the file
+            // reference does not contain any (more) actual data.
+            break;
+        }
+        if (0 == offset) {
+            ExportProbe(ex, hItem, ex->buf, actual_size, expected_size);
+        }
+        offset += actual_size;
+        if (hash) {
+            BCryptHashData(hash, ex->buf, actual_size, 0);
+        }
+        CheckFeed(&check, ex->buf, actual_size);
+
+        // Files within a single chunk are checked before anything is written
+        if (NULL == file && hash && offset >= expected_size) {
+            HashEnd(hash, xf);
+            hash = NULL;
+            if (CheckKnownHash(xf)) {
+                CheckEnd(&check, xf);
+                return EXPORT_KNOWN;
+            }
+            if (StoreLink(filepath, xf, ex->buf)) {
+                CheckEnd(&check, xf);
+                return EXPORT_DONE;
+            }
+        }
+
+        if (NULL == file) {
+            file = CreateExportFile(filepath, xwf_id);
+            if (INVALID_HANDLE_VALUE == file) {
+                file = NULL;
+                rv = EXPORT_ABORT;
+                break;
+            }
+        }
+        INT64 t_write = TRACE_BEGIN();
+        BOOL written = WriteSparse(file, ex->buf, actual_size);
+        TRACE_END(TRACE_WRITE, t_write, xwf_id, actual_size);
+        QosTake(&qos.write, actual_size);
+        if (FALSE == written) {
+            ExportWriteError();
+            rv = EXPORT_ABORT;
+            break;
+        }
+    }
+
+    if (file && !CloseExportFile(file) && EXPORT_DONE == rv) {
+        ExportWriteError();
+        rv = EXPORT_ABORT;
+    }
+    if (EXPORT_DEFERRED == rv) {
+        if (file) {
+            DeleteFileW(filepath);
+        }
+        if (hash) {
+            BCryptDestroyHash(hash);
+        }
+        return rv;
+    }
+    CheckEnd(&check, xf);
+    if (hash) {
+        HashEnd(hash, xf);
+        // Larger files can only be checked after they have been written
+        if (EXPORT_DONE == rv && file && CheckKnownHash(xf)) {
+            DeleteFileW(filepath);
+            return EXPORT_KNOWN;
+        }
+    }
+    if (EXPORT_DONE == rv && NULL == file) {
+        rv = EXPORT_EMPTY;
+    }
+    return rv;
+}
+
+// Reads chunks ahead while the writer thread writes the previous ones
+int
+ExportPipelined(struct XtExport *ex, HANDLE hItem, INT64 xwf_id,
+                struct XtFile *xf, LPCWSTR filepath) {
+    struct XtPipeline *pl = &ex->pipeline;
+    if (!PipelineStart(pl)) {
+        ExportMemoryError(xf);
+        return EXPORT_ABORT;
+    }
+
+    INT64 expected_size = xf->filesize;
+    INT64 offset = 0;
+    HANDLE file = NULL;
+    BCRYPT_HASH_HANDLE hash = HashBegin();
+    struct XtCheck check;
+    CheckBegin(&check);
+    BOOL deferred = 0;
+
+    while (offset < expected_size && !pl->failed) {
+        // Depth changes of the tuner need an empty ring
+        if (tuner.enabled && tuner.depth != pl->depth) {
+            PipelineDrain(pl);
+            PipelineResize(pl, tuner.depth);
+        }
+        WaitForSingleObject(pl->free_slots, INFINITE);
+        struct XtChunk *c = &pl->slots[pl->head];
+        // Out of memory, the tuner falls back to smaller chunks
+        DWORD chunk = pl->chunk;
+        while (!ChunkReserve(c, pl->chunk) && tuner.enabled && TUNE_MIN_CHUNK <= pl->chunk / 2) {
+            pl->chunk /= 2;
+            tuner.chunk = pl->chunk;
+            tuner.budget = (INT64) pl->chunk * pl->depth;
+            tuner.action = "out of memory";
+        }
+        if (chunk != pl->chunk && c->data) {
+            WCHAR buf[128];
+            StringCchPrintfW(buf, 128, L"Adaptive export: out of memory, chunk size reduced to %.1f MB",
+                             pl->chunk / (1024.0 * 1024));
+            XWF_OutputMessage(buf, 0);
+        }
+        if (NULL == c->data) {
+            ReleaseSemaphore(pl->free_slots, 1, NULL);
+            PipelineDrain(pl);
+            if (file) {
+                CloseHandle(file);
+                DeleteFileW(filepath);
+            }
+            if (hash) {
+                BCryptDestroyHash(hash);
+            }
+            ExportMemoryError(xf);
+            return EXPORT_ABORT;
+        }
+        DWORD size = expected_size - offset > pl->chunk
+                     ? pl->chunk : (DWORD) (expected_size - offset);
+
+        INT64 t_read = tuner.enabled ? TraceNow() : 0;
+        DWORD actual_size = ReadChunk(ex, hItem, xwf_id, xf, offset, c->data, size);
+        if (ex->slow && ex->defer) {
+            deferred = 1;
+        }
+        if (0 == actual_size || deferred) {
+            ReleaseSemaphore(pl->free_slots, 1, NULL);
+            break;
+        }
+        if (tuner.enabled) {
+            TuneSample(pl, actual_size, TraceNow() - t_read);
+        }
+        if (0 == offset) {
+            ExportProbe(ex, hItem, c->data, actual_size, expected_size);
+        }
+        // Advance by the bytes actually returned, not by the requested size
+        offset += actual_size;
+        if (hash) {
+            BCryptHashData(hash, c->data, actual_size, 0);
+        }
+        CheckFeed(&check, c->data, actual_size);
+
+        if (NULL == file) {
+            file = CreateExportFile(filepath, xwf_id);
+            if (INVALID_HANDLE_VALUE == file) {
+                ReleaseSemaphore(pl->free_slots, 1, NULL);
+                if (hash) {
+                    BCryptDestroyHash(hash);
+                }
+                return EXPORT_ABORT;
+            }
+        }
+        c->file = file;
+        c->size = actual_size;
+        c->xwf_id = xwf_id;
+        pl->head = (pl->head + 1) % pl->depth;
+        ReleaseSemaphore(pl->full_slots, 1, NULL);
+        // Limited when queued, the writer thread never waits for tokens
+        QosTake(&qos.write, actual_size);
+    }
+
+    // The file must not be closed while chunks are still queued
+    PipelineDrain(pl);
+    if (deferred) {
+        if (file) {
+            CloseHandle(file);
+            DeleteFileW(filepath);
+        }
+        if (hash) {
+            BCryptDestroyHash(hash);
+        }
+        return EXPORT_DEFERRED;
+    }
+    if (hash) {
+        HashEnd(hash, xf);
+    }
+    CheckEnd(&check, xf);
+    if (NULL == file) {
+        return EXPORT_EMPTY;
+    }
+    if (!CloseExportFile(file) || pl->failed) {
+        ExportWriteError();
+        return EXPORT_ABORT;
+    }
+    if (CheckKnownHash(xf)) {
+        DeleteFileW(filepath);
+        return EXPORT_KNOWN;
+    }
+    return EXPORT_DONE;
+}
+
+// Copies the data of a single item into filepath
+int
+ExportItem(struct XtExport *ex, INT64 xwf_id, struct XtFile *xf, LPCWSTR filepath) {
+    // Since we are accessing file data outside of ProcessItemEx,
+    // we need to manually open and close the file handle.
+    INT64 t_open = TRACE_BEGIN();
+    HANDLE hItem = XWF_OpenItem(ex->hVolume, xwf_id, 1);
+    TRACE_END(TRACE_OPEN, t_open, xwf_id, 0);
+    if (0 == hItem) {
+        // This happens when X-Ways cannot access the file contents
+        return EXPORT_INACCESSIBLE;
+    }
+
+    int rv;
+    if (options.read_ahead && xf->filesize > options.chunk_size) {
+        rv = ExportPipelined(ex, hItem, xwf_id, xf, filepath);
+    } else {
+        rv = ExportDirect(ex, hItem, xwf_id, xf, filepath);
+    }
+    XWF_Close(hItem);
+
+    return rv;
+}
+
+// Exports a file whose data has already been read, see CoalesceData
+int
+ExportSlice(struct XtExport *ex, INT64 xwf_id, struct XtFile *xf,
+            LPCWSTR filepath, const BYTE *data) {
+    if (0 == xf->filesize) {
+        return EXPORT_EMPTY;
+    }
+    struct XtCheck check;
+    CheckBegin(&check);
+    CheckFeed(&check, data, (DWORD) xf->filesize);
+    CheckEnd(&check, xf);
+    ExportProbe(ex, NULL, data, (DWORD) xf->filesize, xf->filesize);
+
+    BCRYPT_HASH_HANDLE hash = HashBegin();
+    if (hash) {
+        BCryptHashData(hash, (PUCHAR) data, (ULONG) xf->filesize, 0);
+        HashEnd(hash, xf);
+        if (CheckKnownHash(xf)) {
+            return EXPORT_KNOWN;
+        }
+        if (StoreLink(filepath, xf, data)) {
+            return EXPORT_DONE;
+        }
+    }
+
+    HANDLE file = CreateExportFile(filepath, xwf_id);
+    if (INVALID_HANDLE_VALUE == file) {
+        return EXPORT_ABORT;
+    }
+    INT64 t_write = TRACE_BEGIN();
+    BOOL written = WriteFile(file, data, (DWORD) xf->filesize, NULL, NULL);
+    TRACE_END(TRACE_WRITE, t_write, xwf_id, xf->filesize);
+    QosTake(&qos.write, (double) xf->filesize);
+    CloseHandle(file);
+    if (FALSE == written) {
+        ExportWriteError();
+        return EXPORT_ABORT;
+    }
+    return EXPORT_DONE;
+}
+
+// Reads the volume geometry needed to locate item data
+VOID
+CoalesceInit(struct XtExport *ex) {
+    if (NULL == XWF_GetItemOfs || NULL == XWF_GetVolumeInformation) {
+        return;
+    }
+    LONG file_system = 0;
+    DWORD bytes_per_sector = 0;
+    DWORD sectors_per_cluster = 0;
+    INT64 cluster_count = 0;
+    INT64 first_cluster = 0;
+    XWF_GetVolumeInformation(ex->hVolume, &file_system, &bytes_per_sector,
+                             &sectors_per_cluster, &cluster_count, &first_cluster);
+    ex->sector_size = bytes_per_sector;
+    ex->cluster_size = bytes_per_sector * sectors_per_cluster;
+}
+
+BOOL
+CoalesceCandidate(struct XtExport *ex, struct XtFile *xf) {
+    return ex->cluster_size
+           && -1 != xf->export_id
+           && 0 <= xf->data_ofs
+           && options.coalesce_max_file >= xf->filesize;
+}
+
+// Volume offset right after the last cluster of a file
+INT64
+CoalesceNext(struct XtExport *ex, struct XtFile *xf) {
+    return xf->data_ofs + (xf->filesize + ex->cluster_size - 1) / ex->cluster_size * ex->cluster_size;
+}
+
+// Reads the run of physically adjacent files that starts at worklist
+// position n. The next file of a run has to start in the cluster right
+// after the previous one, files skipped by the worklist are ignored.
+// Returns 1 if at least two files have been read
+// Returns 0 if not
+BOOL
+CoalesceRead(struct XtExport *ex, struct XtWorklist *wl, INT64 n, INT64 fc,
+             struct XtFile *first) {
+    struct XtRun *run = &ex->run;
+    struct XtFile file_buf;
+    INT64 end = first->data_ofs + first->filesize;
+    INT64 next = CoalesceNext(ex, first);
+    INT64 last = n;
+
+    for (INT64 m = n + 1; m < fc; m++) {
+        struct XtFile *xf = WorklistFile(wl, WorklistIndex(wl, m), &file_buf);
+        if (-1 == xf->export_id) {
+            continue;
+        }
+        if (!CoalesceCandidate(ex, xf)
+            || next != xf->data_ofs
+            || options.coalesce_buf < xf->data_ofs + xf->filesize - first->data_ofs) {
+            break;
+        }
+        end = xf->data_ofs + xf->filesize;
+        next = CoalesceNext(ex, xf);
+        last = m;
+    }
+    if (last == n) {
+        return 0;
+    }
+
+    if (NULL == run->buf) {
+        run->buf = malloc(options.coalesce_buf);
+        if (NULL == run->buf) {
+            return 0;
+        }
+    }
+    DWORD size = (DWORD) (end - first->data_ofs);
+    INT64 t_read = TRACE_BEGIN();
+    DWORD actual_size = XWF_Read(ex->hVolume, first->data_ofs, run->buf, size);
+    TRACE_END(TRACE_READ, t_read, -1, actual_size);
+    QosTake(&qos.read, actual_size);
+
+    run->start = first->data_ofs;
+    run->end = first->data_ofs + actual_size;
+    run->last = last;
+    return 1;
+}
+
+// Files spanning several clusters may be fragmented or compressed although
+// their first cluster is where we expect it, so their last bytes are
+// compared with the contents as read by X-Ways. Single cluster files and
+// contiguous files such as carved ones can be neither.
+// Returns 1 if the data read from the volume belongs to the file
+// Returns 0 if not
+BOOL
+CoalesceVerify(struct XtExport *ex, INT64 xwf_id, struct XtFile *xf, const BYTE *data) {
+    if (ex->cluster_size >= xf->filesize || xf->contiguous) {
+        return 1;
+    }
+    INT64 t_open = TRACE_BEGIN();
+    HANDLE hItem = XWF_OpenItem(ex->hVolume, xwf_id, 1);
+    TRACE_END(TRACE_OPEN, t_open, xwf_id, 0);
+    if (0 == hItem) {
+        return 0;
+    }
+    BYTE tail[COALESCE_TAIL];
+    INT64 offset = xf->filesize - COALESCE_TAIL;
+    DWORD actual_size = ReadItem(hItem, xwf_id, offset, tail, COALESCE_TAIL, xf->filesize);
+    XWF_Close(hItem);
+    return COALESCE_TAIL == actual_size && 0 == memcmp(tail, data + offset, COALESCE_TAIL);
+}
 
-    return (XmlWriteString(file, L"<")
-            && XmlWriteString(file, tag1)
-            && XmlWriteString(file, L">\r\n  <path><![CDATA[")
-            && XmlWriteString(file, subdir)
-            && XmlWriteString(file, L"\\]]></path>\r\n  <")
-            && XmlWriteString(file, tag2)
-            && XmlWriteString(file, L">")
-            && XmlWriteString(file, id)
-            && XmlWriteString(file, L"</")
-            && XmlWriteString(file, tag2)
-            && XmlWriteString(file, L">\r\n  <id>")
-            && XmlWriteString(file, id)
-            && XmlWriteString(file, L"</id>\r\n  <category>0</category>\r\n  <f"
-                                    "ileoffset>0</fileoffset>\r\n  <fullpath><"
-                                    "![CDATA[")
-            && XmlWriteString(file, xf->fullpath)
-            && XmlWriteString(file, L"]]></fullpath>\r\n  <created>")
-            && XmlWriteString(file, ctime)
-            && XmlWriteString(file, L"</created>\r\n  <accessed>")
-            && XmlWriteString(file, atime)
-            && XmlWriteString(file, L"</accessed>\r\n  <written>")
-            && XmlWriteString(file, wtime)
-            && XmlWriteString(file, L"</written>\r\n  <fileSize>")
-            && XmlWriteString(file, size)
-            && XmlWriteString(file, L"</fileSize>\r\n</")
-            && XmlWriteString(file, tag1)
-            && XmlWriteString(file, L">\r\n"));
+// Returns the data of the file at worklist position n if it is part of a
+// run of physically adjacent files, reading the whole run on first use
+// Returns NULL if the file has to be read on its own
+const BYTE *
+CoalesceData(struct XtExport *ex, struct XtWorklist *wl, INT64 n, INT64 fc,
+             struct XtFile *xf, INT64 xwf_id) {
+    struct XtRun *run = &ex->run;
+    if (!CoalesceCandidate(ex, xf)) {
+        return NULL;
+    }
+    BOOL covered = run->buf && n <= run->last && run->start <= xf->data_ofs
+                   && xf->data_ofs + xf->filesize <= run->end;
+    if (!covered) {
+        if (!CoalesceRead(ex, wl, n, fc, xf)
+            || xf->data_ofs + xf->filesize > run->end) {
+            return NULL;
+        }
+    }
+    const BYTE *data = run->buf + (xf->data_ofs - run->start);
+    return CoalesceVerify(ex, xwf_id, xf, data) ? data : NULL;
 }
 
-// Creates templates for the three xml report files in dir and also
-// subdirectories for images and videos.
-// Returns 1 if all directories and files were created
-// Returns 0 otherwise
-BOOL
-XmlCreateReportFiles(LPCWSTR dir, struct XtReport *report) {
-    PWSTR img_subdir = NULL;
-    PWSTR vid_subdir = NULL;
-    PWSTR case_report = NULL;
-    PWSTR image_index = NULL;
-    PWSTR movie_index = NULL;
+VOID
+ExportCleanup(struct XtExport *ex) {
+    PipelineStop(&ex->pipeline);
+    free(ex->buf);
+    ex->buf = NULL;
+    ex->buf_size = 0;
+    free(ex->run.buf);
+    ZeroMemory(&ex->run, sizeof(struct XtRun));
+    free(ex->exif.thumb);
+    ZeroMemory(&ex->exif, sizeof(struct XtExif));
+    free(ex->deferred);
+    ex->deferred = NULL;
+    ex->deferred_count = 0;
+    ex->deferred_cap = 0;
+    QosBackground(&qos.background, 0);
+}
 
-    PathAllocCombine(dir, IMG_SUBDIR, 0, &img_subdir);
-    PathAllocCombine(dir, VID_SUBDIR, 0, &vid_subdir);
-    PathAllocCombine(dir, CASE_REPORT, 0, &case_report);
-    PathAllocCombine(dir, IMG_REPORT, 0, &image_index);
-    PathAllocCombine(dir, VID_REPORT, 0, &movie_index);
+VOID
+PreflightInit() {
+    // The DLL stays loaded between runs
+    ZeroMemory(&preflight, sizeof(struct XtPreflight));
+    preflight.dry_run = GetPrivateProfileIntW(L"Preflight", L"DryRun", 0, options_path);
+    preflight.free_space = GetPrivateProfileIntW(L"Preflight", L"FreeSpace", PREFLIGHT_WARN, options_path);
+    preflight.reserve = (INT64) GetPrivateProfileIntW(L"Preflight", L"ReserveMB", 1024, options_path) * 1024 * 1024;
+    preflight.samples = GetPrivateProfileIntW(L"Preflight", L"Samples", 16, options_path);
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    preflight.frequency = frequency.QuadPart;
+}
 
-    CreateDirectoryW(dir, NULL);
-    CreateDirectoryW(img_subdir, NULL);
-    CreateDirectoryW(vid_subdir, NULL);
+// Formats a byte count for log messages
+VOID
+FormatSize(INT64 bytes, LPWSTR buf, size_t len) {
+    if (1024LL * 1024 * 1024 <= bytes) {
+        StringCchPrintfW(buf, len, L"%.1f GB", bytes / (1024.0 * 1024 * 1024));
+    } else if (1024 * 1024 <= bytes) {
+        StringCchPrintfW(buf, len, L"%.1f MB", bytes / (1024.0 * 1024));
+    } else {
+        StringCchPrintfW(buf, len, L"%lld KB", (bytes + 1023) / 1024);
+    }
+}
 
-    report->ref_count = 1;
-    report->xml_case_report = MyCreateFile(case_report);
-    report->xml_image_index = MyCreateFile(image_index);
-    report->xml_movie_index = MyCreateFile(movie_index);
-    StringCchCopyW(report->export_path, MAX_PATH, dir);
+VOID
+FormatDuration(double seconds, LPWSTR buf, size_t len) {
+    INT64 s = (INT64) (seconds + 0.5);
+    StringCchPrintfW(buf, len, L"%lld:%02lld:%02lld", s / 3600, s / 60 % 60, s % 60);
+}
 
-    LocalFree(img_subdir);
-    LocalFree(vid_subdir);
-    LocalFree(case_report);
-    LocalFree(image_index);
-    LocalFree(movie_index);
+// Returns the bytes available in the export directory, -1 if unknown.
+// cluster receives the allocation unit of the destination volume.
+INT64
+PreflightFreeSpace(DWORD *cluster) {
+    *cluster = 4096;
+    ULARGE_INTEGER available;
+    if (!GetDiskFreeSpaceExW(export_dir, &available, NULL, NULL)) {
+        return -1;
+    }
+    // GetDiskFreeSpaceW only accepts root directories
+    WCHAR root[MAX_PATH];
+    StringCchCopyW(root, MAX_PATH, export_dir);
+    DWORD sectors_per_cluster = 0;
+    DWORD bytes_per_sector = 0;
+    DWORD free_clusters = 0;
+    DWORD total_clusters = 0;
+    if (SUCCEEDED(PathCchStripToRoot(root, MAX_PATH))
+        && SUCCEEDED(PathCchAddBackslash(root, MAX_PATH))
+        && GetDiskFreeSpaceW(root, &sectors_per_cluster, &bytes_per_sector,
+                             &free_clusters, &total_clusters)
+        && 0 < sectors_per_cluster * bytes_per_sector) {
+        *cluster = sectors_per_cluster * bytes_per_sector;
+    }
+    return available.QuadPart;
+}
 
-    if (INVALID_HANDLE_VALUE == report->xml_case_report
-        || INVALID_HANDLE_VALUE == report->xml_image_index
-        || INVALID_HANDLE_VALUE == report->xml_movie_index) {
-        return 0;
+// Measures the write throughput of the export directory once per run.
+// Bypasses the write cache, which would absorb the whole sample but not
+// a sustained export.
+VOID
+PreflightSampleWrite() {
+    if (preflight.write_rate) {
+        return;
+    }
+    PWSTR path = NULL;
+    PathAllocCombine(export_dir, PREFLIGHT_TMP, 0, &path);
+    HANDLE file = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_WRITE_THROUGH
+                              | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    LocalFree(path);
+    BYTE *buf = malloc(PREFLIGHT_CHUNK);
+    if (INVALID_HANDLE_VALUE == file || NULL == buf) {
+        if (INVALID_HANDLE_VALUE != file) {
+            CloseHandle(file);
+        }
+        free(buf);
+        return;
+    }
+    // Avoid zeros, compressing destinations would write them for free
+    for (DWORD k = 0; k < PREFLIGHT_CHUNK; k++) {
+        buf[k] = (BYTE) (k * 2654435761U >> 24);
     }
 
-    XmlWriteReport(report->xml_case_report);
-    XmlWriteIndex(report->xml_image_index);
-    XmlWriteIndex(report->xml_movie_index);
+    INT64 total = 0;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&start);
+    for (DWORD k = 0; k < PREFLIGHT_WRITE_LEN / PREFLIGHT_CHUNK; k++) {
+        DWORD written = 0;
+        if (!WriteFile(file, buf, PREFLIGHT_CHUNK, &written, NULL)) {
+            break;
+        }
+        total += written;
+    }
+    QueryPerformanceCounter(&end);
+    CloseHandle(file);
+    free(buf);
 
-    return 1;
+    INT64 ticks = end.QuadPart - start.QuadPart;
+    if (total && 0 < ticks) {
+        preflight.write_rate = (double) total * preflight.frequency / ticks;
+    }
 }
 
-BOOL
-XmlAppendImage(struct XtFile *xf, struct XtReport *report) {
-    return XmlWriteXtFile(report->xml_image_index, xf,
-                          L"Image", L"picture", IMG_SUBDIR);
+// Opens and reads the beginning of up to preflight.samples files, spread
+// evenly across the files of this volume
+VOID
+PreflightSampleRead(HANDLE hVolume, INT64 fc, INT64 count, struct XtWorklist *wl) {
+    if (0 == preflight.samples || 0 == count) {
+        return;
+    }
+    BYTE *buf = malloc(PREFLIGHT_READ_LEN);
+    if (NULL == buf) {
+        return;
+    }
+    INT64 step = count > preflight.samples ? count / preflight.samples : 1;
+    INT64 seen = 0;
+    struct XtFileId id_buf;
+    struct XtFile file_buf;
+    for (INT64 i = 0; i < fc && !XWF_ShouldStop(); i++) {
+        struct XtFile *xf = WorklistFile(wl, i, &file_buf);
+        if (-1 == xf->export_id || seen++ % step) {
+            continue;
+        }
+        INT64 xwf_id = WorklistId(wl, i, &id_buf)->xwf_id;
+        LARGE_INTEGER t0;
+        LARGE_INTEGER t1;
+        LARGE_INTEGER t2;
+        QueryPerformanceCounter(&t0);
+        HANDLE hItem = XWF_OpenItem(hVolume, xwf_id, 1);
+        QueryPerformanceCounter(&t1);
+        if (0 == hItem) {
+            continue;
+        }
+        DWORD size = xf->filesize > PREFLIGHT_READ_LEN ? PREFLIGHT_READ_LEN : (DWORD) xf->filesize;
+        DWORD actual_size = ReadItem(hItem, xwf_id, 0, buf, size, xf->filesize);
+        QueryPerformanceCounter(&t2);
+        XWF_Close(hItem);
+
+        preflight.open_ticks += t1.QuadPart - t0.QuadPart;
+        preflight.opened++;
+        preflight.read_ticks += t2.QuadPart - t1.QuadPart;
+        preflight.read_bytes += actual_size;
+    }
+    free(buf);
 }
 
-BOOL
-XmlAppendMovie(struct XtFile *xf, struct XtReport *report) {
-    return XmlWriteXtFile(report->xml_movie_index, xf,
-                          L"Movie", L"movie", VID_SUBDIR);
+// Estimated export duration in seconds, 0 if nothing could be measured.
+// Reads and writes overlap, the slower side determines the throughput.
+double
+PreflightEstimate(INT64 count, INT64 bytes) {
+    if (0 == preflight.opened || 0 == preflight.read_ticks || 0 == preflight.read_bytes) {
+        return 0;
+    }
+    double open_latency = (double) preflight.open_ticks / preflight.opened / preflight.frequency;
+    double rate = (double) preflight.read_bytes * preflight.frequency / preflight.read_ticks;
+    if (preflight.write_rate && preflight.write_rate < rate) {
+        rate = preflight.write_rate;
+    }
+    // Configured limits, as far as they are slower
+    if (qos.read.rate && qos.read.rate < rate) {
+        rate = qos.read.rate;
+    }
+    if (qos.write.rate && qos.write.rate < rate) {
+        rate = qos.write.rate;
+    }
+    double seconds = count * open_latency + bytes / rate;
+    if (qos.files.rate && count / qos.files.rate > seconds) {
+        seconds = count / qos.files.rate;
+    }
+    return seconds;
 }
 
-void
-XmlFinishReport(struct XtReport *report, BOOL report_type, PWSTR evidence_name) {
-    if (report && 1 == report->ref_count--) {
-        // This is the last reference, close tags and release files
-        XmlWriteString(report->xml_image_index, L"</ReportIndex>");
-        XmlWriteString(report->xml_movie_index, L"</ReportIndex>");
-
-        CloseHandle(report->xml_case_report);
-        CloseHandle(report->xml_image_index);
-        CloseHandle(report->xml_movie_index);
-
-        // One log entry per evidence item
-        WCHAR buf[512];
-        LPCWSTR info_text =
-                report_type == REPORT_TYPE_EXISTING ? L"[%ls]: Exported %d images and %d videos from existing files"
-                                                    : L"[%ls]: Exported %d images and %d videos from deleted files";
-        StringCchPrintfW(buf, 512,
-                         info_text,
-                         evidence_name,
-                         report->image_count,
-                         report->movie_count);
-        XWF_OutputMessage(buf, 0);
-        if (report->size_mismatch_count) {
-            StringCchPrintfW(buf, 512,
-                             L"[*] including %d files with inaccurate si"
-                             "ze (see report table)",
-                             report->size_mismatch_count);
-            XWF_OutputMessage(buf, 0);
+// Counts files and bytes by type and deletion status, compares the space
+// they need with the free space of the export directory and, for a dry
+// run, estimates the duration of the export.
+// Returns 1 if the files of this volume should be exported
+// Returns 0 for a dry run or if there is not enough free space
+BOOL
+PreflightVolume(HANDLE hVolume, INT64 fc, struct XtWorklist *wl) {
+    DWORD cluster = 0;
+    INT64 available = PreflightFreeSpace(&cluster);
+
+    // By deletion status and type
+    INT64 counts[2][2] = {0};
+    INT64 sizes[2][2] = {0};
+    INT64 count = 0;
+    INT64 bytes = 0;
+    INT64 needed = 0;
+    struct XtFileId id_buf;
+    struct XtFile file_buf;
+    for (INT64 i = 0; i < fc; i++) {
+        struct XtFile *xf = WorklistFile(wl, i, &file_buf);
+        if (-1 == xf->export_id) {
+            continue;
         }
-        if (report->inaccessible_count) {
+        int deleted = 0 != xf->deleted;
+        int video = TYPE_VIDEO == WorklistId(wl, i, &id_buf)->type;
+        counts[deleted][video]++;
+        sizes[deleted][video] += xf->filesize;
+        count++;
+        bytes += xf->filesize;
+        needed += (xf->filesize + cluster - 1) / cluster * cluster + PREFLIGHT_XML_BYTES;
+    }
+
+    WCHAR buf[512];
+    WCHAR size1[32];
+    WCHAR size2[32];
+    WCHAR size3[32];
+    if (preflight.dry_run) {
+        StatusPhase("preflight", count, bytes);
+        for (int deleted = 0; deleted < 2; deleted++) {
+            if (0 == counts[deleted][0] + counts[deleted][1]) {
+                continue;
+            }
+            FormatSize(sizes[deleted][0], size1, 32);
+            FormatSize(sizes[deleted][1], size2, 32);
             StringCchPrintfW(buf, 512,
-                             L"[*] excluding %d inaccessible files (see "
-                             "report table)",
-                             report->inaccessible_count);
+                             deleted ? L"[%ls]: %lld images (%ls) and %lld videos (%ls) from deleted files"
+                                     : L"[%ls]: %lld images (%ls) and %lld videos (%ls) from existing files",
+                             current_volume->name_ex,
+                             counts[deleted][0], size1, counts[deleted][1], size2);
             XWF_OutputMessage(buf, 0);
         }
-        if (report->empty_count) {
-            StringCchPrintfW(buf, 512,
-                             L"[*] excluding %d empty files",
-                             report->empty_count);
+
+        PreflightSampleWrite();
+        PreflightSampleRead(hVolume, fc, count, wl);
+        double seconds = PreflightEstimate(count, bytes);
+        if (seconds) {
+            FormatDuration(seconds, size1, 32);
+            StringCchPrintfW(buf, 512, L"[*] estimated export duration %ls", size1);
             XWF_OutputMessage(buf, 0);
         }
 
-        // Remove any empty export directories
-        LPWSTR dir = report->export_path;
-
-        PWSTR img_subdir = NULL;
-        PWSTR vid_subdir = NULL;
-        PWSTR case_report = NULL;
-        PWSTR image_index = NULL;
-        PWSTR movie_index = NULL;
-
-        PathAllocCombine(dir, IMG_SUBDIR, 0, &img_subdir);
-        PathAllocCombine(dir, VID_SUBDIR, 0, &vid_subdir);
-        PathAllocCombine(dir, CASE_REPORT, 0, &case_report);
-        PathAllocCombine(dir, IMG_REPORT, 0, &image_index);
-        PathAllocCombine(dir, VID_REPORT, 0, &movie_index);
+        preflight.files += count;
+        preflight.bytes += bytes;
+        preflight.needed += needed;
+        preflight.seconds += seconds;
+        // Nothing is written, compare everything found so far
+        needed = preflight.needed;
+    }
 
-        if (0 == report->image_count) {
-            DeleteFileW(image_index);
-            RemoveDirectoryW(img_subdir);
-        }
-        if (0 == report->movie_count) {
-            DeleteFileW(movie_index);
-            RemoveDirectoryW(vid_subdir);
-        }
-        if (0 == report->image_count
-            && 0 == report->movie_count) {
-            DeleteFileW(case_report);
-            RemoveDirectoryW(dir);
-        }
+    if (PREFLIGHT_OFF == preflight.free_space || 0 > available
+        || needed + preflight.reserve <= available) {
+        return !preflight.dry_run;
+    }
 
-        LocalFree(img_subdir);
-        LocalFree(vid_subdir);
-        LocalFree(case_report);
-        LocalFree(image_index);
-        LocalFree(movie_index);
+    FormatSize(needed, size1, 32);
+    FormatSize(available, size2, 32);
+    FormatSize(preflight.reserve, size3, 32);
+    if (PREFLIGHT_REFUSE == preflight.free_space && !preflight.dry_run) {
+        StringCchPrintfW(buf, 512,
+                         L"ERROR: Griffeye XML export X-Tension needs about %ls "
+                         "plus %ls reserve, but only %ls are free in the export"
+                         " directory. Aborting.", size1, size3, size2);
+        XWF_OutputMessage(buf, 0);
+        preflight.refused = 1;
+        StatusAbort();
+        return 0;
     }
+    StringCchPrintfW(buf, 512,
+                     L"WARNING: Griffeye XML export X-Tension needs about %ls "
+                     "plus %ls reserve, but only %ls are free in the export dire"
+                     "ctory.", size1, size3, size2);
+    XWF_OutputMessage(buf, 0);
+    return !preflight.dry_run;
 }
 
 // Executed once before processing
@@ -845,7 +7333,7 @@ XT_Init(DWORD nVersion, DWORD nFlags, HANDLE hMainWnd, void *LicInfo) {
         return -1;
     }
 
-    // From here on we always return 1, even when an error occurs.
+    // From here on we never return -1, even when an error occurs.
     // Returning -1 would provoke additional error messages in X-Ways
     // which suggest that the X-Tension is not working properly.
     // We will check export_dir variable instead and abort silently
@@ -878,6 +7366,8 @@ XT_Init(DWORD nVersion, DWORD nFlags, HANDLE hMainWnd, void *LicInfo) {
 
     // Show 'select folder' dialog, starting at case directory
     XWF_GetCaseProp(NULL, XWF_CASEPROP_DIR, export_dir, MAX_PATH);
+    LoadOptions(export_dir);
+    TraceInit();
     if (0 == BrowseForExportDir(export_dir)) {
         // Silent fail condition
         export_dir[0] = L'\0';
@@ -886,8 +7376,66 @@ XT_Init(DWORD nVersion, DWORD nFlags, HANDLE hMainWnd, void *LicInfo) {
         return 1;
     }
 
+    if (!ManifestOpen(export_dir)) {
+        export_dir[0] = L'\0';
+        XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension could not c"
+                          "reate the export manifest. Aborting.", 0);
+        return 1;
+    }
+
+    StatusInit(export_dir);
+    PreflightInit();
+    TuneInit();
+
+    if (!FilterInit()) {
+        export_dir[0] = L'\0';
+        XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension found an in"
+                          "valid [Filter] setting. Aborting.", 0);
+        return 1;
+    }
+    if (!ScheduleInit()) {
+        export_dir[0] = L'\0';
+        XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension found an in"
+                          "valid [Schedule] setting. Aborting.", 0);
+        return 1;
+    }
+
+    if ((options.shard_count || options.shard_index)
+        && (1 > options.shard_index || options.shard_index > options.shard_count)) {
+        export_dir[0] = L'\0';
+        XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension found an in"
+                          "valid [Shard] setting. Aborting.", 0);
+        return 1;
+    }
+
+    if (!StoreOpen()) {
+        export_dir[0] = L'\0';
+        XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension could not o"
+                          "pen the content store. Aborting.", 0);
+        return 1;
+    }
+    if (!HashSetsInit()) {
+        export_dir[0] = L'\0';
+        XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension could not l"
+                          "oad a configured hash set. Aborting.", 0);
+        return 1;
+    }
+
     XWF_OutputMessage(L"Griffeye XML export target:", 0);
     XWF_OutputMessage(export_dir, 1);
+    if (delta.count) {
+        WCHAR buf[128];
+        StringCchPrintfW(buf, 128, L"Delta export: %lld files were exported by previous runs", delta.count);
+        XWF_OutputMessage(buf, 0);
+    }
+    if (options.shard_count) {
+        WCHAR buf[128];
+        StringCchPrintfW(buf, 128, L"Shard export: exporting shard %u of %u",
+                         options.shard_index, options.shard_count);
+        XWF_OutputMessage(buf, 0);
+    }
+    QosInit(export_dir);
+    last_checkpoint = GetTickCount64();
 
     if (!XWF_GetFirstEvObj(NULL)) {
         // Empty case
@@ -897,8 +7445,11 @@ XT_Init(DWORD nVersion, DWORD nFlags, HANDLE hMainWnd, void *LicInfo) {
         return 1;
     }
 
-    // 1: We are NOT thread-safe
-    return 1;
+    StatusPhase("start", 0, 0);
+
+    // 2: XT_ProcessItem is thread-safe, X-Ways may call it
+    // from all of its volume snapshot refinement threads
+    return 2;
 }
 
 // Called before each volume (e.g. every partition of a hard drive)
@@ -943,8 +7494,8 @@ XT_Prepare(HANDLE hVolume, HANDLE hEvidence, DWORD nOpType, PVOID lpReserved) {
             return -1; // Do not call any other X-Tension function
     }
 
-    // Silent fail condition
-    if (L'\0' == export_dir[0]) {
+    // Silent fail condition, also after the free space check failed
+    if (L'\0' == export_dir[0] || preflight.refused) {
         return -1;
     }
 
@@ -996,14 +7547,18 @@ XT_Prepare(HANDLE hVolume, HANDLE hEvidence, DWORD nOpType, PVOID lpReserved) {
 
     // Find or create volume struct
     BOOL volume_exists = SetCurrentVolume(shortname);
+    StatusPhase("classify", 0, 0);
 
     // Allocate enough memory for all files
     DWORD item_count = XWF_GetItemCount(NULL);
-    if (current_volume->file_ids) {
-        free(current_volume->file_ids);
+    DirCacheReset(item_count);
+    if (!WorklistOpen(&current_volume->worklist, item_count)) {
+        XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension could n"
+                          "ot allocate the worklist. Aborting.", 0);
+        return -1;
     }
-    current_volume->file_ids = malloc(sizeof(struct XtFileId) * item_count);
     current_volume->file_count = 0;
+    current_volume->hVolume = hVolume;
 
     // Update extended name for <fullpath> report tag
     StringCchCopyW(current_volume->name_ex, NAME_BUF_LEN, name_ex);
@@ -1012,42 +7567,39 @@ XT_Prepare(HANDLE hVolume, HANDLE hEvidence, DWORD nOpType, PVOID lpReserved) {
         return return_value;
     }
 
-    // New volume was created, initialize current_volume
-    StringCchCopyW(current_volume->name, NAME_BUF_LEN, shortname);
-
-    // We need to create new report files to split evidence items in separate directories.
+    // New volume was created. Its report files are created by ReportOpen
+    // before the first export, most evidence items of large cases do not
+    // contain any pictures or videos.
     PWSTR volume_dir_existing = NULL;
     PWSTR volume_dir_deleted = NULL;
     PathAllocCombine(export_dir_existing, current_volume->name, 0, &volume_dir_existing);
     PathAllocCombine(export_dir_deleted, current_volume->name, 0, &volume_dir_deleted);
     current_volume->report_existing = calloc(1, sizeof(struct XtReport));
     current_volume->report_deleted = calloc(1, sizeof(struct XtReport));
-    BOOL success_existing = XmlCreateReportFiles(volume_dir_existing, current_volume->report_existing);
-    BOOL success_deleted = XmlCreateReportFiles(volume_dir_deleted, current_volume->report_deleted);
+    current_volume->report_existing->ref_count = 1;
+    current_volume->report_deleted->ref_count = 1;
+    StringCchCopyW(current_volume->report_existing->export_path, MAX_PATH, volume_dir_existing);
+    StringCchCopyW(current_volume->report_deleted->export_path, MAX_PATH, volume_dir_deleted);
+    DeltaInitReport(current_volume->report_existing, current_volume->name_hash, REPORT_TYPE_EXISTING);
+    DeltaInitReport(current_volume->report_deleted, current_volume->name_hash, REPORT_TYPE_DELETED);
     LocalFree(volume_dir_existing);
     LocalFree(volume_dir_deleted);
 
-    if (success_existing && success_deleted) {
-        return return_value;
-    } else {
-        XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension could n"
-                          "ot create a file. Aborting.", 0);
-        // Returning -1 would prevent the XT_Finalize call, use
-        // silent fail condition in XT_ProcessItemEx instead.
-        export_dir[0] = L'\0';
-        return 0;
-    }
+    return return_value;
 }
 
-// Called for every file
+// Called for every file, possibly from several threads at once.
+// Everything used here is either read-only during the volume snapshot
+// refinement or updated with interlocked operations.
 EXPORT LONG XTAPI
 XT_ProcessItem(LONG nItemID, PVOID lpReserved) {
     // Silent fail condition
     if (L'\0' == export_dir[0]) {
         return 0;
     }
+    struct XtVolume *volume = current_volume;
     // This should never happen
-    if (NULL == current_volume) {
+    if (NULL == volume) {
         XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension could not a"
                           "ssociate the file with a volume. Aborting.", 0);
         return -1;
@@ -1059,7 +7611,10 @@ XT_ProcessItem(LONG nItemID, PVOID lpReserved) {
     DWORD flags = 0x40000000; // File type category
     int type = TYPE_OTHER;
 
-    if (-1 == XWF_GetItemType(nItemID, type_buf, len | flags)) {
+    INT64 t_classify = TRACE_BEGIN();
+    LONG item_type = XWF_GetItemType(nItemID, type_buf, len | flags);
+    TRACE_END(TRACE_CLASSIFY, t_classify, nItemID, 0);
+    if (-1 == item_type) {
         return 0;
     }
     if (0 == lstrcmpW(type_buf, L"Pictures")) {
@@ -1071,10 +7626,49 @@ XT_ProcessItem(LONG nItemID, PVOID lpReserved) {
         return 0;
     }
 
-    // Enumerate file for further processing
-    INT64 fc = current_volume->file_count++;
-    current_volume->file_ids[fc].xwf_id = nItemID;
-    current_volume->file_ids[fc].type = type;
+    // Leave files of other shards to their instances
+    if (options.shard_count && !ShardOwns(volume->name_hash, nItemID)) {
+        struct XtReport *report = XWF_GetItemInformation(nItemID, XWF_ITEM_INFO_DELETION, NULL)
+                                  ? volume->report_deleted : volume->report_existing;
+        InterlockedIncrement(&report->shard_skipped_count);
+        return 0;
+    }
+
+    // Skip files outside the configured metadata criteria
+    if (filter.enabled) {
+        BOOL deleted = XWF_GetItemInformation(nItemID, XWF_ITEM_INFO_DELETION, NULL);
+        int reason = FilterItem(nItemID, deleted);
+        if (FILTER_PASS != reason) {
+            struct XtReport *report = deleted ? volume->report_deleted : volume->report_existing;
+            InterlockedIncrement(&report->filtered_count[reason]);
+            return 0;
+        }
+    }
+
+    // Skip files that a previous run has already exported, unless
+    // their size has changed in the meantime
+    struct XtDeltaEntry *previous = DeltaLookup(volume->name_hash, nItemID);
+    if (previous && previous->filesize == XWF_GetItemSize(nItemID)) {
+        struct XtReport *report =
+                previous->deleted ? volume->report_deleted : volume->report_existing;
+        InterlockedIncrement(&report->delta_skipped_count);
+        return 0;
+    }
+
+    // Skip icons, sprites and tracking pixels by their header dimensions
+    if (TYPE_PICTURE == type
+        && (options.min_width || options.min_height || options.min_pixels)
+        && IsImageTooSmall(volume->hVolume, nItemID)) {
+        struct XtReport *report = XWF_GetItemInformation(nItemID, XWF_ITEM_INFO_DELETION, NULL)
+                                  ? volume->report_deleted : volume->report_existing;
+        InterlockedIncrement(&report->too_small_count);
+        return 0;
+    }
+
+    // Enumerate file for further processing. Every thread reserves its
+    // own slot, the worklist has room for all items of the volume.
+    INT64 fc = InterlockedIncrement64(&volume->file_count) - 1;
+    WorklistAddId(&volume->worklist, fc, nItemID, type);
 
     return 0;
 }
@@ -1083,195 +7677,243 @@ XT_ProcessItem(LONG nItemID, PVOID lpReserved) {
 EXPORT LONG XTAPI
 XT_Finalize(HANDLE hVolume, HANDLE hEvidence, DWORD nOpType, PVOID lpReserved) {
     const INT64 fc = current_volume->file_count;
-    if (0 == fc || NULL == current_volume->file_ids) {
+    struct XtWorklist *wl = &current_volume->worklist;
+    if (0 == fc || !WorklistReady(wl)) {
         return 0;
     }
     // Allocate enough memory for relevant files
-    if (current_volume->files) {
-        free(current_volume->files);
+    if (!WorklistAllocFiles(wl, fc)) {
+        XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension could n"
+                          "ot allocate the worklist. Aborting.", 0);
+        WorklistFree(wl);
+        return 0;
     }
-    current_volume->files = malloc(sizeof(struct XtFile) * fc);
-
-    struct XtFileId *file_ids = current_volume->file_ids;
-    struct XtFile *files = current_volume->files;
+    // Copies of spilled records
+    struct XtFileId id_buf;
+    struct XtFile file_buf;
 
     // We will calculate actual export progress by size, not by file count
     INT64 total_size = 0;
     INT64 exported_size = 0;
 
+    struct XtExport ex = {0};
+    ex.hVolume = hVolume;
+    // A dry run exports nothing, so neither coalescing nor the export
+    // order need the data offsets
+    BOOL offsets = !preflight.dry_run && (options.coalesce || schedule.offsets);
+    if (offsets) {
+        CoalesceInit(&ex);
+    }
+
     // Grab all necessary metadata
+    INT64 t_collect = TRACE_BEGIN();
     XWF_ShowProgress(L"[XT] Collecting metadata", 4);
     XWF_SetProgressPercentage(0);
+    StatusPhase("metadata", fc, 0);
     for (INT64 i = 0; i < fc; i++) {
         if (XWF_ShouldStop()) {
+            XWF_HideProgress();
+            StatusAbort();
+            WorklistFree(wl);
             return 0;
         }
-        if (GetXwfFileInfo(file_ids[i].xwf_id, &files[i])) {
-            total_size += files[i].filesize;
+        INT64 t_metadata = TRACE_BEGIN();
+        struct XtFileId *id = WorklistId(wl, i, &id_buf);
+        struct XtFile *xf = WorklistFile(wl, i, &file_buf);
+        BOOL valid = preflight.dry_run ? GetXwfFileSize(id->xwf_id, xf)
+                                       : GetXwfFileInfo(id->xwf_id, xf);
+        if (valid) {
+            total_size += xf->filesize;
+            xf->data_ofs = offsets ? GetItemDataOffset(id->xwf_id, xf->filesize, ex.sector_size,
+                                                       &xf->contiguous) : -1;
         } else {
-            files[i].export_id = -1;
+            xf->export_id = -1;
         }
-        XWF_SetProgressPercentage((i + 1) * 100 / fc);
+        WorklistPutFile(wl, i, xf);
+        TRACE_END(TRACE_METADATA, t_metadata, id->xwf_id, 0);
+        StatusProgress(i + 1, 0);
     }
     XWF_HideProgress();
+    TRACE_END(TRACE_COLLECT, t_collect, -1, total_size);
+
+    if ((preflight.dry_run || preflight.free_space)
+        && !PreflightVolume(hVolume, fc, wl)) {
+        WorklistFree(wl);
+        return 0;
+    }
 
     // Export files
+    INT64 t_export = TRACE_BEGIN();
     XWF_ShowProgress(L"[XT] Exporting files", 4);
     XWF_SetProgressPercentage(0);
+    StatusPhase("export", fc, total_size);
     WCHAR filepath[MAX_PATH] = {0};
     WCHAR filename[MAX_PATH] = {0};
-    for (INT64 i = 0; i < fc; i++) {
+    // Export IDs are assigned in export order, so the index stays sequential
+    ScheduleOrder(wl, fc);
+    QosBackground(&qos.background, qos.low_priority);
+    // Items deferred by slow reads follow the worklist, see ReadChunk
+    for (INT64 n = 0; n < fc + ex.deferred_count; n++) {
+        INT64 i = n < fc ? WorklistIndex(wl, n) : ex.deferred[n - fc];
         if (XWF_ShouldStop()) {
+            ExportCleanup(&ex);
+            XWF_HideProgress();
+            StatusAbort();
+            WorklistFree(wl);
             return 1;
         }
-        if (-1 == files[i].export_id) {
+        QosPoll();
+        ReportCheckpointPoll();
+        struct XtFileId *id = WorklistId(wl, i, &id_buf);
+        struct XtFile *xf = WorklistFile(wl, i, &file_buf);
+        if (-1 == xf->export_id) {
+            StatusProgress(n + 1 - ex.deferred_count, exported_size);
             continue;
         }
+        if (L'\0' == xf->fullpath[0]) {
+            GetXwfFilePath((LONG) id->xwf_id, xf);
+        }
+        INT64 t_item = TRACE_BEGIN();
         // Select report depending on file deletion status
         struct XtReport *report =
-                files[i].deleted == 0 ? current_volume->report_existing : current_volume->report_deleted;
+                xf->deleted == 0 ? current_volume->report_existing : current_volume->report_deleted;
+
+        if (!ReportOpen(report)) {
+            XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension could n"
+                              "ot create a file. Aborting.", 0);
+            ExportCleanup(&ex);
+            XWF_HideProgress();
+            StatusAbort();
+            WorklistFree(wl);
+            return 1;
+        }
 
         // filepath = root export directory for this evidence item
         StringCchCopyW(filepath, MAX_PATH, report->export_path);
         // filepath = filepath + [Pictures|Movies]
-        switch (file_ids[i].type) {
+        switch (id->type) {
             case TYPE_PICTURE:
                 PathCchAppend(filepath, MAX_PATH, IMG_SUBDIR);
-                files[i].export_id = report->image_count + 1;
+                xf->export_id = report->image_count + 1;
                 break;
             case TYPE_VIDEO:
                 PathCchAppend(filepath, MAX_PATH, VID_SUBDIR);
-                files[i].export_id = report->movie_count + 1;
+                xf->export_id = report->movie_count + 1;
                 break;
         }
         // filepath = filepath + file number
-        StringCchPrintfW(filename, MAX_PATH, L"%lld", files[i].export_id);
+        StringCchPrintfW(filename, MAX_PATH, L"%lld", xf->export_id);
         PathCchAppend(filepath, MAX_PATH, filename);
 
-        int export_successful = 0;
-        // It is possible that we will get less bytes from XWF_Read
-        INT64 expected_size = files[i].filesize;
-        // Since we are accessing file data outside of ProcessItemEx,
-        // we need to manually open and close the file handle.
-        HANDLE hItem = XWF_OpenItem(hVolume, file_ids[i].xwf_id, 1);
-        if (0 == hItem) {
-            // This happens when X-Ways cannot access the file contents
-            XWF_AddToReportTable(file_ids[i].xwf_id, REP_TABLE_FAILED, 1);
+        // Small adjacent files are sliced out of a single volume read
+        ex.type = id->type;
+        ex.slow = 0;
+        ex.defer = options.slow_read && n < fc && ExportDeferReserve(&ex);
+        xf->unreadable = 0;
+        xf->stored = 0;
+        // Files without data are never probed
+        ex.exif.valid = 0;
+        ex.video.valid = 0;
+        const BYTE *data = options.coalesce && n < fc
+                           ? CoalesceData(&ex, wl, n, fc, xf, id->xwf_id) : NULL;
+        int result;
+        if (data) {
+            result = ExportSlice(&ex, id->xwf_id, xf, filepath, data);
+            report->coalesced_count++;
+        } else {
+            result = ExportItem(&ex, id->xwf_id, xf, filepath);
+        }
+        if (EXPORT_ABORT == result) {
+            ExportCleanup(&ex);
+            XWF_HideProgress();
+            StatusAbort();
+            WorklistFree(wl);
+            return 1;
+        }
+        if (EXPORT_DEFERRED == result) {
+            ex.deferred[ex.deferred_count++] = i;
+            report->deferred_count++;
+            TRACE_END(TRACE_ITEM, t_item, id->xwf_id, 0);
+            continue;
+        }
+        if (EXPORT_INACCESSIBLE == result) {
+            XWF_AddToReportTable(id->xwf_id, REP_TABLE_FAILED, 1);
             report->inaccessible_count++;
+        } else if (EXPORT_EMPTY == result) {
+            report->empty_count++;
+        } else if (EXPORT_KNOWN == result) {
+            XWF_AddToReportTable(id->xwf_id, REP_TABLE_KNOWN, 1);
+            report->known_count++;
+            if (BENIGN_LIST == options.benign_action) {
+                KnownListAppend(report, xf);
+            }
         } else {
-            // declare all variables we need for reading the current file...
-            INT64 i64DataSizeRead = 0;       //amount of data of the current file that has already been processed
-            INT64 i64DataSizeToRead = 0;     //determines how much data to read in this iteration
-            HANDLE file = NULL;
-            DWORD actual_size = 0;
-
-            // Start of loop for exporting files...
-            while ((i64DataSizeRead < expected_size)) {
-                //if expected size - already read data >= chunk of data we want to read  --> we can still read a full chunk of data
-                //else read however much is left of the file
-                if (expected_size - i64DataSizeRead >= FILE_CHUNK) {
-                    i64DataSizeToRead = FILE_CHUNK;
-                } else {
-                    i64DataSizeToRead = expected_size - i64DataSizeRead;
-                }
-
-                //allocate memory
-                LPVOID filebuf = malloc(i64DataSizeToRead);
-
-                if (NULL == filebuf) {
-                    XWF_Close(hItem);
-                    XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension cou"
-                                      "ld not allocate memory for file export. "
-                                      "Aborting.", 0);
-
-                    // print erroring file
-                    // implicit conversion of wchar array to wstring pointer
-                    LPWSTR FileErrorPath = files[i].fullpath;
-                    XWF_OutputMessage(FileErrorPath, 0);
-
-                    XWF_HideProgress();
-                    return 1;
-                }
-
-                // Actual size can be less (or even zero)
-                actual_size = XWF_Read(hItem, i64DataSizeRead, filebuf, i64DataSizeToRead);
-                //remove the following "if" as soon as XWF_Read return value is fixed
-                //only overwrite actual_size if file is considered to be large because XWF_Read is returning 0 in that case --> should be fixed in future releases of X-Ways according to S. Fleischmann
-                if ((actual_size == 0) && (expected_size >= FILE_2GB)) {
-                    actual_size = i64DataSizeToRead;
-                }
-
-                //remember the amount of data we just read, to be able to calculate how much to read in the next iteration
-                i64DataSizeRead = i64DataSizeRead + i64DataSizeToRead;
-
-                if (0 == actual_size) {
-                    // Happens when X-Ways reports a filesize > 0 but the file
-                    // reference does not contain any actual data.
-                    free(filebuf);
-                    report->empty_count++;
-                } else {
-                    // Create file on first iteration, but only when we are actually going to export data
-                    if (NULL == file) {
-                        file = MyCreateFile(filepath);
-                    }
-                    if (INVALID_HANDLE_VALUE == file) {
-                        XWF_Close(hItem);
-                        free(filebuf);
-                        XWF_OutputMessage(L"ERROR: Griffeye XML export X-Tension cou"
-                                          "ld not create a file in the export direc"
-                                          "tory. Aborting.", 0);
-
-                        XWF_HideProgress();
-                        return 1;
-                    }
-
-                    BOOL rv = WriteFile(file, filebuf, actual_size, NULL, NULL);
-                    free(filebuf);
-
-                    if (FALSE == rv) {
-                        CloseHandle(file);
-                        XWF_Close(hItem);
-                        XWF_OutputMessage(L"ERROR: Griffeye XML export X-Ten"
-                                          "sion could not write to export d"
-                                          "irectory. Aborting.", 0);
-                        XWF_HideProgress();
-                        return 1;
-                    }
-                    // If we came this far, at least some data has been exported
-                    export_successful = 1;
-                }//XWF_Read return > 0
-            } //while loop exporting file
-
-            CloseHandle(file);
-            XWF_Close(hItem);
-
-            XWF_AddToReportTable(file_ids[i].xwf_id, REP_TABLE_SUCCESS, 1);
-
-        }//XWF could access current file
+            INT64 t_rtable = TRACE_BEGIN();
+            XWF_AddToReportTable(id->xwf_id, REP_TABLE_SUCCESS, 1);
+            TRACE_END(TRACE_RTABLE, t_rtable, id->xwf_id, 0);
+        }
 
-        // Only add XML entry if at least some data was exported
-        if (export_successful) {
-            switch (file_ids[i].type) {
+        // Only add XML entry if at least some data was exported,
+        // or if benign files are only indexed
+        BOOL known = EXPORT_KNOWN == result && BENIGN_INDEX == options.benign_action;
+        if (EXPORT_DONE == result || known) {
+            if (xf->category) {
+                report->categorized_count++;
+            }
+            if (xf->short_read) {
+                XWF_AddToReportTable(id->xwf_id, REP_TABLE_SIZE, 1);
+                report->size_mismatch_count++;
+            }
+            if (CHECK_TRUNCATED == xf->integrity) {
+                XWF_AddToReportTable(id->xwf_id, REP_TABLE_TRUNCATED, 1);
+                report->truncated_count++;
+            } else if (CHECK_CORRUPT == xf->integrity) {
+                XWF_AddToReportTable(id->xwf_id, REP_TABLE_CORRUPT, 1);
+                report->corrupt_count++;
+            }
+            if (xf->unreadable) {
+                XWF_AddToReportTable(id->xwf_id, REP_TABLE_PARTIAL, 1);
+                report->partial_count++;
+            }
+            INT64 t_xml = TRACE_BEGIN();
+            switch (id->type) {
                 case TYPE_PICTURE:
                     report->image_count++;
-                    XmlAppendImage(&files[i], report);
+                    XmlAppendImage(xf, report);
+                    if (ex.exif.valid) {
+                        ExifListAppend(report, xf, &ex.exif);
+                    }
                     break;
                 case TYPE_VIDEO:
                     report->movie_count++;
-                    XmlAppendMovie(&files[i], report);
+                    XmlAppendMovie(xf, report, ex.video.valid ? &ex.video : NULL);
+                    if (ex.video.valid) {
+                        report->video_count++;
+                    }
                     break;
             }
+            TRACE_END(TRACE_XML, t_xml, id->xwf_id, 0);
+            if (!known) {
+                StoreFile(filepath, xf);
+            }
+            if (xf->stored) {
+                report->stored_count++;
+            }
+            ManifestAppend(id->xwf_id, xf, id->type, filepath, known,
+                           TYPE_VIDEO == id->type && ex.video.valid ? &ex.video : NULL);
         }
+        TRACE_END(TRACE_ITEM, t_item, id->xwf_id, xf->filesize);
         // Advance progress by expected file size regardless of result
-        exported_size += expected_size;
-        XWF_SetProgressPercentage(exported_size * 100 / total_size);
+        exported_size += xf->filesize;
+        StatusProgress(n + 1 - ex.deferred_count, exported_size);
     }
     XWF_HideProgress();
+    ExportCleanup(&ex);
+    // Everything is importable while X-Ways works on the next volume
+    ReportCheckpoint();
+    TRACE_END(TRACE_EXPORT, t_export, -1, exported_size);
 
-    free(current_volume->file_ids);
-    free(current_volume->files);
-    current_volume->file_ids = NULL;
-    current_volume->files = NULL;
+    WorklistFree(wl);
 
     // Return 1 to refresh current directory listing.
     // This is necessary if you want to immediately display
@@ -1284,20 +7926,45 @@ EXPORT LONG XTAPI
 XT_Done(PVOID lpReserved) {
     struct XtVolume *tmp = NULL;
     struct XtVolume *vol = first_volume;
+    BOOL closed = 1;
+
+    if (preflight.dry_run) {
+        WCHAR buf[256];
+        WCHAR size[32];
+        WCHAR needed[32];
+        WCHAR duration[32];
+        FormatSize(preflight.bytes, size, 32);
+        FormatSize(preflight.needed, needed, 32);
+        FormatDuration(preflight.seconds, duration, 32);
+        StringCchPrintfW(buf, 256,
+                         L"Dry run: %lld files (%ls), about %ls in the export directory, estimated duration %ls",
+                         preflight.files, size, needed, duration);
+        XWF_OutputMessage(buf, 0);
+    }
+
+    if (tuner.enabled && tuner.windows) {
+        WCHAR buf[128];
+        StringCchPrintfW(buf, 128, L"Adaptive export: %.1f MB chunks, %u chunks in flight after %u windows",
+                         tuner.chunk / (1024.0 * 1024), tuner.depth, tuner.windows);
+        XWF_OutputMessage(buf, 0);
+    }
+
+    // Final status, while all report counters are still available
+    if (status.enabled && status.phase && strcmp(status.phase, "aborted")) {
+        status.phase = "finished";
+        StatusWrite(GetTickCount64());
+    }
 
     while (vol) {
-        XmlFinishReport(vol->report_existing, REPORT_TYPE_EXISTING, vol->name);
-        XmlFinishReport(vol->report_deleted, REPORT_TYPE_DELETED, vol->name);
+        closed = XmlFinishReport(vol->report_existing, REPORT_TYPE_EXISTING, vol->name) && closed;
+        closed = XmlFinishReport(vol->report_deleted, REPORT_TYPE_DELETED, vol->name) && closed;
 
         free(vol->report_existing);
         vol->report_existing = NULL;
         free(vol->report_deleted);
         vol->report_deleted = NULL;
 
-        free(vol->file_ids);
-        free(vol->files);
-        vol->file_ids = NULL;
-        vol->files = NULL;
+        WorklistFree(&vol->worklist);
 
         tmp = vol;
         vol = vol->next;
@@ -1305,6 +7972,38 @@ XT_Done(PVOID lpReserved) {
         free(tmp);
         tmp = NULL;
     }
+    first_volume = NULL;
+    last_volume = NULL;
+    current_volume = NULL;
+    free(volume_table.buckets);
+    ZeroMemory(&volume_table, sizeof(volume_table));
+
+    if (manifest_file) {
+        // Records of parts that could not be closed stay out of the manifest
+        if (closed) {
+            ManifestFlush();
+        }
+        CloseHandle(manifest_file);
+        manifest_file = NULL;
+    }
+    free(manifest_buf);
+    manifest_buf = NULL;
+    manifest_count = 0;
+    manifest_capacity = 0;
+    if (manifest_strings) {
+        CloseHandle(manifest_strings);
+        manifest_strings = NULL;
+    }
+    DeltaFree();
+    HashSetsFree();
+    StoreClose();
+    FilterFree();
+    ScheduleFree();
+    DirCacheFree();
+    if (L'\0' != export_dir[0]) {
+        TraceFinish(export_dir);
+    }
+    TraceFree();
 
     return 0;
 }
@@ -0,0 +1,697 @@
+/*
+    Fake X-Ways Forensics for the tests: a case with a single volume whose
+    items live in memory, and the XWF_* functions the X-Tension loads.
+    Include after src/xt-gexpo.c, which the tests compile as a whole.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HOST_CASE L"Test Case"
+#define HOST_VOLUME L"Image"
+
+// Report tables of XWF_AddToReportTable, as bits per item
+#define HOST_TABLE_SUCCESS   0x01
+#define HOST_TABLE_FAILED    0x02
+#define HOST_TABLE_KNOWN     0x04
+#define HOST_TABLE_SIZE      0x08
+#define HOST_TABLE_TRUNCATED 0x10
+#define HOST_TABLE_CORRUPT   0x20
+#define HOST_TABLE_PARTIAL   0x40
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            host_failures++; \
+        } \
+    } while (0)
+
+struct HostItem {
+    // -1 for items in the root folder
+    LONG parent;
+    const WCHAR *name;
+    // L"Pictures", L"Video", any other category or NULL for folders
+    const WCHAR *category;
+    BOOL deleted;
+    INT64 flags;
+
+    // Data of the item in host.volume
+    INT64 ofs;
+    INT64 size;
+    // Reported as carved, with a negative definition offset
+    BOOL carved;
+
+    // Reads overlapping [bad_ofs, bad_ofs + bad_len) of the item fail
+    INT64 bad_ofs;
+    INT64 bad_len;
+    // Milliseconds every read of the item takes that ends after slow_ofs
+    DWORD read_delay;
+    INT64 slow_ofs;
+
+    volatile LONG tables;
+    volatile LONG64 read_bytes;
+};
+
+struct Host {
+    char root[256];
+    WCHAR case_dir[MAX_PATH];
+    WCHAR export_dir[MAX_PATH];
+
+    struct HostItem *items;
+    LONG count;
+    LONG capacity;
+
+    BYTE *volume;
+    INT64 volume_size;
+    INT64 volume_capacity;
+
+    // Statistics of the last run
+    volatile LONG opens;
+    volatile LONG offset_lookups;
+    volatile LONG reads;
+    volatile LONG64 read_bytes;
+    volatile LONG messages;
+
+    // XWF_ShouldStop returns 1 from this call on, 0 = never
+    volatile LONG stop_after;
+    volatile LONG stop_calls;
+    // Called by XWF_Read before an item is read, NULL = none
+    VOID (*read_hook)(struct HostItem *item);
+
+    // Messages of XWF_OutputMessage, one per line
+    pthread_mutex_t log_mutex;
+    WCHAR *log;
+    size_t log_len;
+};
+
+static struct Host host = {.log_mutex = PTHREAD_MUTEX_INITIALIZER};
+static int host_failures;
+// Volume handle passed to the X-Tension
+static int host_volume;
+static int host_evidence;
+
+static VOID
+HostLog(LPCWSTR message) {
+    pthread_mutex_lock(&host.log_mutex);
+    size_t len = wcslen(message);
+    host.log = realloc(host.log, (host.log_len + len + 2) * sizeof(WCHAR));
+    wmemcpy(host.log + host.log_len, message, len);
+    host.log_len += len;
+    host.log[host.log_len++] = L'\n';
+    host.log[host.log_len] = L'\0';
+    pthread_mutex_unlock(&host.log_mutex);
+    if (getenv("HOST_VERBOSE")) {
+        fprintf(stderr, "  xwf: %ls\n", message);
+    }
+}
+
+// Returns 1 if a message containing text has been output
+static BOOL
+HostLogged(LPCWSTR text) {
+    return host.log && NULL != wcsstr(host.log, text);
+}
+
+static struct HostItem *
+HostItem(LONG id) {
+    return 0 <= id && id < host.count ? &host.items[id] : NULL;
+}
+
+static LONG XTAPI
+Host_AddToReportTable(LONG id, LPWSTR table, DWORD flags) {
+    static const struct {
+        LPCWSTR name;
+        LONG bit;
+    } tables[] = {
+        {REP_TABLE_SUCCESS, HOST_TABLE_SUCCESS}, {REP_TABLE_FAILED, HOST_TABLE_FAILED},
+        {REP_TABLE_KNOWN, HOST_TABLE_KNOWN}, {REP_TABLE_SIZE, HOST_TABLE_SIZE},
+        {REP_TABLE_TRUNCATED, HOST_TABLE_TRUNCATED}, {REP_TABLE_CORRUPT, HOST_TABLE_CORRUPT},
+        {REP_TABLE_PARTIAL, HOST_TABLE_PARTIAL},
+    };
+    struct HostItem *item = HostItem(id);
+    for (size_t i = 0; item && i < sizeof(tables) / sizeof(tables[0]); i++) {
+        if (0 == wcscmp(table, tables[i].name)) {
+            __atomic_or_fetch(&item->tables, tables[i].bit, __ATOMIC_SEQ_CST);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static VOID XTAPI
+Host_Close(HANDLE h) {
+}
+
+static INT64 XTAPI
+Host_GetCaseProp(LPVOID c, LONG prop, PVOID buf, LONG len) {
+    switch (prop) {
+        case XWF_CASEPROP_TITLE:
+            StringCchCopyW(buf, len, HOST_CASE);
+            return 0;
+        case XWF_CASEPROP_DIR:
+            StringCchCopyW(buf, len, host.case_dir);
+            return 0;
+    }
+    return -1;
+}
+
+static HANDLE XTAPI
+Host_GetFirstEvObj(LPVOID reserved) {
+    return &host_evidence;
+}
+
+static HANDLE XTAPI
+Host_GetNextEvObj(HANDLE prev, LPVOID reserved) {
+    return NULL;
+}
+
+static DWORD XTAPI
+Host_GetItemCount(LPVOID volume) {
+    return (DWORD) host.count;
+}
+
+static INT64 XTAPI
+Host_GetItemInformation(LONG id, LONG type, LPBOOL success) {
+    struct HostItem *item = HostItem(id);
+    if (success) {
+        *success = NULL != item;
+    }
+    if (NULL == item) {
+        return 0;
+    }
+    switch (type) {
+        case XWF_ITEM_INFO_FLAGS:
+            return item->flags;
+        case XWF_ITEM_INFO_DELETION:
+            return item->deleted;
+        case XWF_ITEM_INFO_CREATIONTIME:
+        case XWF_ITEM_INFO_MODIFICATIONTIME:
+        case XWF_ITEM_INFO_LASTACCESSTIME:
+            // 2020-01-01 plus a minute per item
+            return (1577836800LL + 60 * id + 11644473600LL) * 10000000;
+    }
+    return 0;
+}
+
+static LPWSTR XTAPI
+Host_GetItemName(LONG id) {
+    struct HostItem *item = HostItem(id);
+    return (LPWSTR) (item ? item->name : L"");
+}
+
+// Items are stored at sector boundaries of the volume
+static VOID XTAPI
+Host_GetItemOfs(LONG id, PINT64 def_ofs, PINT64 start_sector) {
+    struct HostItem *item = HostItem(id);
+    InterlockedIncrement(&host.offset_lookups);
+    *def_ofs = item && item->carved ? -item->ofs : 0;
+    *start_sector = item && item->category && !item->carved ? item->ofs / 512 : -1;
+}
+
+static LONG XTAPI
+Host_GetItemParent(LONG id) {
+    struct HostItem *item = HostItem(id);
+    return item ? item->parent : -1;
+}
+
+static INT64 XTAPI
+Host_GetItemSize(LONG id) {
+    struct HostItem *item = HostItem(id);
+    return item && item->category ? item->size : -1;
+}
+
+static LONG XTAPI
+Host_GetItemType(LONG id, LPWSTR buf, DWORD len) {
+    struct HostItem *item = HostItem(id);
+    if (NULL == item || NULL == item->category) {
+        buf[0] = L'\0';
+        return -1;
+    }
+    StringCchCopyW(buf, len & 0xffff, item->category);
+    return 1;
+}
+
+static VOID XTAPI
+Host_GetVolumeInformation(HANDLE volume, LPLONG file_system, LPDWORD bytes_per_sector,
+                          LPDWORD sectors_per_cluster, PINT64 cluster_count, PINT64 first_cluster_sector) {
+    *file_system = 6;
+    *bytes_per_sector = 512;
+    *sectors_per_cluster = 8;
+    *cluster_count = host.volume_size / 4096;
+    *first_cluster_sector = 0;
+}
+
+static VOID XTAPI
+Host_GetVolumeName(HANDLE volume, LPWSTR buf, DWORD type) {
+    StringCchCopyW(buf, NAME_BUF_LEN, 1 == type ? L"[/evidence/" HOST_VOLUME L".e01]" : HOST_VOLUME);
+}
+
+static VOID XTAPI
+Host_HideProgress() {
+}
+
+// Item handles point to the item itself
+static HANDLE XTAPI
+Host_OpenItem(HANDLE volume, LONG id, DWORD flags) {
+    struct HostItem *item = HostItem(id);
+    if (NULL == item || NULL == item->category) {
+        return NULL;
+    }
+    InterlockedIncrement(&host.opens);
+    return item;
+}
+
+static VOID XTAPI
+Host_OutputMessage(LPWSTR message, DWORD flags) {
+    InterlockedIncrement(&host.messages);
+    HostLog(message);
+}
+
+// Reads of the volume handle are not limited to an item. Reads touching a
+// bad region of an item fail completely like X-Ways does for unreadable
+// sectors.
+static DWORD XTAPI
+Host_Read(HANDLE h, INT64 offset, LPVOID buf, DWORD len) {
+    INT64 start = 0;
+    INT64 size = host.volume_size;
+    struct HostItem *item = NULL;
+    if ((HANDLE) &host_volume != h) {
+        item = h;
+        start = item->ofs;
+        size = item->size;
+    }
+    InterlockedIncrement(&host.reads);
+    if (0 > offset || offset >= size) {
+        return 0;
+    }
+    DWORD n = (DWORD) min((INT64) len, size - offset);
+    if (item && host.read_hook) {
+        host.read_hook(item);
+    }
+    if (item && item->read_delay && offset + n > item->slow_ofs) {
+        Sleep(item->read_delay);
+    }
+    if (item && item->bad_len && offset < item->bad_ofs + item->bad_len && item->bad_ofs < offset + n) {
+        return 0;
+    }
+    memcpy(buf, host.volume + start + offset, n);
+    InterlockedExchangeAdd64(&host.read_bytes, n);
+    if (item) {
+        InterlockedExchangeAdd64(&item->read_bytes, n);
+    }
+    return n;
+}
+
+static VOID XTAPI
+Host_SetProgressDescription(LPWSTR text) {
+}
+
+static VOID XTAPI
+Host_SetProgressPercentage(DWORD percent) {
+}
+
+static BOOL XTAPI
+Host_ShouldStop() {
+    LONG calls = InterlockedIncrement(&host.stop_calls);
+    return host.stop_after && calls >= host.stop_after;
+}
+
+static VOID XTAPI
+Host_ShowProgress(LPWSTR text, DWORD flags) {
+}
+
+FARPROC
+ShimGetProc(LPCSTR name) {
+    static const struct {
+        LPCSTR name;
+        FARPROC proc;
+    } procs[] = {
+        {"XWF_AddToReportTable", (FARPROC) Host_AddToReportTable},
+        {"XWF_Close", (FARPROC) Host_Close},
+        {"XWF_GetCaseProp", (FARPROC) Host_GetCaseProp},
+        {"XWF_GetFirstEvObj", (FARPROC) Host_GetFirstEvObj},
+        {"XWF_GetItemCount", (FARPROC) Host_GetItemCount},
+        {"XWF_GetItemInformation", (FARPROC) Host_GetItemInformation},
+        {"XWF_GetItemName", (FARPROC) Host_GetItemName},
+        {"XWF_GetItemOfs", (FARPROC) Host_GetItemOfs},
+        {"XWF_GetItemParent", (FARPROC) Host_GetItemParent},
+        {"XWF_GetItemSize", (FARPROC) Host_GetItemSize},
+        {"XWF_GetItemType", (FARPROC) Host_GetItemType},
+        {"XWF_GetNextEvObj", (FARPROC) Host_GetNextEvObj},
+        {"XWF_GetVolumeInformation", (FARPROC) Host_GetVolumeInformation},
+        {"XWF_GetVolumeName", (FARPROC) Host_GetVolumeName},
+        {"XWF_HideProgress", (FARPROC) Host_HideProgress},
+        {"XWF_OpenItem", (FARPROC) Host_OpenItem},
+        {"XWF_OutputMessage", (FARPROC) Host_OutputMessage},
+        {"XWF_Read", (FARPROC) Host_Read},
+        {"XWF_SetProgressDescription", (FARPROC) Host_SetProgressDescription},
+        {"XWF_SetProgressPercentage", (FARPROC) Host_SetProgressPercentage},
+        {"XWF_ShouldStop", (FARPROC) Host_ShouldStop},
+        {"XWF_ShowProgress", (FARPROC) Host_ShowProgress},
+    };
+    for (size_t i = 0; i < sizeof(procs) / sizeof(procs[0]); i++) {
+        if (0 == strcmp(name, procs[i].name)) {
+            return procs[i].proc;
+        }
+    }
+    return NULL;
+}
+
+static VOID
+HostWriteText(const char *dir, const char *name, const char *text) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    if (NULL == f) {
+        perror(path);
+        exit(2);
+    }
+    fputs(text, f);
+    fclose(f);
+}
+
+// Creates an empty case in a new temporary folder. ini is the content of
+// xt-gexpo.ini, NULL for none. The export goes to <root>/out.
+static VOID
+HostInit(const char *ini) {
+    char tmpl[] = "/tmp/gexpo-test-XXXXXX";
+    if (NULL == mkdtemp(tmpl)) {
+        perror("mkdtemp");
+        exit(2);
+    }
+    snprintf(host.root, sizeof(host.root), "%s", tmpl);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/case", host.root);
+    mkdir(path, 0755);
+    swprintf(host.case_dir, MAX_PATH, L"%s\\case", host.root);
+    snprintf(path, sizeof(path), "%s/out", host.root);
+    mkdir(path, 0755);
+    swprintf(host.export_dir, MAX_PATH, L"%s\\out\\" HOST_CASE L"\\" EXPORT_DIR, host.root);
+
+    snprintf(path, sizeof(path), "%s/out", host.root);
+    HostWriteText(host.root, "xt-gexpo.conf", path);
+    if (ini) {
+        HostWriteText(host.root, "xt-gexpo.ini", ini);
+    }
+}
+
+// Replaces xt-gexpo.ini, e.g. before a delta run
+static VOID
+HostSetOptions(const char *ini) {
+    HostWriteText(host.root, "xt-gexpo.ini", ini);
+}
+
+static LONG
+HostAddItem(LONG parent, const WCHAR *name, const WCHAR *category, const void *data, INT64 size) {
+    if (host.count == host.capacity) {
+        host.capacity = host.capacity ? 2 * host.capacity : 64;
+        host.items = realloc(host.items, host.capacity * sizeof(struct HostItem));
+    }
+    // Data starts at a sector boundary
+    INT64 ofs = (host.volume_size + 511) / 512 * 512;
+    if (ofs + size >= host.volume_capacity) {
+        host.volume_capacity = 2 * (ofs + size) + 4096;
+        host.volume = realloc(host.volume, host.volume_capacity);
+    }
+    memset(host.volume + host.volume_size, 0, ofs - host.volume_size);
+    if (data && size) {
+        memcpy(host.volume + ofs, data, size);
+    }
+    host.volume_size = ofs + size;
+
+    struct HostItem *item = &host.items[host.count];
+    ZeroMemory(item, sizeof(struct HostItem));
+    item->parent = parent;
+    item->name = name;
+    item->category = category;
+    item->ofs = ofs;
+    item->size = size;
+    return host.count++;
+}
+
+static LONG
+HostAddFolder(LONG parent, const WCHAR *name) {
+    return HostAddItem(parent, name, NULL, NULL, 0);
+}
+
+static LONG
+HostAddFile(LONG parent, const WCHAR *name, const WCHAR *category, const void *data, INT64 size) {
+    return HostAddItem(parent, name, category, data, size);
+}
+
+// Adds a file of size bytes in a pattern that differs by seed
+static LONG
+HostAddPattern(const WCHAR *name, const WCHAR *category, INT64 size, BYTE seed) {
+    BYTE *buf = malloc(size ? size : 1);
+    for (INT64 i = 0; i < size; i++) {
+        buf[i] = (BYTE) (seed + i * 13 + (i >> 11));
+    }
+    LONG id = HostAddFile(-1, name, category, buf, size);
+    free(buf);
+    return id;
+}
+
+// Bytes of a file built by a test, grown as needed. b is freed by the test.
+struct HostData {
+    BYTE *b;
+    DWORD len;
+    DWORD capacity;
+};
+
+// Makes room for len more bytes
+static VOID
+HostReserve(struct HostData *d, DWORD len) {
+    if (d->len + len > d->capacity) {
+        d->capacity = max(2 * d->capacity, d->len + len + 4096);
+        d->b = realloc(d->b, d->capacity);
+    }
+}
+
+static VOID
+HostPut(struct HostData *d, const void *p, DWORD len) {
+    HostReserve(d, len);
+    memcpy(d->b + d->len, p, len);
+    d->len += len;
+}
+
+static VOID
+HostFill(struct HostData *d, BYTE value, DWORD len) {
+    HostReserve(d, len);
+    memset(d->b + d->len, value, len);
+    d->len += len;
+}
+
+// Appends the lowest size bytes of v, most significant first
+static VOID
+HostPutBe(struct HostData *d, UINT64 v, DWORD size) {
+    HostReserve(d, size);
+    for (DWORD i = 0; i < size; i++) {
+        d->b[d->len++] = (BYTE) (v >> (8 * (size - 1 - i)));
+    }
+}
+
+// Appends the lowest size bytes of v, least significant first
+static VOID
+HostPutLe(struct HostData *d, UINT64 v, DWORD size) {
+    HostReserve(d, size);
+    for (DWORD i = 0; i < size; i++) {
+        d->b[d->len++] = (BYTE) (v >> (8 * i));
+    }
+}
+
+// Writes the MD5 hash of data as hex into hex[33], e.g. for hash sets
+static VOID
+HostMd5Hex(const BYTE *data, INT64 size, char *hex) {
+    BCRYPT_ALG_HANDLE alg = NULL;
+    BCRYPT_HASH_HANDLE hash = NULL;
+    BYTE md5[16];
+    BCryptOpenAlgorithmProvider(&alg, BCRYPT_MD5_ALGORITHM, NULL, 0);
+    BCryptCreateHash(alg, &hash, NULL, 0, NULL, 0, 0);
+    BCryptHashData(hash, (PUCHAR) data, (ULONG) size, 0);
+    BCryptFinishHash(hash, md5, 16, 0);
+    BCryptDestroyHash(hash);
+    BCryptCloseAlgorithmProvider(alg, 0);
+    for (int i = 0; i < 16; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", md5[i]);
+    }
+}
+
+struct HostWorker {
+    LONG first;
+    LONG step;
+};
+
+static VOID *
+HostProcessItems(VOID *param) {
+    struct HostWorker *w = param;
+    for (LONG id = w->first; id < host.count; id += w->step) {
+        XT_ProcessItem(id, NULL);
+    }
+    return NULL;
+}
+
+// Runs the X-Tension on the volume like a volume snapshot refinement with
+// the given number of threads calling XT_ProcessItem.
+// Returns the result of XT_Finalize, or -1 if the X-Tension refused to run
+static LONG
+HostRun(int threads) {
+    host.opens = 0;
+    host.offset_lookups = 0;
+    host.reads = 0;
+    host.read_bytes = 0;
+    host.stop_calls = 0;
+    for (LONG i = 0; i < host.count; i++) {
+        host.items[i].tables = 0;
+    }
+
+    LONG rv = XT_Init(MIN_VER << 16, XT_INIT_XWF, NULL, NULL);
+    if (2 != rv) {
+        return -1;
+    }
+    if (0 > XT_Prepare(&host_volume, &host_evidence, XT_ACTION_RVS, NULL)) {
+        XT_Done(NULL);
+        return -1;
+    }
+    pthread_t tids[64];
+    struct HostWorker workers[64];
+    threads = max(1, min(threads, 64));
+    for (int t = 0; t < threads; t++) {
+        workers[t].first = t;
+        workers[t].step = threads;
+        pthread_create(&tids[t], NULL, HostProcessItems, &workers[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    rv = XT_Finalize(&host_volume, &host_evidence, XT_ACTION_RVS, NULL);
+    XT_Done(NULL);
+    return rv;
+}
+
+// Path below the export folder, e.g. "Existing/Image/Pictures/1"
+static VOID
+HostExportPath(char *out, size_t len, const char *rel) {
+    snprintf(out, len, "%s/out/%ls/%ls/%s", host.root, HOST_CASE, EXPORT_DIR, rel);
+}
+
+// Reads a whole file below the export folder, NULL if it does not exist.
+// The buffer is zero-terminated.
+static BYTE *
+HostReadExport(const char *rel, size_t *len) {
+    char path[PATH_MAX];
+    HostExportPath(path, sizeof(path), rel);
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    BYTE *buf = calloc(1, size + sizeof(WCHAR));
+    if (size != (long) fread(buf, 1, size, f)) {
+        size = -1;
+    }
+    fclose(f);
+    if (0 > size) {
+        free(buf);
+        return NULL;
+    }
+    if (len) {
+        *len = size;
+    }
+    return buf;
+}
+
+// Returns 1 if the export file has exactly the content of item id
+static BOOL
+HostExportMatches(const char *rel, LONG id) {
+    size_t len = 0;
+    BYTE *data = HostReadExport(rel, &len);
+    struct HostItem *item = HostItem(id);
+    BOOL rv = data && item && len == (size_t) item->size
+              && 0 == memcmp(data, host.volume + item->ofs, len);
+    free(data);
+    return rv;
+}
+
+// Returns 1 if the export file exists
+static BOOL
+HostExportExists(const char *rel) {
+    char path[PATH_MAX];
+    struct stat st;
+    HostExportPath(path, sizeof(path), rel);
+    return 0 == stat(path, &st);
+}
+
+// Reads a UTF-16 (here UTF-32) XML file written by the X-Tension
+static WCHAR *
+HostReadXml(const char *rel) {
+    size_t len = 0;
+    BYTE *data = HostReadExport(rel, &len);
+    if (NULL == data || 2 > len) {
+        free(data);
+        return NULL;
+    }
+    // Skip the byte order mark, which has two bytes on every platform
+    WCHAR *xml = calloc(1, len + sizeof(WCHAR));
+    memcpy(xml, data + 2, len - 2);
+    free(data);
+    return xml;
+}
+
+// Counts the occurrences of text in str
+static int
+CountOf(LPCWSTR str, LPCWSTR text) {
+    int n = 0;
+    for (LPCWSTR s = str ? wcsstr(str, text) : NULL; s; s = wcsstr(s + 1, text)) {
+        n++;
+    }
+    return n;
+}
+
+static VOID
+RemoveTree(const char *path) {
+    DIR *dir = opendir(path);
+    if (NULL == dir) {
+        unlink(path);
+        return;
+    }
+    struct dirent *e;
+    while ((e = readdir(dir))) {
+        if (0 == strcmp(e->d_name, ".") || 0 == strcmp(e->d_name, "..")) {
+            continue;
+        }
+        char child[PATH_MAX];
+        snprintf(child, sizeof(child), "%s/%s", path, e->d_name);
+        RemoveTree(child);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+// Removes the temporary folder unless the test failed, and resets the case
+static int
+HostDone(const char *test) {
+    if (host_failures) {
+        fprintf(stderr, "%s: %d check(s) failed, files left in %s\n", test, host_failures, host.root);
+    } else {
+        RemoveTree(host.root);
+        printf("%s: ok\n", test);
+    }
+    free(host.items);
+    free(host.volume);
+    free(host.log);
+    host.items = NULL;
+    host.volume = NULL;
+    host.log = NULL;
+    host.count = host.capacity = 0;
+    host.volume_size = host.volume_capacity = 0;
+    host.log_len = 0;
+    host.stop_after = 0;
+    int rv = host_failures;
+    host_failures = 0;
+    return rv;
+}
@@ -0,0 +1,9 @@
+// Path helpers of PathCch.h. Paths use backslashes like on Windows, the
+// file functions of win32.c translate them.
+#include <windows.h>
+
+HRESULT PathAllocCombine(PCWSTR, PCWSTR, ULONG, PWSTR *);
+HRESULT PathCchCombine(PWSTR, size_t, PCWSTR, PCWSTR);
+HRESULT PathCchAppend(PWSTR, size_t, PCWSTR);
+HRESULT PathCchAddBackslash(PWSTR, size_t);
+HRESULT PathCchStripToRoot(PWSTR, size_t);
@@ -0,0 +1,24 @@
+// Folder dialog, never shown in tests as they provide xt-gexpo.conf
+#include <windows.h>
+
+#define BFFM_INITIALIZED 1
+#define BFFM_SETEXPANDED (0x400 + 106)
+#define BIF_RETURNONLYFSDIRS 0x0001
+#define BIF_USENEWUI 0x0050
+
+typedef int (CALLBACK *BFFCALLBACK)(HWND, UINT, LPARAM, LPARAM);
+typedef void *PIDLIST_ABSOLUTE;
+
+typedef struct {
+    HWND hwndOwner;
+    PIDLIST_ABSOLUTE pidlRoot;
+    LPWSTR pszDisplayName;
+    LPCWSTR lpszTitle;
+    UINT ulFlags;
+    BFFCALLBACK lpfn;
+    LPARAM lParam;
+    int iImage;
+} BROWSEINFOW;
+
+PIDLIST_ABSOLUTE SHBrowseForFolderW(BROWSEINFOW *);
+BOOL SHGetPathFromIDListW(PIDLIST_ABSOLUTE, LPWSTR);
@@ -0,0 +1,16 @@
+// MD5 through the CNG interface, the only algorithm the X-Tension uses
+#include <windows.h>
+
+typedef void *BCRYPT_ALG_HANDLE;
+typedef void *BCRYPT_HASH_HANDLE;
+
+#define BCRYPT_MD5_ALGORITHM L"MD5"
+#define BCRYPT_HASH_REUSABLE_FLAG 0x00000020
+#define BCRYPT_SUCCESS(status) (((NTSTATUS) (status)) >= 0)
+
+NTSTATUS BCryptOpenAlgorithmProvider(BCRYPT_ALG_HANDLE *, LPCWSTR, LPCWSTR, ULONG);
+NTSTATUS BCryptCloseAlgorithmProvider(BCRYPT_ALG_HANDLE, ULONG);
+NTSTATUS BCryptCreateHash(BCRYPT_ALG_HANDLE, BCRYPT_HASH_HANDLE *, PUCHAR, ULONG, PUCHAR, ULONG, ULONG);
+NTSTATUS BCryptHashData(BCRYPT_HASH_HANDLE, PUCHAR, ULONG, ULONG);
+NTSTATUS BCryptFinishHash(BCRYPT_HASH_HANDLE, PUCHAR, ULONG, ULONG);
+NTSTATUS BCryptDestroyHash(BCRYPT_HASH_HANDLE);
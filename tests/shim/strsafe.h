@@ -0,0 +1,13 @@
+// Bounded string functions of strsafe.h. Like the originals, they
+// truncate and fail if the buffer is too small.
+#include <windows.h>
+
+#define STRSAFE_E_INSUFFICIENT_BUFFER ((HRESULT) 0x8007007A)
+
+HRESULT StringCchCopyW(LPWSTR, size_t, LPCWSTR);
+HRESULT StringCchCatW(LPWSTR, size_t, LPCWSTR);
+HRESULT StringCchPrintfW(LPWSTR, size_t, LPCWSTR, ...);
+HRESULT StringCchCopyA(LPSTR, size_t, LPCSTR);
+HRESULT StringCchCatA(LPSTR, size_t, LPCSTR);
+HRESULT StringCchPrintfA(LPSTR, size_t, LPCSTR, ...);
+HRESULT StringCchVPrintfA(LPSTR, size_t, LPCSTR, va_list);
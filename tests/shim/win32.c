@@ -0,0 +1,1431 @@
+/*
+    POSIX implementation of the Win32 functions declared in windows.h.
+    Semantics follow the Windows documentation as far as the X-Tension
+    relies on them: backslashes in paths, shared file locks per handle,
+    growing file mappings, alertable waits for ReadFileEx.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <windows.h>
+#include <PathCch.h>
+#include <Shlobj.h>
+#include <bcrypt.h>
+#include <strsafe.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHIM_FILE      1
+#define SHIM_MAPPING   2
+#define SHIM_SEMAPHORE 3
+#define SHIM_THREAD    4
+
+// 100 ns intervals between 1601-01-01 and 1970-01-01
+#define EPOCH_DIFF 116444736000000000LL
+
+struct ShimHandle {
+    int kind;
+
+    // Files and mappings
+    int fd;
+    INT64 size;
+    BOOL writable;
+
+    // Semaphores
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    LONG count;
+    LONG maximum;
+
+    // Threads
+    pthread_t thread;
+    LPTHREAD_START_ROUTINE start;
+    LPVOID param;
+    BOOL done;
+    BOOL joined;
+};
+
+// Completion routine queued by ReadFileEx until the next alertable wait
+struct ShimApc {
+    LPOVERLAPPED_COMPLETION_ROUTINE routine;
+    DWORD error;
+    DWORD bytes;
+    LPOVERLAPPED overlapped;
+    struct ShimApc *next;
+};
+
+// Mapped views and their length for munmap
+struct ShimView {
+    void *address;
+    size_t length;
+    struct ShimView *next;
+};
+
+static __thread DWORD last_error;
+static __thread struct ShimApc *apcs;
+
+static pthread_mutex_t view_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct ShimView *views;
+
+DWORD
+GetLastError(void) {
+    return last_error;
+}
+
+VOID
+SetLastError(DWORD error) {
+    last_error = error;
+}
+
+static BOOL
+Fail(int error) {
+    switch (error) {
+        case ENOENT:    last_error = ERROR_FILE_NOT_FOUND; break;
+        case ENOTDIR:   last_error = ERROR_PATH_NOT_FOUND; break;
+        case EEXIST:    last_error = ERROR_ALREADY_EXISTS; break;
+        case EACCES:
+        case EPERM:     last_error = ERROR_ACCESS_DENIED; break;
+        case EXDEV:     last_error = ERROR_NOT_SAME_DEVICE; break;
+        case ENOSPC:    last_error = ERROR_DISK_FULL; break;
+        case ENOTEMPTY: last_error = ERROR_DIR_NOT_EMPTY; break;
+        case ENOMEM:    last_error = ERROR_NOT_ENOUGH_MEMORY; break;
+        case EAGAIN:    last_error = ERROR_LOCK_VIOLATION; break;
+        default:        last_error = ERROR_INVALID_PARAMETER; break;
+    }
+    return FALSE;
+}
+
+// Converts a path to UTF-8 with forward slashes, NULL if out of memory
+static char *
+NativePath(LPCWSTR path) {
+    size_t len = wcslen(path);
+    char *out = malloc(4 * len + 1);
+    if (NULL == out) {
+        return NULL;
+    }
+    WideCharToMultiByte(CP_UTF8, 0, path, -1, out, (int) (4 * len + 1), NULL, NULL);
+    for (char *c = out; *c; c++) {
+        if ('\\' == *c) {
+            *c = '/';
+        }
+    }
+    return out;
+}
+
+static struct ShimHandle *
+NewHandle(int kind) {
+    struct ShimHandle *h = calloc(1, sizeof(struct ShimHandle));
+    if (NULL == h) {
+        Fail(ENOMEM);
+        return NULL;
+    }
+    h->kind = kind;
+    h->fd = -1;
+    return h;
+}
+
+static struct ShimHandle *
+GetHandle(HANDLE handle, int kind) {
+    struct ShimHandle *h = handle;
+    if (NULL == h || INVALID_HANDLE_VALUE == handle || kind != h->kind) {
+        last_error = ERROR_INVALID_HANDLE;
+        return NULL;
+    }
+    return h;
+}
+
+static VOID
+FileTimeFromUnix(const struct timespec *ts, FILETIME *ft) {
+    UINT64 t = (UINT64) ts->tv_sec * 10000000 + ts->tv_nsec / 100 + EPOCH_DIFF;
+    ft->dwLowDateTime = (DWORD) t;
+    ft->dwHighDateTime = (DWORD) (t >> 32);
+}
+
+HANDLE
+CreateFileW(LPCWSTR path, DWORD access, DWORD share, LPSECURITY_ATTRIBUTES sa,
+            DWORD disposition, DWORD flags, HANDLE template) {
+    int oflags = O_CLOEXEC;
+    if ((access & GENERIC_READ) && (access & (GENERIC_WRITE | FILE_APPEND_DATA))) {
+        oflags |= O_RDWR;
+    } else if (access & (GENERIC_WRITE | FILE_APPEND_DATA)) {
+        oflags |= O_WRONLY;
+    } else {
+        oflags |= O_RDONLY;
+    }
+    if (FILE_APPEND_DATA == (access & (GENERIC_WRITE | FILE_APPEND_DATA))) {
+        oflags |= O_APPEND;
+    }
+    switch (disposition) {
+        case CREATE_NEW:        oflags |= O_CREAT | O_EXCL; break;
+        case CREATE_ALWAYS:     oflags |= O_CREAT | O_TRUNC; break;
+        case OPEN_ALWAYS:       oflags |= O_CREAT; break;
+        case TRUNCATE_EXISTING: oflags |= O_TRUNC; break;
+    }
+
+    char *native = NativePath(path);
+    if (NULL == native) {
+        Fail(ENOMEM);
+        return INVALID_HANDLE_VALUE;
+    }
+    struct stat st;
+    BOOL existed = 0 == stat(native, &st);
+    if (existed && S_ISDIR(st.st_mode)) {
+        free(native);
+        last_error = ERROR_ACCESS_DENIED;
+        return INVALID_HANDLE_VALUE;
+    }
+    int fd = open(native, oflags, 0644);
+    if (-1 == fd) {
+        int error = errno;
+        free(native);
+        Fail(error);
+        if (EEXIST == error) {
+            last_error = ERROR_FILE_EXISTS;
+        }
+        return INVALID_HANDLE_VALUE;
+    }
+    if (flags & FILE_FLAG_DELETE_ON_CLOSE) {
+        unlink(native);
+    }
+    free(native);
+
+    struct ShimHandle *h = NewHandle(SHIM_FILE);
+    if (NULL == h) {
+        close(fd);
+        return INVALID_HANDLE_VALUE;
+    }
+    h->fd = fd;
+    h->writable = O_RDONLY != (oflags & O_ACCMODE);
+    // Like Windows, report whether OPEN_ALWAYS and CREATE_ALWAYS found a file
+    last_error = existed && (OPEN_ALWAYS == disposition || CREATE_ALWAYS == disposition)
+                 ? ERROR_ALREADY_EXISTS : ERROR_SUCCESS;
+    return h;
+}
+
+BOOL
+ReadFile(HANDLE file, LPVOID buf, DWORD len, LPDWORD read_len, LPOVERLAPPED ol) {
+    struct ShimHandle *h = GetHandle(file, SHIM_FILE);
+    if (NULL == h) {
+        return FALSE;
+    }
+    size_t done = 0;
+    off_t offset = ol ? (off_t) ((UINT64) ol->OffsetHigh << 32 | ol->Offset) : 0;
+    while (done < len) {
+        ssize_t n = ol ? pread(h->fd, (BYTE *) buf + done, len - done, offset + done)
+                       : read(h->fd, (BYTE *) buf + done, len - done);
+        if (-1 == n && EINTR == errno) {
+            continue;
+        }
+        if (-1 == n) {
+            return Fail(errno);
+        }
+        if (0 == n) {
+            break;
+        }
+        done += n;
+    }
+    if (read_len) {
+        *read_len = (DWORD) done;
+    }
+    return TRUE;
+}
+
+BOOL
+ReadFileEx(HANDLE file, LPVOID buf, DWORD len, LPOVERLAPPED ol, LPOVERLAPPED_COMPLETION_ROUTINE routine) {
+    DWORD bytes = 0;
+    if (NULL == ol || !ReadFile(file, buf, len, &bytes, ol)) {
+        return FALSE;
+    }
+    struct ShimApc *apc = calloc(1, sizeof(struct ShimApc));
+    if (NULL == apc) {
+        return Fail(ENOMEM);
+    }
+    apc->routine = routine;
+    apc->bytes = bytes;
+    apc->overlapped = ol;
+    apc->next = apcs;
+    apcs = apc;
+    return TRUE;
+}
+
+BOOL
+WriteFile(HANDLE file, LPCVOID buf, DWORD len, LPDWORD written, LPOVERLAPPED ol) {
+    struct ShimHandle *h = GetHandle(file, SHIM_FILE);
+    if (NULL == h) {
+        return FALSE;
+    }
+    size_t done = 0;
+    off_t offset = ol ? (off_t) ((UINT64) ol->OffsetHigh << 32 | ol->Offset) : 0;
+    while (done < len) {
+        ssize_t n = ol ? pwrite(h->fd, (const BYTE *) buf + done, len - done, offset + done)
+                       : write(h->fd, (const BYTE *) buf + done, len - done);
+        if (-1 == n && EINTR == errno) {
+            continue;
+        }
+        if (-1 == n) {
+            if (written) {
+                *written = (DWORD) done;
+            }
+            return Fail(errno);
+        }
+        done += n;
+    }
+    if (written) {
+        *written = (DWORD) done;
+    }
+    return TRUE;
+}
+
+static VOID *
+ThreadMain(VOID *param) {
+    struct ShimHandle *h = param;
+    h->start(h->param);
+    pthread_mutex_lock(&h->mutex);
+    h->done = 1;
+    pthread_cond_broadcast(&h->cond);
+    pthread_mutex_unlock(&h->mutex);
+    return NULL;
+}
+
+BOOL
+CloseHandle(HANDLE handle) {
+    struct ShimHandle *h = handle;
+    if (NULL == h || INVALID_HANDLE_VALUE == handle) {
+        last_error = ERROR_INVALID_HANDLE;
+        return FALSE;
+    }
+    switch (h->kind) {
+        case SHIM_FILE:
+        case SHIM_MAPPING:
+            close(h->fd);
+            break;
+        case SHIM_THREAD: {
+            // The thread may still run, it owns the handle from here on
+            pthread_mutex_lock(&h->mutex);
+            BOOL done = h->done;
+            pthread_mutex_unlock(&h->mutex);
+            if (!done) {
+                pthread_detach(h->thread);
+                h->joined = 1;
+                return TRUE;
+            }
+            if (!h->joined) {
+                pthread_join(h->thread, NULL);
+            }
+        }
+            // Fall through
+        case SHIM_SEMAPHORE:
+            pthread_mutex_destroy(&h->mutex);
+            pthread_cond_destroy(&h->cond);
+            break;
+        default:
+            // Pseudo handles
+            return TRUE;
+    }
+    free(h);
+    return TRUE;
+}
+
+BOOL
+SetFilePointerEx(HANDLE file, LARGE_INTEGER distance, PLARGE_INTEGER position, DWORD method) {
+    struct ShimHandle *h = GetHandle(file, SHIM_FILE);
+    if (NULL == h) {
+        return FALSE;
+    }
+    int whence = FILE_BEGIN == method ? SEEK_SET : FILE_CURRENT == method ? SEEK_CUR : SEEK_END;
+    off_t pos = lseek(h->fd, (off_t) distance.QuadPart, whence);
+    if (-1 == pos) {
+        return Fail(errno);
+    }
+    if (position) {
+        position->QuadPart = pos;
+    }
+    return TRUE;
+}
+
+BOOL
+SetEndOfFile(HANDLE file) {
+    struct ShimHandle *h = GetHandle(file, SHIM_FILE);
+    if (NULL == h) {
+        return FALSE;
+    }
+    off_t pos = lseek(h->fd, 0, SEEK_CUR);
+    if (-1 == pos || -1 == ftruncate(h->fd, pos)) {
+        return Fail(errno);
+    }
+    return TRUE;
+}
+
+BOOL
+GetFileSizeEx(HANDLE file, PLARGE_INTEGER size) {
+    struct ShimHandle *h = GetHandle(file, SHIM_FILE);
+    struct stat st;
+    if (NULL == h) {
+        return FALSE;
+    }
+    if (-1 == fstat(h->fd, &st)) {
+        return Fail(errno);
+    }
+    size->QuadPart = st.st_size;
+    return TRUE;
+}
+
+BOOL
+FlushFileBuffers(HANDLE file) {
+    struct ShimHandle *h = GetHandle(file, SHIM_FILE);
+    return h && 0 == fsync(h->fd);
+}
+
+BOOL
+SetFileInformationByHandle(HANDLE file, FILE_INFO_BY_HANDLE_CLASS info, LPVOID buf, DWORD len) {
+    return NULL != GetHandle(file, SHIM_FILE);
+}
+
+// Seeking past the end already leaves holes, so FSCTL_SET_SPARSE has
+// nothing to do
+BOOL
+DeviceIoControl(HANDLE file, DWORD code, LPVOID in, DWORD in_len, LPVOID out, DWORD out_len,
+                LPDWORD returned, LPOVERLAPPED ol) {
+    if (NULL == GetHandle(file, SHIM_FILE)) {
+        return FALSE;
+    }
+    if (returned) {
+        *returned = 0;
+    }
+    return FSCTL_SET_SPARSE == code;
+}
+
+// Open file description locks belong to the handle like on Windows, also
+// between threads of one process
+static BOOL
+LockRange(HANDLE file, short type, BOOL wait, DWORD low, DWORD high, LPOVERLAPPED ol) {
+    struct ShimHandle *h = GetHandle(file, SHIM_FILE);
+    if (NULL == h) {
+        return FALSE;
+    }
+    struct flock lock = {0};
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = (off_t) ((UINT64) ol->OffsetHigh << 32 | ol->Offset);
+    lock.l_len = (off_t) ((UINT64) high << 32 | low);
+    while (-1 == fcntl(h->fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &lock)) {
+        if (EINTR != errno) {
+            return Fail(errno);
+        }
+    }
+    return TRUE;
+}
+
+BOOL
+LockFileEx(HANDLE file, DWORD flags, DWORD reserved, DWORD low, DWORD high, LPOVERLAPPED ol) {
+    return LockRange(file, flags & LOCKFILE_EXCLUSIVE_LOCK ? F_WRLCK : F_RDLCK,
+                     !(flags & LOCKFILE_FAIL_IMMEDIATELY), low, high, ol);
+}
+
+BOOL
+UnlockFileEx(HANDLE file, DWORD reserved, DWORD low, DWORD high, LPOVERLAPPED ol) {
+    return LockRange(file, F_UNLCK, 0, low, high, ol);
+}
+
+HANDLE
+CreateFileMappingW(HANDLE file, LPSECURITY_ATTRIBUTES sa, DWORD protect, DWORD high, DWORD low, LPCWSTR name) {
+    struct ShimHandle *f = GetHandle(file, SHIM_FILE);
+    struct stat st;
+    if (NULL == f) {
+        return NULL;
+    }
+    if (-1 == fstat(f->fd, &st)) {
+        Fail(errno);
+        return NULL;
+    }
+    INT64 size = (INT64) ((UINT64) high << 32 | low);
+    if (0 == size) {
+        size = st.st_size;
+    }
+    // Empty files cannot be mapped, larger mappings extend the file
+    if (0 == size || (size > st.st_size && PAGE_READWRITE != protect)) {
+        last_error = ERROR_INVALID_PARAMETER;
+        return NULL;
+    }
+    if (size > st.st_size && -1 == ftruncate(f->fd, size)) {
+        Fail(errno);
+        return NULL;
+    }
+    struct ShimHandle *h = NewHandle(SHIM_MAPPING);
+    if (NULL == h) {
+        return NULL;
+    }
+    h->fd = dup(f->fd);
+    h->size = size;
+    h->writable = PAGE_READWRITE == protect;
+    return h;
+}
+
+LPVOID
+MapViewOfFile(HANDLE mapping, DWORD access, DWORD high, DWORD low, SIZE_T len) {
+    struct ShimHandle *h = GetHandle(mapping, SHIM_MAPPING);
+    if (NULL == h) {
+        return NULL;
+    }
+    INT64 offset = (INT64) ((UINT64) high << 32 | low);
+    if (0 == len) {
+        len = (SIZE_T) (h->size - offset);
+    }
+    BOOL write = FILE_MAP_READ != access;
+    if ((write && !h->writable) || offset + (INT64) len > h->size) {
+        last_error = ERROR_ACCESS_DENIED;
+        return NULL;
+    }
+    struct ShimView *view = malloc(sizeof(struct ShimView));
+    if (NULL == view) {
+        Fail(ENOMEM);
+        return NULL;
+    }
+    void *address = mmap(NULL, len, write ? PROT_READ | PROT_WRITE : PROT_READ,
+                         MAP_SHARED, h->fd, (off_t) offset);
+    if (MAP_FAILED == address) {
+        free(view);
+        Fail(errno);
+        return NULL;
+    }
+    view->address = address;
+    view->length = len;
+    pthread_mutex_lock(&view_mutex);
+    view->next = views;
+    views = view;
+    pthread_mutex_unlock(&view_mutex);
+    return address;
+}
+
+BOOL
+UnmapViewOfFile(LPCVOID address) {
+    pthread_mutex_lock(&view_mutex);
+    for (struct ShimView **v = &views; *v; v = &(*v)->next) {
+        if ((*v)->address == address) {
+            struct ShimView *view = *v;
+            *v = view->next;
+            pthread_mutex_unlock(&view_mutex);
+            munmap(view->address, view->length);
+            free(view);
+            return TRUE;
+        }
+    }
+    pthread_mutex_unlock(&view_mutex);
+    last_error = ERROR_INVALID_PARAMETER;
+    return FALSE;
+}
+
+BOOL
+CreateDirectoryW(LPCWSTR path, LPSECURITY_ATTRIBUTES sa) {
+    char *native = NativePath(path);
+    int rv = native ? mkdir(native, 0755) : -1;
+    int error = native ? errno : ENOMEM;
+    free(native);
+    return 0 == rv || Fail(error);
+}
+
+BOOL
+RemoveDirectoryW(LPCWSTR path) {
+    char *native = NativePath(path);
+    int rv = native ? rmdir(native) : -1;
+    int error = native ? errno : ENOMEM;
+    free(native);
+    return 0 == rv || Fail(error);
+}
+
+BOOL
+DeleteFileW(LPCWSTR path) {
+    char *native = NativePath(path);
+    int rv = native ? unlink(native) : -1;
+    int error = native ? errno : ENOMEM;
+    free(native);
+    return 0 == rv || Fail(error);
+}
+
+BOOL
+MoveFileExW(LPCWSTR from, LPCWSTR to, DWORD flags) {
+    char *native_from = NativePath(from);
+    char *native_to = NativePath(to);
+    int rv = -1;
+    int error = ENOMEM;
+    if (native_from && native_to) {
+        struct stat st;
+        if (!(flags & MOVEFILE_REPLACE_EXISTING) && 0 == stat(native_to, &st)) {
+            error = EEXIST;
+        } else {
+            rv = rename(native_from, native_to);
+            error = errno;
+        }
+    }
+    free(native_from);
+    free(native_to);
+    return 0 == rv || Fail(error);
+}
+
+BOOL
+CreateHardLinkW(LPCWSTR link_path, LPCWSTR existing, LPSECURITY_ATTRIBUTES sa) {
+    char *native_link = NativePath(link_path);
+    char *native_existing = NativePath(existing);
+    int rv = -1;
+    int error = ENOMEM;
+    if (native_link && native_existing) {
+        rv = link(native_existing, native_link);
+        error = errno;
+    }
+    free(native_link);
+    free(native_existing);
+    return 0 == rv || Fail(error);
+}
+
+DWORD
+GetFileAttributesW(LPCWSTR path) {
+    char *native = NativePath(path);
+    struct stat st;
+    int rv = native ? stat(native, &st) : -1;
+    int error = native ? errno : ENOMEM;
+    free(native);
+    if (-1 == rv) {
+        Fail(error);
+        return INVALID_FILE_ATTRIBUTES;
+    }
+    return S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+}
+
+BOOL
+GetFileAttributesExW(LPCWSTR path, GET_FILEEX_INFO_LEVELS level, LPVOID info) {
+    WIN32_FILE_ATTRIBUTE_DATA *data = info;
+    char *native = NativePath(path);
+    struct stat st;
+    int rv = native ? stat(native, &st) : -1;
+    int error = native ? errno : ENOMEM;
+    free(native);
+    if (-1 == rv) {
+        return Fail(error);
+    }
+    ZeroMemory(data, sizeof(WIN32_FILE_ATTRIBUTE_DATA));
+    data->dwFileAttributes = S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+    FileTimeFromUnix(&st.st_ctim, &data->ftCreationTime);
+    FileTimeFromUnix(&st.st_atim, &data->ftLastAccessTime);
+    FileTimeFromUnix(&st.st_mtim, &data->ftLastWriteTime);
+    data->nFileSizeHigh = (DWORD) ((UINT64) st.st_size >> 32);
+    data->nFileSizeLow = (DWORD) st.st_size;
+    return TRUE;
+}
+
+UINT
+GetTempFileNameW(LPCWSTR dir, LPCWSTR prefix, UINT unique, LPWSTR out) {
+    static volatile LONG counter;
+    for (int attempt = 0; attempt < 65536; attempt++) {
+        UINT number = (UINT) (InterlockedIncrement(&counter) + getpid()) & 0xffff;
+        if (0 == number) {
+            continue;
+        }
+        StringCchPrintfW(out, MAX_PATH, L"%ls\\%.3ls%X.tmp", dir, prefix, number);
+        HANDLE file = CreateFileW(out, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (INVALID_HANDLE_VALUE != file) {
+            CloseHandle(file);
+            return number;
+        }
+        if (ERROR_FILE_EXISTS != last_error) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+BOOL
+GetDiskFreeSpaceExW(LPCWSTR path, PULARGE_INTEGER available, PULARGE_INTEGER total, PULARGE_INTEGER free_bytes) {
+    char *native = NativePath(path);
+    struct statvfs st;
+    int rv = native ? statvfs(native, &st) : -1;
+    int error = native ? errno : ENOMEM;
+    free(native);
+    if (-1 == rv) {
+        return Fail(error);
+    }
+    if (available) available->QuadPart = (ULONGLONG) st.f_bavail * st.f_frsize;
+    if (total) total->QuadPart = (ULONGLONG) st.f_blocks * st.f_frsize;
+    if (free_bytes) free_bytes->QuadPart = (ULONGLONG) st.f_bfree * st.f_frsize;
+    return TRUE;
+}
+
+BOOL
+GetDiskFreeSpaceW(LPCWSTR root, LPDWORD sectors_per_cluster, LPDWORD bytes_per_sector,
+                  LPDWORD free_clusters, LPDWORD total_clusters) {
+    char *native = NativePath(root);
+    struct statvfs st;
+    int rv = native ? statvfs(native, &st) : -1;
+    int error = native ? errno : ENOMEM;
+    free(native);
+    if (-1 == rv) {
+        return Fail(error);
+    }
+    *sectors_per_cluster = (DWORD) (st.f_frsize / 512 ? st.f_frsize / 512 : 1);
+    *bytes_per_sector = 512;
+    if (free_clusters) *free_clusters = (DWORD) min(st.f_bavail, 0xffffffffULL);
+    if (total_clusters) *total_clusters = (DWORD) min(st.f_blocks, 0xffffffffULL);
+    return TRUE;
+}
+
+LONG
+CompareFileTime(const FILETIME *a, const FILETIME *b) {
+    UINT64 ta = (UINT64) a->dwHighDateTime << 32 | a->dwLowDateTime;
+    UINT64 tb = (UINT64) b->dwHighDateTime << 32 | b->dwLowDateTime;
+    return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+BOOL
+SystemTimeToFileTime(const SYSTEMTIME *st, FILETIME *ft) {
+    if (1601 > st->wYear || 1 > st->wMonth || 12 < st->wMonth || 1 > st->wDay || 31 < st->wDay
+        || 23 < st->wHour || 59 < st->wMinute || 59 < st->wSecond) {
+        last_error = ERROR_INVALID_PARAMETER;
+        return FALSE;
+    }
+    struct tm tm = {0};
+    tm.tm_year = st->wYear - 1900;
+    tm.tm_mon = st->wMonth - 1;
+    tm.tm_mday = st->wDay;
+    tm.tm_hour = st->wHour;
+    tm.tm_min = st->wMinute;
+    tm.tm_sec = st->wSecond;
+    struct timespec ts = {timegm(&tm), st->wMilliseconds * 1000000L};
+    FileTimeFromUnix(&ts, ft);
+    return TRUE;
+}
+
+static VOID
+LocalTime(const SYSTEMTIME *st, struct tm *tm) {
+    if (st) {
+        ZeroMemory(tm, sizeof(struct tm));
+        tm->tm_year = st->wYear - 1900;
+        tm->tm_mon = st->wMonth - 1;
+        tm->tm_mday = st->wDay;
+        tm->tm_hour = st->wHour;
+        tm->tm_min = st->wMinute;
+        tm->tm_sec = st->wSecond;
+    } else {
+        time_t now = time(NULL);
+        localtime_r(&now, tm);
+    }
+}
+
+// Both formats are fixed, ISO 8601 date and 24 hour time
+int
+GetDateFormatEx(LPCWSTR locale, DWORD flags, const SYSTEMTIME *st, LPCWSTR format, LPWSTR out, int len, LPCWSTR calendar) {
+    struct tm tm;
+    WCHAR buf[32];
+    LocalTime(st, &tm);
+    int n = swprintf(buf, 32, L"%04d-%02d-%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) + 1;
+    if (0 == len) {
+        return n;
+    }
+    return SUCCEEDED(StringCchCopyW(out, len, buf)) ? n : 0;
+}
+
+int
+GetTimeFormatEx(LPCWSTR locale, DWORD flags, const SYSTEMTIME *st, LPCWSTR format, LPWSTR out, int len) {
+    struct tm tm;
+    WCHAR buf[32];
+    LocalTime(st, &tm);
+    int n = swprintf(buf, 32, L"%02d:%02d:%02d", tm.tm_hour, tm.tm_min, tm.tm_sec) + 1;
+    if (0 == len) {
+        return n;
+    }
+    return SUCCEEDED(StringCchCopyW(out, len, buf)) ? n : 0;
+}
+
+// Finds key in section of an ini file. Returns the value with surrounding
+// blanks removed in value, or 0 if the file, section or key is missing.
+static BOOL
+ProfileValue(LPCWSTR section, LPCWSTR key, LPCWSTR path, char *value, size_t len) {
+    char *native = NativePath(path);
+    FILE *f = native ? fopen(native, "r") : NULL;
+    free(native);
+    if (NULL == f) {
+        return 0;
+    }
+    char want_section[256];
+    char want_key[256];
+    WideCharToMultiByte(CP_UTF8, 0, section, -1, want_section, sizeof(want_section), NULL, NULL);
+    WideCharToMultiByte(CP_UTF8, 0, key, -1, want_key, sizeof(want_key), NULL, NULL);
+
+    char line[1024];
+    BOOL in_section = 0;
+    BOOL found = 0;
+    while (!found && fgets(line, sizeof(line), f)) {
+        char *s = line;
+        while (' ' == *s || '\t' == *s) s++;
+        char *end = s + strlen(s);
+        while (end > s && strchr(" \t\r\n", end[-1])) *--end = '\0';
+        if ('[' == *s) {
+            char *close = strchr(s, ']');
+            if (close) {
+                *close = '\0';
+                in_section = 0 == strcasecmp(s + 1, want_section);
+            }
+            continue;
+        }
+        char *eq = strchr(s, '=');
+        if (!in_section || ';' == *s || NULL == eq) {
+            continue;
+        }
+        char *name_end = eq;
+        while (name_end > s && strchr(" \t", name_end[-1])) name_end--;
+        *name_end = '\0';
+        if (0 == strcasecmp(s, want_key)) {
+            char *v = eq + 1;
+            while (' ' == *v || '\t' == *v) v++;
+            snprintf(value, len, "%s", v);
+            found = 1;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+UINT
+GetPrivateProfileIntW(LPCWSTR section, LPCWSTR key, INT fallback, LPCWSTR path) {
+    char value[1024];
+    if (!ProfileValue(section, key, path, value, sizeof(value))) {
+        return (UINT) fallback;
+    }
+    return (UINT) strtol(value, NULL, 10);
+}
+
+DWORD
+GetPrivateProfileStringW(LPCWSTR section, LPCWSTR key, LPCWSTR fallback, LPWSTR out, DWORD len, LPCWSTR path) {
+    char value[1024];
+    if (!ProfileValue(section, key, path, value, sizeof(value))) {
+        StringCchCopyW(out, len, fallback ? fallback : L"");
+        return (DWORD) wcslen(out);
+    }
+    size_t n = mbstowcs(out, value, len);
+    if ((size_t) -1 == n) {
+        out[0] = L'\0';
+        return 0;
+    }
+    if (n >= len) {
+        out[len - 1] = L'\0';
+        return len - 1;
+    }
+    return (DWORD) n;
+}
+
+HLOCAL
+LocalFree(HLOCAL mem) {
+    free(mem);
+    return NULL;
+}
+
+BOOL
+QueryPerformanceCounter(LARGE_INTEGER *counter) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    counter->QuadPart = (LONGLONG) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return TRUE;
+}
+
+BOOL
+QueryPerformanceFrequency(LARGE_INTEGER *frequency) {
+    frequency->QuadPart = 1000000000;
+    return TRUE;
+}
+
+ULONGLONG
+GetTickCount64(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+VOID
+Sleep(DWORD ms) {
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    while (-1 == nanosleep(&ts, &ts) && EINTR == errno) {
+    }
+}
+
+// Runs the completion routines queued by ReadFileEx on this thread
+DWORD
+SleepEx(DWORD ms, BOOL alertable) {
+    if (alertable && apcs) {
+        while (apcs) {
+            struct ShimApc *apc = apcs;
+            apcs = apc->next;
+            apc->routine(apc->error, apc->bytes, apc->overlapped);
+            free(apc);
+        }
+        return WAIT_IO_COMPLETION;
+    }
+    Sleep(ms);
+    return 0;
+}
+
+// Pseudo handles that CloseHandle ignores
+static struct ShimHandle current_process = {0};
+static struct ShimHandle current_thread = {0};
+
+HANDLE
+GetCurrentProcess(void) {
+    return &current_process;
+}
+
+HANDLE
+GetCurrentThread(void) {
+    return &current_thread;
+}
+
+DWORD
+GetCurrentThreadId(void) {
+    return (DWORD) gettid();
+}
+
+BOOL
+SetThreadPriority(HANDLE thread, int priority) {
+    return TRUE;
+}
+
+BOOL
+GetProcessMemoryInfo(HANDLE process, PPROCESS_MEMORY_COUNTERS counters, DWORD len) {
+    ZeroMemory(counters, len);
+    counters->cb = len;
+    return TRUE;
+}
+
+HANDLE
+CreateThread(LPSECURITY_ATTRIBUTES sa, SIZE_T stack, LPTHREAD_START_ROUTINE start, LPVOID param,
+             DWORD flags, LPDWORD id) {
+    struct ShimHandle *h = NewHandle(SHIM_THREAD);
+    if (NULL == h) {
+        return NULL;
+    }
+    pthread_mutex_init(&h->mutex, NULL);
+    pthread_cond_init(&h->cond, NULL);
+    h->start = start;
+    h->param = param;
+    int error = pthread_create(&h->thread, NULL, ThreadMain, h);
+    if (error) {
+        pthread_mutex_destroy(&h->mutex);
+        pthread_cond_destroy(&h->cond);
+        free(h);
+        Fail(error);
+        return NULL;
+    }
+    if (id) {
+        *id = 0;
+    }
+    return h;
+}
+
+HANDLE
+CreateSemaphoreW(LPSECURITY_ATTRIBUTES sa, LONG initial, LONG maximum, LPCWSTR name) {
+    if (0 > initial || initial > maximum || 1 > maximum) {
+        last_error = ERROR_INVALID_PARAMETER;
+        return NULL;
+    }
+    struct ShimHandle *h = NewHandle(SHIM_SEMAPHORE);
+    if (NULL == h) {
+        return NULL;
+    }
+    pthread_mutex_init(&h->mutex, NULL);
+    pthread_cond_init(&h->cond, NULL);
+    h->count = initial;
+    h->maximum = maximum;
+    return h;
+}
+
+BOOL
+ReleaseSemaphore(HANDLE semaphore, LONG count, LPLONG previous) {
+    struct ShimHandle *h = GetHandle(semaphore, SHIM_SEMAPHORE);
+    if (NULL == h) {
+        return FALSE;
+    }
+    pthread_mutex_lock(&h->mutex);
+    if (0 >= count || h->count + count > h->maximum) {
+        pthread_mutex_unlock(&h->mutex);
+        last_error = ERROR_INVALID_PARAMETER;
+        return FALSE;
+    }
+    if (previous) {
+        *previous = h->count;
+    }
+    h->count += count;
+    pthread_cond_broadcast(&h->cond);
+    pthread_mutex_unlock(&h->mutex);
+    return TRUE;
+}
+
+DWORD
+WaitForSingleObject(HANDLE handle, DWORD ms) {
+    struct ShimHandle *h = handle;
+    if (NULL == h || INVALID_HANDLE_VALUE == handle
+        || (SHIM_SEMAPHORE != h->kind && SHIM_THREAD != h->kind)) {
+        last_error = ERROR_INVALID_HANDLE;
+        return WAIT_FAILED;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000L;
+    if (1000000000L <= deadline.tv_nsec) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    DWORD rv = WAIT_OBJECT_0;
+    pthread_mutex_lock(&h->mutex);
+    while (SHIM_SEMAPHORE == h->kind ? 0 == h->count : !h->done) {
+        int error = INFINITE == ms ? pthread_cond_wait(&h->cond, &h->mutex)
+                                   : pthread_cond_timedwait(&h->cond, &h->mutex, &deadline);
+        if (ETIMEDOUT == error) {
+            rv = WAIT_TIMEOUT;
+            break;
+        }
+    }
+    if (WAIT_OBJECT_0 == rv && SHIM_SEMAPHORE == h->kind) {
+        h->count--;
+    }
+    pthread_mutex_unlock(&h->mutex);
+    if (WAIT_OBJECT_0 == rv && SHIM_THREAD == h->kind && !h->joined) {
+        pthread_join(h->thread, NULL);
+        h->joined = 1;
+    }
+    return rv;
+}
+
+int
+WideCharToMultiByte(UINT codepage, DWORD flags, LPCWSTR str, int len, LPSTR out, int out_len,
+                    LPCSTR fallback, LPBOOL used_fallback) {
+    if (-1 == len) {
+        len = (int) wcslen(str) + 1;
+    }
+    int n = 0;
+    for (int i = 0; i < len; i++) {
+        UINT32 c = (UINT32) str[i];
+        BYTE b[4];
+        int size;
+        if (0x80 > c) {
+            b[0] = (BYTE) c;
+            size = 1;
+        } else if (0x800 > c) {
+            b[0] = (BYTE) (0xc0 | c >> 6);
+            b[1] = (BYTE) (0x80 | (c & 0x3f));
+            size = 2;
+        } else if (0x10000 > c) {
+            b[0] = (BYTE) (0xe0 | c >> 12);
+            b[1] = (BYTE) (0x80 | (c >> 6 & 0x3f));
+            b[2] = (BYTE) (0x80 | (c & 0x3f));
+            size = 3;
+        } else {
+            b[0] = (BYTE) (0xf0 | c >> 18);
+            b[1] = (BYTE) (0x80 | (c >> 12 & 0x3f));
+            b[2] = (BYTE) (0x80 | (c >> 6 & 0x3f));
+            b[3] = (BYTE) (0x80 | (c & 0x3f));
+            size = 4;
+        }
+        if (out_len) {
+            if (n + size > out_len) {
+                last_error = ERROR_INVALID_PARAMETER;
+                return 0;
+            }
+            memcpy(out + n, b, size);
+        }
+        n += size;
+    }
+    return n;
+}
+
+// Converts a single character if the high-order word is zero, otherwise
+// the string in place
+LPWSTR
+CharLowerW(LPWSTR str) {
+    if (0 == ((UINT_PTR) str >> 16)) {
+        return (LPWSTR) (UINT_PTR) towlower((wint_t) (UINT_PTR) str);
+    }
+    for (LPWSTR c = str; *c; c++) {
+        *c = towlower(*c);
+    }
+    return str;
+}
+
+int
+lstrcmpW(LPCWSTR a, LPCWSTR b) {
+    return wcscmp(a, b);
+}
+
+int
+lstrcmpiW(LPCWSTR a, LPCWSTR b) {
+    return wcscasecmp(a, b);
+}
+
+int
+mbstowcs_s(size_t *converted, wchar_t *dst, size_t dst_len, const char *src, size_t count) {
+    size_t n = mbstowcs(dst, src, dst_len);
+    if ((size_t) -1 == n) {
+        dst[0] = L'\0';
+        *converted = 0;
+        return EINVAL;
+    }
+    if (n >= dst_len) {
+        n = dst_len - 1;
+    }
+    dst[n] = L'\0';
+    *converted = n + 1;
+    return 0;
+}
+
+HMODULE
+GetModuleHandleW(LPCWSTR name) {
+    return &current_process;
+}
+
+FARPROC
+GetProcAddress(HMODULE module, LPCSTR name) {
+    return ShimGetProc(name);
+}
+
+int
+MessageBoxW(HWND window, LPCWSTR text, LPCWSTR caption, UINT type) {
+    fprintf(stderr, "%ls: %ls\n", caption, text);
+    return IDOK;
+}
+
+LRESULT
+SendMessageW(HWND window, UINT message, WPARAM wparam, LPARAM lparam) {
+    return 0;
+}
+
+HRESULT
+OleInitialize(LPVOID reserved) {
+    return S_OK;
+}
+
+VOID
+CoTaskMemFree(LPVOID mem) {
+    free(mem);
+}
+
+PIDLIST_ABSOLUTE
+SHBrowseForFolderW(BROWSEINFOW *bi) {
+    return NULL;
+}
+
+BOOL
+SHGetPathFromIDListW(PIDLIST_ABSOLUTE pidl, LPWSTR path) {
+    return FALSE;
+}
+
+// Paths
+
+static BOOL
+IsAbsolute(PCWSTR path) {
+    return L'\\' == path[0] || L'/' == path[0]
+           || (path[0] && L':' == path[1]);
+}
+
+HRESULT
+PathCchCombine(PWSTR out, size_t len, PCWSTR dir, PCWSTR more) {
+    WCHAR buf[32768];
+    if (NULL == more || L'\0' == more[0]) {
+        StringCchCopyW(buf, 32768, dir ? dir : L"");
+    } else if (NULL == dir || L'\0' == dir[0] || IsAbsolute(more)) {
+        StringCchCopyW(buf, 32768, more);
+    } else {
+        size_t n = wcslen(dir);
+        BOOL separator = L'\\' == dir[n - 1] || L'/' == dir[n - 1];
+        StringCchPrintfW(buf, 32768, separator ? L"%ls%ls" : L"%ls\\%ls", dir, more);
+    }
+    return StringCchCopyW(out, len, buf);
+}
+
+HRESULT
+PathAllocCombine(PCWSTR dir, PCWSTR more, ULONG flags, PWSTR *out) {
+    size_t len = (dir ? wcslen(dir) : 0) + (more ? wcslen(more) : 0) + 2;
+    *out = malloc(len * sizeof(WCHAR));
+    if (NULL == *out) {
+        return E_OUTOFMEMORY;
+    }
+    HRESULT hr = PathCchCombine(*out, len, dir, more);
+    if (FAILED(hr)) {
+        free(*out);
+        *out = NULL;
+    }
+    return hr;
+}
+
+HRESULT
+PathCchAppend(PWSTR path, size_t len, PCWSTR more) {
+    return PathCchCombine(path, len, path, more);
+}
+
+HRESULT
+PathCchAddBackslash(PWSTR path, size_t len) {
+    size_t n = wcslen(path);
+    if (n && L'\\' == path[n - 1]) {
+        return S_FALSE;
+    }
+    return StringCchCatW(path, len, L"\\");
+}
+
+HRESULT
+PathCchStripToRoot(PWSTR path, size_t len) {
+    if (L'/' == path[0] || L'\\' == path[0]) {
+        path[1] = L'\0';
+    } else if (path[0] && L':' == path[1]) {
+        path[2] = L'\0';
+    } else {
+        return E_FAIL;
+    }
+    return S_OK;
+}
+
+// Strings
+
+HRESULT
+StringCchCopyW(LPWSTR dst, size_t len, LPCWSTR src) {
+    size_t n = wcslen(src);
+    if (0 == len) {
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+    if (n >= len) {
+        wmemmove(dst, src, len - 1);
+        dst[len - 1] = L'\0';
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+    wmemmove(dst, src, n + 1);
+    return S_OK;
+}
+
+HRESULT
+StringCchCatW(LPWSTR dst, size_t len, LPCWSTR src) {
+    size_t n = wcsnlen(dst, len);
+    if (n >= len) {
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+    return StringCchCopyW(dst + n, len - n, src);
+}
+
+HRESULT
+StringCchPrintfW(LPWSTR dst, size_t len, LPCWSTR format, ...) {
+    // vswprintf fails without output if the buffer is too small
+    size_t size = 1024;
+    while (1) {
+        WCHAR *buf = malloc(size * sizeof(WCHAR));
+        if (NULL == buf) {
+            return E_OUTOFMEMORY;
+        }
+        va_list args;
+        va_start(args, format);
+        int n = vswprintf(buf, size, format, args);
+        va_end(args);
+        if (0 <= n) {
+            HRESULT hr = StringCchCopyW(dst, len, buf);
+            free(buf);
+            return hr;
+        }
+        free(buf);
+        if (size > 1048576) {
+            return E_FAIL;
+        }
+        size *= 4;
+    }
+}
+
+HRESULT
+StringCchCopyA(LPSTR dst, size_t len, LPCSTR src) {
+    size_t n = strlen(src);
+    if (0 == len) {
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+    if (n >= len) {
+        memmove(dst, src, len - 1);
+        dst[len - 1] = '\0';
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+    memmove(dst, src, n + 1);
+    return S_OK;
+}
+
+HRESULT
+StringCchCatA(LPSTR dst, size_t len, LPCSTR src) {
+    size_t n = strnlen(dst, len);
+    if (n >= len) {
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+    return StringCchCopyA(dst + n, len - n, src);
+}
+
+HRESULT
+StringCchVPrintfA(LPSTR dst, size_t len, LPCSTR format, va_list args) {
+    int n = vsnprintf(dst, len, format, args);
+    return 0 <= n && (size_t) n < len ? S_OK : STRSAFE_E_INSUFFICIENT_BUFFER;
+}
+
+HRESULT
+StringCchPrintfA(LPSTR dst, size_t len, LPCSTR format, ...) {
+    va_list args;
+    va_start(args, format);
+    HRESULT hr = StringCchVPrintfA(dst, len, format, args);
+    va_end(args);
+    return hr;
+}
+
+// MD5 (RFC 1321)
+
+struct ShimMd5 {
+    UINT32 state[4];
+    UINT64 length;
+    BYTE block[64];
+};
+
+static const UINT32 md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const BYTE md5_r[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static VOID
+Md5Block(struct ShimMd5 *md5, const BYTE *p) {
+    UINT32 w[16];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (UINT32) p[4 * i] | (UINT32) p[4 * i + 1] << 8
+               | (UINT32) p[4 * i + 2] << 16 | (UINT32) p[4 * i + 3] << 24;
+    }
+    UINT32 a = md5->state[0], b = md5->state[1], c = md5->state[2], d = md5->state[3];
+    for (int i = 0; i < 64; i++) {
+        UINT32 f;
+        int g;
+        if (16 > i) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (32 > i) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        } else if (48 > i) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+        UINT32 t = d;
+        d = c;
+        c = b;
+        UINT32 x = a + f + md5_k[i] + w[g];
+        b = b + (x << md5_r[i] | x >> (32 - md5_r[i]));
+        a = t;
+    }
+    md5->state[0] += a;
+    md5->state[1] += b;
+    md5->state[2] += c;
+    md5->state[3] += d;
+}
+
+static VOID
+Md5Reset(struct ShimMd5 *md5) {
+    md5->state[0] = 0x67452301;
+    md5->state[1] = 0xefcdab89;
+    md5->state[2] = 0x98badcfe;
+    md5->state[3] = 0x10325476;
+    md5->length = 0;
+}
+
+static VOID
+Md5Update(struct ShimMd5 *md5, const BYTE *data, size_t len) {
+    size_t used = md5->length % 64;
+    md5->length += len;
+    while (len) {
+        size_t n = min(64 - used, len);
+        memcpy(md5->block + used, data, n);
+        used += n;
+        data += n;
+        len -= n;
+        if (64 == used) {
+            Md5Block(md5, md5->block);
+            used = 0;
+        }
+    }
+}
+
+static VOID
+Md5Final(struct ShimMd5 *md5, BYTE digest[16]) {
+    UINT64 bits = md5->length * 8;
+    BYTE pad[72] = {0x80};
+    size_t used = md5->length % 64;
+    size_t pad_len = (56 > used ? 56 : 120) - used;
+    for (int i = 0; i < 8; i++) {
+        pad[pad_len + i] = (BYTE) (bits >> (8 * i));
+    }
+    Md5Update(md5, pad, pad_len + 8);
+    for (int i = 0; i < 16; i++) {
+        digest[i] = (BYTE) (md5->state[i / 4] >> (8 * (i % 4)));
+    }
+}
+
+NTSTATUS
+BCryptOpenAlgorithmProvider(BCRYPT_ALG_HANDLE *alg, LPCWSTR id, LPCWSTR impl, ULONG flags) {
+    if (0 != wcscmp(id, BCRYPT_MD5_ALGORITHM)) {
+        return (NTSTATUS) 0xC00000BB;
+    }
+    *alg = &current_process;
+    return 0;
+}
+
+NTSTATUS
+BCryptCloseAlgorithmProvider(BCRYPT_ALG_HANDLE alg, ULONG flags) {
+    return 0;
+}
+
+NTSTATUS
+BCryptCreateHash(BCRYPT_ALG_HANDLE alg, BCRYPT_HASH_HANDLE *hash, PUCHAR object, ULONG object_len,
+                 PUCHAR secret, ULONG secret_len, ULONG flags) {
+    struct ShimMd5 *md5 = malloc(sizeof(struct ShimMd5));
+    if (NULL == md5) {
+        return (NTSTATUS) 0xC0000017;
+    }
+    Md5Reset(md5);
+    *hash = md5;
+    return 0;
+}
+
+NTSTATUS
+BCryptHashData(BCRYPT_HASH_HANDLE hash, PUCHAR data, ULONG len, ULONG flags) {
+    Md5Update(hash, data, len);
+    return 0;
+}
+
+NTSTATUS
+BCryptFinishHash(BCRYPT_HASH_HANDLE hash, PUCHAR digest, ULONG len, ULONG flags) {
+    if (16 != len) {
+        return (NTSTATUS) 0xC000000D;
+    }
+    Md5Final(hash, digest);
+    Md5Reset(hash);
+    return 0;
+}
+
+NTSTATUS
+BCryptDestroyHash(BCRYPT_HASH_HANDLE hash) {
+    free(hash);
+    return 0;
+}
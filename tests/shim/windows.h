@@ -0,0 +1,367 @@
+/*
+    Minimal Win32 API for running the X-Tension on POSIX systems in tests.
+    Only what src/xt-gexpo.c uses is declared, see win32.c. WCHAR is the
+    native wchar_t, so wide strings and files written by the X-Tension use
+    UTF-32 instead of UTF-16 here.
+*/
+
+#ifndef SHIM_WINDOWS_H
+#define SHIM_WINDOWS_H
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#define __declspec(x)
+#define __stdcall
+#define WINAPI
+#define CALLBACK
+#define __in
+
+#define VOID  void
+#define TRUE  1
+#define FALSE 0
+
+#define MAX_PATH 260
+#define INFINITE 0xFFFFFFFF
+
+typedef int32_t BOOL, *LPBOOL;
+typedef uint8_t BYTE, *LPBYTE, *PBYTE, UCHAR, *PUCHAR, UINT8;
+typedef int8_t INT8;
+typedef char CHAR;
+typedef uint16_t WORD, UINT16;
+typedef int16_t INT16;
+typedef uint32_t DWORD, *LPDWORD, UINT, UINT32, ULONG;
+typedef int32_t LONG, *LPLONG, INT, INT32;
+typedef int64_t INT64, *PINT64, LONGLONG, LONG64;
+typedef uint64_t UINT64, ULONGLONG, ULONG64, DWORD64, DWORDLONG;
+typedef size_t SIZE_T;
+typedef intptr_t LONG_PTR, LPARAM, LRESULT;
+typedef uintptr_t UINT_PTR, ULONG_PTR, DWORD_PTR, WPARAM;
+
+typedef wchar_t WCHAR, *LPWSTR, *PWSTR;
+typedef const wchar_t *LPCWSTR, *PCWSTR;
+typedef char *LPSTR;
+typedef const char *LPCSTR;
+
+typedef void *PVOID, *LPVOID, *HANDLE, *HWND, *HMODULE, *HINSTANCE, *HLOCAL;
+typedef const void *LPCVOID;
+typedef HANDLE *PHANDLE;
+typedef intptr_t (*FARPROC)();
+
+typedef int32_t HRESULT;
+typedef int32_t NTSTATUS;
+
+typedef union {
+    struct {
+        DWORD LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef union {
+    struct {
+        DWORD LowPart;
+        DWORD HighPart;
+    };
+    ULONGLONG QuadPart;
+} ULARGE_INTEGER, *PULARGE_INTEGER;
+
+typedef struct {
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+} FILETIME;
+
+typedef struct {
+    WORD wYear, wMonth, wDayOfWeek, wDay, wHour, wMinute, wSecond, wMilliseconds;
+} SYSTEMTIME;
+
+typedef struct _OVERLAPPED {
+    ULONG_PTR Internal;
+    ULONG_PTR InternalHigh;
+    union {
+        struct {
+            DWORD Offset;
+            DWORD OffsetHigh;
+        };
+        PVOID Pointer;
+    };
+    HANDLE hEvent;
+} OVERLAPPED, *LPOVERLAPPED;
+
+typedef VOID (*LPOVERLAPPED_COMPLETION_ROUTINE)(DWORD, DWORD, LPOVERLAPPED);
+
+typedef struct {
+    DWORD nLength;
+    LPVOID lpSecurityDescriptor;
+    BOOL bInheritHandle;
+} SECURITY_ATTRIBUTES, *LPSECURITY_ATTRIBUTES;
+
+typedef struct {
+    DWORD dwFileAttributes;
+    FILETIME ftCreationTime;
+    FILETIME ftLastAccessTime;
+    FILETIME ftLastWriteTime;
+    DWORD nFileSizeHigh;
+    DWORD nFileSizeLow;
+} WIN32_FILE_ATTRIBUTE_DATA;
+
+typedef enum {
+    GetFileExInfoStandard
+} GET_FILEEX_INFO_LEVELS;
+
+typedef struct {
+    DWORD cb;
+    DWORD PageFaultCount;
+    SIZE_T PeakWorkingSetSize;
+    SIZE_T WorkingSetSize;
+    SIZE_T QuotaPeakPagedPoolUsage;
+    SIZE_T QuotaPagedPoolUsage;
+    SIZE_T QuotaPeakNonPagedPoolUsage;
+    SIZE_T QuotaNonPagedPoolUsage;
+    SIZE_T PagefileUsage;
+    SIZE_T PeakPagefileUsage;
+} PROCESS_MEMORY_COUNTERS, *PPROCESS_MEMORY_COUNTERS;
+
+typedef enum {
+    IoPriorityHintVeryLow,
+    IoPriorityHintLow,
+    IoPriorityHintNormal
+} PRIORITY_HINT;
+
+typedef struct {
+    PRIORITY_HINT PriorityHint;
+} FILE_IO_PRIORITY_HINT_INFO;
+
+typedef enum {
+    FileBasicInfo,
+    FileIoPriorityHintInfo = 12
+} FILE_INFO_BY_HANDLE_CLASS;
+
+// A zeroed pthread_rwlock_t is a valid unlocked lock, like SRWLOCK_INIT
+typedef pthread_rwlock_t SRWLOCK, *PSRWLOCK;
+#define SRWLOCK_INIT PTHREAD_RWLOCK_INITIALIZER
+
+typedef DWORD (*LPTHREAD_START_ROUTINE)(LPVOID);
+
+#define INVALID_HANDLE_VALUE ((HANDLE) (LONG_PTR) -1)
+#define INVALID_FILE_ATTRIBUTES ((DWORD) -1)
+
+#define GENERIC_READ     0x80000000
+#define GENERIC_WRITE    0x40000000
+#define FILE_APPEND_DATA 0x00000004
+
+#define FILE_SHARE_READ   1
+#define FILE_SHARE_WRITE  2
+#define FILE_SHARE_DELETE 4
+
+#define CREATE_NEW        1
+#define CREATE_ALWAYS     2
+#define OPEN_EXISTING     3
+#define OPEN_ALWAYS       4
+#define TRUNCATE_EXISTING 5
+
+#define FILE_ATTRIBUTE_READONLY   0x00000001
+#define FILE_ATTRIBUTE_HIDDEN     0x00000002
+#define FILE_ATTRIBUTE_DIRECTORY  0x00000010
+#define FILE_ATTRIBUTE_NORMAL     0x00000080
+#define FILE_ATTRIBUTE_TEMPORARY  0x00000100
+#define FILE_FLAG_WRITE_THROUGH   0x80000000
+#define FILE_FLAG_OVERLAPPED      0x40000000
+#define FILE_FLAG_NO_BUFFERING    0x20000000
+#define FILE_FLAG_RANDOM_ACCESS   0x10000000
+#define FILE_FLAG_SEQUENTIAL_SCAN 0x08000000
+#define FILE_FLAG_DELETE_ON_CLOSE 0x04000000
+
+#define FILE_BEGIN   0
+#define FILE_CURRENT 1
+#define FILE_END     2
+
+#define ERROR_SUCCESS          0
+#define ERROR_FILE_NOT_FOUND   2
+#define ERROR_PATH_NOT_FOUND   3
+#define ERROR_ACCESS_DENIED    5
+#define ERROR_INVALID_HANDLE   6
+#define ERROR_NOT_ENOUGH_MEMORY 8
+#define ERROR_NOT_SAME_DEVICE  17
+#define ERROR_SHARING_VIOLATION 32
+#define ERROR_LOCK_VIOLATION   33
+#define ERROR_HANDLE_EOF       38
+#define ERROR_FILE_EXISTS      80
+#define ERROR_INVALID_PARAMETER 87
+#define ERROR_DISK_FULL        112
+#define ERROR_DIR_NOT_EMPTY    145
+#define ERROR_ALREADY_EXISTS   183
+
+#define WAIT_OBJECT_0      0
+#define WAIT_IO_COMPLETION 0xC0
+#define WAIT_TIMEOUT       258
+#define WAIT_FAILED        0xFFFFFFFF
+
+#define MOVEFILE_REPLACE_EXISTING 1
+#define MOVEFILE_WRITE_THROUGH    8
+
+#define PAGE_READONLY  0x02
+#define PAGE_READWRITE 0x04
+#define FILE_MAP_WRITE 0x0002
+#define FILE_MAP_READ  0x0004
+#define FILE_MAP_ALL_ACCESS 0xF001F
+
+#define LOCKFILE_FAIL_IMMEDIATELY 1
+#define LOCKFILE_EXCLUSIVE_LOCK   2
+
+#define FSCTL_SET_SPARSE 0x000900C4
+
+#define THREAD_MODE_BACKGROUND_BEGIN 0x00010000
+#define THREAD_MODE_BACKGROUND_END   0x00020000
+
+#define MB_OK              0x00
+#define MB_YESNO           0x04
+#define MB_ICONERROR       0x10
+#define MB_ICONWARNING     0x30
+#define MB_ICONINFORMATION 0x40
+#define IDOK  1
+#define IDYES 6
+
+#define LOCALE_NAME_USER_DEFAULT NULL
+#define DATE_SHORTDATE 1
+#define TIME_FORCE24HOURFORMAT 8
+
+#define CP_UTF8 65001
+
+#define S_OK    ((HRESULT) 0)
+#define S_FALSE ((HRESULT) 1)
+#define E_FAIL  ((HRESULT) 0x80004005)
+#define E_OUTOFMEMORY ((HRESULT) 0x8007000E)
+#define SUCCEEDED(hr) (((HRESULT) (hr)) >= 0)
+#define FAILED(hr)    (((HRESULT) (hr)) < 0)
+
+#define MAXUINT32 ((UINT32) ~((UINT32) 0))
+#define MAXUINT64 ((UINT64) ~((UINT64) 0))
+#define MAXINT64  ((INT64) (MAXUINT64 >> 1))
+
+#define LOWORD(x) ((WORD) (x))
+#define HIWORD(x) ((WORD) ((x) >> 16))
+#define UNREFERENCED_PARAMETER(x) ((void) (x))
+#define _TRUNCATE ((size_t) -1)
+
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#define CopyMemory(d, s, n) memcpy((d), (s), (n))
+#define MoveMemory(d, s, n) memmove((d), (s), (n))
+#define ZeroMemory(p, n)    memset((p), 0, (n))
+#define CreateFile CreateFileW
+
+// Handles and files
+HANDLE CreateFileW(LPCWSTR, DWORD, DWORD, LPSECURITY_ATTRIBUTES, DWORD, DWORD, HANDLE);
+BOOL ReadFile(HANDLE, LPVOID, DWORD, LPDWORD, LPOVERLAPPED);
+BOOL ReadFileEx(HANDLE, LPVOID, DWORD, LPOVERLAPPED, LPOVERLAPPED_COMPLETION_ROUTINE);
+BOOL WriteFile(HANDLE, LPCVOID, DWORD, LPDWORD, LPOVERLAPPED);
+BOOL CloseHandle(HANDLE);
+BOOL SetFilePointerEx(HANDLE, LARGE_INTEGER, PLARGE_INTEGER, DWORD);
+BOOL SetEndOfFile(HANDLE);
+BOOL GetFileSizeEx(HANDLE, PLARGE_INTEGER);
+BOOL FlushFileBuffers(HANDLE);
+BOOL SetFileInformationByHandle(HANDLE, FILE_INFO_BY_HANDLE_CLASS, LPVOID, DWORD);
+BOOL DeviceIoControl(HANDLE, DWORD, LPVOID, DWORD, LPVOID, DWORD, LPDWORD, LPOVERLAPPED);
+BOOL LockFileEx(HANDLE, DWORD, DWORD, DWORD, DWORD, LPOVERLAPPED);
+BOOL UnlockFileEx(HANDLE, DWORD, DWORD, DWORD, LPOVERLAPPED);
+HANDLE CreateFileMappingW(HANDLE, LPSECURITY_ATTRIBUTES, DWORD, DWORD, DWORD, LPCWSTR);
+LPVOID MapViewOfFile(HANDLE, DWORD, DWORD, DWORD, SIZE_T);
+BOOL UnmapViewOfFile(LPCVOID);
+
+BOOL CreateDirectoryW(LPCWSTR, LPSECURITY_ATTRIBUTES);
+BOOL RemoveDirectoryW(LPCWSTR);
+BOOL DeleteFileW(LPCWSTR);
+BOOL MoveFileExW(LPCWSTR, LPCWSTR, DWORD);
+BOOL CreateHardLinkW(LPCWSTR, LPCWSTR, LPSECURITY_ATTRIBUTES);
+DWORD GetFileAttributesW(LPCWSTR);
+BOOL GetFileAttributesExW(LPCWSTR, GET_FILEEX_INFO_LEVELS, LPVOID);
+UINT GetTempFileNameW(LPCWSTR, LPCWSTR, UINT, LPWSTR);
+BOOL GetDiskFreeSpaceExW(LPCWSTR, PULARGE_INTEGER, PULARGE_INTEGER, PULARGE_INTEGER);
+BOOL GetDiskFreeSpaceW(LPCWSTR, LPDWORD, LPDWORD, LPDWORD, LPDWORD);
+
+LONG CompareFileTime(const FILETIME *, const FILETIME *);
+BOOL SystemTimeToFileTime(const SYSTEMTIME *, FILETIME *);
+int GetDateFormatEx(LPCWSTR, DWORD, const SYSTEMTIME *, LPCWSTR, LPWSTR, int, LPCWSTR);
+int GetTimeFormatEx(LPCWSTR, DWORD, const SYSTEMTIME *, LPCWSTR, LPWSTR, int);
+
+UINT GetPrivateProfileIntW(LPCWSTR, LPCWSTR, INT, LPCWSTR);
+DWORD GetPrivateProfileStringW(LPCWSTR, LPCWSTR, LPCWSTR, LPWSTR, DWORD, LPCWSTR);
+
+// Errors, time and threads
+DWORD GetLastError(void);
+VOID SetLastError(DWORD);
+HLOCAL LocalFree(HLOCAL);
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER *);
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *);
+ULONGLONG GetTickCount64(void);
+VOID Sleep(DWORD);
+DWORD SleepEx(DWORD, BOOL);
+
+HANDLE GetCurrentProcess(void);
+HANDLE GetCurrentThread(void);
+DWORD GetCurrentThreadId(void);
+BOOL SetThreadPriority(HANDLE, int);
+BOOL GetProcessMemoryInfo(HANDLE, PPROCESS_MEMORY_COUNTERS, DWORD);
+
+HANDLE CreateThread(LPSECURITY_ATTRIBUTES, SIZE_T, LPTHREAD_START_ROUTINE, LPVOID, DWORD, LPDWORD);
+HANDLE CreateSemaphoreW(LPSECURITY_ATTRIBUTES, LONG, LONG, LPCWSTR);
+BOOL ReleaseSemaphore(HANDLE, LONG, LPLONG);
+DWORD WaitForSingleObject(HANDLE, DWORD);
+
+#define InitializeSRWLock(l)       pthread_rwlock_init((l), NULL)
+#define AcquireSRWLockExclusive(l) pthread_rwlock_wrlock(l)
+#define ReleaseSRWLockExclusive(l) pthread_rwlock_unlock(l)
+#define AcquireSRWLockShared(l)    pthread_rwlock_rdlock(l)
+#define ReleaseSRWLockShared(l)    pthread_rwlock_unlock(l)
+
+#define InterlockedIncrement(p)          __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p)          __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedIncrement64(p)        __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement64(p)        __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(p, v)        __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchange64(p, v)      __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(p, v)     __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd64(p, v)   __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(p, v, c) __sync_val_compare_and_swap((p), (c), (v))
+#define InterlockedCompareExchange64(p, v, c) __sync_val_compare_and_swap((p), (c), (v))
+#define MemoryBarrier() __sync_synchronize()
+
+// Strings
+int WideCharToMultiByte(UINT, DWORD, LPCWSTR, int, LPSTR, int, LPCSTR, LPBOOL);
+LPWSTR CharLowerW(LPWSTR);
+int lstrcmpW(LPCWSTR, LPCWSTR);
+int lstrcmpiW(LPCWSTR, LPCWSTR);
+int mbstowcs_s(size_t *, wchar_t *, size_t, const char *, size_t);
+
+#define _wcsicmp wcscasecmp
+#define _wcsnicmp wcsncasecmp
+#define wcstok_s wcstok
+#define swscanf_s swscanf
+
+// Host process and user interface
+HMODULE GetModuleHandleW(LPCWSTR);
+FARPROC GetProcAddress(HMODULE, LPCSTR);
+int MessageBoxW(HWND, LPCWSTR, LPCWSTR, UINT);
+LRESULT SendMessageW(HWND, UINT, WPARAM, LPARAM);
+HRESULT OleInitialize(LPVOID);
+VOID CoTaskMemFree(LPVOID);
+
+// Provided by the test, resolves the XWF_* functions of the host
+FARPROC ShimGetProc(LPCSTR name);
+
+#endif
@@ -0,0 +1,55 @@
+/*
+    Adaptive=1 changes chunk size and read-ahead depth of the pipeline
+    between files and within them. Slow reads make sure that several
+    tuning windows pass; every file still has to arrive intact.
+*/
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+#define FILES 6
+#define SIZE  (6 * 1024 * 1024 + 12345)
+
+int
+main() {
+    HostInit("[Export]\nChunkSizeMB=1\nReadAhead=2\nAdaptive=1\nMemoryBudgetMB=8\n"
+             "[Status]\nIntervalMs=0\n");
+    static WCHAR names[FILES][16];
+    LONG ids[FILES];
+    BYTE *buf = malloc(SIZE);
+    for (int n = 0; n < FILES; n++) {
+        for (INT64 i = 0; i < SIZE; i++) {
+            buf[i] = (BYTE) (n * 17 + i * 5 + (i >> 13));
+        }
+        swprintf(names[n], 16, L"v%d.mp4", n);
+        ids[n] = HostAddFile(-1, names[n], L"Video", buf, SIZE);
+        HostItem(ids[n])->read_delay = 100;
+    }
+    free(buf);
+
+    CHECK(1 == HostRun(1));
+
+    char rel[64];
+    for (int n = 0; n < FILES; n++) {
+        snprintf(rel, sizeof(rel), "Existing/Image/Movies/%d", n + 1);
+        CHECK(HostExportMatches(rel, ids[n]));
+    }
+    CHECK(HostLogged(L"Adaptive export: "));
+
+    // Settings of the last window, within the memory budget
+    char *status = (char *) HostReadExport("Status.json", NULL);
+    const char *chunk = status ? strstr(status, "\"adaptive_chunk_mb\": ") : NULL;
+    const char *depth = status ? strstr(status, "\"adaptive_read_ahead\": ") : NULL;
+    CHECK(chunk && depth);
+    if (chunk && depth) {
+        double mb = atof(chunk + strlen("\"adaptive_chunk_mb\": "));
+        int read_ahead = atoi(depth + strlen("\"adaptive_read_ahead\": "));
+        CHECK(1 <= mb && 1 <= read_ahead);
+        CHECK(mb * (read_ahead + 1) <= 8);
+    }
+    CHECK(status && NULL == strstr(status, "\"adaptive_action\": \"off\""));
+    CHECK(status && NULL == strstr(status, "\"adaptive_action\": \"start\""));
+    free(status);
+
+    return HostDone("adaptive") ? 1 : 0;
+}
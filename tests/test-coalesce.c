@@ -0,0 +1,86 @@
+/*
+    Coalesce=1 reads physically adjacent files in one go and slices them
+    out of the buffer. Files spanning several clusters are verified by
+    reading their end through X-Ways, unless they are known to be
+    contiguous. Empty files in a run are not exported. A dry run does
+    not look up any offsets.
+*/
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+// Sizes just below a cluster boundary, so the next file starts in the
+// following cluster of 4096 bytes
+static const INT64 sizes[] = {4096 - 100, 3 * 4096 - 100, 0, 2 * 4096 - 50, 4096 - 300, 5 * 4096 - 1};
+#define FILES (sizeof(sizes) / sizeof(sizes[0]))
+
+static int
+Run(const char *test, BOOL carved) {
+    HostInit("[Export]\nCoalesce=1\n");
+    static WCHAR names[FILES][16];
+    LONG ids[FILES];
+    BYTE *buf = calloc(5, 4096);
+    // Offset 0 is neither a start sector nor a carved offset
+    HostAddFile(-1, L"filler.txt", L"Text", buf, 4096);
+    for (size_t n = 0; n < FILES; n++) {
+        for (INT64 i = 0; i < sizes[n]; i++) {
+            buf[i] = (BYTE) (n * 41 + i * 3);
+        }
+        swprintf(names[n], 16, L"p%d.jpg", (int) n);
+        ids[n] = HostAddFile(-1, names[n], L"Pictures", buf, sizes[n]);
+        HostItem(ids[n])->carved = carved;
+    }
+    free(buf);
+
+    CHECK(1 == HostRun(1));
+    CHECK(0 < host.offset_lookups);
+
+    // Only files of several clusters which are not carved are opened
+    int verified = 0;
+    for (size_t n = 0; n < FILES; n++) {
+        verified += 4096 < sizes[n] && !HostItem(ids[n])->carved;
+    }
+    CHECK(verified == host.opens);
+
+    int export_id = 1;
+    char rel[64];
+    for (size_t n = 0; n < FILES; n++) {
+        if (0 == sizes[n]) {
+            CHECK(0 == HostItem(ids[n])->tables);
+            continue;
+        }
+        CHECK(HOST_TABLE_SUCCESS == HostItem(ids[n])->tables);
+        snprintf(rel, sizeof(rel), "Existing/Image/Pictures/%d", export_id++);
+        CHECK(HostExportMatches(rel, ids[n]));
+    }
+    snprintf(rel, sizeof(rel), "Existing/Image/Pictures/%d", export_id);
+    CHECK(!HostExportExists(rel));
+    WCHAR *xml = HostReadXml("Existing/Image/C4P Index.xml");
+    CHECK(export_id - 1 == CountOf(xml, L"<Image>"));
+    free(xml);
+
+    return HostDone(test);
+}
+
+static int
+DryRun() {
+    HostInit("[Export]\nCoalesce=1\n[Preflight]\nDryRun=1\n");
+    BYTE buf[4096] = {0};
+    HostAddFile(-1, L"p0.jpg", L"Pictures", buf, sizeof(buf));
+    HostAddFile(-1, L"p1.jpg", L"Pictures", buf, sizeof(buf));
+
+    HostRun(1);
+    CHECK(0 == host.offset_lookups);
+    CHECK(HostLogged(L"Dry run: 2 files"));
+    CHECK(!HostExportExists("Existing/Image/Pictures/1"));
+
+    return HostDone("coalesce-dry-run");
+}
+
+int
+main() {
+    int failures = Run("coalesce", 0);
+    failures += Run("coalesce-carved", 1);
+    failures += DryRun();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+/*
+    Delta=1 skips files listed in the manifest of previous runs and
+    continues their numbering. A run interrupted while writing a record
+    leaves a partial record at the end of the manifest, which is cut off
+    before the next run appends, so its records stay aligned. A manifest
+    of a newer version is not appended to. The highest export IDs are
+    looked up per evidence item.
+*/
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+#define MANIFEST_NAME "Export Manifest.dat"
+
+// Appends len bytes to the manifest, like an interrupted write
+static VOID
+AppendPartial(DWORD len) {
+    char path[PATH_MAX];
+    HostExportPath(path, sizeof(path), MANIFEST_NAME);
+    FILE *f = fopen(path, "ab");
+    for (DWORD i = 0; i < len; i++) {
+        fputc(0xa5, f);
+    }
+    fclose(f);
+}
+
+// Returns the manifest records, NULL unless all records are complete
+static struct XtManifestRecord *
+ReadManifest(size_t *count) {
+    size_t len = 0;
+    BYTE *data = HostReadExport(MANIFEST_NAME, &len);
+    const struct XtManifestHeader *header = (const struct XtManifestHeader *) data;
+    *count = 0;
+    if (NULL == data || sizeof(*header) > len
+        || sizeof(struct XtManifestRecord) != header->record_size
+        || (len - sizeof(*header)) % sizeof(struct XtManifestRecord)) {
+        free(data);
+        return NULL;
+    }
+    *count = (len - sizeof(*header)) / sizeof(struct XtManifestRecord);
+    memmove(data, header + 1, len - sizeof(*header));
+    return (struct XtManifestRecord *) data;
+}
+
+static int
+Partial() {
+    HostInit("[Export]\nDelta=1\n");
+    BYTE buf[1000];
+    memset(buf, 1, sizeof(buf));
+    LONG first = HostAddFile(-1, L"first.jpg", L"Pictures", buf, sizeof(buf));
+    memset(buf, 2, sizeof(buf));
+    LONG second = HostAddFile(-1, L"second.jpg", L"Pictures", buf, sizeof(buf));
+    CHECK(1 == HostRun(1));
+
+    AppendPartial(50);
+    memset(buf, 3, sizeof(buf));
+    LONG third = HostAddFile(-1, L"third.jpg", L"Pictures", buf, sizeof(buf));
+    CHECK(1 == HostRun(1));
+
+    CHECK(HostExportMatches("Existing/Image/Pictures/1", first));
+    CHECK(HostExportMatches("Existing/Image/Pictures/2", second));
+    CHECK(HostExportMatches("Existing/Image/Pictures/3", third));
+    CHECK(HostLogged(L"2 files were exported by previous runs"));
+    size_t count = 0;
+    struct XtManifestRecord *rec = ReadManifest(&count);
+    CHECK(rec && 3 == count);
+    if (rec && 3 == count) {
+        CHECK(first == rec[0].xwf_id && second == rec[1].xwf_id && third == rec[2].xwf_id);
+        CHECK(3 == rec[2].export_id && sizeof(buf) == rec[2].filesize);
+    }
+    free(rec);
+
+    // A third run reads all three records and has nothing left to export
+    CHECK(0 == HostRun(1));
+    CHECK(HostLogged(L"3 files were exported by previous runs"));
+    CHECK(!HostExportExists("Existing/Image/Pictures/4"));
+
+    return HostDone("delta-partial");
+}
+
+// A manifest written by a newer version
+static int
+Newer() {
+    HostInit("[Export]\nDelta=1\n");
+    BYTE buf[1000];
+    memset(buf, 1, sizeof(buf));
+    HostAddFile(-1, L"first.jpg", L"Pictures", buf, sizeof(buf));
+    CHECK(1 == HostRun(1));
+
+    char path[PATH_MAX];
+    struct XtManifestHeader header = {0};
+    HostExportPath(path, sizeof(path), MANIFEST_NAME);
+    FILE *f = fopen(path, "r+b");
+    CHECK(f && 1 == fread(&header, sizeof(header), 1, f));
+    header.version = MANIFEST_VERSION + 1;
+    fseek(f, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, f);
+    fclose(f);
+    struct stat before;
+    struct stat after;
+    CHECK(0 == stat(path, &before));
+
+    memset(buf, 2, sizeof(buf));
+    HostAddFile(-1, L"second.jpg", L"Pictures", buf, sizeof(buf));
+    CHECK(1 != HostRun(1));
+    CHECK(HostLogged(L"could not read the export manifest"));
+    CHECK(0 == stat(path, &after) && before.st_size == after.st_size);
+
+    return HostDone("delta-newer");
+}
+
+// Export IDs of many evidence items, which grow the table several times
+static int
+Bases() {
+    delta.table = calloc(65536, sizeof(struct XtDeltaEntry));
+    delta.mask = 65535;
+    for (UINT32 v = 0; v < 5000; v++) {
+        struct XtManifestRecord rec = {0};
+        rec.volume_hash = 0x9e3779b97f4a7c15ULL * (v + 1);
+        rec.filesize = 1;
+        for (UINT32 n = 1; n <= 4; n++) {
+            rec.xwf_id = n;
+            rec.export_id = v + n;
+            rec.type = n % 2 ? TYPE_PICTURE : TYPE_VIDEO;
+            rec.deleted = n > 2;
+            DeltaInsert(&rec);
+        }
+    }
+    CHECK(5000 == delta.base_count && 20000 == delta.count);
+    for (UINT32 v = 0; v < 5000; v++) {
+        struct XtReport existing = {0};
+        struct XtReport deleted = {0};
+        DeltaInitReport(&existing, 0x9e3779b97f4a7c15ULL * (v + 1), REPORT_TYPE_EXISTING);
+        DeltaInitReport(&deleted, 0x9e3779b97f4a7c15ULL * (v + 1), REPORT_TYPE_DELETED);
+        CHECK(v + 1 == existing.image_count && v + 2 == existing.movie_count);
+        CHECK(v + 3 == deleted.image_base && v + 4 == deleted.movie_base);
+    }
+    struct XtReport unknown = {0};
+    DeltaInitReport(&unknown, 12345, REPORT_TYPE_EXISTING);
+    CHECK(0 == unknown.image_count && 0 == unknown.movie_count);
+    DeltaFree();
+    return HostDone("delta-bases");
+}
+
+int
+main() {
+    int failures = Partial();
+    failures += Newer();
+    failures += Bases();
+    return failures ? 1 : 0;
+}
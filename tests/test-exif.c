@@ -0,0 +1,249 @@
+/*
+    Extract=1 and Thumbnails=1 list camera, capture time and GPS position
+    of pictures in Exif.txt and save their thumbnails in Previews. The
+    parser is checked directly on JPEG and HEIF pictures with little and
+    big endian TIFF data, then through an export.
+*/
+
+#include <math.h>
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+static const BYTE thumbnail[] = {0xff, 0xd8, 0xff, 0xdb, 't', 'h', 'u', 'm', 'b', 0xff, 0xd9};
+
+// TIFF data of the Exif segment, values of more than 4 bytes are stored
+// in an area after the IFDs
+struct Tiff {
+    BYTE b[1024];
+    DWORD data;
+    BOOL le;
+};
+
+static VOID
+Put16(BYTE *b, BOOL le, UINT32 v) {
+    b[le ? 0 : 1] = (BYTE) v;
+    b[le ? 1 : 0] = (BYTE) (v >> 8);
+}
+
+static VOID
+Put32(BYTE *b, BOOL le, UINT32 v) {
+    for (int i = 0; i < 4; i++) {
+        b[le ? i : 3 - i] = (BYTE) (v >> (8 * i));
+    }
+}
+
+static VOID
+Entry(struct Tiff *t, DWORD pos, UINT16 tag, UINT16 type, UINT32 count) {
+    Put16(t->b + pos, t->le, tag);
+    Put16(t->b + pos + 2, t->le, type);
+    Put32(t->b + pos + 4, t->le, count);
+}
+
+static VOID
+EntryLong(struct Tiff *t, DWORD pos, UINT16 tag, UINT32 value) {
+    Entry(t, pos, tag, 4, 1);
+    Put32(t->b + pos + 8, t->le, value);
+}
+
+static VOID
+EntryAscii(struct Tiff *t, DWORD pos, UINT16 tag, const char *s) {
+    DWORD count = (DWORD) strlen(s) + 1;
+    Entry(t, pos, tag, 2, count);
+    if (4 >= count) {
+        memcpy(t->b + pos + 8, s, count);
+        return;
+    }
+    Put32(t->b + pos + 8, t->le, t->data);
+    memcpy(t->b + t->data, s, count);
+    t->data += count;
+}
+
+// Degrees, minutes and seconds as three rationals
+static VOID
+EntryRational(struct Tiff *t, DWORD pos, UINT16 tag, const UINT32 v[6]) {
+    Entry(t, pos, tag, 5, 3);
+    Put32(t->b + pos + 8, t->le, t->data);
+    for (int i = 0; i < 6; i++) {
+        Put32(t->b + t->data + i * 4, t->le, v[i]);
+    }
+    t->data += 24;
+}
+
+// IFD0 at 8 with make and model, the Exif IFD at 70 with the capture time,
+// the GPS IFD at 90 and IFD1 at 150 with the thumbnail
+static VOID
+MakeTiff(struct Tiff *t, BOOL le) {
+    static const UINT32 latitude[6] = {52, 1, 30, 1, 0, 1};
+    static const UINT32 longitude[6] = {13, 1, 2460, 100, 0, 1};
+    memset(t->b, 0, sizeof(t->b));
+    t->le = le;
+    t->data = 256;
+    memcpy(t->b, le ? "II*\0" : "MM\0*", 4);
+    Put32(t->b + 4, le, 8);
+
+    Put16(t->b + 8, le, 4);
+    // Control characters and trailing spaces are removed
+    EntryAscii(t, 10, 0x010f, "Canon\x01");
+    EntryAscii(t, 22, 0x0110, "EOS\t5D");
+    EntryLong(t, 34, 0x8769, 70);
+    EntryLong(t, 46, 0x8825, 90);
+    Put32(t->b + 58, le, 150);
+
+    Put16(t->b + 70, le, 1);
+    EntryAscii(t, 72, 0x9003, "2019:05:04 12:34:56");
+
+    Put16(t->b + 90, le, 4);
+    EntryAscii(t, 92, 1, "N");
+    EntryRational(t, 104, 2, latitude);
+    EntryAscii(t, 116, 3, "W");
+    EntryRational(t, 128, 4, longitude);
+
+    Put16(t->b + 150, le, 2);
+    EntryLong(t, 152, 0x0201, t->data);
+    EntryLong(t, 164, 0x0202, sizeof(thumbnail));
+    memcpy(t->b + t->data, thumbnail, sizeof(thumbnail));
+    t->data += sizeof(thumbnail);
+}
+
+// A JPEG with JFIF and Exif segments. Returns the offset of the TIFF data.
+static DWORD
+Jpeg(struct HostData *d, BOOL le) {
+    struct Tiff t;
+    MakeTiff(&t, le);
+    d->len = 0;
+    HostPut(d, "\xff\xd8\xff\xe0\x00\x10JFIF\0\x01\x01\0\0\x01\0\x01\0\0", 20);
+    HostPut(d, "\xff\xe1", 2);
+    HostPutBe(d, 2 + 6 + t.data, 2);
+    HostPut(d, "Exif\0\0", 6);
+    DWORD tiff = d->len;
+    HostPut(d, t.b, t.data);
+    HostPut(d, "\xff\xd9", 2);
+    return tiff;
+}
+
+// A HEIF picture with an Exif item in mdat, found through iinf and iloc
+static VOID
+Heif(struct HostData *d, BOOL le) {
+    struct Tiff t;
+    MakeTiff(&t, le);
+    d->len = 0;
+    HostPutBe(d, 16, 4);
+    HostPut(d, "ftypheic\0\0\0\0", 12);
+    HostPutBe(d, 12 + 35 + 30, 4);
+    HostPut(d, "meta\0\0\0\0", 8);
+    // iinf version 0 with one infe version 2, item 1 of type Exif
+    HostPutBe(d, 14 + 21, 4);
+    HostPut(d, "iinf\0\0\0\0", 8);
+    HostPutBe(d, 1, 2);
+    HostPutBe(d, 21, 4);
+    HostPut(d, "infe\x02\0\0\0", 8);
+    HostPutBe(d, 1, 2);
+    HostPutBe(d, 0, 2);
+    HostPut(d, "Exif\0", 5);
+    // iloc version 0 with offsets and lengths of 4 bytes, one extent
+    HostPutBe(d, 30, 4);
+    HostPut(d, "iloc\0\0\0\0\x44\0", 10);
+    HostPutBe(d, 1, 2);
+    HostPutBe(d, 1, 2);
+    HostPutBe(d, 0, 2);
+    HostPutBe(d, 1, 2);
+    DWORD item = d->len + 8 + 8;
+    HostPutBe(d, item, 4);
+    HostPutBe(d, 4 + t.data, 4);
+    HostPutBe(d, 8 + 4 + t.data, 4);
+    HostPut(d, "mdat", 4);
+    // The item starts with the offset of the TIFF header
+    HostPutBe(d, 0, 4);
+    HostPut(d, t.b, t.data);
+}
+
+static BOOL
+ExifMatches(struct XtExif *exif, BOOL thumb) {
+    return exif->valid
+           && 0 == wcscmp(exif->make, L"Canon")
+           && 0 == wcscmp(exif->model, L"EOS 5D")
+           && 0 == wcscmp(exif->taken, L"2019-05-04 12:34:56")
+           && exif->gps
+           && 1e-9 > fabs(exif->latitude - 52.5)
+           && 1e-9 > fabs(exif->longitude + 13.41)
+           && (thumb ? sizeof(thumbnail) == exif->thumb_len
+                       && 0 == memcmp(exif->thumb, thumbnail, sizeof(thumbnail))
+                     : 0 == exif->thumb_len);
+}
+
+static int
+Parser() {
+    struct XtExif exif = {0};
+    struct HostData d = {0};
+    options.exif = 1;
+    options.thumbnails = 1;
+    for (BOOL le = 0; le <= 1; le++) {
+        Jpeg(&d, le);
+        ExifParse(&exif, d.b, d.len, d.len);
+        CHECK(ExifMatches(&exif, 1));
+        Heif(&d, le);
+        ExifParse(&exif, d.b, d.len, d.len);
+        CHECK(ExifMatches(&exif, 1));
+    }
+
+    // A thumbnail beyond the first chunk is left out, other fields are not
+    DWORD tiff = Jpeg(&d, 1);
+    ExifParse(&exif, d.b, d.len - 2 - sizeof(thumbnail), d.len);
+    CHECK(ExifMatches(&exif, 0));
+    options.thumbnails = 0;
+    ExifParse(&exif, d.b, d.len, d.len);
+    CHECK(ExifMatches(&exif, 0));
+
+    // Damaged or missing Exif data
+    d.b[tiff] = 'X';
+    ExifParse(&exif, d.b, d.len, d.len);
+    CHECK(!exif.valid);
+    Jpeg(&d, 1);
+    ExifParse(&exif, d.b, tiff, d.len);
+    CHECK(!exif.valid);
+    memcpy(d.b + tiff - 6, "Exig", 4);
+    ExifParse(&exif, d.b, d.len, d.len);
+    CHECK(!exif.valid);
+    Jpeg(&d, 1);
+    options.exif = 0;
+    ExifParse(&exif, d.b, d.len, d.len);
+    CHECK(!exif.valid);
+    free(exif.thumb);
+    free(d.b);
+    return HostDone("exif-parser");
+}
+
+static int
+Export() {
+    HostInit("[Exif]\nThumbnails=1\n");
+    struct HostData d = {0};
+    Jpeg(&d, 1);
+    HostAddFile(-1, L"a.jpg", L"Pictures", d.b, d.len);
+    free(d.b);
+    // Without an Exif segment
+    HostAddFile(-1, L"b.jpg", L"Pictures", (const BYTE *) "\xff\xd8\xff\xd9", 4);
+
+    CHECK(1 == HostRun(1));
+
+    WCHAR *list = HostReadXml("Existing/Image/Exif.txt");
+    CHECK(1 == CountOf(list, L"id\tmake\tmodel\ttaken\tlatitude\tlongitude\tthumbnail\r\n"));
+    CHECK(1 == CountOf(list, L"\r\n1\tCanon\tEOS 5D\t2019-05-04 12:34:56\t52.500000\t-13.410000\tPreviews\\1.jpg\r\n"));
+    CHECK(2 == CountOf(list, L"\r\n"));
+    free(list);
+    size_t len = 0;
+    BYTE *thumb = HostReadExport("Existing/Image/Previews/1.jpg", &len);
+    CHECK(thumb && sizeof(thumbnail) == len && 0 == memcmp(thumb, thumbnail, len));
+    free(thumb);
+    CHECK(!HostExportExists("Existing/Image/Previews/2.jpg"));
+    CHECK(HostLogged(L"listing Exif data of 1 pictures"));
+
+    return HostDone("exif-export");
+}
+
+int
+main() {
+    int failures = Parser();
+    failures += Export();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+/*
+    Files of known benign hashes are not exported, files of categorized
+    hashes get their category in the index. Covers small files, which are
+    checked before writing, and files larger than a chunk, which are
+    removed after writing, for every BenignAction. A list without MD5
+    hashes is an error.
+*/
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+#define SMALL 3000
+// Larger than a chunk of 1 MB
+#define LARGE (3 * 1024 * 1024 + 100)
+
+static BOOL
+IsKnown(LONG id) {
+    return HOST_TABLE_KNOWN == HostItem(id)->tables;
+}
+
+static int
+Run(const char *test, const char *action, int read_ahead) {
+    HostInit(NULL);
+    LONG small = HostAddPattern(L"benign.jpg", L"Pictures", SMALL, 1);
+    LONG categorized = HostAddPattern(L"categorized.jpg", L"Pictures", SMALL, 2);
+    LONG plain = HostAddPattern(L"plain.jpg", L"Pictures", SMALL, 3);
+    LONG large = HostAddPattern(L"benign.mp4", L"Video", LARGE, 4);
+    LONG large_picture = HostAddPattern(L"large.jpg", L"Pictures", LARGE, 5);
+
+    char hex[33];
+    char text[256];
+    char list[200] = "";
+    LONG benign[] = {small, large, large_picture};
+    for (int i = 0; i < 3; i++) {
+        struct HostItem *item = HostItem(benign[i]);
+        HostMd5Hex(host.volume + item->ofs, item->size, hex);
+        StringCchCatA(list, sizeof(list), hex);
+        StringCchCatA(list, sizeof(list), "\r\n");
+    }
+    HostWriteText(host.root, "benign.txt", list);
+    HostMd5Hex(host.volume + HostItem(categorized)->ofs, SMALL, hex);
+    snprintf(text, sizeof(text), "md5,category\n%s,3\n", hex);
+    HostWriteText(host.root, "categorized.txt", text);
+
+    char ini[1024];
+    snprintf(ini, sizeof(ini),
+             "[Export]\nChunkSizeMB=1\nReadAhead=%d\n"
+             "[HashSets]\nBenign=%s/benign.txt\nCategorized=%s/categorized.txt\nBenignAction=%s\n",
+             read_ahead, host.root, host.root, action);
+    HostSetOptions(ini);
+
+    CHECK(1 == HostRun(4));
+
+    CHECK(HostLogged(L"Hash set Benign: 3 hashes"));
+    CHECK(HostLogged(L"Hash set Categorized: 1 hashes"));
+    CHECK(IsKnown(small));
+    CHECK(IsKnown(large));
+    CHECK(IsKnown(large_picture));
+    CHECK(HOST_TABLE_SUCCESS == HostItem(categorized)->tables);
+    CHECK(HOST_TABLE_SUCCESS == HostItem(plain)->tables);
+
+    // Only the two other pictures are exported, benign IDs are only
+    // used when they are indexed
+    BOOL index = 0 == strcmp(action, "index");
+    int exported = 0;
+    for (int export_id = 1; export_id <= 4; export_id++) {
+        snprintf(text, sizeof(text), "Existing/Image/Pictures/%d", export_id);
+        if (HostExportMatches(text, categorized) || HostExportMatches(text, plain)) {
+            exported++;
+        } else {
+            CHECK(!HostExportExists(text));
+        }
+    }
+    CHECK(2 == exported);
+    CHECK(!HostExportExists(index ? "Existing/Image/Pictures/5" : "Existing/Image/Pictures/3"));
+    CHECK(!HostExportExists("Existing/Image/Movies/1"));
+
+    WCHAR *xml = HostReadXml("Existing/Image/C4P Index.xml");
+    CHECK((index ? 4 : 2) == CountOf(xml, L"<Image>"));
+    CHECK(1 == CountOf(xml, L"<category>3</category>"));
+    CHECK((index ? 1 : 0) == CountOf(xml, L"benign.jpg]]>"));
+    CHECK((index ? 1 : 0) == CountOf(xml, L"large.jpg]]>"));
+    free(xml);
+    xml = HostReadXml("Existing/Image/C4M Index.xml");
+    CHECK((index ? 1 : 0) == CountOf(xml, L"<Movie>"));
+    free(xml);
+
+    // Known Files.txt lists hash and path of every benign file
+    xml = HostReadXml("Existing/Image/Known Files.txt");
+    if (0 == strcmp(action, "list")) {
+        CHECK(3 == CountOf(xml, L"\r\n"));
+        HostMd5Hex(host.volume + HostItem(large)->ofs, LARGE, hex);
+        WCHAR line[64];
+        swprintf(line, 64, L"%s\tImage", hex);
+        CHECK(1 == CountOf(xml, line));
+    } else {
+        CHECK(NULL == xml);
+    }
+    free(xml);
+
+    return HostDone(test);
+}
+
+// A list without MD5 hashes, like the SHA-1 first NSRL format, stops the
+// export instead of loading an empty set
+static int
+Empty() {
+    HostInit(NULL);
+    HostAddPattern(L"a.jpg", L"Pictures", SMALL, 1);
+    HostWriteText(host.root, "nsrl.txt",
+                  "\"SHA-1\",\"MD5\",\"CRC32\",\"FileName\"\r\n"
+                  "\"0000002D9D62AEBE1E0E9DB6C9C1A3E5D5C3D7E8\",\"1D6EBB5A789ABD108FF578263E1F40F3\","
+                  "\"FFFFFFFF\",\"a.jpg\"\r\n");
+    char ini[1024];
+    snprintf(ini, sizeof(ini), "[HashSets]\nBenign=%s/nsrl.txt\n", host.root);
+    HostSetOptions(ini);
+
+    CHECK(-1 == HostRun(1));
+    CHECK(HostLogged(L"found no MD5 hashes in"));
+    CHECK(HostLogged(L"could not load a configured hash set"));
+    CHECK(!HostExportExists("Existing/Image/Pictures/1"));
+
+    return HostDone("hashsets-empty");
+}
+
+int
+main() {
+    int failures = Run("hashsets-skip", "skip", 1);
+    failures += Run("hashsets-list", "list", 1);
+    failures += Run("hashsets-index", "index", 1);
+    // Files larger than a chunk are written without the pipeline
+    failures += Run("hashsets-index-direct", "index", 0);
+    failures += Empty();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,149 @@
+/*
+    Index parts can be imported while the export is running, so they have
+    to end with a closing tag whenever records are written out, not only
+    at checkpoints. Parts closed to stay within MaxOpenFiles are reopened
+    and continued at their end. A case report only counts records of parts
+    that could be sealed, and the manifest only lists them.
+*/
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+#define FILES 100
+
+static int checked;
+static int invalid;
+
+// Checks the picture index before every read, i.e. between records
+static VOID
+CheckIndex(struct HostItem *item) {
+    if (!HostExportExists("Existing/Image/C4P Index.xml")) {
+        return;
+    }
+    WCHAR *xml = HostReadXml("Existing/Image/C4P Index.xml");
+    size_t len = xml ? wcslen(xml) : 0;
+    size_t end = wcslen(INDEX_END);
+    checked++;
+    if (NULL == xml || 1 != CountOf(xml, L"<ReportIndex ")
+        || len < end || 0 != wcscmp(xml + len - end, INDEX_END)) {
+        invalid++;
+    }
+    free(xml);
+}
+
+static int
+Sealed() {
+    HostInit("[Export]\nReadAhead=0\n[Index]\nCheckpointSec=0\n");
+    BYTE buf[1000];
+    static WCHAR names[FILES][160];
+    for (int n = 0; n < FILES; n++) {
+        memset(buf, n, sizeof(buf));
+        // Long names, so that the records fill the buffer
+        swprintf(names[n], 160, L"%0150d.jpg", n);
+        HostAddFile(-1, names[n], L"Pictures", buf, sizeof(buf));
+    }
+    host.read_hook = CheckIndex;
+
+    CHECK(1 == HostRun(1));
+    host.read_hook = NULL;
+
+    CHECK(FILES - 1 <= checked);
+    CHECK(0 == invalid);
+    WCHAR *xml = HostReadXml("Existing/Image/C4P Index.xml");
+    CHECK(FILES == CountOf(xml, L"<Image>"));
+    CHECK(1 == CountOf(xml, INDEX_END));
+    free(xml);
+    xml = HostReadXml("Existing/Image/Case Report.xml");
+    CHECK(1 == CountOf(xml, L"<Committed images=\"100\" movies=\"0\" complete=\"1\"/>"));
+    free(xml);
+
+    return HostDone("index-sealed");
+}
+
+static int
+Reopened() {
+    HostInit("[Index]\nMaxOpenFiles=2\nCheckpointSec=0\n");
+    BYTE buf[1000];
+    static WCHAR names[FILES][16];
+    for (int n = 0; n < FILES; n++) {
+        memset(buf, n, sizeof(buf));
+        // Existing and deleted pictures and videos take turns, which
+        // needs four index files
+        BOOL video = n / 2 % 2;
+        swprintf(names[n], 16, video ? L"v%d.mp4" : L"p%d.jpg", n);
+        LONG id = HostAddFile(-1, names[n], video ? L"Video" : L"Pictures", buf, sizeof(buf));
+        HostItem(id)->deleted = n % 2;
+    }
+
+    CHECK(1 == HostRun(1));
+
+    const char *indexes[] = {"Existing/Image/C4P Index.xml", "Existing/Image/C4M Index.xml",
+                             "Deleted/Image/C4P Index.xml", "Deleted/Image/C4M Index.xml"};
+    for (int i = 0; i < 4; i++) {
+        WCHAR *xml = HostReadXml(indexes[i]);
+        CHECK(FILES / 4 == CountOf(xml, i % 2 ? L"<Movie>" : L"<Image>"));
+        CHECK(1 == CountOf(xml, L"<?xml "));
+        CHECK(1 == CountOf(xml, INDEX_END));
+        free(xml);
+    }
+
+    return HostDone("index-reopened");
+}
+
+// Returns the number of complete records in the manifest
+static size_t
+ManifestRecords() {
+    size_t len = 0;
+    BYTE *data = HostReadExport("Export Manifest.dat", &len);
+    free(data);
+    return sizeof(struct XtManifestHeader) < len
+           ? (len - sizeof(struct XtManifestHeader)) / sizeof(struct XtManifestRecord) : 0;
+}
+
+// Checkpoints before every file, the picture index fails to write from
+// the fifth file on
+static VOID
+FailIndex(struct HostItem *item) {
+    ReportCheckpoint();
+    struct XtIndex *index = &first_volume->report_existing->image_index;
+    if (4 == item - host.items && index->file) {
+        // Writes to a read-only handle fail
+        PWSTR path = AllocIndexPath(index->dir, index->name, index->part);
+        CloseHandle(index->file);
+        index->file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        LocalFree(path);
+    }
+}
+
+static int
+Unsealed() {
+    HostInit("[Export]\nReadAhead=0\n[Index]\nCheckpointSec=0\n");
+    BYTE buf[1000];
+    for (int n = 0; n < 10; n++) {
+        memset(buf, n, sizeof(buf));
+        HostAddFile(-1, L"p.jpg", L"Pictures", buf, sizeof(buf));
+    }
+    host.read_hook = FailIndex;
+
+    HostRun(1);
+    host.read_hook = NULL;
+
+    WCHAR *xml = HostReadXml("Existing/Image/Case Report.xml");
+    CHECK(1 == CountOf(xml, L"<Committed images=\"4\" movies=\"0\" complete=\"0\"/>"));
+    free(xml);
+    xml = HostReadXml("Existing/Image/C4P Index.xml");
+    CHECK(4 == CountOf(xml, L"<Image>"));
+    free(xml);
+    CHECK(4 == ManifestRecords());
+
+    return HostDone("index-unsealed");
+}
+
+int
+main() {
+    int failures = Sealed();
+    failures += Reopened();
+    failures += Unsealed();
+    return failures ? 1 : 0;
+}
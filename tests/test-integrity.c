@@ -0,0 +1,193 @@
+/*
+    The integrity check parses JPEG, PNG, GIF, MP4 and AVI data as it is
+    exported, in chunks of any size. Intact, truncated and corrupt files
+    are checked directly with all kinds of chunk boundaries, then exported
+    with Check=1 and Bisect=1, which adds elements to their index records.
+*/
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+static VOID
+Jpeg(struct HostData *d) {
+    d->len = 0;
+    HostPut(d, "\xff\xd8\xff\xe0\x00\x10JFIF\0\x01\x01\0\0\x01\0\x01\0\0", 20);
+    // Frame header, 8x8 pixels and one component
+    HostPut(d, "\xff\xc0\x00\x0b\x08\x00\x08\x00\x08\x01\x01\x11\x00", 13);
+    HostPut(d, "\xff\xda\x00\x08\x01\x01\x00\x00\x3f\x00", 10);
+    // Scan with a stuffed byte and a restart marker
+    HostPut(d, "\x12\x34\xff\x00\x56\xff\xd0\x78\x9a", 9);
+    HostPut(d, "\xff\xd9", 2);
+}
+
+static VOID
+PngChunk(struct HostData *d, const char *type, const void *data, DWORD len) {
+    HostPutBe(d, len, 4);
+    DWORD start = d->len;
+    HostPut(d, type, 4);
+    HostPut(d, data, len);
+    HostPutBe(d, Crc32(0xffffffff, d->b + start, len + 4) ^ 0xffffffff, 4);
+}
+
+static VOID
+Png(struct HostData *d) {
+    d->len = 0;
+    HostPut(d, "\x89PNG\r\n\x1a\n", 8);
+    PngChunk(d, "IHDR", "\0\0\0\x08\0\0\0\x08\x08\x02\0\0\0", 13);
+    PngChunk(d, "IDAT", "\x78\x9c\x63\x00\x00\x00\x01\x00\x01", 9);
+    PngChunk(d, "IEND", "", 0);
+}
+
+static VOID
+Gif(struct HostData *d) {
+    d->len = 0;
+    // Screen descriptor with a global color table of two colors
+    HostPut(d, "GIF89a\x08\0\x08\0\x80\0\0", 13);
+    HostPut(d, "\0\0\0\xff\xff\xff", 6);
+    // Graphic control extension
+    HostPut(d, "\x21\xf9\x04\0\0\0\0\0", 8);
+    // Image with LZW data in one sub-block
+    HostPut(d, "\x2c\0\0\0\0\x08\0\x08\0\0", 10);
+    HostPut(d, "\x02\x03\x84\x8f\x59\0", 6);
+    HostPut(d, "\x3b", 1);
+}
+
+static VOID
+Mp4(struct HostData *d) {
+    d->len = 0;
+    HostPutBe(d, 16, 4);
+    HostPut(d, "ftypisom\0\0\0\x01", 12);
+    HostPutBe(d, 8 + 8 + 16, 4);
+    HostPut(d, "moov", 4);
+    HostPutBe(d, 8 + 16, 4);
+    HostPut(d, "trak", 4);
+    HostPutBe(d, 16, 4);
+    HostPut(d, "tkhd\0\0\0\0\0\0\0\0", 12);
+    HostPutBe(d, 8 + 100, 4);
+    HostPut(d, "mdat", 4);
+    HostFill(d, 0x55, 100);
+}
+
+static VOID
+Avi(struct HostData *d) {
+    d->len = 0;
+    HostPut(d, "RIFF", 4);
+    HostPutLe(d, 4 + (8 + 4 + 8 + 56) + (8 + 4 + 8 + 11 + 1), 4);
+    HostPut(d, "AVI ", 4);
+    HostPut(d, "LIST", 4);
+    HostPutLe(d, 4 + 8 + 56, 4);
+    HostPut(d, "hdrl", 4);
+    HostPut(d, "avih", 4);
+    HostPutLe(d, 56, 4);
+    HostFill(d, 0, 56);
+    HostPut(d, "LIST", 4);
+    HostPutLe(d, 4 + 8 + 11 + 1, 4);
+    HostPut(d, "movi", 4);
+    // Frame of odd size, padded
+    HostPut(d, "00dc", 4);
+    HostPutLe(d, 11, 4);
+    HostPut(d, "frame data\0\0", 12);
+}
+
+// Result of checking data fed in pieces of piece bytes, 0 = all at once
+static int
+Check(const struct HostData *d, DWORD len, DWORD piece) {
+    struct XtCheck c;
+    struct XtFile xf = {0};
+    xf.filesize = len;
+    CheckBegin(&c);
+    for (DWORD pos = 0; pos < len;) {
+        DWORD n = piece && piece < len - pos ? piece : len - pos;
+        CheckFeed(&c, d->b + pos, n);
+        pos += n;
+    }
+    CheckEnd(&c, &xf);
+    return xf.integrity;
+}
+
+// Checks an intact file and its damaged variants with every piece size
+static VOID
+CheckFormat(const char *name, VOID (*make)(struct HostData *), DWORD corrupt_ofs, int truncated) {
+    static const DWORD pieces[] = {0, 1, 2, 3, 7, 64};
+    struct HostData d = {0};
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+        make(&d);
+        int intact = Check(&d, d.len, pieces[i]);
+        int cut = Check(&d, d.len - 1, pieces[i]);
+        d.b[corrupt_ofs] ^= 0xa5;
+        int corrupt = Check(&d, d.len, pieces[i]);
+        if (CHECK_OK != intact || truncated != cut || CHECK_CORRUPT != corrupt) {
+            fprintf(stderr, "%s in pieces of %u: intact %d, truncated %d, corrupt %d\n",
+                    name, pieces[i], intact, cut, corrupt);
+            host_failures++;
+        }
+    }
+    free(d.b);
+}
+
+static int
+Parsers() {
+    options.check = 1;
+    // Corrupted bytes: second byte of the frame marker, a PNG checksum,
+    // the image separator of the GIF, the type of the trak box and the
+    // ID of the first AVI list
+    CheckFormat("jpeg", Jpeg, 21, CHECK_TRUNCATED);
+    CheckFormat("png", Png, 8 + 8 + 13, CHECK_TRUNCATED);
+    CheckFormat("gif", Gif, 13 + 6 + 8, CHECK_TRUNCATED);
+    CheckFormat("mp4", Mp4, 16 + 8 + 5, CHECK_TRUNCATED);
+    CheckFormat("avi", Avi, 12 + 1, CHECK_TRUNCATED);
+
+    // Without the check or a known format nothing is reported
+    struct HostData d = {0};
+    Jpeg(&d);
+    options.check = 0;
+    CHECK(CHECK_NONE == Check(&d, d.len, 0));
+    options.check = 1;
+    memset(d.b, 'x', d.len);
+    CHECK(CHECK_NONE == Check(&d, d.len, 0));
+    free(d.b);
+    return HostDone("integrity-parsers");
+}
+
+static int
+Export() {
+    HostInit("[Integrity]\nCheck=1\n[Salvage]\nBisect=1\nMinBlockKB=4\n");
+    struct HostData d = {0};
+    Jpeg(&d);
+    LONG intact = HostAddFile(-1, L"intact.jpg", L"Pictures", d.b, d.len);
+    LONG truncated = HostAddFile(-1, L"truncated.jpg", L"Pictures", d.b, d.len - 2);
+    d.b[21] = 0xd8;
+    LONG corrupt = HostAddFile(-1, L"corrupt.jpg", L"Pictures", d.b, d.len);
+    // A picture with an unreadable block in the middle
+    BYTE *buf = calloc(1, 64 * 1024);
+    Jpeg(&d);
+    memcpy(buf, d.b, d.len);
+    LONG partial = HostAddFile(-1, L"partial.jpg", L"Pictures", buf, 64 * 1024);
+    HostItem(partial)->bad_ofs = 16 * 1024;
+    HostItem(partial)->bad_len = 100;
+    free(buf);
+    free(d.b);
+
+    CHECK(1 == HostRun(1));
+
+    CHECK(HOST_TABLE_SUCCESS == HostItem(intact)->tables);
+    CHECK(HostItem(truncated)->tables & HOST_TABLE_TRUNCATED);
+    CHECK(HostItem(corrupt)->tables & HOST_TABLE_CORRUPT);
+    CHECK(HostItem(partial)->tables & HOST_TABLE_PARTIAL);
+    WCHAR *xml = HostReadXml("Existing/Image/C4P Index.xml");
+    CHECK(4 == CountOf(xml, L"<Image>"));
+    CHECK(1 == CountOf(xml, L"  <integrity>truncated</integrity>\r\n"));
+    CHECK(1 == CountOf(xml, L"  <integrity>corrupt</integrity>\r\n"));
+    CHECK(1 == CountOf(xml, L"  <unreadable>4096</unreadable>\r\n</Image>"));
+    CHECK(0 == CountOf(xml, L"<!--"));
+    free(xml);
+
+    return HostDone("integrity-export");
+}
+
+int
+main() {
+    int failures = Parsers();
+    failures += Export();
+    return failures ? 1 : 0;
+}
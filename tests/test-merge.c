@@ -0,0 +1,270 @@
+/*
+    gexpo-merge combines two shard exports written here as fixtures:
+    indexes, exported files, Exif.txt with its thumbnails and
+    Known Files.txt. IDs of the second shard continue after the first.
+    Does not need the X-Tension, only ../tools/gexpo-merge.
+*/
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tool.h"
+
+#define MERGE "../tools/gexpo-merge"
+
+static void
+MakeDirs(const char *path) {
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for (char *p = tmp + 1; *p; p++) {
+        if ('/' == *p) {
+            *p = '\0';
+            mkdir(tmp, 0755);
+            *p = '/';
+        }
+    }
+    mkdir(tmp, 0755);
+}
+
+// Writes an ASCII text as UTF-16LE with byte order mark, like the X-Tension
+static void
+WriteUtf16(const char *dir, const char *name, const char *text) {
+    char path[2048];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "wb");
+    if (NULL == f) {
+        perror(path);
+        exit(2);
+    }
+    fputc(0xff, f);
+    fputc(0xfe, f);
+    for (; *text; text++) {
+        fputc(*text, f);
+        fputc(0, f);
+    }
+    fclose(f);
+}
+
+static void
+WriteBytes(const char *dir, const char *name, const char *content) {
+    char path[2048];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "wb");
+    fputs(content, f);
+    fclose(f);
+}
+
+// Reads a UTF-16LE file below root as ASCII, NULL if it does not exist
+static char *
+ReadUtf16(const char *rel) {
+    char path[2048];
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *data = malloc(size + 1);
+    size = (long) fread(data, 1, size, f);
+    fclose(f);
+    char *text = calloc(1, size / 2 + 1);
+    long start = 2 <= size && 0xff == data[0] && 0xfe == data[1] ? 2 : 0;
+    for (long i = start; i + 1 < size; i += 2) {
+        text[(i - start) / 2] = (char) data[i];
+    }
+    free(data);
+    return text;
+}
+
+static char *
+ReadBytes(const char *rel) {
+    char path[2048];
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) {
+        return NULL;
+    }
+    char *text = calloc(1, 256);
+    if (0 == fread(text, 1, 255, f)) {
+        text[0] = '\0';
+    }
+    fclose(f);
+    return text;
+}
+
+static void
+IndexRecord(char *xml, size_t len, const char *tag1, const char *tag2, const char *subdir,
+            int id, const char *name) {
+    size_t used = strlen(xml);
+    snprintf(xml + used, len - used,
+             "<%s>\r\n  <path><![CDATA[%s\\]]></path>\r\n  <%s>%d</%s>\r\n  <id>%d</id>\r\n"
+             "  <category>0</category>\r\n  <fileoffset>0</fileoffset>\r\n"
+             "  <fullpath><![CDATA[Image\\%s]]></fullpath>\r\n  <fileSize>5</fileSize>\r\n</%s>\r\n",
+             tag1, subdir, tag2, id, tag2, id, name, tag1);
+}
+
+// Writes a report with pictures named <shard>-p<n>.jpg and one movie.
+// Every even picture has EXIF data with a thumbnail.
+static void
+WriteShard(int shard, const char *report, int pictures) {
+    char dir[256];
+    char sub[512];
+    char name[64];
+    char content[80];
+    char xml[16384] = "<?xml version=\"1.0\" encoding=\"utf-16\"?>\r\n<ReportIndex>\r\n";
+    char exif[4096] = "id\tmake\tmodel\ttaken\tlatitude\tlongitude\tthumbnail\r\n";
+    snprintf(dir, sizeof(dir), "%s/shard%d/%s", root, shard, report);
+    snprintf(sub, sizeof(sub), "%s/Pictures", dir);
+    MakeDirs(sub);
+    snprintf(sub, sizeof(sub), "%s/Movies", dir);
+    MakeDirs(sub);
+    snprintf(sub, sizeof(sub), "%s/Previews", dir);
+    MakeDirs(sub);
+
+    for (int n = 1; n <= pictures; n++) {
+        snprintf(name, sizeof(name), "%d-p%d.jpg", shard, n);
+        IndexRecord(xml, sizeof(xml), "Image", "picture", "Pictures", n, name);
+        snprintf(sub, sizeof(sub), "Pictures/%d", n);
+        WriteBytes(dir, sub, name);
+        if (0 == n % 2) {
+            size_t used = strlen(exif);
+            snprintf(exif + used, sizeof(exif) - used, "%d\tCam%d\tM%d\t\t\t\tPreviews\\%d.jpg\r\n",
+                     n, shard, n, n);
+            snprintf(sub, sizeof(sub), "Previews/%d.jpg", n);
+            snprintf(content, sizeof(content), "thumb %s", name);
+            WriteBytes(dir, sub, content);
+        }
+    }
+    strcat(xml, "</ReportIndex>");
+    WriteUtf16(dir, "C4P Index.xml", xml);
+    WriteUtf16(dir, "Exif.txt", exif);
+
+    snprintf(name, sizeof(name), "%d-v1.mp4", shard);
+    strcpy(xml, "<?xml version=\"1.0\" encoding=\"utf-16\"?>\r\n<ReportIndex>\r\n");
+    IndexRecord(xml, sizeof(xml), "Movie", "movie", "Movies", 1, name);
+    strcat(xml, "</ReportIndex>");
+    WriteUtf16(dir, "C4M Index.xml", xml);
+    WriteBytes(dir, "Movies/1", name);
+
+    snprintf(xml, sizeof(xml), "0123456789abcdef0123456789abcde%d\tImage\\benign%d.jpg\r\n", shard, shard);
+    WriteUtf16(dir, "Known Files.txt", xml);
+    WriteUtf16(dir, "Case Report.xml",
+               "<?xml version=\"1.0\" encoding=\"utf-16\"?>\r\n<CaseReport>\r\n"
+               "  <CaseNumber><![CDATA[Test Case]]></CaseNumber>\r\n</CaseReport>");
+}
+
+static int
+Merge(const char *shards) {
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "%s '%s/merged' %s >'%s/merge.txt' 2>&1", MERGE, root, shards, root);
+    int status = system(cmd);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void
+RemoveTree(const char *path) {
+    DIR *dir = opendir(path);
+    if (NULL == dir) {
+        unlink(path);
+        return;
+    }
+    struct dirent *e;
+    while ((e = readdir(dir))) {
+        if (0 == strcmp(e->d_name, ".") || 0 == strcmp(e->d_name, "..")) {
+            continue;
+        }
+        char child[1024];
+        snprintf(child, sizeof(child), "%s/%s", path, e->d_name);
+        RemoveTree(child);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+int
+main() {
+    snprintf(root, sizeof(root), "/tmp/gexpo-test-XXXXXX");
+    if (NULL == mkdtemp(root)) {
+        perror("mkdtemp");
+        return 2;
+    }
+    WriteShard(1, "Existing/Image", 3);
+    WriteShard(2, "Existing/Image", 4);
+    // Only the second shard has deleted files
+    WriteShard(2, "Deleted/Image", 2);
+
+    char shards[512];
+    snprintf(shards, sizeof(shards), "'%s/shard1/' '%s/shard2/'", root, root);
+    CHECK(0 == Merge(shards));
+
+    // Reports both shards have are merged once
+    char *output = ReadBytes("merge.txt");
+    CHECK(1 == CountOf(output, "Existing/Image: "));
+    CHECK(1 == CountOf(output, "Deleted/Image: "));
+    free(output);
+
+    // Pictures 1-3 of shard 1, then 4-7 for pictures 1-4 of shard 2
+    char *xml = ReadUtf16("merged/Existing/Image/C4P Index.xml");
+    CHECK(7 == CountOf(xml, "<Image>"));
+    CHECK(1 == CountOf(xml, "<id>7</id>"));
+    CHECK(NULL == strstr(xml ? xml : "", "<id>8</id>"));
+    free(xml);
+    xml = ReadUtf16("merged/Existing/Image/C4M Index.xml");
+    CHECK(2 == CountOf(xml, "<Movie>"));
+    free(xml);
+    char *file = ReadBytes("merged/Existing/Image/Pictures/5");
+    CHECK(file && 0 == strcmp(file, "2-p2.jpg"));
+    free(file);
+    file = ReadBytes("merged/Existing/Image/Movies/2");
+    CHECK(file && 0 == strcmp(file, "2-v1.mp4"));
+    free(file);
+
+    // Exif lines and thumbnails are renumbered like the pictures
+    char *exif = ReadUtf16("merged/Existing/Image/Exif.txt");
+    CHECK(1 == CountOf(exif, "id\tmake"));
+    CHECK(1 == CountOf(exif, "\r\n2\tCam1\tM2\t\t\t\tPreviews\\2.jpg\r\n"));
+    CHECK(1 == CountOf(exif, "\r\n5\tCam2\tM2\t\t\t\tPreviews\\5.jpg\r\n"));
+    CHECK(1 == CountOf(exif, "\r\n7\tCam2\tM4\t\t\t\tPreviews\\7.jpg\r\n"));
+    CHECK(4 == CountOf(exif, "\r\n"));
+    free(exif);
+    file = ReadBytes("merged/Existing/Image/Previews/7.jpg");
+    CHECK(file && 0 == strcmp(file, "thumb 2-p4.jpg"));
+    free(file);
+    CHECK(NULL == ReadBytes("merged/Existing/Image/Previews/4.jpg"));
+
+    char *known = ReadUtf16("merged/Existing/Image/Known Files.txt");
+    CHECK(1 == CountOf(known, "benign1.jpg\r\n"));
+    CHECK(1 == CountOf(known, "benign2.jpg\r\n"));
+    free(known);
+
+    // Reports only one shard has are merged as well
+    xml = ReadUtf16("merged/Deleted/Image/C4P Index.xml");
+    CHECK(2 == CountOf(xml, "<Image>"));
+    free(xml);
+    file = ReadBytes("merged/Deleted/Image/Previews/2.jpg");
+    CHECK(file && 0 == strcmp(file, "thumb 2-p2.jpg"));
+    free(file);
+
+    // A shard folder that does not exist, or has no reports, is an error
+    char path[2048];
+    snprintf(path, sizeof(path), "%s/merged", root);
+    RemoveTree(path);
+    snprintf(shards, sizeof(shards), "'%s/shard1' '%s/shard3'", root, root);
+    CHECK(0 != Merge(shards));
+    snprintf(path, sizeof(path), "%s/empty", root);
+    MakeDirs(path);
+    snprintf(shards, sizeof(shards), "'%s/shard1' '%s/empty'", root, root);
+    CHECK(0 != Merge(shards));
+
+    if (failures) {
+        fprintf(stderr, "merge: %d check(s) failed, files left in %s\n", failures, root);
+        return 1;
+    }
+    RemoveTree(root);
+    printf("merge: ok\n");
+    return 0;
+}
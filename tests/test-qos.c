@@ -0,0 +1,56 @@
+/*
+    Rate limits can be changed while an export is running, in
+    xt-gexpo.ini or in Control.ini in the export root. The control file
+    overrides the configuration only for the keys it has.
+*/
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+#define FILES 6
+
+static LONG control_item;
+
+static VOID
+WriteControl(struct HostItem *item) {
+    if (item == HostItem(control_item)) {
+        char path[PATH_MAX];
+        HostExportPath(path, sizeof(path), "Control.ini");
+        FILE *f = fopen(path, "w");
+        fputs("[QoS]\nReadMBps=200\nFilesPerSec=1000\n", f);
+        fclose(f);
+    }
+}
+
+int
+main() {
+    HostInit("[QoS]\nReadMBps=100\nWriteMBps=300\nReloadMs=1\n[Status]\nIntervalMs=0\n");
+    BYTE buf[1000];
+    static WCHAR names[FILES][16];
+    LONG ids[FILES];
+    for (int n = 0; n < FILES; n++) {
+        memset(buf, n, sizeof(buf));
+        swprintf(names[n], 16, L"p%d.jpg", n);
+        ids[n] = HostAddFile(-1, names[n], L"Pictures", buf, sizeof(buf));
+        HostItem(ids[n])->read_delay = 5;
+    }
+    control_item = ids[2];
+    host.read_hook = WriteControl;
+
+    CHECK(1 == HostRun(1));
+
+    char rel[64];
+    for (int n = 0; n < FILES; n++) {
+        snprintf(rel, sizeof(rel), "Existing/Image/Pictures/%d", n + 1);
+        CHECK(HostExportMatches(rel, ids[n]));
+    }
+    CHECK(HostLogged(L"QoS: read 100 MB/s, write 300 MB/s, 0 files/s"));
+    CHECK(HostLogged(L"QoS: read 200 MB/s, write 300 MB/s, 1000 files/s"));
+    char *status = (char *) HostReadExport("Status.json", NULL);
+    CHECK(status && strstr(status, "\"qos_read_mb_per_sec\": 200,"));
+    CHECK(status && strstr(status, "\"qos_write_mb_per_sec\": 300,"));
+    CHECK(status && strstr(status, "\"qos_files_per_sec\": 1000,"));
+    free(status);
+
+    return HostDone("qos") ? 1 : 0;
+}
@@ -0,0 +1,257 @@
+/*
+    gexpo-reindex rebuilds the indexes of an export from a manifest
+    written here as a fixture, including the elements of damaged and
+    partially recovered files and video details. Exif.txt, its thumbnails
+    and Known Files.txt are copied along, also from a manifest of a newer
+    version with longer records. Does not need the X-Tension,
+    only ../tools/gexpo-reindex.
+*/
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../src/xt-gexpo-manifest.h"
+#include "tool.h"
+
+#define REINDEX "../tools/gexpo-reindex"
+
+static FILE *strings;
+static uint64_t strings_size;
+// Bytes a newer version appends to each record
+static uint32_t record_pad;
+
+// Appends an ASCII string as UTF-16LE to the string table
+static uint64_t
+String(const char *s) {
+    uint64_t offset = strings_size;
+    size_t len = strlen(s) + 1;
+    for (size_t i = 0; i < len; i++) {
+        fputc(s[i], strings);
+        fputc(0, strings);
+    }
+    strings_size += 2 * len;
+    return offset;
+}
+
+static void
+WriteRecord(FILE *f, uint32_t export_id, uint16_t type, const char *fullpath, const char *output) {
+    struct XtManifestRecord rec = {0};
+    rec.volume_hash = 1;
+    rec.xwf_id = export_id;
+    rec.filesize = 1000 + export_id;
+    rec.evidence = 8;
+    rec.fullpath = String(fullpath);
+    rec.output = String(output);
+    rec.export_id = export_id;
+    rec.type = type;
+    if (1 == export_id) {
+        rec.integrity = MANIFEST_INTEGRITY_TRUNCATED;
+        rec.unreadable = 4096;
+    } else if (2 == export_id && MANIFEST_TYPE_PICTURE == type) {
+        rec.integrity = MANIFEST_INTEGRITY_CORRUPT;
+    }
+    if (MANIFEST_TYPE_VIDEO == type && 1 == export_id) {
+        rec.flags = MANIFEST_FLAG_VIDEO;
+        rec.duration = 12.345;
+        rec.width = 1920;
+        rec.height = 1080;
+        rec.video_created = 1517155200;
+        strcpy(rec.codec, "avc1");
+    }
+    fwrite(&rec, sizeof(rec), 1, f);
+    for (uint32_t i = 0; i < record_pad; i++) {
+        fputc(0xa5, f);
+    }
+}
+
+static void
+WriteManifest() {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/Export Manifest.str", root);
+    strings = fopen(path, "wb");
+    uint32_t strings_header[2] = {MANIFEST_STRINGS_MAGIC, MANIFEST_VERSION};
+    fwrite(strings_header, sizeof(strings_header), 1, strings);
+    strings_size = sizeof(strings_header);
+    String("Image");
+
+    snprintf(path, sizeof(path), "%s/Export Manifest.dat", root);
+    FILE *f = fopen(path, "wb");
+    struct XtManifestHeader header = {MANIFEST_MAGIC, MANIFEST_VERSION + (record_pad ? 1 : 0),
+                                      sizeof(struct XtManifestRecord) + record_pad, 0};
+    fwrite(&header, sizeof(header), 1, f);
+    WriteRecord(f, 1, MANIFEST_TYPE_PICTURE, "Image\\a.jpg", "Existing\\Image\\Pictures\\1");
+    WriteRecord(f, 2, MANIFEST_TYPE_PICTURE, "Image\\b.jpg", "Existing\\Image\\Pictures\\2");
+    WriteRecord(f, 3, MANIFEST_TYPE_PICTURE, "Image\\c.jpg", "Existing\\Image\\Pictures\\3");
+    WriteRecord(f, 1, MANIFEST_TYPE_VIDEO, "Image\\d.mp4", "Existing\\Image\\Movies\\1");
+    WriteRecord(f, 2, MANIFEST_TYPE_VIDEO, "Image\\e.mp4", "Existing\\Image\\Movies\\2");
+    fclose(f);
+    fclose(strings);
+}
+
+// Writes an ASCII text below root as UTF-16LE with byte order mark
+static void
+WriteUtf16(const char *rel, const char *text) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+    FILE *f = fopen(path, "wb");
+    fputc(0xff, f);
+    fputc(0xfe, f);
+    for (; *text; text++) {
+        fputc(*text, f);
+        fputc(0, f);
+    }
+    fclose(f);
+}
+
+// Lists of the report, with a line and thumbnail of a picture that is not
+// in the manifest
+static void
+WriteLists() {
+    char path[256];
+    const char *dirs[] = {"Existing", "Existing/Image", "Existing/Image/Previews"};
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", root, dirs[i]);
+        mkdir(path, 0755);
+    }
+    WriteUtf16("Existing/Image/Exif.txt",
+               "id\tmake\tmodel\ttaken\tlatitude\tlongitude\tthumbnail\r\n"
+               "1\tCam\tM1\t\t\t\tPreviews\\1.jpg\r\n"
+               "3\tCam\tM3\t2019-05-04 12:00:00\t\t\t\r\n"
+               "9\tCam\tM9\t\t\t\tPreviews\\9.jpg\r\n");
+    WriteUtf16("Existing/Image/Known Files.txt", "0123456789abcdef0123456789abcdef\tImage\\e.jpg\r\n");
+    snprintf(path, sizeof(path), "%s/Existing/Image/Previews/1.jpg", root);
+    FILE *f = fopen(path, "wb");
+    fputs("thumb 1", f);
+    fclose(f);
+    snprintf(path, sizeof(path), "%s/Existing/Image/Previews/9.jpg", root);
+    f = fopen(path, "wb");
+    fputs("thumb 9", f);
+    fclose(f);
+}
+
+// Reads a whole file below root, NULL if it does not exist
+static char *
+ReadText(const char *rel) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", root, rel);
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *text = calloc(1, size + 1);
+    if (size != (long) fread(text, 1, size, f)) {
+        text[0] = '\0';
+    }
+    fclose(f);
+    return text;
+}
+
+// Returns the record of an index with the given id
+static char *
+Record(const char *xml, const char *tag, int id) {
+    char want[32];
+    snprintf(want, sizeof(want), "<id>%d</id>", id);
+    const char *s = xml ? strstr(xml, want) : NULL;
+    const char *end = s ? strstr(s, tag) : NULL;
+    if (NULL == end) {
+        return calloc(1, 1);
+    }
+    char *record = calloc(1, end - s + 1);
+    memcpy(record, s, end - s);
+    return record;
+}
+
+int
+main() {
+    snprintf(root, sizeof(root), "/tmp/gexpo-test-XXXXXX");
+    if (NULL == mkdtemp(root)) {
+        perror("mkdtemp");
+        return 2;
+    }
+    WriteManifest();
+    WriteLists();
+
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "%s -u '%s' '%s/out' >/dev/null", REINDEX, root, root);
+    int status = system(cmd);
+    CHECK(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+
+    char *xml = ReadText("out/Existing/Image/C4P Index.xml");
+    CHECK(3 == CountOf(xml, "<Image>"));
+    char *record = Record(xml, "</Image>", 1);
+    CHECK(1 == CountOf(record, "</fileSize>\r\n  <integrity>truncated</integrity>\r\n"
+                               "  <unreadable>4096</unreadable>\r\n"));
+    free(record);
+    record = Record(xml, "</Image>", 2);
+    CHECK(1 == CountOf(record, "<integrity>corrupt</integrity>"));
+    CHECK(0 == CountOf(record, "<unreadable>"));
+    free(record);
+    record = Record(xml, "</Image>", 3);
+    CHECK(0 == CountOf(record, "<integrity>"));
+    free(record);
+    free(xml);
+
+    xml = ReadText("out/Existing/Image/C4M Index.xml");
+    CHECK(2 == CountOf(xml, "<Movie>"));
+    CHECK(1 == CountOf(xml, "<integrity>truncated</integrity>"));
+    record = Record(xml, "</Movie>", 1);
+    CHECK(1 == CountOf(record, "  <video duration=\"12.345\" width=\"1920\" height=\"1080\" "
+                               "codec=\"avc1\" created=\"1517155200\"/>\r\n"));
+    free(record);
+    record = Record(xml, "</Movie>", 2);
+    CHECK(0 == CountOf(record, "<video"));
+    free(record);
+    free(xml);
+
+    // Lists are converted to UTF-8 like the indexes
+    char *exif = ReadText("out/Existing/Image/Exif.txt");
+    CHECK(exif && 0 == strncmp(exif, "id\tmake\t", 8));
+    CHECK(1 == CountOf(exif, "\r\n1\tCam\tM1\t\t\t\tPreviews\\1.jpg\r\n"));
+    CHECK(1 == CountOf(exif, "\r\n3\tCam\tM3\t2019-05-04 12:00:00\t\t\t\r\n"));
+    CHECK(0 == CountOf(exif, "M9"));
+    free(exif);
+    char *thumb = ReadText("out/Existing/Image/Previews/1.jpg");
+    CHECK(thumb && 0 == strcmp(thumb, "thumb 1"));
+    free(thumb);
+    CHECK(NULL == ReadText("out/Existing/Image/Previews/9.jpg"));
+    char *known = ReadText("out/Existing/Image/Known Files.txt");
+    CHECK(1 == CountOf(known, "\tImage\\e.jpg\r\n"));
+    free(known);
+
+    // Rewriting the indexes in place leaves the lists alone
+    snprintf(cmd, sizeof(cmd), "%s -u '%s' '%s' >/dev/null", REINDEX, root, root);
+    status = system(cmd);
+    CHECK(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+    exif = ReadText("Existing/Image/Exif.txt");
+    CHECK(exif && 0xff == (unsigned char) exif[0] && 0xfe == (unsigned char) exif[1]);
+    free(exif);
+    xml = ReadText("Existing/Image/C4P Index.xml");
+    CHECK(3 == CountOf(xml, "<Image>"));
+    free(xml);
+
+    // Records of a newer version are longer, the known fields are read
+    record_pad = 16;
+    WriteManifest();
+    snprintf(cmd, sizeof(cmd), "%s -u '%s' '%s/newer' >/dev/null", REINDEX, root, root);
+    status = system(cmd);
+    CHECK(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+    xml = ReadText("newer/Existing/Image/C4M Index.xml");
+    CHECK(2 == CountOf(xml, "<Movie>"));
+    CHECK(1 == CountOf(xml, "codec=\"avc1\" created=\"1517155200\"/>"));
+    free(xml);
+
+    if (failures) {
+        fprintf(stderr, "reindex: %d check(s) failed, files left in %s\n", failures, root);
+        return 1;
+    }
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+    if (system(cmd)) {
+        fprintf(stderr, "reindex: could not remove %s\n", root);
+    }
+    printf("reindex: ok\n");
+    return 0;
+}
@@ -0,0 +1,126 @@
+/*
+    SlowReadMs defers a file when the first block of a chunk is slow,
+    before the chunk itself is read; a file whose chunk turns out to be
+    slow behind a fast first block is finished right away. Either way, no
+    slow region is read twice. Bisect=1 recovers the readable parts of a
+    failed chunk and ends a file whose last chunk is unreadable.
+*/
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+#define MB (1024 * 1024)
+
+static BYTE *
+Pattern(INT64 size, int seed) {
+    BYTE *buf = malloc(size);
+    for (INT64 i = 0; i < size; i++) {
+        buf[i] = (BYTE) (seed * 31 + i * 7 + (i >> 12));
+    }
+    return buf;
+}
+
+// Returns 1 if the export file has the data of item id up to len bytes,
+// with [zero, zero + zero_len) zero-filled
+static BOOL
+ExportEquals(const char *rel, LONG id, INT64 len, INT64 zero, INT64 zero_len) {
+    size_t actual = 0;
+    BYTE *data = HostReadExport(rel, &actual);
+    const BYTE *expected = host.volume + HostItem(id)->ofs;
+    BOOL rv = data && (size_t) len == actual;
+    for (INT64 i = 0; rv && i < len; i++) {
+        rv = data[i] == (zero <= i && i < zero + zero_len ? 0 : expected[i]);
+    }
+    free(data);
+    return rv;
+}
+
+static int
+Deferred(const char *test, const char *ini) {
+    HostInit(ini);
+    BYTE *buf = Pattern(3 * MB, 1);
+    LONG first = HostAddFile(-1, L"first.mp4", L"Video", buf, 10000);
+    LONG slow = HostAddFile(-1, L"slow.mp4", L"Video", buf, 3 * MB);
+    LONG last = HostAddFile(-1, L"last.mp4", L"Video", buf + 1, 10000);
+    HostItem(slow)->read_delay = 100;
+    free(buf);
+
+    CHECK(1 == HostRun(1));
+
+    // The slow file is exported after the others
+    CHECK(HostExportMatches("Existing/Image/Movies/1", first));
+    CHECK(HostExportMatches("Existing/Image/Movies/2", last));
+    CHECK(HostExportMatches("Existing/Image/Movies/3", slow));
+    CHECK(HostLogged(L"exporting 1 files with slow reads last"));
+    // Only the first block is read before the file is deferred
+    CHECK(3 * MB + 4096 == HostItem(slow)->read_bytes);
+    CHECK(10000 + 4096 == HostItem(first)->read_bytes);
+
+    return HostDone(test);
+}
+
+static int
+SlowChunk() {
+    HostInit("[Export]\nChunkSizeMB=1\nReadAhead=0\n[Salvage]\nSlowReadMs=50\n");
+    BYTE *buf = Pattern(3 * MB, 2);
+    LONG file = HostAddFile(-1, L"file.mp4", L"Video", buf, 3 * MB);
+    // The first block of the second chunk is fast, the rest is slow
+    HostItem(file)->read_delay = 100;
+    HostItem(file)->slow_ofs = MB + MB / 2;
+    free(buf);
+
+    CHECK(1 == HostRun(1));
+
+    CHECK(HostExportMatches("Existing/Image/Movies/1", file));
+    CHECK(!HostLogged(L"with slow reads last"));
+    // First blocks of the first two chunks, the third is not probed
+    CHECK(3 * MB + 2 * 4096 == HostItem(file)->read_bytes);
+
+    return HostDone("salvage-slow-chunk");
+}
+
+static int
+Bisect(const char *test, BOOL bisect) {
+    char ini[128];
+    snprintf(ini, sizeof(ini), "[Export]\nChunkSizeMB=1\n[Salvage]\nBisect=%d\nMinBlockKB=4\n", bisect);
+    HostInit(ini);
+    BYTE *buf = Pattern(3 * MB, 3);
+    // 100 unreadable bytes in the second chunk
+    LONG middle = HostAddFile(-1, L"middle.mp4", L"Video", buf, 3 * MB);
+    HostItem(middle)->bad_ofs = MB + 10000;
+    HostItem(middle)->bad_len = 100;
+    // The last chunk is unreadable from its first to its last block
+    LONG end = HostAddFile(-1, L"end.mp4", L"Video", buf, 2 * MB + MB / 2);
+    HostItem(end)->bad_ofs = 2 * MB;
+    HostItem(end)->bad_len = MB / 2;
+    free(buf);
+
+    CHECK(1 == HostRun(1));
+
+    WCHAR *xml = HostReadXml("Existing/Image/C4M Index.xml");
+    if (bisect) {
+        // The 4 KB piece with the unreadable bytes is zero-filled
+        CHECK(ExportEquals("Existing/Image/Movies/1", middle, 3 * MB, MB + 8192, 4096));
+        CHECK(HostItem(middle)->tables & HOST_TABLE_PARTIAL);
+        CHECK(1 == CountOf(xml, L"<unreadable>4096</unreadable>"));
+    } else {
+        CHECK(ExportEquals("Existing/Image/Movies/1", middle, MB, 0, 0));
+        CHECK(0 == CountOf(xml, L"<unreadable>"));
+    }
+    CHECK(ExportEquals("Existing/Image/Movies/2", end, 2 * MB, 0, 0));
+    CHECK(!(HostItem(end)->tables & HOST_TABLE_PARTIAL));
+    free(xml);
+
+    return HostDone(test);
+}
+
+int
+main() {
+    int failures = Deferred("salvage-deferred", "[Export]\nChunkSizeMB=1\nReadAhead=0\n[Salvage]\nSlowReadMs=50\n");
+    failures += Deferred("salvage-deferred-pipelined",
+                         "[Export]\nChunkSizeMB=1\nReadAhead=2\n[Salvage]\nSlowReadMs=50\n");
+    failures += SlowChunk();
+    failures += Bisect("salvage-bisect", 1);
+    failures += Bisect("salvage-no-bisect", 0);
+    return failures ? 1 : 0;
+}
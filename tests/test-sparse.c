@@ -0,0 +1,73 @@
+/*
+    Sparse=1 skips aligned 64 KB blocks of zeros when writing an exported
+    file. The file keeps its logical size and content, also when it ends
+    in a skipped range, the skipped ranges take no disk space and the hash
+    is computed over the full content. Covers the direct and the pipelined
+    writer.
+*/
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+#define MB (1024 * 1024)
+#define SIZE (4 * MB)
+
+// Data at the start, an island in the middle that is not aligned, zeros
+// up to the end of the file
+static BYTE *
+Data() {
+    BYTE *buf = calloc(1, SIZE);
+    for (DWORD i = 0; i < 100000; i++) {
+        buf[i] = (BYTE) (1 + i % 251);
+    }
+    for (DWORD i = 2 * MB + 1000; i < 2 * MB + 6000; i++) {
+        buf[i] = (BYTE) (1 + i % 13);
+    }
+    return buf;
+}
+
+static int
+Run(const char *test, int read_ahead) {
+    HostInit(NULL);
+    BYTE *buf = Data();
+    LONG file = HostAddFile(-1, L"sparse.mp4", L"Video", buf, SIZE);
+    // Smaller than a block, written as before
+    LONG dense = HostAddFile(-1, L"dense.mp4", L"Video", buf, 60000);
+
+    // The categorized hash is only found if the hash sees the zeros
+    char hex[33];
+    char text[256];
+    HostMd5Hex(buf, SIZE, hex);
+    snprintf(text, sizeof(text), "md5,category\n%s,3\n", hex);
+    HostWriteText(host.root, "categorized.txt", text);
+    free(buf);
+    char ini[512];
+    snprintf(ini, sizeof(ini),
+             "[Export]\nChunkSizeMB=1\nReadAhead=%d\nSparse=1\n[HashSets]\nCategorized=%s/categorized.txt\n",
+             read_ahead, host.root);
+    HostSetOptions(ini);
+
+    CHECK(1 == HostRun(1));
+
+    CHECK(HostExportMatches("Existing/Image/Movies/1", file));
+    CHECK(HostExportMatches("Existing/Image/Movies/2", dense));
+    // Only the blocks with data take disk space
+    char path[PATH_MAX];
+    struct stat st;
+    HostExportPath(path, sizeof(path), "Existing/Image/Movies/1");
+    CHECK(0 == stat(path, &st) && SIZE == st.st_size && MB > st.st_blocks * 512);
+
+    WCHAR *xml = HostReadXml("Existing/Image/C4M Index.xml");
+    CHECK(2 == CountOf(xml, L"<Movie>"));
+    CHECK(1 == CountOf(xml, L"<category>3</category>"));
+    free(xml);
+
+    return HostDone(test);
+}
+
+int
+main() {
+    int failures = Run("sparse-direct", 0);
+    failures += Run("sparse-pipelined", 2);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+/*
+    The export can be stopped by the user while metadata is collected and
+    while files are exported. Status.json has to say so in both cases.
+*/
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+#define FILES 20
+
+static int
+Run(const char *test, LONG stop_after, int exported) {
+    HostInit(NULL);
+    BYTE buf[1000];
+    static WCHAR names[FILES][16];
+    for (int n = 0; n < FILES; n++) {
+        memset(buf, n, sizeof(buf));
+        swprintf(names[n], 16, L"p%d.jpg", n);
+        HostAddFile(-1, names[n], L"Pictures", buf, sizeof(buf));
+    }
+    host.stop_after = stop_after;
+
+    HostRun(1);
+
+    char *status = (char *) HostReadExport("Status.json", NULL);
+    CHECK(status && strstr(status, "\"phase\": \"aborted\""));
+    free(status);
+    char rel[64];
+    for (int export_id = 1; export_id <= exported; export_id++) {
+        snprintf(rel, sizeof(rel), "Existing/Image/Pictures/%d", export_id);
+        CHECK(HostExportExists(rel));
+    }
+    snprintf(rel, sizeof(rel), "Existing/Image/Pictures/%d", exported + 1);
+    CHECK(!HostExportExists(rel));
+
+    return HostDone(test);
+}
+
+int
+main() {
+    // XWF_ShouldStop is first called once per item while collecting
+    // metadata, then once per item while exporting
+    int failures = Run("stop-metadata", 5, 0);
+    failures += Run("stop-export", FILES + 5, 4);
+    return failures ? 1 : 0;
+}
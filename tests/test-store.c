@@ -0,0 +1,225 @@
+/*
+    A content store shared by cases links exports of contents it already
+    holds to the stored copies: small files before they are written, larger
+    files after. Empty files are not stored, and a stored copy with the same
+    hash but other bytes is never linked. An export waits while another
+    process holds the lock of the index. Several processes export into one
+    store at the same time, each content ends up in it once and all their
+    exports are linked to it.
+*/
+
+#include <sys/wait.h>
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+#define SMALL 3000
+// Larger than a chunk of 1 MB
+#define LARGE (2 * 1024 * 1024 + 100)
+#define INSTANCES 4
+
+static char store_dir[64];
+
+// Path of the stored copy of the content of item id
+static VOID
+BlobPath(LONG id, char *path, size_t len) {
+    char hex[33];
+    struct HostItem *item = HostItem(id);
+    HostMd5Hex(host.volume + item->ofs, item->size, hex);
+    snprintf(path, len, "%s/%.2s/%s", store_dir, hex, hex);
+}
+
+// Returns 1 if the export file is a link to the stored copy of item id
+static BOOL
+IsLinked(const char *rel, LONG id) {
+    char path[PATH_MAX];
+    char blob[PATH_MAX];
+    struct stat st;
+    struct stat blob_st;
+    HostExportPath(path, sizeof(path), rel);
+    BlobPath(id, blob, sizeof(blob));
+    return 0 == stat(path, &st) && 0 == stat(blob, &blob_st) && st.st_ino == blob_st.st_ino;
+}
+
+// Returns the number of links to the stored copy of item id
+static nlink_t
+Links(LONG id) {
+    char blob[PATH_MAX];
+    struct stat st;
+    BlobPath(id, blob, sizeof(blob));
+    return 0 == stat(blob, &st) ? st.st_nlink : 0;
+}
+
+static UINT64
+StoredCount() {
+    char path[PATH_MAX];
+    struct XtStoreHeader header = {0};
+    snprintf(path, sizeof(path), "%s/Store Index.dat", store_dir);
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        if (1 != fread(&header, sizeof(header), 1, f)) {
+            header.count = 0;
+        }
+        fclose(f);
+    }
+    return header.count;
+}
+
+static VOID
+Init() {
+    char ini[256];
+    snprintf(ini, sizeof(ini), "[Export]\nChunkSizeMB=1\n[Store]\nDir=%s\nMaxFiles=100\n", store_dir);
+    HostInit(ini);
+}
+
+// Two cases with the same files, the second one is linked to the first
+static int
+Cases() {
+    Init();
+    LONG small = HostAddPattern(L"small.jpg", L"Pictures", SMALL, 1);
+    LONG large = HostAddPattern(L"large.mp4", L"Video", LARGE, 2);
+    HostAddPattern(L"empty.jpg", L"Pictures", 0, 3);
+    CHECK(1 == HostRun(1));
+    CHECK(IsLinked("Existing/Image/Pictures/1", small));
+    CHECK(IsLinked("Existing/Image/Movies/1", large));
+    CHECK(2 == StoredCount());
+    CHECK(!HostLogged(L"copies in the content store"));
+    int failures = HostDone("store-first-case");
+
+    Init();
+    small = HostAddPattern(L"small.jpg", L"Pictures", SMALL, 1);
+    large = HostAddPattern(L"large.mp4", L"Video", LARGE, 2);
+    HostAddPattern(L"empty.jpg", L"Pictures", 0, 3);
+    CHECK(1 == HostRun(1));
+    CHECK(HostExportMatches("Existing/Image/Pictures/1", small));
+    CHECK(HostExportMatches("Existing/Image/Movies/1", large));
+    CHECK(IsLinked("Existing/Image/Pictures/1", small));
+    CHECK(IsLinked("Existing/Image/Movies/1", large));
+    CHECK(2 == StoredCount());
+    CHECK(HostLogged(L"linking 2 files to copies in the content store"));
+    return failures + HostDone("store-second-case");
+}
+
+// Stored copies of the same size and hash but other bytes, as after an
+// MD5 collision, are left alone
+static int
+Collision() {
+    Init();
+    LONG small = HostAddPattern(L"small.jpg", L"Pictures", SMALL, 1);
+    LONG large = HostAddPattern(L"large.mp4", L"Video", LARGE, 2);
+    LONG ids[] = {small, large};
+    for (int i = 0; i < 2; i++) {
+        char blob[PATH_MAX];
+        BlobPath(ids[i], blob, sizeof(blob));
+        CHECK(0 == unlink(blob));
+        FILE *f = fopen(blob, "wb");
+        for (INT64 n = 0; n < HostItem(ids[i])->size; n++) {
+            fputc('x', f);
+        }
+        fclose(f);
+    }
+
+    CHECK(1 == HostRun(1));
+    CHECK(HostExportMatches("Existing/Image/Pictures/1", small));
+    CHECK(HostExportMatches("Existing/Image/Movies/1", large));
+    CHECK(!IsLinked("Existing/Image/Pictures/1", small));
+    CHECK(!IsLinked("Existing/Image/Movies/1", large));
+    CHECK(1 == Links(small) && 1 == Links(large));
+    CHECK(!HostLogged(L"copies in the content store"));
+    return HostDone("store-collision");
+}
+
+// Processes which export the same new contents into the store at once
+static int
+Instances() {
+    pid_t pids[INSTANCES];
+    fflush(stdout);
+    for (int i = 0; i < INSTANCES; i++) {
+        pids[i] = fork();
+        if (0 == pids[i]) {
+            char test[32];
+            char rel[64];
+            LONG small[8];
+            LONG large[8];
+            Init();
+            // Slow reads let the instances overlap
+            for (int n = 0; n < 8; n++) {
+                small[n] = HostAddPattern(L"small.jpg", L"Pictures", SMALL, 10 + n);
+                large[n] = HostAddPattern(L"large.mp4", L"Video", LARGE, 20 + n);
+                HostItem(small[n])->read_delay = 1;
+                HostItem(large[n])->read_delay = 1;
+            }
+            CHECK(1 == HostRun(1));
+            // Every export is linked to the one stored copy
+            for (int n = 0; n < 8; n++) {
+                snprintf(rel, sizeof(rel), "Existing/Image/Pictures/%d", n + 1);
+                CHECK(HostExportMatches(rel, small[n]) && IsLinked(rel, small[n]));
+                snprintf(rel, sizeof(rel), "Existing/Image/Movies/%d", n + 1);
+                CHECK(HostExportMatches(rel, large[n]) && IsLinked(rel, large[n]));
+            }
+            snprintf(test, sizeof(test), "store-instance-%d", i);
+            exit(HostDone(test) ? 1 : 0);
+        }
+    }
+    for (int i = 0; i < INSTANCES; i++) {
+        int status = 0;
+        CHECK(pids[i] == waitpid(pids[i], &status, 0) && WIFEXITED(status) && 0 == WEXITSTATUS(status));
+    }
+    CHECK(3 + 16 == StoredCount());
+    return HostDone("store-instances");
+}
+
+// Another process holds the lock of the index, the export waits for it
+static int
+Locked() {
+    Init();
+    LONG file = HostAddPattern(L"locked.jpg", L"Pictures", SMALL, 90);
+    int ready[2];
+    CHECK(0 == pipe(ready));
+    fflush(stdout);
+    pid_t pid = fork();
+    if (0 == pid) {
+        WCHAR path[MAX_PATH];
+        OVERLAPPED ov = {0};
+        ov.OffsetHigh = STORE_LOCK_HIGH;
+        swprintf(path, MAX_PATH, L"%s\\Store Index.dat", store_dir);
+        HANDLE index = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                   NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        BOOL locked = LockFileEx(index, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov);
+        if (1 != write(ready[1], &locked, 1)) {
+            _exit(1);
+        }
+        Sleep(300);
+        UnlockFileEx(index, 0, 1, 0, &ov);
+        _exit(0);
+    }
+    char locked = 0;
+    CHECK(1 == read(ready[0], &locked, 1) && locked);
+    ULONGLONG start = GetTickCount64();
+    CHECK(1 == HostRun(1));
+    CHECK(250 <= GetTickCount64() - start);
+    int status = 0;
+    CHECK(pid == waitpid(pid, &status, 0) && WIFEXITED(status) && 0 == WEXITSTATUS(status));
+    close(ready[0]);
+    close(ready[1]);
+    CHECK(HostExportMatches("Existing/Image/Pictures/1", file));
+    CHECK(IsLinked("Existing/Image/Pictures/1", file));
+    return HostDone("store-locked");
+}
+
+int
+main() {
+    snprintf(store_dir, sizeof(store_dir), "/tmp/gexpo-test-XXXXXX");
+    if (NULL == mkdtemp(store_dir)) {
+        perror("mkdtemp");
+        return 2;
+    }
+    int failures = Cases();
+    failures += Collision();
+    failures += Locked();
+    failures += Instances();
+    if (0 == failures) {
+        RemoveTree(store_dir);
+    }
+    return failures ? 1 : 0;
+}
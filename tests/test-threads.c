@@ -0,0 +1,143 @@
+/*
+    XT_ProcessItem is called from all refinement threads of X-Ways at once.
+    Runs it with many threads on a few thousand pictures and videos and
+    checks that every one of them is exported exactly once.
+*/
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+#define FOLDERS 40
+#define FILES   3000
+#define THREADS 16
+
+// Content of file n: its number, then bytes derived from it
+static VOID
+FillFile(BYTE *buf, INT64 size, UINT32 n) {
+    for (INT64 i = 0; i < size; i++) {
+        buf[i] = (BYTE) (n * 31 + i * 7);
+    }
+    memcpy(buf, &n, sizeof(n));
+}
+
+// Finds the item whose content is in data, -1 if none
+static LONG
+ItemOf(const BYTE *data, size_t len, const LONG *ids) {
+    UINT32 n;
+    if (sizeof(n) > len) {
+        return -1;
+    }
+    memcpy(&n, data, sizeof(n));
+    if (FILES <= n) {
+        return -1;
+    }
+    struct HostItem *item = HostItem(ids[n]);
+    return (size_t) item->size == len && 0 == memcmp(host.volume + item->ofs, data, len) ? ids[n] : -1;
+}
+
+// Checks one Pictures or Movies folder, marks the items found in seen
+static int
+CheckFolder(const char *folder, int count, const LONG *ids, BYTE *seen) {
+    int found = 0;
+    for (int export_id = 1; export_id <= count; export_id++) {
+        char rel[256];
+        size_t len = 0;
+        snprintf(rel, sizeof(rel), "%s/%d", folder, export_id);
+        BYTE *data = HostReadExport(rel, &len);
+        LONG id = data ? ItemOf(data, len, ids) : -1;
+        CHECK(-1 != id);
+        if (-1 != id) {
+            CHECK(!seen[id]);
+            seen[id] = 1;
+            found++;
+        }
+        free(data);
+    }
+    char rel[256];
+    snprintf(rel, sizeof(rel), "%s/%d", folder, count + 1);
+    CHECK(!HostExportExists(rel));
+    return found;
+}
+
+// Returns 1 if item is somewhere below folder
+static BOOL
+IsBelow(LONG item, LONG folder) {
+    for (LONG id = HostItem(item)->parent; -1 != id; id = HostItem(id)->parent) {
+        if (id == folder) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Exports all files except those below folder number exclude, -1 for none
+static int
+Run(const char *test, const char *ini, int exclude) {
+    HostInit(ini);
+    LONG folders[FOLDERS];
+    LONG ids[FILES];
+    static WCHAR folder_names[FOLDERS][16];
+    static WCHAR file_names[FILES][16];
+    for (int i = 0; i < FOLDERS; i++) {
+        swprintf(folder_names[i], 16, L"dir%d", i);
+        folders[i] = HostAddFolder(i ? folders[(i - 1) / 2] : -1, folder_names[i]);
+    }
+
+    BYTE *buf = malloc(200000);
+    int pictures[2] = {0};
+    int movies[2] = {0};
+    for (int n = 0; n < FILES; n++) {
+        // Every 7th file is a video, every 5th deleted, every 11th no
+        // picture or video at all
+        BOOL video = 0 == n % 7;
+        BOOL other = 0 == n % 11;
+        BOOL deleted = 0 == n % 5;
+        INT64 size = 100 + (n * 7919) % (video ? 199000 : 20000);
+        FillFile(buf, size, n);
+        swprintf(file_names[n], 16, video ? L"v%d.mp4" : L"p%d.jpg", n);
+        ids[n] = HostAddFile(folders[n % FOLDERS], file_names[n],
+                             other ? L"Documents" : video ? L"Video" : L"Pictures", buf, size);
+        HostItem(ids[n])->deleted = deleted;
+        BOOL excluded = -1 != exclude && IsBelow(ids[n], folders[exclude]);
+        if (!other && !excluded) {
+            (video ? movies : pictures)[deleted]++;
+        }
+    }
+    free(buf);
+
+    CHECK(1 == HostRun(THREADS));
+
+    BYTE *seen = calloc(host.count, 1);
+    int found = CheckFolder("Existing/" "Image/Pictures", pictures[0], ids, seen)
+                + CheckFolder("Existing/" "Image/Movies", movies[0], ids, seen)
+                + CheckFolder("Deleted/" "Image/Pictures", pictures[1], ids, seen)
+                + CheckFolder("Deleted/" "Image/Movies", movies[1], ids, seen);
+    CHECK(pictures[0] + pictures[1] + movies[0] + movies[1] == found);
+    for (int n = 0; n < FILES; n++) {
+        struct HostItem *item = HostItem(ids[n]);
+        BOOL skipped = 0 == n % 11 || (-1 != exclude && IsBelow(ids[n], folders[exclude]));
+        CHECK(skipped ? 0 == item->tables : HOST_TABLE_SUCCESS == item->tables);
+        CHECK(skipped != seen[ids[n]]);
+    }
+    free(seen);
+
+    // Every record is in the index of its folder
+    WCHAR *index = HostReadXml("Existing/Image/C4P Index.xml");
+    CHECK(pictures[0] == CountOf(index, L"<Image>"));
+    free(index);
+    index = HostReadXml("Deleted/Image/C4M Index.xml");
+    CHECK(movies[1] == CountOf(index, L"<Movie>"));
+    free(index);
+
+    return HostDone(test);
+}
+
+int
+main() {
+    int failures = Run("threads", NULL, -1);
+    // Worklist records in temporary files instead of memory
+    failures += Run("threads-spilled", "[Worklist]\nSpillItems=1\n", -1);
+    // Folder paths are cached by all threads while classifying
+    failures += Run("threads-filtered", "[Filter]\nExclude=**\\dir3\\**\n", 3);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,305 @@
+/*
+    Probe=1 records duration, resolution, codec and creation time of MP4,
+    AVI and Matroska videos. The parsers are checked directly, then an MP4
+    whose moov box follows a large mdat is exported: the details are found
+    by reading beyond the first chunk and are written to the Movie index
+    and the manifest.
+*/
+
+#include <math.h>
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+#define CREATED 1517155200
+
+// Starts a box, BoxEnd sets its size
+static DWORD
+Box(struct HostData *d, const char *type) {
+    DWORD start = d->len;
+    HostPutBe(d, 0, 4);
+    HostPut(d, type, 4);
+    return start;
+}
+
+static VOID
+BoxEnd(struct HostData *d, DWORD start) {
+    DWORD len = d->len;
+    d->len = start;
+    HostPutBe(d, len - start, 4);
+    d->len = len;
+}
+
+static VOID
+Track(struct HostData *d, const char *handler, const char *format) {
+    DWORD trak = Box(d, "trak");
+    DWORD mdia = Box(d, "mdia");
+    DWORD hdlr = Box(d, "hdlr");
+    HostFill(d, 0, 8);
+    HostPut(d, handler, 4);
+    HostFill(d, 0, 12);
+    BoxEnd(d, hdlr);
+    DWORD minf = Box(d, "minf");
+    DWORD stbl = Box(d, "stbl");
+    DWORD stsd = Box(d, "stsd");
+    HostPutBe(d, 0, 4);
+    HostPutBe(d, 1, 4);
+    // Sample entry with the dimensions at offset 32
+    DWORD entry = Box(d, format);
+    HostFill(d, 0, 24);
+    HostPutBe(d, 1920, 2);
+    HostPutBe(d, 1080, 2);
+    HostFill(d, 0, 50);
+    BoxEnd(d, entry);
+    BoxEnd(d, stsd);
+    BoxEnd(d, stbl);
+    BoxEnd(d, minf);
+    BoxEnd(d, mdia);
+    BoxEnd(d, trak);
+}
+
+// The moov box follows mdat, like in most camera recordings. Returns the
+// offset of moov.
+static DWORD
+Mp4(struct HostData *d, DWORD media) {
+    d->len = 0;
+    DWORD box = Box(d, "ftyp");
+    HostPut(d, "isom\0\0\0\x01", 8);
+    BoxEnd(d, box);
+    box = Box(d, "mdat");
+    HostFill(d, 0x55, media);
+    BoxEnd(d, box);
+
+    DWORD moov = Box(d, "moov");
+    box = Box(d, "mvhd");
+    // Version 0: creation time since 1904, timescale and duration
+    HostPutBe(d, 0, 4);
+    HostPutBe(d, CREATED + 2082844800ULL, 4);
+    HostPutBe(d, 0, 4);
+    HostPutBe(d, 1000, 4);
+    HostPutBe(d, 12345, 4);
+    HostFill(d, 0, 80);
+    BoxEnd(d, box);
+    Track(d, "soun", "mp4a");
+    Track(d, "vide", "avc1");
+    BoxEnd(d, moov);
+    return moov;
+}
+
+static DWORD
+Chunk(struct HostData *d, const char *id, const char *type) {
+    DWORD start = d->len;
+    HostPut(d, id, 4);
+    HostPutLe(d, 0, 4);
+    if (type) {
+        HostPut(d, type, 4);
+    }
+    return start;
+}
+
+static VOID
+ChunkEnd(struct HostData *d, DWORD start) {
+    DWORD len = d->len;
+    d->len = start + 4;
+    HostPutLe(d, len - start - 8, 4);
+    d->len = len;
+    if (len & 1) {
+        HostFill(d, 0, 1);
+    }
+}
+
+static VOID
+Stream(struct HostData *d, const char *type, const char *handler, const char *compression) {
+    DWORD strl = Chunk(d, "LIST", "strl");
+    DWORD chunk = Chunk(d, "strh", NULL);
+    HostPut(d, type, 4);
+    HostPut(d, handler, 4);
+    HostFill(d, 0, 48);
+    ChunkEnd(d, chunk);
+    // BITMAPINFOHEADER with the compression at offset 16
+    chunk = Chunk(d, "strf", NULL);
+    HostFill(d, 0, 16);
+    HostPut(d, compression, 4);
+    HostFill(d, 0, 20);
+    ChunkEnd(d, chunk);
+    ChunkEnd(d, strl);
+}
+
+static VOID
+Avi(struct HostData *d) {
+    d->len = 0;
+    DWORD riff = Chunk(d, "RIFF", "AVI ");
+    DWORD hdrl = Chunk(d, "LIST", "hdrl");
+    // 250 frames of 40 ms
+    DWORD avih = Chunk(d, "avih", NULL);
+    HostPutLe(d, 40000, 4);
+    HostFill(d, 0, 12);
+    HostPutLe(d, 250, 4);
+    HostFill(d, 0, 12);
+    HostPutLe(d, 640, 4);
+    HostPutLe(d, 480, 4);
+    HostFill(d, 0, 16);
+    ChunkEnd(d, avih);
+    Stream(d, "auds", "\0\0\0\0", "\x01\0\0\0");
+    Stream(d, "vids", "xvid", "H264");
+    ChunkEnd(d, hdrl);
+    DWORD movi = Chunk(d, "LIST", "movi");
+    DWORD frame = Chunk(d, "00dc", NULL);
+    HostPut(d, "frame", 5);
+    ChunkEnd(d, frame);
+    ChunkEnd(d, movi);
+    ChunkEnd(d, riff);
+}
+
+// Starts an element with a size of two bytes, EbmlEnd sets it
+static DWORD
+Ebml(struct HostData *d, UINT32 id, DWORD id_len) {
+    HostPutBe(d, id, id_len);
+    DWORD start = d->len;
+    HostPutBe(d, 0x4000, 2);
+    return start;
+}
+
+static VOID
+EbmlEnd(struct HostData *d, DWORD start) {
+    DWORD len = d->len;
+    d->len = start;
+    HostPutBe(d, 0x4000 | (len - start - 2), 2);
+    d->len = len;
+}
+
+static VOID
+EbmlBytes(struct HostData *d, UINT32 id, DWORD id_len, const void *p, DWORD len) {
+    HostPutBe(d, id, id_len);
+    HostPutBe(d, 0x80 | len, 1);
+    HostPut(d, p, len);
+}
+
+static VOID
+EbmlUnsigned(struct HostData *d, UINT32 id, DWORD id_len, UINT64 v, DWORD len) {
+    HostPutBe(d, id, id_len);
+    HostPutBe(d, 0x80 | len, 1);
+    HostPutBe(d, v, len);
+}
+
+// A WebM file with an audio track before the video track. The segment has
+// an unknown size, like in live recordings.
+static VOID
+Mkv(struct HostData *d) {
+    d->len = 0;
+    DWORD header = Ebml(d, 0x1a45dfa3, 4);
+    EbmlBytes(d, 0x4282, 2, "webm", 4);
+    EbmlEnd(d, header);
+    HostPutBe(d, EBML_SEGMENT, 4);
+    HostPutBe(d, 0x01ffffffffffffffULL, 8);
+
+    DWORD info = Ebml(d, EBML_INFO, 4);
+    EbmlUnsigned(d, EBML_TIMECODE_SCALE, 3, 1000000, 3);
+    float duration = 12345;
+    UINT32 bits;
+    memcpy(&bits, &duration, 4);
+    EbmlUnsigned(d, EBML_DURATION, 2, bits, 4);
+    EbmlUnsigned(d, EBML_DATE, 2, (CREATED - 978307200ULL) * 1000000000, 8);
+    EbmlEnd(d, info);
+
+    DWORD tracks = Ebml(d, EBML_TRACKS, 4);
+    DWORD entry = Ebml(d, EBML_TRACK_ENTRY, 1);
+    EbmlUnsigned(d, EBML_TRACK_TYPE, 1, 2, 1);
+    EbmlBytes(d, EBML_CODEC_ID, 1, "A_OPUS", 6);
+    EbmlEnd(d, entry);
+    entry = Ebml(d, EBML_TRACK_ENTRY, 1);
+    EbmlUnsigned(d, EBML_TRACK_TYPE, 1, 1, 1);
+    EbmlBytes(d, EBML_CODEC_ID, 1, "V_VP9", 5);
+    DWORD video = Ebml(d, EBML_VIDEO, 1);
+    EbmlUnsigned(d, EBML_PIXEL_WIDTH, 1, 1920, 2);
+    EbmlUnsigned(d, EBML_PIXEL_HEIGHT, 1, 1080, 2);
+    EbmlEnd(d, video);
+    EbmlEnd(d, entry);
+    EbmlEnd(d, tracks);
+
+    DWORD cluster = Ebml(d, EBML_CLUSTER, 4);
+    HostFill(d, 0, 16);
+    EbmlEnd(d, cluster);
+}
+
+static BOOL
+VideoMatches(struct XtVideo *v, double duration, UINT32 width, UINT32 height, const char *codec,
+             INT64 created) {
+    return v->valid && 1e-6 > fabs(v->duration - duration) && width == v->width
+           && height == v->height && 0 == strcmp(v->codec, codec) && created == v->created;
+}
+
+static int
+Parsers() {
+    struct XtVideo v;
+    struct HostData d = {0};
+    options.video = 1;
+    Mp4(&d, 100);
+    VideoProbe(&v, NULL, d.b, d.len, d.len);
+    CHECK(VideoMatches(&v, 12.345, 1920, 1080, "avc1", CREATED));
+    Avi(&d);
+    VideoProbe(&v, NULL, d.b, d.len, d.len);
+    CHECK(VideoMatches(&v, 10, 640, 480, "H264", 0));
+    Mkv(&d);
+    VideoProbe(&v, NULL, d.b, d.len, d.len);
+    CHECK(VideoMatches(&v, 12.345, 1920, 1080, "V_VP9", CREATED));
+
+    // Without a handle, nothing beyond the first chunk can be read
+    DWORD moov = Mp4(&d, 100);
+    VideoProbe(&v, NULL, d.b, moov, d.len);
+    CHECK(!v.valid);
+    // Unsafe characters of codec identifiers are replaced
+    memcpy(memmem(d.b, d.len, "avc1", 4), "a<\"1", 4);
+    VideoProbe(&v, NULL, d.b, d.len, d.len);
+    CHECK(v.valid && 0 == strcmp(v.codec, "a__1"));
+    options.video = 0;
+    VideoProbe(&v, NULL, d.b, d.len, d.len);
+    CHECK(!v.valid);
+    free(d.b);
+    return HostDone("video-parsers");
+}
+
+static int
+Export() {
+    HostInit("[Export]\nChunkSizeMB=1\n[Video]\nProbe=1\n");
+    struct HostData d = {0};
+    Mp4(&d, 3 * 1024 * 1024);
+    LONG mp4 = HostAddFile(-1, L"camera.mp4", L"Video", d.b, d.len);
+    // Not a known format
+    LONG other = HostAddFile(-1, L"other.mp4", L"Video", (const BYTE *) "not a video", 11);
+    free(d.b);
+
+    CHECK(1 == HostRun(1));
+    CHECK(HostExportMatches("Existing/Image/Movies/1", mp4));
+    CHECK(HostExportMatches("Existing/Image/Movies/2", other));
+
+    WCHAR *xml = HostReadXml("Existing/Image/C4M Index.xml");
+    CHECK(2 == CountOf(xml, L"<Movie>"));
+    CHECK(1 == CountOf(xml, L"</fileSize>\r\n  <video duration=\"12.345\" width=\"1920\" height=\"1080\" "
+                            L"codec=\"avc1\" created=\"1517155200\"/>\r\n</Movie>"));
+    CHECK(0 == CountOf(xml, L"<!--"));
+    free(xml);
+
+    size_t len = 0;
+    BYTE *manifest = HostReadExport("Export Manifest.dat", &len);
+    const struct XtManifestHeader *header = (const struct XtManifestHeader *) manifest;
+    CHECK(manifest && sizeof(*header) + 2 * sizeof(struct XtManifestRecord) == len);
+    if (manifest && sizeof(*header) + 2 * sizeof(struct XtManifestRecord) == len) {
+        CHECK(sizeof(struct XtManifestRecord) == header->record_size);
+        const struct XtManifestRecord *rec = (const struct XtManifestRecord *) (header + 1);
+        CHECK(rec[0].flags & MANIFEST_FLAG_VIDEO);
+        CHECK(12.345 == rec[0].duration && 1920 == rec[0].width && 1080 == rec[0].height);
+        CHECK(CREATED == rec[0].video_created && 0 == strcmp(rec[0].codec, "avc1"));
+        CHECK(!(rec[1].flags & MANIFEST_FLAG_VIDEO) && 0 == rec[1].width && '\0' == rec[1].codec[0]);
+    }
+    free(manifest);
+
+    return HostDone("video-export");
+}
+
+int
+main() {
+    int failures = Parsers();
+    failures += Export();
+    return failures ? 1 : 0;
+}
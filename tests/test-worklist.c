@@ -0,0 +1,81 @@
+/*
+    Spilled worklists are sorted by [Schedule] Order in several runs that
+    are merged, the records are rewritten in export order. The export has
+    to follow the same order as with a worklist in memory.
+*/
+
+#include "../src/xt-gexpo.c"
+#include "host.h"
+
+// More records than fit into one run of 1 MB
+#define FILES 12000
+
+static LONG ids[FILES];
+
+static VOID
+AddFiles() {
+    static WCHAR names[FILES][16];
+    BYTE buf[600];
+    for (int n = 0; n < FILES; n++) {
+        // Sizes repeat, equal sizes keep their enumeration order
+        INT64 size = 100 + (n * 7919) % 500;
+        for (INT64 i = 0; i < size; i++) {
+            buf[i] = (BYTE) (n + i * 7);
+        }
+        memcpy(buf, &n, sizeof(n));
+        swprintf(names[n], 16, L"p%d.jpg", n);
+        ids[n] = HostAddFile(-1, names[n], L"Pictures", buf, size);
+    }
+}
+
+// Checks that the pictures were exported by size and returns the file
+// numbers in export order
+static int *
+ExportOrder() {
+    int *order = calloc(FILES, sizeof(int));
+    char rel[64];
+    for (int export_id = 1; export_id <= FILES; export_id++) {
+        snprintf(rel, sizeof(rel), "Existing/Image/Pictures/%d", export_id);
+        BYTE *data = HostReadExport(rel, NULL);
+        int n = -1;
+        if (data) {
+            memcpy(&n, data, sizeof(n));
+        }
+        free(data);
+        CHECK(0 <= n && n < FILES && HostExportMatches(rel, ids[n]));
+        if (0 > n || n >= FILES) {
+            break;
+        }
+        order[export_id - 1] = n;
+        if (1 < export_id) {
+            INT64 size = HostItem(ids[n])->size;
+            int prev = order[export_id - 2];
+            INT64 prev_size = HostItem(ids[prev])->size;
+            CHECK(prev_size < size || (prev_size == size && prev < n));
+        }
+    }
+    return order;
+}
+
+static int
+Run(const char *test, const char *ini, int **order) {
+    HostInit(ini);
+    AddFiles();
+    CHECK(1 == HostRun(1));
+    *order = ExportOrder();
+    return HostDone(test);
+}
+
+int
+main() {
+    CHECK(FILES * sizeof(struct XtSortRecord) > 1024 * 1024);
+    int *memory;
+    int *spilled;
+    int failures = Run("worklist", "[Schedule]\nOrder=size\n", &memory);
+    failures += Run("worklist-spilled",
+                    "[Schedule]\nOrder=size\n[Worklist]\nSpillItems=1\nSortMemoryMB=1\n", &spilled);
+    CHECK(0 == memcmp(memory, spilled, FILES * sizeof(int)));
+    free(memory);
+    free(spilled);
+    return failures || host_failures ? 1 : 0;
+}
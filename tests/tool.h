@@ -0,0 +1,28 @@
+/*
+    Checks shared by the tests of the manifest tools, which run the tools
+    on fixtures in root without the X-Tension.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+static char root[64];
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static int
+CountOf(const char *str, const char *text) {
+    int n = 0;
+    for (const char *s = str ? strstr(str, text) : NULL; s; s = strstr(s + 1, text)) {
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,647 @@
+/*
+    Griffeye XML export X-Tension for X-Ways Forensics
+    Copyright (C) 2019 R. Yushaev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Merges the exports of several shards (see [Shard] in the README) into a
+// single export. Index records are streamed shard by shard and renumbered,
+// so memory use does not depend on the size of the export. Builds on
+// Windows and POSIX systems.
+//
+// Usage: gexpo-merge [-c case] [-n records] [-s MB] [-u] [-k] <output dir> <shard dir>...
+
+#include "gexpo-xml.h"
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+// Report directories relative to the shard folders, e.g. "Existing/Ev1"
+struct Names {
+    char **names;
+    size_t count;
+    size_t capacity;
+};
+
+// Totals of one merged report and type
+struct Stats {
+    uint64_t records;
+    uint64_t missing;
+};
+
+// Text lists of one merged report, created by the first shard that has them
+struct Lists {
+    struct Out *exif;
+    struct Out *known;
+};
+
+int keep = 0;
+
+// Reads the next <Image> or <Movie> element into record
+// Returns its length in code units, 0 at the end of the file
+// Returns -1 if an element is longer than RECORD_LEN
+long
+InRecord(struct In *in) {
+    // Outside of elements, only the last 7 units are kept
+    size_t len = 0;
+    int32_t unit;
+    while (0 <= (unit = InUnit(in))) {
+        if (7 == len) {
+            memmove(record, record + 1, 6 * sizeof(uint16_t));
+            len--;
+        }
+        record[len++] = (uint16_t) unit;
+        if (7 == len && (UnitsEqual(record, "<Image>", 7) || UnitsEqual(record, "<Movie>", 7))) {
+            break;
+        }
+    }
+    if (0 > unit) {
+        return 0;
+    }
+    while (0 <= (unit = InUnit(in))) {
+        if (RECORD_LEN == len) {
+            return -1;
+        }
+        record[len++] = (uint16_t) unit;
+        if ('>' == unit && 15 <= len
+            && (UnitsEqual(record + len - 8, "</Image>", 8) || UnitsEqual(record + len - 8, "</Movie>", 8))) {
+            return (long) len;
+        }
+    }
+    // Truncated element at the end of an interrupted index
+    return 0;
+}
+
+// Copies rec up to the content of the element open...close, writes the
+// new content instead and returns the position of close
+size_t
+OutReplace(struct Out *out, const uint16_t *rec, size_t len, size_t from,
+           const char *open, const char *close, const char *content, uint64_t number) {
+    size_t start = UnitsFind(rec, len, from, open);
+    if (len == start) {
+        return from;
+    }
+    start += strlen(open);
+    OutString16(out, rec + from, start - from);
+    if (content) {
+        OutAscii(out, "<![CDATA[");
+        OutUtf8(out, content);
+        OutAscii(out, "]]>");
+    } else {
+        OutNumber(out, (int64_t) number);
+    }
+    return UnitsFind(rec, len, start, close);
+}
+
+// Platform layer
+
+int
+DirExists(const char *path) {
+#ifdef _WIN32
+    wchar_t wpath[PATH_LEN];
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, PATH_LEN);
+    DWORD attributes = GetFileAttributesW(wpath);
+    return INVALID_FILE_ATTRIBUTES != attributes && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat st;
+    return 0 == stat(path, &st) && S_ISDIR(st.st_mode);
+#endif
+}
+
+int
+FileExists(const char *path) {
+    FILE *file = OpenFile(path, "rb");
+    if (file) {
+        fclose(file);
+    }
+    return NULL != file;
+}
+
+// Moves a file, copying it if it is on another volume
+// Returns 1 if successful
+// Returns 0 if not
+int
+MovePath(const char *from, const char *to) {
+#ifdef _WIN32
+    wchar_t wfrom[PATH_LEN];
+    wchar_t wto[PATH_LEN];
+    MultiByteToWideChar(CP_UTF8, 0, from, -1, wfrom, PATH_LEN);
+    MultiByteToWideChar(CP_UTF8, 0, to, -1, wto, PATH_LEN);
+    return 0 != MoveFileExW(wfrom, wto, MOVEFILE_COPY_ALLOWED);
+#else
+    if (0 == rename(from, to)) {
+        return 1;
+    }
+    if (EXDEV != errno) {
+        return 0;
+    }
+    return CopyPath(from, to) && 0 == remove(from);
+#endif
+}
+
+// Adds a copy of name, duplicates are removed by NamesUnique once the
+// list is sorted
+int
+NamesAdd(struct Names *list, const char *name) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? 2 * list->capacity : 64;
+        char **grown = realloc(list->names, sizeof(char *) * capacity);
+        if (NULL == grown) {
+            fprintf(stderr, "ERROR: not enough memory\n");
+            return 0;
+        }
+        list->names = grown;
+        list->capacity = capacity;
+    }
+    list->names[list->count] = malloc(strlen(name) + 1);
+    if (NULL == list->names[list->count]) {
+        fprintf(stderr, "ERROR: not enough memory\n");
+        return 0;
+    }
+    strcpy(list->names[list->count++], name);
+    return 1;
+}
+
+int
+CompareNames(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+// Removes adjacent duplicates from a sorted list
+void
+NamesUnique(struct Names *list) {
+    size_t count = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (count && 0 == strcmp(list->names[count - 1], list->names[i])) {
+            free(list->names[i]);
+        } else {
+            list->names[count++] = list->names[i];
+        }
+    }
+    list->count = count;
+}
+
+// Adds all report directories "<top>/<name>" of a shard, i.e. the
+// subdirectories of <shard>/<top> that contain a case report, and counts
+// them in *found. A shard without <top> has no such reports.
+// Returns 1 if successful
+// Returns 0 if not
+int
+NamesAddReports(struct Names *list, const char *shard, const char *top, size_t *found) {
+    char dir[PATH_LEN];
+    char path[PATH_LEN];
+    char name[PATH_LEN];
+    if (!PathFormat(dir, "%s/%s", shard, top)) {
+        return 0;
+    }
+    int rv = 1;
+#ifdef _WIN32
+    wchar_t pattern[PATH_LEN];
+    if (!PathFormat(path, "%s/*", dir)) {
+        return 0;
+    }
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, pattern, PATH_LEN);
+    WIN32_FIND_DATAW entry;
+    HANDLE find = FindFirstFileW(pattern, &entry);
+    if (INVALID_HANDLE_VALUE == find) {
+        return 1;
+    }
+    do {
+        char entry_name[PATH_LEN];
+        WideCharToMultiByte(CP_UTF8, 0, entry.cFileName, -1, entry_name, PATH_LEN, NULL, NULL);
+#else
+    DIR *find = opendir(dir);
+    if (NULL == find) {
+        return 1;
+    }
+    struct dirent *entry;
+    while (rv && NULL != (entry = readdir(find))) {
+        const char *entry_name = entry->d_name;
+#endif
+        if ('.' == entry_name[0]) {
+            continue;
+        }
+        rv = PathFormat(path, "%s/%s/%s", dir, entry_name, CASE_REPORT)
+             && PathFormat(name, "%s/%s", top, entry_name);
+        if (rv && FileExists(path)) {
+            rv = NamesAdd(list, name);
+            (*found)++;
+        }
+#ifdef _WIN32
+    } while (rv && FindNextFileW(find, &entry));
+    FindClose(find);
+#else
+    }
+    closedir(find);
+#endif
+    return rv;
+}
+
+// Reads the case name of a case report into buf
+void
+ReadCaseName(const char *dir, char *buf, size_t buf_len) {
+    char path[PATH_LEN];
+    buf[0] = '\0';
+    if (!PathFormat(path, "%s/%s", dir, CASE_REPORT)) {
+        return;
+    }
+    struct In *in = InOpen(path);
+    if (NULL == in) {
+        return;
+    }
+    size_t len = 0;
+    int32_t unit;
+    while (len < RECORD_LEN && 0 <= (unit = InUnit(in))) {
+        record[len++] = (uint16_t) unit;
+    }
+    InClose(in);
+    const char *open = "<CaseNumber><![CDATA[";
+    size_t start = UnitsFind(record, len, 0, open);
+    if (len == start) {
+        return;
+    }
+    start += strlen(open);
+    size_t end = UnitsFind(record, len, start, "]]>");
+    ToUtf8(record + start, end - start, buf, buf_len);
+}
+
+// Writes the absolute Windows path of subdir of a shard report to buf, for
+// files that are kept in the shard folders
+// Returns 1 if successful
+// Returns 0 if the path is too long
+int
+KeptPath(char *buf, const char *shard, const char *report, const char *subdir) {
+    char full[PATH_LEN];
+    FullPath(shard, full, PATH_LEN);
+    if (!PathFormat(buf, "%s/%s/%s", full, report, subdir) || PATH_LEN - 1 <= strlen(buf)) {
+        return 0;
+    }
+    for (char *p = buf; *p; p++) {
+        if ('/' == *p) *p = '\\';
+    }
+    return 1;
+}
+
+// Streams all index parts of one type of a shard report into index in dir,
+// adding offset to all IDs. Raises *max_id to the highest new ID.
+// Returns 1 if successful
+// Returns 0 if not
+int
+MergeIndex(struct Index *index, const char *dir, const char *shard, const char *report,
+           int movies, uint64_t offset, uint64_t *max_id, struct Stats *stats) {
+    const char *name = movies ? VID_REPORT : IMG_REPORT;
+    const char *subdir = movies ? VID_SUBDIR : IMG_SUBDIR;
+    const char *tag2 = movies ? "movie" : "picture";
+    char open[16];
+    char close[16];
+    snprintf(open, sizeof(open), "<%s>", tag2);
+    snprintf(close, sizeof(close), "</%s>", tag2);
+
+    // Files stay in the shard folder, or are moved next to the new index
+    char path_tag[PATH_LEN];
+    if (keep) {
+        if (!KeptPath(path_tag, shard, report, subdir)) {
+            return 0;
+        }
+        strcat(path_tag, "\\");
+    } else {
+        snprintf(path_tag, PATH_LEN, "%s\\", subdir);
+        char files[PATH_LEN];
+        if (!PathFormat(files, "%s/%s", dir, subdir)) {
+            return 0;
+        }
+        if (!MakeDirs(files)) {
+            fprintf(stderr, "ERROR: could not create %s\n", files);
+            return 0;
+        }
+    }
+
+    for (uint32_t part = 1; ; part++) {
+        char file_name[256];
+        char path[PATH_LEN];
+        IndexPartName(name, part, file_name, sizeof(file_name));
+        if (!PathFormat(path, "%s/%s/%s", shard, report, file_name)) {
+            return 0;
+        }
+        struct In *in = InOpen(path);
+        if (NULL == in) {
+            return 1;
+        }
+
+        long len;
+        while (0 < (len = InRecord(in))) {
+            uint64_t old_id = UnitsNumber(record, len, "<id>");
+            uint64_t file_id = UnitsNumber(record, len, open);
+            uint64_t id = offset + old_id;
+            if (id > *max_id) {
+                *max_id = id;
+            }
+
+            if (!keep) {
+                char from[PATH_LEN];
+                char to[PATH_LEN];
+                if (!PathFormat(from, "%s/%s/%s/%llu", shard, report, subdir, (unsigned long long) file_id)
+                    || !PathFormat(to, "%s/%s/%llu", dir, subdir, (unsigned long long) id)) {
+                    InClose(in);
+                    return 0;
+                }
+                if (!MovePath(from, to)) {
+                    stats->missing++;
+                }
+                file_id = id;
+            }
+
+            if (!IndexRotate(index, dir)) {
+                InClose(in);
+                return 0;
+            }
+            index->records++;
+            stats->records++;
+            size_t pos = OutReplace(index->out, record, len, 0, "<path>", "</path>", path_tag, 0);
+            pos = OutReplace(index->out, record, len, pos, open, close, NULL, file_id);
+            pos = OutReplace(index->out, record, len, pos, "<id>", "</id>", NULL, id);
+            OutString16(index->out, record + pos, len - pos);
+            OutAscii(index->out, "\r\n");
+        }
+        InClose(in);
+        if (0 > len) {
+            fprintf(stderr, "ERROR: %s contains an element longer than %d characters\n", path, RECORD_LEN);
+            return 0;
+        }
+    }
+}
+
+// Appends the Exif.txt of a shard report to list, adding offset to the
+// picture IDs. The thumbnails in Previews are renamed along with them.
+// Returns 1 if successful
+// Returns 0 if not
+int
+MergeExif(struct Out **list, const char *dir, const char *shard, const char *report,
+          uint64_t offset, struct Stats *stats) {
+    char path[PATH_LEN];
+    char previews[PATH_LEN];
+    if (!PathFormat(path, "%s/%s/%s", shard, report, EXIF_LIST)
+        || !PathFormat(previews, "%s/%s", dir, PREVIEW_SUBDIR)) {
+        return 0;
+    }
+    struct In *in = InOpen(path);
+    if (NULL == in) {
+        return 1;
+    }
+    // The header line is only written once
+    long len = InLine(in);
+    if (0 < len && NULL == *list) {
+        if (!PathFormat(path, "%s/%s", dir, EXIF_LIST) || NULL == (*list = OutCreate(path, options.utf8))) {
+            InClose(in);
+            return 0;
+        }
+        OutString16(*list, record, len);
+    }
+
+    // Lines are "<id>\t...\t<thumbnail>", the thumbnail is "Previews\<id>.jpg"
+    int moved = 0;
+    while (0 < (len = InLine(in))) {
+        uint64_t old_id = UnitsNumber(record, len, "");
+        size_t first_tab = UnitsFind(record, len, 0, "\t");
+        size_t last_tab = first_tab;
+        for (size_t i = first_tab; i < (size_t) len; i++) {
+            if ('\t' == record[i]) {
+                last_tab = i;
+            }
+        }
+        size_t end = len;
+        while (end > last_tab && ('\r' == record[end - 1] || '\n' == record[end - 1])) {
+            end--;
+        }
+        if (0 == old_id || (size_t) len == first_tab) {
+            continue;
+        }
+        uint64_t id = offset + old_id;
+        OutNumber(*list, (int64_t) id);
+        OutString16(*list, record + first_tab, last_tab + 1 - first_tab);
+        if (end > last_tab + 1 && keep) {
+            char kept[PATH_LEN];
+            if (!KeptPath(kept, shard, report, PREVIEW_SUBDIR)) {
+                InClose(in);
+                return 0;
+            }
+            OutUtf8(*list, kept);
+            OutAscii(*list, "\\");
+            OutNumber(*list, (int64_t) old_id);
+            OutAscii(*list, ".jpg");
+        } else if (end > last_tab + 1) {
+            char from[PATH_LEN];
+            char to[PATH_LEN];
+            if (!PathFormat(from, "%s/%s/%s/%llu.jpg", shard, report, PREVIEW_SUBDIR,
+                            (unsigned long long) old_id)
+                || !PathFormat(to, "%s/%llu.jpg", previews, (unsigned long long) id)) {
+                InClose(in);
+                return 0;
+            }
+            if (!moved && !MakeDirs(previews)) {
+                fprintf(stderr, "ERROR: could not create %s\n", previews);
+                InClose(in);
+                return 0;
+            }
+            moved = 1;
+            if (!MovePath(from, to)) {
+                stats->missing++;
+            }
+            OutAscii(*list, PREVIEW_SUBDIR "\\");
+            OutNumber(*list, (int64_t) id);
+            OutAscii(*list, ".jpg");
+        }
+        OutAscii(*list, "\r\n");
+    }
+    InClose(in);
+    if (0 > len) {
+        fprintf(stderr, "ERROR: %s contains a line longer than %d characters\n", path, RECORD_LEN);
+        return 0;
+    }
+    return 1;
+}
+
+// Appends the Known Files.txt of a shard report to list, it holds no IDs
+// Returns 1 if successful
+// Returns 0 if not
+int
+MergeKnown(struct Out **list, const char *dir, const char *shard, const char *report) {
+    char path[PATH_LEN];
+    if (!PathFormat(path, "%s/%s/%s", shard, report, KNOWN_LIST)) {
+        return 0;
+    }
+    struct In *in = InOpen(path);
+    if (NULL == in) {
+        return 1;
+    }
+    if (NULL == *list) {
+        if (!PathFormat(path, "%s/%s", dir, KNOWN_LIST) || NULL == (*list = OutCreate(path, options.utf8))) {
+            InClose(in);
+            return 0;
+        }
+    }
+    long len;
+    while (0 < (len = InLine(in))) {
+        OutString16(*list, record, len);
+    }
+    InClose(in);
+    if (0 > len) {
+        fprintf(stderr, "ERROR: %s contains a line longer than %d characters\n", path, RECORD_LEN);
+        return 0;
+    }
+    return 1;
+}
+
+// Merges one report directory of all shards
+// Returns 1 if successful
+// Returns 0 if not
+int
+MergeReport(const char *out_dir, const char *report, char **shards, int shard_count) {
+    char dir[PATH_LEN];
+    if (!PathFormat(dir, "%s/%s", out_dir, report)) {
+        return 0;
+    }
+    if (!MakeDirs(dir)) {
+        fprintf(stderr, "ERROR: could not create %s\n", dir);
+        return 0;
+    }
+
+    struct Index images = {IMG_REPORT, 0, 0, NULL};
+    struct Index movies = {VID_REPORT, 0, 0, NULL};
+    struct Stats stats = {0, 0};
+    struct Lists lists = {NULL, NULL};
+    uint64_t image_offset = 0;
+    uint64_t movie_offset = 0;
+    char case_name[1024] = "";
+    int rv = 1;
+    for (int s = 0; rv && s < shard_count; s++) {
+        char shard_dir[PATH_LEN];
+        if (!PathFormat(shard_dir, "%s/%s", shards[s], report)) {
+            rv = 0;
+            break;
+        }
+        if ('\0' == case_name[0]) {
+            ReadCaseName(shard_dir, case_name, sizeof(case_name));
+        }
+        // IDs of the next shard continue after the highest one so far
+        uint64_t max_id = image_offset;
+        rv = MergeIndex(&images, dir, shards[s], report, 0, image_offset, &max_id, &stats)
+             && MergeExif(&lists.exif, dir, shards[s], report, image_offset, &stats)
+             && MergeKnown(&lists.known, dir, shards[s], report);
+        image_offset = max_id;
+        max_id = movie_offset;
+        rv = rv && MergeIndex(&movies, dir, shards[s], report, 1, movie_offset, &max_id, &stats);
+        movie_offset = max_id;
+    }
+    rv = IndexClosePart(&images) && rv;
+    rv = IndexClosePart(&movies) && rv;
+    if (lists.exif) {
+        rv = OutClose(lists.exif) && rv;
+    }
+    if (lists.known) {
+        rv = OutClose(lists.known) && rv;
+    }
+
+    const char *configured = options.case_name;
+    if ('\0' == configured[0]) {
+        options.case_name = case_name;
+    }
+    rv = rv && WriteCaseReport(dir, images.part, movies.part);
+    options.case_name = configured;
+
+    printf("%s: %llu records", report, (unsigned long long) stats.records);
+    if (stats.missing) {
+        printf(", %llu files not found", (unsigned long long) stats.missing);
+    }
+    printf("\n");
+    return rv;
+}
+
+void
+Usage() {
+    fprintf(stderr,
+            "Usage: gexpo-merge [options] <output dir> <shard dir>...\n\n"
+            "Merges the exports of several shards into a single export. Each\n"
+            "<shard dir> is the \"Griffeye Export\" folder of one shard. Export IDs\n"
+            "are renumbered in the order of the shards on the command line.\n\n"
+            "  -c <name>  case name for the case reports (default: from the shards)\n"
+            "  -k         keep the exported files in the shard folders and\n"
+            "             reference them by path instead of moving them\n"
+            "  -n <count> maximum records per index part (default: no limit)\n"
+            "  -s <MB>    maximum size per index part (default: no limit)\n"
+            "  -u         write UTF-8 instead of UTF-16\n");
+}
+
+int
+main(int argc, char **argv) {
+#ifdef _WIN32
+    Utf8Args(&argc, &argv);
+#endif
+    int arg = 1;
+    for (; arg < argc && '-' == argv[arg][0]; arg++) {
+        if (0 == strcmp(argv[arg], "-u")) {
+            options.utf8 = 1;
+        } else if (0 == strcmp(argv[arg], "-k")) {
+            keep = 1;
+        } else if (arg + 1 < argc && 0 == strcmp(argv[arg], "-c")) {
+            options.case_name = argv[++arg];
+        } else if (arg + 1 < argc && 0 == strcmp(argv[arg], "-n")) {
+            options.max_records = strtoull(argv[++arg], NULL, 10);
+        } else if (arg + 1 < argc && 0 == strcmp(argv[arg], "-s")) {
+            options.max_bytes = strtoull(argv[++arg], NULL, 10) * 1024 * 1024;
+        } else {
+            Usage();
+            return 2;
+        }
+    }
+    if (arg + 2 > argc) {
+        Usage();
+        return 2;
+    }
+    const char *out_dir = argv[arg];
+    char **shards = argv + arg + 1;
+    int shard_count = argc - arg - 1;
+
+    // Every shard has to contribute, a mistyped folder would silently
+    // leave out its files
+    struct Names reports = {NULL, 0, 0};
+    for (int s = 0; s < shard_count; s++) {
+        size_t found = 0;
+        if (!DirExists(shards[s])) {
+            fprintf(stderr, "ERROR: shard folder %s not found\n", shards[s]);
+            return 1;
+        }
+        if (!NamesAddReports(&reports, shards[s], "Existing", &found)
+            || !NamesAddReports(&reports, shards[s], "Deleted", &found)) {
+            return 1;
+        }
+        if (0 == found) {
+            fprintf(stderr, "ERROR: no reports found in %s\n", shards[s]);
+            return 1;
+        }
+    }
+    qsort(reports.names, reports.count, sizeof(char *), CompareNames);
+    NamesUnique(&reports);
+
+    for (size_t r = 0; r < reports.count; r++) {
+        if (!MergeReport(out_dir, reports.names[r], shards, shard_count)) {
+            return 1;
+        }
+        free(reports.names[r]);
+    }
+    free(reports.names);
+    return 0;
+}
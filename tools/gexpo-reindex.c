@@ -0,0 +1,465 @@
+/*
+    Griffeye XML export X-Tension for X-Ways Forensics
+    Copyright (C) 2019 R. Yushaev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Regenerates C4All XML indexes from the export manifest of the X-Tension,
+// without access to the evidence. Builds on Windows and POSIX systems.
+//
+// Usage: gexpo-reindex [-c case] [-n records] [-s MB] [-u] <export dir> <output dir>
+
+#include "../src/xt-gexpo-manifest.h"
+#include "gexpo-xml.h"
+
+#define MANIFEST     "Export Manifest.dat"
+#define MANIFEST_STR "Export Manifest.str"
+
+// Whole file contents
+struct Blob {
+    uint8_t *data;
+    uint64_t size;
+};
+
+struct Blob strings = {0};
+// Thumbnails listed in Exif.txt that could not be copied
+uint64_t missing_previews = 0;
+
+// Returns 1 if the whole file has been read
+// Returns 0 if not
+int
+ReadBlob(const char *dir, const char *name, struct Blob *blob) {
+    char path[PATH_LEN];
+    snprintf(path, PATH_LEN, "%s/%s", dir, name);
+    FILE *file = OpenFile(path, "rb");
+    if (NULL == file) {
+        fprintf(stderr, "ERROR: could not open %s\n", path);
+        return 0;
+    }
+    uint64_t capacity = 1 << 20;
+    blob->data = malloc(capacity);
+    blob->size = 0;
+    size_t n;
+    while (blob->data && 0 < (n = fread(blob->data + blob->size, 1, capacity - blob->size, file))) {
+        blob->size += n;
+        if (blob->size == capacity) {
+            capacity *= 2;
+            uint8_t *grown = realloc(blob->data, capacity);
+            if (NULL == grown) {
+                free(blob->data);
+            }
+            blob->data = grown;
+        }
+    }
+    fclose(file);
+    if (NULL == blob->data) {
+        fprintf(stderr, "ERROR: not enough memory for %s\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+// Returns the UTF-16 string at offset, NULL if there is none
+const uint16_t *
+String(uint64_t offset) {
+    if (0 == offset || offset + 2 > strings.size || offset % 2) {
+        return NULL;
+    }
+    // The string table ends with a terminator unless a run was interrupted
+    for (uint64_t i = offset; i + 1 < strings.size; i += 2) {
+        if (0 == strings.data[i] && 0 == strings.data[i + 1]) {
+            return (const uint16_t *) (strings.data + offset);
+        }
+    }
+    return NULL;
+}
+
+// Same element layout as XmlWriteXtFile of the X-Tension
+int
+IndexWriteRecord(struct Index *index, const char *dir, const struct XtManifestRecord *rec,
+                 const uint16_t *fullpath) {
+    const char *tag1 = MANIFEST_TYPE_PICTURE == rec->type ? "Image" : "Movie";
+    const char *tag2 = MANIFEST_TYPE_PICTURE == rec->type ? "picture" : "movie";
+    const char *subdir = MANIFEST_TYPE_PICTURE == rec->type ? IMG_SUBDIR : VID_SUBDIR;
+
+    if (!IndexRotate(index, dir)) {
+        return 0;
+    }
+    index->records++;
+
+    struct Out *out = index->out;
+    OutAscii(out, "<");
+    OutAscii(out, tag1);
+    OutAscii(out, ">\r\n  <path><![CDATA[");
+    OutAscii(out, subdir);
+    OutAscii(out, "\\]]></path>\r\n  <");
+    OutAscii(out, tag2);
+    OutAscii(out, ">");
+    OutNumber(out, rec->export_id);
+    OutAscii(out, "</");
+    OutAscii(out, tag2);
+    OutAscii(out, ">\r\n  <id>");
+    OutNumber(out, rec->export_id);
+    OutAscii(out, "</id>\r\n  <category>");
+    OutNumber(out, rec->category);
+    OutAscii(out, "</category>\r\n  <fileoffset>0</fileoffset>\r\n  <fullpath><![CDATA[");
+    OutString(out, fullpath);
+    OutAscii(out, "]]></fullpath>\r\n  <created>");
+    OutNumber(out, rec->created);
+    OutAscii(out, "</created>\r\n  <accessed>");
+    OutNumber(out, rec->accessed);
+    OutAscii(out, "</accessed>\r\n  <written>");
+    OutNumber(out, rec->written);
+    OutAscii(out, "</written>\r\n  <fileSize>");
+    OutNumber(out, rec->filesize);
+    OutAscii(out, "</fileSize>\r\n");
+    if (MANIFEST_INTEGRITY_TRUNCATED == rec->integrity) {
+        OutAscii(out, "  <integrity>truncated</integrity>\r\n");
+    } else if (MANIFEST_INTEGRITY_CORRUPT == rec->integrity) {
+        OutAscii(out, "  <integrity>corrupt</integrity>\r\n");
+    }
+    if (rec->unreadable) {
+        OutAscii(out, "  <unreadable>");
+        OutNumber(out, rec->unreadable);
+        OutAscii(out, "</unreadable>\r\n");
+    }
+    if (rec->flags & MANIFEST_FLAG_VIDEO) {
+        char video[256];
+        snprintf(video, sizeof(video),
+                 "  <video duration=\"%.3f\" width=\"%u\" height=\"%u\" "
+                 "codec=\"%.*s\" created=\"%lld\"/>\r\n",
+                 rec->duration, rec->width, rec->height, MANIFEST_CODEC_LEN - 1, rec->codec,
+                 (long long) rec->video_created);
+        OutAscii(out, video);
+    }
+    OutAscii(out, "</");
+    OutAscii(out, tag1);
+    OutAscii(out, ">\r\n");
+    return 1;
+}
+
+// Length of the report directory of an output path, which is the output
+// path without its last two components ("Pictures\12"), 0 if there is none
+size_t
+ReportDirLen(const uint16_t *output) {
+    size_t len = String16Len(output);
+    for (int cut = 0; cut < 2; cut++) {
+        while (0 < len && '\\' != output[len - 1]) {
+            len--;
+        }
+        if (0 == len) {
+            return 0;
+        }
+        len--;
+    }
+    return len;
+}
+
+int
+CompareRecords(const void *a, const void *b) {
+    const struct XtManifestRecord *ra = *(const struct XtManifestRecord **) a;
+    const struct XtManifestRecord *rb = *(const struct XtManifestRecord **) b;
+    const uint16_t *oa = String(ra->output);
+    const uint16_t *ob = String(rb->output);
+    size_t la = ReportDirLen(oa);
+    size_t lb = ReportDirLen(ob);
+    for (size_t i = 0; i < la && i < lb; i++) {
+        if (oa[i] != ob[i]) {
+            return oa[i] < ob[i] ? -1 : 1;
+        }
+    }
+    if (la != lb) {
+        return la < lb ? -1 : 1;
+    }
+    if (ra->type != rb->type) {
+        return ra->type < rb->type ? -1 : 1;
+    }
+    return ra->export_id < rb->export_id ? -1 : ra->export_id > rb->export_id;
+}
+
+// Returns 1 if records [first, last), sorted by CompareRecords, contain the
+// picture with this export ID
+// Returns 0 if not
+int
+HasPicture(const struct XtManifestRecord **first, const struct XtManifestRecord **last, uint64_t id) {
+    while (first < last) {
+        const struct XtManifestRecord **mid = first + (last - first) / 2;
+        if (MANIFEST_TYPE_PICTURE == (*mid)->type && id == (*mid)->export_id) {
+            return 1;
+        }
+        if (MANIFEST_TYPE_PICTURE < (*mid)->type || (MANIFEST_TYPE_PICTURE == (*mid)->type && id < (*mid)->export_id)) {
+            last = mid;
+        } else {
+            first = mid + 1;
+        }
+    }
+    return 0;
+}
+
+// Copies the Exif.txt of a report with the lines of the pictures in
+// [first, last), along with their thumbnails in Previews
+// Returns 1 if successful
+// Returns 0 if not
+int
+CopyExif(const char *from, const char *to, const struct XtManifestRecord **first,
+         const struct XtManifestRecord **last) {
+    char path[PATH_LEN];
+    char previews[PATH_LEN];
+    if (!PathFormat(path, "%s/%s", from, EXIF_LIST) || !PathFormat(previews, "%s/%s", to, PREVIEW_SUBDIR)) {
+        return 0;
+    }
+    struct In *in = InOpen(path);
+    if (NULL == in) {
+        return 1;
+    }
+    long len = InLine(in);
+    struct Out *list = NULL;
+    if (0 < len) {
+        if (!PathFormat(path, "%s/%s", to, EXIF_LIST) || NULL == (list = OutCreate(path, options.utf8))) {
+            InClose(in);
+            return 0;
+        }
+        OutString16(list, record, len);
+    }
+
+    // Lines are "<id>\t...\t<thumbnail>", the thumbnail is "Previews\<id>.jpg"
+    int rv = 1;
+    int made = 0;
+    while (rv && 0 < (len = InLine(in))) {
+        uint64_t id = UnitsNumber(record, len, "");
+        if (!HasPicture(first, last, id)) {
+            continue;
+        }
+        size_t last_tab = len;
+        size_t end = len;
+        for (size_t i = 0; i < (size_t) len; i++) {
+            if ('\t' == record[i]) {
+                last_tab = i;
+            }
+        }
+        while (end > last_tab && ('\r' == record[end - 1] || '\n' == record[end - 1])) {
+            end--;
+        }
+        if (end > last_tab + 1) {
+            char src[PATH_LEN];
+            char dst[PATH_LEN];
+            rv = PathFormat(src, "%s/%s/%llu.jpg", from, PREVIEW_SUBDIR, (unsigned long long) id)
+                 && PathFormat(dst, "%s/%llu.jpg", previews, (unsigned long long) id);
+            if (rv && !made && !(made = MakeDirs(previews))) {
+                fprintf(stderr, "ERROR: could not create %s\n", previews);
+                rv = 0;
+            }
+            if (rv && !CopyPath(src, dst)) {
+                missing_previews++;
+            }
+        }
+        OutString16(list, record, len);
+    }
+    InClose(in);
+    if (0 > len) {
+        fprintf(stderr, "ERROR: %s contains a line longer than %d characters\n", path, RECORD_LEN);
+        rv = 0;
+    }
+    if (list) {
+        rv = OutClose(list) && rv;
+    }
+    return rv;
+}
+
+// Copies the Known Files.txt of a report, it holds no IDs
+// Returns 1 if successful
+// Returns 0 if not
+int
+CopyKnown(const char *from, const char *to) {
+    char path[PATH_LEN];
+    if (!PathFormat(path, "%s/%s", from, KNOWN_LIST)) {
+        return 0;
+    }
+    struct In *in = InOpen(path);
+    if (NULL == in) {
+        return 1;
+    }
+    struct Out *list = NULL;
+    if (!PathFormat(path, "%s/%s", to, KNOWN_LIST) || NULL == (list = OutCreate(path, options.utf8))) {
+        InClose(in);
+        return 0;
+    }
+    long len;
+    while (0 < (len = InLine(in))) {
+        OutString16(list, record, len);
+    }
+    InClose(in);
+    int rv = OutClose(list);
+    if (0 > len) {
+        fprintf(stderr, "ERROR: %s contains a line longer than %d characters\n", path, RECORD_LEN);
+        return 0;
+    }
+    return rv;
+}
+
+// Writes indexes and case report for records [first, last) of one report
+// dir, and copies its lists and thumbnails from the export
+int
+WriteReport(const char *export_dir, const char *out_dir, const struct XtManifestRecord **first,
+            const struct XtManifestRecord **last) {
+    char report[PATH_LEN];
+    char dir[PATH_LEN];
+    char source[PATH_LEN];
+    const uint16_t *output = String((*first)->output);
+    ToUtf8(output, ReportDirLen(output), report, PATH_LEN);
+    // Windows accepts both separators
+    for (char *p = report; *p; p++) {
+        if ('\\' == *p) *p = '/';
+    }
+    if (!PathFormat(dir, "%s/%s", out_dir, report) || !PathFormat(source, "%s/%s", export_dir, report)) {
+        return 0;
+    }
+    if (!MakeDirs(dir)) {
+        fprintf(stderr, "ERROR: could not create %s\n", dir);
+        return 0;
+    }
+
+    struct Index images = {IMG_REPORT, 0, 0, NULL};
+    struct Index movies = {VID_REPORT, 0, 0, NULL};
+    int rv = 1;
+    for (const struct XtManifestRecord **r = first; rv && r < last; r++) {
+        struct Index *index = MANIFEST_TYPE_PICTURE == (*r)->type ? &images : &movies;
+        const uint16_t *fullpath = String((*r)->fullpath);
+        rv = IndexWriteRecord(index, dir, *r, fullpath);
+    }
+    rv = IndexClosePart(&images) && rv;
+    rv = IndexClosePart(&movies) && rv;
+    rv = rv && WriteCaseReport(dir, images.part, movies.part);
+
+    // Nothing to copy if the indexes are rewritten in place
+    char full_source[PATH_LEN];
+    char full_dir[PATH_LEN];
+    FullPath(source, full_source, PATH_LEN);
+    FullPath(dir, full_dir, PATH_LEN);
+    if (0 == strcmp(full_source, full_dir)) {
+        return rv;
+    }
+    return rv && CopyExif(source, dir, first, last) && CopyKnown(source, dir);
+}
+
+void
+Usage() {
+    fprintf(stderr,
+            "Usage: gexpo-reindex [options] <export dir> <output dir>\n\n"
+            "Regenerates the C4All XML indexes of a Griffeye export from its\n"
+            "export manifest. <export dir> is the \"Griffeye Export\" folder.\n"
+            "Exif.txt, its thumbnails and Known Files.txt are copied along.\n\n"
+            "  -c <name>  case name for the case reports\n"
+            "  -n <count> maximum records per index part (default: no limit)\n"
+            "  -s <MB>    maximum size per index part (default: no limit)\n"
+            "  -u         write UTF-8 instead of UTF-16\n");
+}
+
+int
+main(int argc, char **argv) {
+#ifdef _WIN32
+    Utf8Args(&argc, &argv);
+#endif
+    int arg = 1;
+    for (; arg < argc && '-' == argv[arg][0]; arg++) {
+        if (0 == strcmp(argv[arg], "-u")) {
+            options.utf8 = 1;
+        } else if (arg + 1 < argc && 0 == strcmp(argv[arg], "-c")) {
+            options.case_name = argv[++arg];
+        } else if (arg + 1 < argc && 0 == strcmp(argv[arg], "-n")) {
+            options.max_records = strtoull(argv[++arg], NULL, 10);
+        } else if (arg + 1 < argc && 0 == strcmp(argv[arg], "-s")) {
+            options.max_bytes = strtoull(argv[++arg], NULL, 10) * 1024 * 1024;
+        } else {
+            Usage();
+            return 2;
+        }
+    }
+    if (arg + 2 != argc) {
+        Usage();
+        return 2;
+    }
+    const char *export_dir = argv[arg];
+    const char *out_dir = argv[arg + 1];
+
+    struct Blob manifest = {0};
+    if (!ReadBlob(export_dir, MANIFEST, &manifest) || !ReadBlob(export_dir, MANIFEST_STR, &strings)) {
+        return 1;
+    }
+    const struct XtManifestHeader *header = (const struct XtManifestHeader *) manifest.data;
+    if (sizeof(struct XtManifestHeader) > manifest.size
+        || MANIFEST_MAGIC != header->magic
+        || MANIFEST_VERSION > header->version
+        || sizeof(struct XtManifestRecord) > header->record_size) {
+        fprintf(stderr, "ERROR: %s has an unknown format\n",
+                MANIFEST);
+        return 1;
+    }
+
+    // Records without paths or of other types cannot be indexed
+    uint64_t count = (manifest.size - sizeof(struct XtManifestHeader)) / header->record_size;
+    uint64_t skipped = 0;
+    uint64_t used = 0;
+    const struct XtManifestRecord **records = malloc(sizeof(struct XtManifestRecord *) * (count ? count : 1));
+    if (NULL == records) {
+        fprintf(stderr, "ERROR: not enough memory\n");
+        return 1;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        const struct XtManifestRecord *rec = (const struct XtManifestRecord *)
+                (manifest.data + sizeof(struct XtManifestHeader) + i * header->record_size);
+        const uint16_t *output = String(rec->output);
+        if (NULL == output || 0 == ReportDirLen(output) || NULL == String(rec->fullpath)
+            || (MANIFEST_TYPE_PICTURE != rec->type && MANIFEST_TYPE_VIDEO != rec->type)) {
+            skipped++;
+            continue;
+        }
+        records[used++] = rec;
+    }
+    qsort(records, used, sizeof(struct XtManifestRecord *), CompareRecords);
+
+    uint64_t reports = 0;
+    for (uint64_t first = 0; first < used;) {
+        const uint16_t *output = String(records[first]->output);
+        size_t len = ReportDirLen(output);
+        uint64_t last = first + 1;
+        while (last < used) {
+            const uint16_t *next = String(records[last]->output);
+            if (len != ReportDirLen(next) || memcmp(output, next, len * 2)) {
+                break;
+            }
+            last++;
+        }
+        if (!WriteReport(export_dir, out_dir, records + first, records + last)) {
+            return 1;
+        }
+        reports++;
+        first = last;
+    }
+
+    printf("%llu records in %llu reports written", (unsigned long long) used, (unsigned long long) reports);
+    if (skipped) {
+        printf(", %llu records without paths skipped", (unsigned long long) skipped);
+    }
+    if (missing_previews) {
+        printf(", %llu thumbnails not found", (unsigned long long) missing_previews);
+    }
+    printf("\n");
+
+    free(records);
+    free(manifest.data);
+    free(strings.data);
+    return 0;
+}
@@ -0,0 +1,622 @@
+/*
+    Griffeye XML export X-Tension for X-Ways Forensics
+    Copyright (C) 2019 R. Yushaev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published
+    by the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Shared by the manifest tools: XML and text files in UTF-16LE or UTF-8,
+// index parts and case reports in the layout of the X-Tension.
+// Each tool is a single translation unit that includes this file once.
+
+#ifndef GEXPO_XML_H
+#define GEXPO_XML_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#endif
+
+#define IMG_REPORT   "C4P Index"
+#define VID_REPORT   "C4M Index"
+#define IMG_SUBDIR   "Pictures"
+#define VID_SUBDIR   "Movies"
+#define CASE_REPORT  "Case Report.xml"
+#define EXIF_LIST    "Exif.txt"
+#define KNOWN_LIST   "Known Files.txt"
+#define PREVIEW_SUBDIR "Previews"
+
+#define PATH_LEN 4096
+#define OUT_BUF_LEN 65536
+#define IN_BUF_LEN 65536
+// Longest accepted index element or list line, in UTF-16 code units
+#define RECORD_LEN 65536
+
+struct Options {
+    const char *case_name;
+    uint64_t max_records;
+    uint64_t max_bytes;
+    int utf8;
+};
+
+// Buffered output file, in UTF-16LE or UTF-8
+struct Out {
+    FILE *file;
+    int utf8;
+    uint64_t bytes;
+    size_t used;
+    uint8_t buf[OUT_BUF_LEN];
+};
+
+// Input XML or text file in UTF-16LE or UTF-8, read as UTF-16 code units
+struct In {
+    FILE *file;
+    int utf8;
+    int32_t pending;
+    size_t pos;
+    size_t len;
+    uint8_t buf[IN_BUF_LEN];
+};
+
+// Index being written, rotated into parts like the X-Tension does
+struct Index {
+    const char *name;
+    uint32_t part;
+    uint64_t records;
+    struct Out *out;
+};
+
+struct Options options = {"", 0, 0, 0};
+uint16_t record[RECORD_LEN];
+
+// Platform layer: paths are UTF-8 with '/' separators internally
+
+FILE *
+OpenFile(const char *path, const char *mode) {
+#ifdef _WIN32
+    wchar_t wpath[PATH_LEN];
+    wchar_t wmode[8];
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, PATH_LEN);
+    MultiByteToWideChar(CP_UTF8, 0, mode, -1, wmode, 8);
+    return _wfopen(wpath, wmode);
+#else
+    return fopen(path, mode);
+#endif
+}
+
+// Creates a directory and all missing parents
+// Returns 1 if successful
+// Returns 0 if not
+int
+MakeDirs(const char *path) {
+    char tmp[PATH_LEN];
+    snprintf(tmp, PATH_LEN, "%s", path);
+    for (char *p = tmp + 1; ; p++) {
+        if ('/' != *p && '\0' != *p) {
+            continue;
+        }
+        char c = *p;
+        *p = '\0';
+#ifdef _WIN32
+        wchar_t wpath[PATH_LEN];
+        MultiByteToWideChar(CP_UTF8, 0, tmp, -1, wpath, PATH_LEN);
+        if (!CreateDirectoryW(wpath, NULL) && ERROR_ALREADY_EXISTS != GetLastError()
+            && ':' != p[-1]) {
+            return 0;
+        }
+#else
+        if (0 != mkdir(tmp, 0777) && EEXIST != errno) {
+            return 0;
+        }
+#endif
+        if ('\0' == c) {
+            return 1;
+        }
+        *p = '/';
+    }
+}
+
+// Writes the absolute path of path to buf
+void
+FullPath(const char *path, char *buf, size_t len) {
+#ifdef _WIN32
+    wchar_t wpath[PATH_LEN];
+    wchar_t wfull[PATH_LEN];
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, PATH_LEN);
+    if (GetFullPathNameW(wpath, PATH_LEN, wfull, NULL)) {
+        WideCharToMultiByte(CP_UTF8, 0, wfull, -1, buf, (int) len, NULL, NULL);
+        return;
+    }
+#else
+    char full[PATH_MAX];
+    if (realpath(path, full)) {
+        snprintf(buf, len, "%s", full);
+        return;
+    }
+#endif
+    snprintf(buf, len, "%s", path);
+}
+
+// Copies a file, replacing an existing one
+// Returns 1 if successful
+// Returns 0 if not
+int
+CopyPath(const char *from, const char *to) {
+#ifdef _WIN32
+    wchar_t wfrom[PATH_LEN];
+    wchar_t wto[PATH_LEN];
+    MultiByteToWideChar(CP_UTF8, 0, from, -1, wfrom, PATH_LEN);
+    MultiByteToWideChar(CP_UTF8, 0, to, -1, wto, PATH_LEN);
+    return 0 != CopyFileW(wfrom, wto, FALSE);
+#else
+    FILE *in = fopen(from, "rb");
+    FILE *out = in ? fopen(to, "wb") : NULL;
+    int rv = NULL != out;
+    char buf[IN_BUF_LEN];
+    size_t n;
+    while (rv && 0 < (n = fread(buf, 1, IN_BUF_LEN, in))) {
+        rv = n == fwrite(buf, 1, n, out);
+    }
+    if (in) {
+        fclose(in);
+    }
+    if (out) {
+        rv = 0 == fclose(out) && rv;
+    }
+    return rv;
+#endif
+}
+
+// Formats a path into buf, which holds PATH_LEN bytes
+// Returns 1 if successful
+// Returns 0 if the path is too long
+int
+PathFormat(char *buf, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, PATH_LEN, format, args);
+    va_end(args);
+    if (0 > len || PATH_LEN <= len) {
+        fprintf(stderr, "ERROR: path too long: %s\n", buf);
+        return 0;
+    }
+    return 1;
+}
+
+size_t
+String16Len(const uint16_t *s) {
+    size_t len = 0;
+    while (s[len]) {
+        len++;
+    }
+    return len;
+}
+
+// Converts len UTF-16 code units to UTF-8, returns the number of bytes
+size_t
+ToUtf8(const uint16_t *s, size_t len, char *out, size_t out_len) {
+    size_t pos = 0;
+    for (size_t i = 0; i < len && pos + 4 < out_len; i++) {
+        uint32_t c = s[i];
+        if (0xd800 <= c && 0xdbff >= c && i + 1 < len && 0xdc00 <= s[i + 1] && 0xdfff >= s[i + 1]) {
+            c = 0x10000 + ((c - 0xd800) << 10) + (s[++i] - 0xdc00);
+        }
+        if (0x80 > c) {
+            out[pos++] = (char) c;
+        } else if (0x800 > c) {
+            out[pos++] = (char) (0xc0 | c >> 6);
+            out[pos++] = (char) (0x80 | (c & 0x3f));
+        } else if (0x10000 > c) {
+            out[pos++] = (char) (0xe0 | c >> 12);
+            out[pos++] = (char) (0x80 | (c >> 6 & 0x3f));
+            out[pos++] = (char) (0x80 | (c & 0x3f));
+        } else {
+            out[pos++] = (char) (0xf0 | c >> 18);
+            out[pos++] = (char) (0x80 | (c >> 12 & 0x3f));
+            out[pos++] = (char) (0x80 | (c >> 6 & 0x3f));
+            out[pos++] = (char) (0x80 | (c & 0x3f));
+        }
+    }
+    out[pos] = '\0';
+    return pos;
+}
+
+int
+InFill(struct In *in) {
+    in->pos = 0;
+    in->len = fread(in->buf, 1, IN_BUF_LEN, in->file);
+    return 0 < in->len;
+}
+
+int
+InByte(struct In *in) {
+    if (in->pos == in->len && !InFill(in)) {
+        return -1;
+    }
+    return in->buf[in->pos++];
+}
+
+// Opens an XML file and detects its encoding
+// Returns NULL if the file does not exist
+struct In *
+InOpen(const char *path) {
+    FILE *file = OpenFile(path, "rb");
+    if (NULL == file) {
+        return NULL;
+    }
+    struct In *in = malloc(sizeof(struct In));
+    if (NULL == in) {
+        fclose(file);
+        return NULL;
+    }
+    in->file = file;
+    in->pending = -1;
+    InFill(in);
+    if (2 <= in->len && 0xff == in->buf[0] && 0xfe == in->buf[1]) {
+        in->utf8 = 0;
+        in->pos = 2;
+    } else if (3 <= in->len && 0xef == in->buf[0] && 0xbb == in->buf[1] && 0xbf == in->buf[2]) {
+        in->utf8 = 1;
+        in->pos = 3;
+    } else {
+        // No BOM, "<?" is "<\0?\0" in UTF-16LE
+        in->utf8 = !(2 <= in->len && 0 == in->buf[1]);
+    }
+    return in;
+}
+
+void
+InClose(struct In *in) {
+    fclose(in->file);
+    free(in);
+}
+
+// Returns the next UTF-16 code unit, -1 at the end of the file
+int32_t
+InUnit(struct In *in) {
+    if (0 <= in->pending) {
+        int32_t unit = in->pending;
+        in->pending = -1;
+        return unit;
+    }
+    int b = InByte(in);
+    if (0 > b) {
+        return -1;
+    }
+    if (!in->utf8) {
+        int hi = InByte(in);
+        return 0 > hi ? -1 : b | hi << 8;
+    }
+    uint32_t c = b;
+    int follow = 0xf0 <= c ? 3 : 0xe0 <= c ? 2 : 0xc0 <= c ? 1 : 0;
+    c &= follow ? 0x3f >> follow : 0x7f;
+    for (; follow; follow--) {
+        b = InByte(in);
+        if (0 > b) {
+            return -1;
+        }
+        c = c << 6 | (b & 0x3f);
+    }
+    if (0x10000 <= c) {
+        c -= 0x10000;
+        in->pending = 0xdc00 | (c & 0x3ff);
+        return 0xd800 | c >> 10;
+    }
+    return c;
+}
+
+// Returns 1 if the len units at s match the ASCII string tag
+int
+UnitsEqual(const uint16_t *s, const char *tag, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] != (uint8_t) tag[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Returns the position of tag in rec at or after from, len if not found
+size_t
+UnitsFind(const uint16_t *rec, size_t len, size_t from, const char *tag) {
+    size_t tag_len = strlen(tag);
+    for (size_t i = from; i + tag_len <= len; i++) {
+        if (UnitsEqual(rec + i, tag, tag_len)) {
+            return i;
+        }
+    }
+    return len;
+}
+
+// Reads the next line of a text list into record, including its line break
+// Returns its length in code units, 0 at the end of the file
+// Returns -1 if a line is longer than RECORD_LEN
+long
+InLine(struct In *in) {
+    size_t len = 0;
+    int32_t unit;
+    while (0 <= (unit = InUnit(in))) {
+        if (RECORD_LEN == len) {
+            return -1;
+        }
+        record[len++] = (uint16_t) unit;
+        if ('\n' == unit) {
+            break;
+        }
+    }
+    return (long) len;
+}
+
+// Returns the number in the element starting at open, e.g. "<id>12</id>"
+uint64_t
+UnitsNumber(const uint16_t *rec, size_t len, const char *open) {
+    size_t pos = UnitsFind(rec, len, 0, open) + strlen(open);
+    uint64_t n = 0;
+    for (; pos < len && '0' <= rec[pos] && '9' >= rec[pos]; pos++) {
+        n = n * 10 + rec[pos] - '0';
+    }
+    return n;
+}
+
+int
+OutFlush(struct Out *out) {
+    int rv = out->used == fwrite(out->buf, 1, out->used, out->file);
+    out->used = 0;
+    return rv;
+}
+
+void
+OutBytes(struct Out *out, const void *data, size_t len) {
+    if (OUT_BUF_LEN < out->used + len) {
+        OutFlush(out);
+    }
+    out->bytes += len;
+    if (OUT_BUF_LEN < len) {
+        fwrite(data, 1, len, out->file);
+        return;
+    }
+    memcpy(out->buf + out->used, data, len);
+    out->used += len;
+}
+
+// Writes an ASCII literal
+void
+OutAscii(struct Out *out, const char *s) {
+    if (out->utf8) {
+        OutBytes(out, s, strlen(s));
+        return;
+    }
+    for (; *s; s++) {
+        uint8_t c[2] = {(uint8_t) *s, 0};
+        OutBytes(out, c, 2);
+    }
+}
+
+// Writes a UTF-8 string, e.g. a command line argument
+void
+OutUtf8(struct Out *out, const char *s) {
+    if (out->utf8) {
+        OutBytes(out, s, strlen(s));
+        return;
+    }
+    while (*s) {
+        uint32_t c = (uint8_t) *s++;
+        int follow = 0xf0 <= c ? 3 : 0xe0 <= c ? 2 : 0xc0 <= c ? 1 : 0;
+        c &= follow ? 0x3f >> follow : 0x7f;
+        for (; follow && 0x80 == ((uint8_t) *s & 0xc0); follow--) {
+            c = c << 6 | ((uint8_t) *s++ & 0x3f);
+        }
+        if (0x10000 <= c) {
+            c -= 0x10000;
+            uint8_t pair[4] = {(uint8_t) (c >> 10), (uint8_t) (0xd8 | c >> 18),
+                               (uint8_t) c, (uint8_t) (0xdc | (c >> 8 & 0x03))};
+            OutBytes(out, pair, 4);
+        } else {
+            uint8_t unit[2] = {(uint8_t) c, (uint8_t) (c >> 8)};
+            OutBytes(out, unit, 2);
+        }
+    }
+}
+
+// Writes len UTF-16LE code units
+void
+OutString16(struct Out *out, const uint16_t *s, size_t len) {
+    if (!out->utf8) {
+        OutBytes(out, s, len * 2);
+        return;
+    }
+    char utf8[PATH_LEN * 4];
+    while (len) {
+        size_t n = len > PATH_LEN ? PATH_LEN : len;
+        // Keep surrogate pairs together
+        if (n < len && 0xd800 <= s[n - 1] && 0xdbff >= s[n - 1]) {
+            n--;
+        }
+        OutBytes(out, utf8, ToUtf8(s, n, utf8, sizeof(utf8)));
+        s += n;
+        len -= n;
+    }
+}
+
+// Writes a NUL-terminated UTF-16LE string, e.g. of the string table
+void
+OutString(struct Out *out, const uint16_t *s) {
+    OutString16(out, s, String16Len(s));
+}
+
+void
+OutNumber(struct Out *out, int64_t n) {
+    char buf[32];
+    snprintf(buf, 32, "%lld", (long long) n);
+    OutAscii(out, buf);
+}
+
+// Creates an output file, starting with a byte order mark in UTF-16
+struct Out *
+OutCreate(const char *path, int utf8) {
+    struct Out *out = malloc(sizeof(struct Out));
+    if (NULL == out) {
+        return NULL;
+    }
+    out->file = OpenFile(path, "wb");
+    if (NULL == out->file) {
+        fprintf(stderr, "ERROR: could not create %s\n", path);
+        free(out);
+        return NULL;
+    }
+    out->utf8 = utf8;
+    out->bytes = 0;
+    out->used = 0;
+    if (!utf8) {
+        uint8_t bom[2] = {0xff, 0xfe};
+        OutBytes(out, bom, 2);
+    }
+    return out;
+}
+
+// Creates an XML file and writes its declaration
+struct Out *
+OutOpen(const char *path, int utf8) {
+    struct Out *out = OutCreate(path, utf8);
+    if (out) {
+        OutAscii(out, utf8 ? "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n"
+                           : "<?xml version=\"1.0\" encoding=\"utf-16\"?>\r\n");
+    }
+    return out;
+}
+
+int
+OutClose(struct Out *out) {
+    int rv = OutFlush(out);
+    rv = 0 == fclose(out->file) && rv;
+    free(out);
+    return rv;
+}
+
+void
+IndexPartName(const char *name, uint32_t part, char *buf, size_t len) {
+    if (1 < part) {
+        snprintf(buf, len, "%s %u.xml", name, part);
+    } else {
+        snprintf(buf, len, "%s.xml", name);
+    }
+}
+
+int
+IndexClosePart(struct Index *index) {
+    if (NULL == index->out) {
+        return 1;
+    }
+    OutAscii(index->out, "</ReportIndex>");
+    int rv = OutClose(index->out);
+    index->out = NULL;
+    return rv;
+}
+
+// Opens the next part before a record if there is none or it is full
+int
+IndexRotate(struct Index *index, const char *dir) {
+    if (index->out
+        && (0 == options.max_records || index->records < options.max_records)
+        && (0 == options.max_bytes || index->out->bytes < options.max_bytes)) {
+        return 1;
+    }
+    if (!IndexClosePart(index)) {
+        return 0;
+    }
+    char name[256];
+    char path[PATH_LEN];
+    index->part++;
+    IndexPartName(index->name, index->part, name, sizeof(name));
+    snprintf(path, PATH_LEN, "%s/%s", dir, name);
+    index->out = OutOpen(path, options.utf8);
+    index->records = 0;
+    if (NULL == index->out) {
+        return 0;
+    }
+    OutAscii(index->out, "<ReportIndex version=\"1.0\" source=\"Naufragous\" dll=\"Gri"
+                         "ffeye XML export X-Tension\">\r\n");
+    return 1;
+}
+
+int
+WriteCaseReport(const char *dir, uint32_t image_parts, uint32_t movie_parts) {
+    char path[PATH_LEN];
+    char name[256];
+    char date[64];
+    char clock[64];
+    time_t now = time(NULL);
+    struct tm *local = localtime(&now);
+    strftime(date, sizeof(date), "%d-%b-%Y", local);
+    strftime(clock, sizeof(clock), "%H-%M-%S", local);
+
+    snprintf(path, PATH_LEN, "%s/%s", dir, CASE_REPORT);
+    struct Out *out = OutOpen(path, options.utf8);
+    if (NULL == out) {
+        return 0;
+    }
+    OutAscii(out, "<CaseReport>\r\n  <CaseNumber><![CDATA[");
+    OutUtf8(out, options.case_name);
+    OutAscii(out, "]]></CaseNumber>\r\n  <Date><![CDATA[");
+    OutAscii(out, date);
+    OutAscii(out, "]]></Date>\r\n  <Time><![CDATA[");
+    OutAscii(out, clock);
+    OutAscii(out, "]]></Time>\r\n  <Comment><![CDATA[Created by Griffeye XML export X-Te"
+                  "nsion: https://github.com/Naufragous/xt-gexpo/ ]]></Comment>\r\n  <DL"
+                  "Lversion><![CDATA[V1.0]]></DLLversion>\r\n  <XwaysVersion><![CDATA[]]"
+                  "></XwaysVersion>\r\n  <IndexFiles>\r\n");
+    for (uint32_t part = 1; part <= image_parts; part++) {
+        IndexPartName(IMG_REPORT, part, name, sizeof(name));
+        OutAscii(out, "    <ImageIndex><![CDATA[");
+        OutAscii(out, name);
+        OutAscii(out, "]]></ImageIndex>\r\n");
+    }
+    for (uint32_t part = 1; part <= movie_parts; part++) {
+        IndexPartName(VID_REPORT, part, name, sizeof(name));
+        OutAscii(out, "    <MovieIndex><![CDATA[");
+        OutAscii(out, name);
+        OutAscii(out, "]]></MovieIndex>\r\n");
+    }
+    OutAscii(out, "  </IndexFiles>\r\n</CaseReport>");
+    return OutClose(out);
+}
+
+
+#ifdef _WIN32
+// Replaces the arguments with their UTF-8 versions, like all other paths
+void
+Utf8Args(int *argc, char ***argv) {
+    wchar_t **wargv = CommandLineToArgvW(GetCommandLineW(), argc);
+    *argv = malloc(sizeof(char *) * *argc);
+    for (int i = 0; *argv && i < *argc; i++) {
+        int len = WideCharToMultiByte(CP_UTF8, 0, wargv[i], -1, NULL, 0, NULL, NULL);
+        (*argv)[i] = malloc(len);
+        WideCharToMultiByte(CP_UTF8, 0, wargv[i], -1, (*argv)[i], len, NULL, NULL);
+    }
+    LocalFree(wargv);
+}
+#endif
+
+#endif